@@ -0,0 +1,120 @@
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <stdint.h>
+#include "../src/compressedStreams.h"
+#include "../src/statePermuter.h"
+
+using namespace std;
+
+// Synthetic input for the epilogos executables, for benchmarking:  numSites consecutive sites (200 bp wide by default)
+// on one chromosome, each with the states of numEpigenomes epigenomes.
+//
+// Like real chromatin state calls, the states come in runs:  each site has a "consensus" state, which carries over
+// from the previous site, except that with probability 1/runLength it's replaced by a new one drawn uniformly at random.
+// Each epigenome's state is the consensus state with probability 1 - entropy, and otherwise a state drawn
+// uniformly at random.  So entropy = 0 yields the same state in every epigenome at each site, and entropy = 1
+// yields independent uniformly distributed states; the entropy of the states at a site increases with it,
+// from 0 to log2(numStates) bits.  The entropy determines e.g. the number of distinct state pairs per site,
+// which determines how much work S2 and S3 do per site.
+//
+// The random numbers are a pure function of the seed (via splitmix64, as in statePermuter.h),
+// so the output is the same on every platform.
+
+class RandomNumbers {
+public:
+  explicit RandomNumbers(const uint64_t& seed) : m_counter(mix64(seed)) {};
+  // Uniformly distributed in [0,1).
+  double uniform(void) { return static_cast<double>(next() >> 11) * (1.0/9007199254740992.0); } // 2^53
+  // Uniformly distributed in 1, 2, ..., n.
+  int below1based(const int& n) { return 1 + static_cast<int>(uniform() * n); }
+private:
+  uint64_t next(void)
+  {
+    static const uint64_t GOLDEN_GAMMA(makeUint64(0x9E3779B9U, 0x7F4A7C15U));
+    m_counter += GOLDEN_GAMMA;
+    return mix64(m_counter);
+  }
+  uint64_t m_counter;
+};
+
+int main(int argc, const char* argv[])
+{
+  unsigned long seed(0);
+  int runLength(10), width(200);
+  const char *pChrom("chrB");
+
+  // Options (arguments beginning with "--") may appear anywhere on the command line;
+  // remove them, so that the remaining arguments can be interpreted by position.
+  int numPositionalArgs(1);
+  for (int i = 1; i < argc; i++)
+    {
+      if (0 == strcmp(argv[i], "--seed") && i + 1 < argc)
+	seed = strtoul(argv[++i], NULL, 10);
+      else if (0 == strcmp(argv[i], "--run-length") && i + 1 < argc)
+	runLength = atoi(argv[++i]);
+      else if (0 == strcmp(argv[i], "--width") && i + 1 < argc)
+	width = atoi(argv[++i]);
+      else if (0 == strcmp(argv[i], "--chrom") && i + 1 < argc)
+	pChrom = argv[++i];
+      else
+	argv[numPositionalArgs++] = argv[i];
+    }
+  argc = numPositionalArgs;
+
+  if (argc != 6)
+    {
+    Usage:
+      cerr << "Usage:  " << argv[0] << " [--seed S] [--run-length L] [--width W] [--chrom C] numSites numEpigenomes numStates entropy outfile\n"
+	   << "where\n"
+	   << "* numSites, numEpigenomes, and numStates are the dimensions of the synthetic input written to outfile\n"
+	   << "  (tab-delimited chrom, start, stop, state of epigenome 1, state of epigenome 2, ...)\n"
+	   << "* entropy (between 0 and 1) is the probability that an epigenome's state is drawn uniformly at random,\n"
+	   << "  instead of being the site's consensus state\n"
+	   << "* the consensus state changes with probability 1/L at each site (default L = 10)\n"
+	   << "* the sites are W bp wide (default 200), on chromosome C (default chrB)\n"
+	   << "* S (default 0) seeds the random numbers\n"
+	   << "If the name of outfile ends in \".gz\", it's written with bgzip-compatible (BGZF) compression."
+	   << endl << endl;
+      return -1;
+    }
+
+  const long numSites(atol(argv[1]));
+  const int numEpigenomes(atoi(argv[2])), numStates(atoi(argv[3]));
+  const double entropy(atof(argv[4]));
+  if (numSites < 1 || numEpigenomes < 1 || numStates < 1 || entropy < 0 || entropy > 1 || runLength < 1 || width < 1)
+    {
+      cerr << "Error:  Invalid argument(s) received." << endl << endl;
+      goto Usage;
+    }
+  BgzfOutputStream ofs(argv[5]);
+  if (!ofs)
+    {
+      cerr << "Error:  Unable to open file \"" << argv[5] << "\" for writing." << endl << endl;
+      return -1;
+    }
+
+  RandomNumbers rng(seed);
+  int consensusState(rng.below1based(numStates));
+  long beg(0);
+  for (long i = 0; i < numSites; i++, beg += width)
+    {
+      if (i != 0 && rng.uniform() * runLength < 1.)
+	consensusState = rng.below1based(numStates);
+      ofs << pChrom << '\t' << beg << '\t' << beg + width;
+      for (int e = 0; e < numEpigenomes; e++)
+	ofs << '\t' << (rng.uniform() < entropy ? rng.below1based(numStates) : consensusState);
+      ofs << '\n';
+    }
+  ofs.flush();
+  if (!ofs)
+    {
+      cerr << "Error:  Failed to write file \"" << argv[5] << "\"." << endl << endl;
+      return -1;
+    }
+
+  return 0;
+}
@@ -0,0 +1,275 @@
+#include <iostream>
+#include <sstream>
+#include <streambuf>
+#include <vector>
+#include <set>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <stdint.h>
+#include <sys/time.h>
+#include "../src/metricModels.h"
+#include "../src/nullDistribution.h"
+#include "../src/siteTallies.h"
+#include "../src/stateFileReader.h"
+
+using namespace std;
+
+// Times the inner loops of the three steps of epilogos, in memory, on a file of states
+// (e.g. one written by generateStateMatrix), for each of the metrics S1, S2, and S3:
+// * tally:  reading the states and tallying each site's states or state pairs (SiteTallier::processSite()),
+//   the loop of computeEpilogosPart1_perChrom's onePassThroughData(), without writing the tallies to disk
+// * observations:  Model::processInputValue() and Model::computeAndWriteMetric() for every site's tallies,
+//   as in computeEpilogosPart2_perChrom, written to a stream that discards them
+// * nulls:  the same, for the null values of a comparison between two groups
+// * loadNullDistn and loadDataAndReport:  computeEpilogosPart3_perChrom's steps, on the null values and observations above
+// Each step (except tally) is repeated, and the fastest repetition is reported, as one tab-delimited line per step
+// (benchmark, metric, number of sites or lines, seconds, sites or lines per second).
+
+class DiscardStreambuf : public std::streambuf {
+public:
+  DiscardStreambuf() : m_numBytes(0) {};
+  uint64_t numBytes(void) const { return m_numBytes; }
+protected:
+  int_type overflow(int_type c) { m_numBytes++; return traits_type::not_eof(c); }
+  std::streamsize xsputn(const char *, std::streamsize n) { m_numBytes += n; return n; }
+private:
+  uint64_t m_numBytes;
+};
+
+class DiscardStream : public std::ostream {
+public:
+  DiscardStream() : std::ostream(NULL) { init(&m_sbuf); }
+private:
+  DiscardStream(const DiscardStream&); // we have no need for a copy constructor, so disable it
+  DiscardStreambuf m_sbuf;
+};
+
+// The tallies of every site, as computeEpilogosPart1_perChrom would write them, and Q (and Q2).
+struct TalliedSites {
+  vector<unsigned int> begs, ends, values;
+  unsigned int valuesPerSite;
+  string Q1, Q2;
+};
+
+double secondsNow(void);
+double secondsNow(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return static_cast<double>(tv.tv_sec) + 1.0e-6*static_cast<double>(tv.tv_usec);
+}
+
+void report(const char *pBenchmark, const int& metric, const uint64_t& num, const double& seconds);
+void report(const char *pBenchmark, const int& metric, const uint64_t& num, const double& seconds)
+{
+  cout << pBenchmark << "\tS" << metric << '\t' << num << '\t' << seconds << '\t'
+       << (seconds > 0 ? static_cast<double>(num)/seconds : 0.) << endl;
+}
+
+bool tallySites(const char *pFilename, const measurementType& KLtype, const int& numStates,
+		const set<int>& group1, const set<int>& group2, TalliedSites& sites, double& seconds);
+bool tallySites(const char *pFilename, const measurementType& KLtype, const int& numStates,
+		const set<int>& group1, const set<int>& group2, TalliedSites& sites, double& seconds)
+{
+  StateFileReader reader;
+  SiteTallier tallier;
+  vector<int> statesAtThisSite;
+  vector<unsigned int> Prow;
+  ostringstream ossQ1, ossQ2;
+
+  if (!reader.open(pFilename, numStates))
+    {
+      cerr << "Error:  Unable to open file \"" << pFilename << "\" for reading." << endl << endl;
+      return false;
+    }
+  tallier.init(KLtype, group1, group2, numStates);
+  sites.begs.clear();
+  sites.ends.clear();
+  sites.values.clear();
+  const double start = secondsNow();
+  while (reader.readSite(statesAtThisSite))
+    {
+      if (1 == reader.linenum() && !groupsFitInput(group1, group2, static_cast<int>(statesAtThisSite.size())))
+	return false;
+      Prow.clear();
+      tallier.processSite(statesAtThisSite, &Prow, true);
+      sites.begs.push_back(static_cast<unsigned int>(atol(reader.beg())));
+      sites.ends.push_back(static_cast<unsigned int>(atol(reader.end())));
+      sites.values.insert(sites.values.end(), Prow.begin(), Prow.end());
+    }
+  seconds = secondsNow() - start;
+  if (reader.failed())
+    return false;
+  if (sites.begs.empty())
+    {
+      cerr << "Error:  File " << pFilename << " is empty." << endl << endl;
+      return false;
+    }
+  sites.valuesPerSite = static_cast<unsigned int>(sites.values.size() / sites.begs.size());
+  tallier.writeQ(ossQ1, ossQ2);
+  sites.Q1 = ossQ1.str();
+  sites.Q2 = ossQ2.str();
+  return true;
+}
+
+// Returns a model ready to score the sites, writing the observations or the null values to os
+// and the scores to osScores, or NULL after reporting an error.
+Model* createModelForSites(const measurementType& KLtype, const TalliedSites& sites, const bool& nulls, ostream& os, ostream& osScores);
+Model* createModelForSites(const measurementType& KLtype, const TalliedSites& sites, const bool& nulls, ostream& os, ostream& osScores)
+{
+  Model *pM = createModel(KLtype);
+  istringstream issQ1(sites.Q1), issQ2(sites.Q2);
+  const unsigned int Nsites(static_cast<unsigned int>(sites.begs.size()));
+
+  if (!pM->init(NULL, NULL, nulls ? "" : NULL, string("chrB"))
+      || !pM->getQcontrib(issQ1, "(Q tallies for group 1)", Nsites)
+      || (!sites.Q2.empty() && !pM->getQcontrib(issQ2, "(Q tallies for group 2)", Nsites)))
+    {
+      delete pM;
+      return NULL;
+    }
+  if (nulls)
+    pM->redirectOutput(NULL, NULL, &os);
+  else
+    pM->redirectOutput(&os, &osScores, NULL);
+  return pM;
+}
+
+void scoreSites(Model *pM, const TalliedSites& sites, const bool& nulls);
+void scoreSites(Model *pM, const TalliedSites& sites, const bool& nulls)
+{
+  const unsigned int *pVal = sites.values.empty() ? NULL : &sites.values[0];
+  for (size_t i = 0; i < sites.begs.size(); i++)
+    {
+      if (!nulls)
+	{
+	  pM->processInputValue(sites.begs[i]);
+	  pM->processInputValue(sites.ends[i]);
+	}
+      for (unsigned int j = 0; j < sites.valuesPerSite; j++)
+	pM->processInputValue(*pVal++);
+      pM->computeAndWriteMetric();
+    }
+}
+
+// Times scoreSites() numRepeats times, and returns the fastest time; the output of the last repetition is written to os.
+bool timeScoring(const measurementType& KLtype, const TalliedSites& sites, const bool& nulls, const int& numRepeats,
+		 ostream& os, double& fastest);
+bool timeScoring(const measurementType& KLtype, const TalliedSites& sites, const bool& nulls, const int& numRepeats,
+		 ostream& os, double& fastest)
+{
+  DiscardStream discard;
+  for (int r = 0; r < numRepeats; r++)
+    {
+      Model *pM = createModelForSites(KLtype, sites, nulls, r + 1 < numRepeats ? discard : os, discard);
+      if (NULL == pM)
+	return false;
+      const double start = secondsNow();
+      scoreSites(pM, sites, nulls);
+      const double seconds = secondsNow() - start;
+      delete pM;
+      if (0 == r || seconds < fastest)
+	fastest = seconds;
+    }
+  return true;
+}
+
+int main(int argc, const char* argv[])
+{
+  int numRepeats(3);
+
+  // Options (arguments beginning with "--") may appear anywhere on the command line;
+  // remove them, so that the remaining arguments can be interpreted by position.
+  int numPositionalArgs(1);
+  for (int i = 1; i < argc; i++)
+    {
+      if (0 == strcmp(argv[i], "--repeat") && i + 1 < argc)
+	{
+	  numRepeats = atoi(argv[++i]);
+	  if (numRepeats < 1)
+	    {
+	      cerr << "Error:  Invalid number of repetitions (\"" << argv[i] << "\") received." << endl << endl;
+	      return -1;
+	    }
+	}
+      else
+	argv[numPositionalArgs++] = argv[i];
+    }
+  argc = numPositionalArgs;
+
+  if (4 != argc && 5 != argc)
+    {
+      cerr << "Usage:  " << argv[0] << " [--repeat R] stateFile numStates groupSpec [group2spec]\n"
+	   << "where stateFile, numStates, groupSpec, and group2spec are as for computeEpilogosPart1_perChrom.\n"
+	   << "The inner loops of the three steps of epilogos are timed in memory, for each metric, on the sites of stateFile;\n"
+	   << "each loop except the first (which reads stateFile) is repeated R times (default 3), and the fastest time is reported.\n"
+	   << "The loops of computeEpilogosPart3_perChrom are only timed for a comparison of two groups, which has null values."
+	   << endl << endl;
+      return -1;
+    }
+
+  const char *pFilename(argv[1]);
+  const int numStates(atoi(argv[2]));
+  set<int> group1, group2;
+  vector<char> spec(argv[3], argv[3] + strlen(argv[3]) + 1);
+  if (numStates < 1 || !parseOneSetOfColumnSpecs(&spec[0], group1))
+    return -1;
+  if (5 == argc)
+    {
+      spec.assign(argv[4], argv[4] + strlen(argv[4]) + 1);
+      if (!parseOneSetOfColumnSpecs(&spec[0], group2))
+	return -1;
+    }
+
+  cout << "benchmark\tmetric\tnum\tseconds\tnumPerSecond" << endl;
+  for (int metric = KL; metric <= KLss; metric++)
+    {
+      const measurementType KLtype(static_cast<measurementType>(metric));
+      TalliedSites sites;
+      ostringstream obs, nulls;
+      double seconds;
+
+      if (!tallySites(pFilename, KLtype, numStates, group1, group2, sites, seconds))
+	return -1;
+      const uint64_t numSites(sites.begs.size());
+      report("tally", metric, numSites, seconds);
+      if (!timeScoring(KLtype, sites, false, numRepeats, obs, seconds))
+	return -1;
+      report("observations", metric, numSites, seconds);
+      if (group2.empty())
+	continue;
+      if (!timeScoring(KLtype, sites, true, numRepeats, nulls, seconds))
+	return -1;
+      report("nulls", metric, numSites, seconds);
+
+      // computeEpilogosPart3_perChrom
+      const string nullsText(nulls.str()), obsText(obs.str());
+      vector<NullData> nullDistn;
+      for (int r = 0; r < numRepeats; r++)
+	{
+	  istringstream iss(nullsText);
+	  nullDistn.clear();
+	  const double start = secondsNow();
+	  loadNullDistn(iss, nullDistn);
+	  const double t = secondsNow() - start;
+	  if (0 == r || t < seconds)
+	    seconds = t;
+	}
+      report("loadNullDistn", metric, numSites, seconds);
+      for (int r = 0; r < numRepeats; r++)
+	{
+	  istringstream iss(obsText);
+	  DiscardStream discard;
+	  const double start = secondsNow();
+	  if (!loadDataAndReport(iss, discard, nullDistn))
+	    return -1;
+	  const double t = secondsNow() - start;
+	  if (0 == r || t < seconds)
+	    seconds = t;
+	}
+      report("loadDataAndReport", metric, numSites, seconds);
+    }
+
+  return 0;
+}
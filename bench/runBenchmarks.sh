@@ -0,0 +1,208 @@
+#! /bin/bash
+
+# Runs the epilogos benchmarks (also run by "make bench"):
+# 1. microbenchmarks of the inner loops of all three steps, for every metric, on synthetic data of low and high entropy;
+# 2. end-to-end runs of computeEpilogosPart1_perChrom, computeEpilogosPart2_perChrom, and computeEpilogosPart3_perChrom
+#    on the same synthetic data, with --stats; their reports are collected in outdir/stats.jsonl;
+# 3. end-to-end runs on the example data in ../data, whose results are checked against those in ../data/results_*.
+# The sizes of the synthetic data can be set via the environment variables
+# BENCH_SITES (default 100000), BENCH_EPIGENOMES (default 127), BENCH_STATES (default 15),
+# and BENCH_ENTROPIES (default "0.2 0.8"); set BENCH_REFERENCE=0 to skip step 3.
+
+usage() {
+    echo -e "Usage:  $0 bindir outdir"
+    echo -e "where bindir contains the epilogos executables, generateStateMatrix, and microbenchmarks (built by \"make bench\"),"
+    echo -e "and outdir will be created if necessary, and all data and results will be written there."
+    exit 2
+}
+
+if [[ $# != 2 ]]; then
+    usage
+fi
+
+bindir=$1
+outdir=$2
+benchdir=`dirname $0`
+datadir=${benchdir}/../data
+sites=${BENCH_SITES:-100000}
+epigenomes=${BENCH_EPIGENOMES:-127}
+states=${BENCH_STATES:-15}
+entropies=${BENCH_ENTROPIES:-"0.2 0.8"}
+# the groups of the example data (see ../data/*GroupSpec.txt)
+groupA="29-32,35-36,46,50-51"
+groupB="33-34,37-45,47-48,61"
+
+EXE1=${bindir}/computeEpilogosPart1_perChrom
+EXE2=${bindir}/computeEpilogosPart2_perChrom
+EXE3=${bindir}/computeEpilogosPart3_perChrom
+for exe in $EXE1 $EXE2 $EXE3 ${bindir}/generateStateMatrix ${bindir}/microbenchmarks; do
+    if [ ! -x $exe ]; then
+	echo -e "Error:  Required executable \"$exe\" was not found; run \"make bench\" to build it."
+	exit 2
+    fi
+done
+
+mkdir -p $outdir
+statsFile=${outdir}/stats.jsonl
+rm -f $statsFile
+
+# Runs a command whose --stats report is written to standard error, and appends the report to $statsFile.
+# The command's other messages to standard error are passed on.
+runWithStats() {
+    "$@" --stats 2> ${outdir}/stderr.tmp
+    local status=$?
+    grep '^{"program"' ${outdir}/stderr.tmp >> $statsFile
+    grep -v '^{"program"' ${outdir}/stderr.tmp 1>&2
+    rm -f ${outdir}/stderr.tmp
+    return $status
+}
+
+# Prints the number of lines of file1 and file2 that differ, ignoring the final ignoreLast columns,
+# after sorting both by coordinates.  Numbers are considered equal if they differ by at most one unit in their last digit,
+# or by a relative amount of at most 1e-5, because the reference results were written by an earlier build,
+# whose floating-point arithmetic (and therefore rounding) sometimes differs.
+compareTables() {
+    local file1=$1 file2=$2 ignoreLast=$3
+    zcat -f $file1 | LC_ALL=C sort -k1,1 -k2,2n > ${outdir}/compare1.tmp
+    zcat -f $file2 | LC_ALL=C sort -k1,1 -k2,2n > ${outdir}/compare2.tmp
+    awk -F'\t' -v ignoreLast=$ignoreLast -v file2=${outdir}/compare2.tmp '
+    # one unit in the last digit of the number x, e.g. 0.001 for "2.189" or "-3.1e-05" (1e-06)
+    function lastDigitUnit(x,   mantissa, exponent, numDecimals) {
+	mantissa = x
+	exponent = 0
+	if (match(x, /[eE]/)) {
+	    mantissa = substr(x, 1, RSTART - 1)
+	    exponent = substr(x, RSTART + 1) + 0
+	}
+	numDecimals = match(mantissa, /\./) ? length(mantissa) - RSTART : 0
+	return 10 ^ (exponent - numDecimals)
+    }
+    function abs(x) {
+	return x < 0 ? -x : x
+    }
+    function differ(x, y,   d, u, uy) {
+	if (x == y)
+	    return 0
+	if (x !~ /^-?[0-9.]+([eE][-+]?[0-9]+)?$/ || y !~ /^-?[0-9.]+([eE][-+]?[0-9]+)?$/)
+	    return 1
+	d = abs(x - y)
+	u = lastDigitUnit(x)
+	uy = lastDigitUnit(y)
+	return d > 1.000001 * (uy > u ? uy : u) && d > 1e-5 * (abs(x) > abs(y) ? abs(x) : abs(y))
+    }
+    {
+	if ((getline other < file2) <= 0) {
+	    numDiffering++
+	    next
+	}
+	n = split(other, f, "\t")
+	if (n != NF) {
+	    numDiffering++
+	    next
+	}
+	for (i = 1; i <= NF - ignoreLast; i++)
+	    if (differ($i, f[i])) {
+		numDiffering++
+		break
+	    }
+    }
+    END {
+	while ((getline other < file2) > 0)
+	    numDiffering++
+	print numDiffering + 0
+    }' ${outdir}/compare1.tmp
+    rm -f ${outdir}/compare1.tmp ${outdir}/compare2.tmp
+}
+
+# Reports whether the number of differing lines ($2) is zero, and records any failure in $failures.
+failures=0
+check() {
+    if [ "$2" == "0" ]; then
+	echo -e "$1:  OK"
+    else
+	echo -e "$1:  FAILED ($2 lines differ)"
+	failures=$((failures + 1))
+    fi
+}
+
+# ----------------------------------------------------------
+echo -e "Microbenchmarks ($sites sites, $epigenomes epigenomes, $states states)"
+# ----------------------------------------------------------
+
+for entropy in $entropies; do
+    synthetic=${outdir}/synthetic_entropy${entropy}.txt.gz
+    ${bindir}/generateStateMatrix $sites $epigenomes $states $entropy $synthetic || exit 2
+    echo -e "entropy $entropy:"
+    ${bindir}/microbenchmarks $synthetic $states $groupA $groupB > ${outdir}/microbenchmarks_entropy${entropy}.txt || exit 2
+    cat ${outdir}/microbenchmarks_entropy${entropy}.txt
+done
+
+# ----------------------------------------------------------
+echo -e "\nEnd-to-end runs on synthetic data (reports in $statsFile)"
+# ----------------------------------------------------------
+
+for entropy in $entropies; do
+    synthetic=${outdir}/synthetic_entropy${entropy}.txt.gz
+    for metric in 1 2 3; do
+	d=${outdir}/S${metric}_entropy${entropy}
+	mkdir -p $d
+	runWithStats $EXE1 --binary $synthetic $metric $states $d/P.bin $d/Q1.txt $d/N.txt $groupA $groupB $d/R.bin $d/Q2.txt || exit 2
+	Nsites=`cat $d/N.txt`
+	runWithStats $EXE2 $d/P.bin $metric $Nsites $d/Q1.txt $d/obs.txt $d/scores.txt.gz chrB $d/Q2.txt || exit 2
+	runWithStats $EXE2 $d/R.bin $metric $Nsites $d/Q1.txt $d/Q2.txt $d/nulls.txt || exit 2
+	runWithStats $EXE3 $d/obs.txt $d/nulls.txt $d/withPvals.bed || exit 2
+	rm -f $d/P.bin $d/R.bin
+    done
+done
+# one line per run:  program, wall time, sites per second
+sed -e 's/^{"program": "\([^"]*\)", "wallSeconds": \([^,]*\),.*"sitesPerSecond": \([^,]*\),.*/\1\t\2 s\t\3 sites\/s/' $statsFile
+
+# ----------------------------------------------------------
+echo -e "\nEnd-to-end runs on the example data, checked against the reference results"
+# ----------------------------------------------------------
+
+infile=${datadir}/chr1_127epigenomes_15observedStates.txt.gz
+if [ "${BENCH_REFERENCE:-1}" == "0" ]; then
+    echo -e "Skipped."
+elif [ ! -s $infile ]; then
+    echo -e "Skipped, because $infile was not found."
+else
+    UNSTARCH_EXE=`which unstarch 2> /dev/null`
+
+    # S1 for the group of blood and T-cell samples (see README.md)
+    ref=${datadir}/results_Blood_T-cell/KL
+    d=${outdir}/Blood_T-cell_KL
+    mkdir -p $d
+    runWithStats $EXE2 --fused --exemplars $d/exemplarRegions.txt $infile 1 15 $d/observations.bed $d/scores.txt.gz chr1 $groupB || exit 2
+    check "S1 scores" `compareTables $d/scores.txt.gz ${ref}/scores.txt.gz 0`
+    check "S1 exemplar regions" `compareTables $d/exemplarRegions.txt ${ref}/exemplarRegions.txt 0`
+    if [ -x "$UNSTARCH_EXE" ]; then
+	$UNSTARCH_EXE ${ref}/observations.starch > $d/reference.bed
+	check "S1 observations" `compareTables $d/observations.bed $d/reference.bed 0`
+    fi
+
+    # Differential S1 for the group of HSC and B-cell samples vs. the group of blood and T-cell samples.
+    # The null values are obtained by random permutations that differ from those of the reference results,
+    # so their p-values (the final column) aren't compared.
+    ref=${datadir}/results_HSC_B-cell_vs_Blood_T-cell/DKL
+    d=${outdir}/HSC_B-cell_vs_Blood_T-cell_DKL
+    mkdir -p $d
+    runWithStats $EXE2 --fused $infile 1 15 $d/observations.txt $d/scores.txt.gz chr1 $groupA $groupB $d/nulls.txt || exit 2
+    runWithStats $EXE3 --exemplars $d/exemplarRegions.txt $d/observations.txt $d/nulls.txt $d/observations.bed || exit 2
+    check "DKL scores" `compareTables $d/scores.txt.gz ${ref}/scores.txt.gz 0`
+    check "DKL exemplar regions" `compareTables $d/exemplarRegions.txt ${ref}/exemplarRegions.txt 1`
+    if [ -x "$UNSTARCH_EXE" ]; then
+	$UNSTARCH_EXE ${ref}/observations.starch > $d/reference.bed
+	check "DKL observations" `compareTables $d/observations.bed $d/reference.bed 1`
+    fi
+    if [ ! -x "$UNSTARCH_EXE" ]; then
+	echo -e "(The observations weren't compared, because unstarch (part of bedops) was not found.)"
+    fi
+    tail -n 3 $statsFile | sed -e 's/^{"program": "\([^"]*\)", "wallSeconds": \([^,]*\),.*"sitesPerSecond": \([^,]*\),.*/\1\t\2 s\t\3 sites\/s/'
+fi
+
+if [ $failures != 0 ]; then
+    echo -e "\n$failures check(s) failed."
+    exit 1
+fi
+exit 0
@@ -48,18 +48,14 @@ S2=0
 S3=0
 if [ "$metric" == "1" ]; then
     S1=1
-    SCORE_COLUMN=7
 elif [ "$metric" == "2" ]; then
     S2=1
-    SCORE_COLUMN=10
 elif [ "$metric" == "3" ]; then
     S3=1
-    SCORE_COLUMN=10
 else
     echo -e "Error:  Mode of operation \"$metric\" not implemented."
     exit 2
 fi
-STATE_COLUMN=4
     
 if [ ! -s "$fileOfFilenames" ]; then
     echo -e "Error:  File \"$fileOfFilenames\" was not found, or it is empty."
@@ -135,7 +131,11 @@ do
 	exit 2
     fi
     bytes=`ls -l $file | awk '{print $5}'`
-    maxNumEpis=`head -n 1 $file | cut -f4- | awk '{print NF}'`
+    if [[ "$file" == *.gz ]]; then
+	# use the uncompressed size, for estimating the number of lines (gzip -l reports it modulo 4 GB)
+	bytes=`gzip -l $file | awk 'NR==2{print $2}'`
+    fi
+    maxNumEpis=`zcat -f $file | head -n 1 | cut -f4- | awk '{print NF}'`
     approxLineCount=`echo $bytes | awk -v n=$maxNumEpis '{print int($1/(n*3))}'`
     tempVar=${tempVar}":"${approxLineCount}
 done <<< "$(cat $fileOfFilenames)" # see note above regarding this syntax
@@ -159,7 +159,7 @@ dependencies="afterok" # SLURM syntax
 while read line
 do
     file=$line
-    chr=`head -n 1 $file | cut -f1`
+    chr=`zcat -f $file | head -n 1 | cut -f1`
     outfileNsites=${outdir}/${chr}_numSites.txt
     if [ $S1 == 1 ]; then
 	PfilenameString="_P1numerators.txt"
@@ -196,14 +196,14 @@ do
 
     if [ -s ${outdir}/observations.starch ]; then
 	if [ -s ${outdir}/scores.txt.gz ] || [ -s ${outdir}/${chr}_scores.txt ]; then
-	    if [[ "$groupBspec" == "" || ("$groupBspec" != "" && ( -s $outfileRand || -s ${outdir}/allNullsGenomewide.txt )) ]]; then
+	    if [[ "$groupBspec" == "" || ("$groupBspec" != "" && ( -s $outfileRand || -s ${outdir}/allNullsGenomewide.bin )) ]]; then
 		processThisChromosome="NO"
 	    fi
 	fi
     else
 	if [[ -s ${outdir}/${chr}_observed.txt || -s ${outdir}/${chr}_observed.bed || -s ${outdir}/${chr}_observed_withPvals.bed ]]; then
 	    if [ -s ${outdir}/scores.txt.gz ] || [ -s ${outdir}/${chr}_scores.txt ]; then
-		if [[ "$groupBspec" == "" || ("$groupBspec" != "" && ( -s $outfileRand || -s ${outdir}/allNullsGenomewide.txt )) ]]; then
+		if [[ "$groupBspec" == "" || ("$groupBspec" != "" && ( -s $outfileRand || -s ${outdir}/allNullsGenomewide.bin )) ]]; then
 		    processThisChromosome="NO"
 		fi
 	    fi
@@ -213,7 +213,7 @@ do
     jobName="p1a_$chr"
     offset=4000      # estimated empirically
     coefficient=0.03 # estimated empirically
-    maxNumEpigenomes=`head -n 1 $file | cut -f4- | awk '{print NF}'`
+    maxNumEpigenomes=`zcat -f $file | head -n 1 | cut -f4- | awk '{print NF}'`
     memSize=`echo $maxNumEpigenomes | awk -v c=$offset -v gA=$groupAsize -v gB=$groupBsize '{print c + $1 + gA + gB}'`
     if [ $S1 == 1 ]; then
 	memSize=`echo $memSize | awk -v ns=$numStates -v gB=$groupBsize '{kbOut = $1 + 2*ns; if(gB!=0){kbOut += 4*ns} print kbOut}'`
@@ -278,9 +278,6 @@ else
     fi
 fi
 
-tempfile=${outdir}/tempfile_Q_${PID}.txt
-TEMP1=${outdir}/tempfile1_Q_${PID}.txt
-TEMP2=${outdir}/tempfile2_Q_${PID}.txt
 if [ $dependencies == "afterok" ]; then
     dependencyString=""
 else
@@ -303,120 +300,30 @@ if [[ ! -s ${outdir}/observations.starch && ! -s ${outdir}/scores.txt.gz && (! -
 	exit 2
     fi
     if [ $S3 == 1 ]; then
-	memSize=`echo 2 | awk -v gA=$groupAsize -v gB=$groupBsize -v ns=$numStates '{gmax=gA;if(gB>gA){gmax=gB}print int($1 + 3*(ns*ns*gmax*(gmax-1)/2)/1000000 + 0.5)"M"}'`
-	# the factor of 3 provides a bit of extra room for safety
+	memSize=`echo 2 | awk -v gA=$groupAsize -v gB=$groupBsize -v ns=$numStates '{gmax=gA;if(gB>gA){gmax=gB}print int($1 + 10*(ns*ns*gmax*(gmax-1)/2)/1000000 + 0.5)"M"}'`
+	# the tallies are summed as 8-byte integers; the factor of 10 provides a bit of extra room for safety
     else
 	memSize="2M" # more than enough
     fi
     
     QQjobID=$(sbatch --parsable --partition=$queueName $dependencyString --job-name=$QQjobName --output=${outdir}/${QQjobName}.o%j --error=${outdir}/${QQjobName}.e%j --mem=$memSize <<EOF
 #! /bin/bash
-firstFile=\`ls -1 ${outdir}/chr*${QfilenameString} | head -n 1\`
-if [ ! -s \$firstFile ]; then
-   echo -e "Error:  File "\$firstFile" is empty."
-   exit 2
-fi
-numRows=\`wc -l < \$firstFile\`
-awk '{print NF}' \$firstFile | sort -n | uniq > $tempfile
-if [ \`wc -l < $tempfile\` != "1" ]; then
-   echo -e "Error:  File "\$firstFile" has at least two rows with different numbers of columns."
+$EXE1 --sum-tallies $outfileQ ${outdir}/chr*${QfilenameString}
+if [ \$? != 0 ]; then
+   echo -e "Error:  Failed to sum the tallies in ${outdir}/chr*${QfilenameString}."
    exit 2
 fi
-numCols=\`cat $tempfile\`
-
-cp \$firstFile $TEMP1
-for file in \`ls -1 ${outdir}/chr*${QfilenameString} | tail -n +2\`
-do
-   if [ ! -s \$file ]; then
-      echo -e "Error:  File "\$file" is empty."
-      exit 2
-   fi
-   thisNumRows=\`wc -l < \$file\`
-   awk '{print NF}' \$file | sort -n | uniq > $tempfile
-   if [ \`wc -l < $tempfile\` != "1" ]; then
-      echo -e "Error:  File "\$file" has at least two rows with different numbers of columns."
-      exit 2
-   fi
-   thisNumCols=\`cat $tempfile\`
-   if [ \$thisNumRows != \$numRows ]; then
-      echo -en "Error:  Files "\$firstFile" and "\$file" have different numbers of rows ("
-      echo \$numRows" and "\$thisNumRows")."
-      exit 2
-   fi
-   if [ \$thisNumCols != \$numCols ]; then
-      echo -en "Error:  Files "\$firstFile" and "\$file" have different numbers of columns ("
-      echo \$numCols" and "\$thisNumCols")."
-      exit 2
-   fi
-
-   paste $TEMP1 \$file \
-      | awk -v nCols=\$numCols '{printf("%d", \$1 + \$(nCols + 1)); \
-                                 for (i=2; i<= nCols; i++){ \
-                                    printf("\t%d", \$i + \$(nCols + i)); \
-                                 } \
-                                 printf("\n"); \
-                                }' \
-      > $TEMP2
-   mv $TEMP2 $TEMP1
-done
-cp $TEMP1 $outfileQ
 rm -f ${outdir}/chr*${QfilenameString}
 
 if [ "$groupBspec" != "" ]; then
-   firstFile=\`ls -1 ${outdir}/chr*${QBfilenameString} | head -n 1\`
-   if [ ! -s \$firstFile ]; then
-      echo -e "Error:  File "\$firstFile" is empty."
-      exit 2
-   fi
-   numRows=\`wc -l < \$firstFile\`
-   awk '{print NF}' \$firstFile | sort -n | uniq > $tempfile
-   if [ \`wc -l < $tempfile\` != "1" ]; then
-      echo -e "Error:  File "\$firstFile" has at least two rows with different numbers of columns."
+   $EXE1 --sum-tallies $outfileQB ${outdir}/chr*${QBfilenameString}
+   if [ \$? != 0 ]; then
+      echo -e "Error:  Failed to sum the tallies in ${outdir}/chr*${QBfilenameString}."
       exit 2
    fi
-   numCols=\`cat $tempfile\`
-
-   cp \$firstFile $TEMP1
-   for file in \`ls -1 ${outdir}/chr*${QBfilenameString} | tail -n +2\`
-   do
-      if [ ! -s \$file ]; then
-         echo -e "Error:  File "\$file" is empty."
-         exit 2
-      fi
-      thisNumRows=\`wc -l < \$file\`
-      awk '{print NF}' \$file | sort -n | uniq > $tempfile
-      if [ \`wc -l < $tempfile\` != "1" ]; then
-         echo -e "Error:  File "\$file" has at least two rows with different numbers of columns."
-         exit 2
-      fi
-      thisNumCols=\`cat $tempfile\`
-      if [ \$thisNumRows != \$numRows ]; then
-         echo -en "Error:  Files "\$firstFile" and "\$file" have different numbers of rows ("
-         echo \$numRows" and "\$thisNumRows")."
-         exit 2
-      fi
-      if [ \$thisNumCols != \$numCols ]; then
-         echo -en "Error:  Files "\$firstFile" and "\$file" have different numbers of columns ("
-         echo \$numCols" and "\$thisNumCols")."
-         exit 2
-      fi
-
-      paste $TEMP1 \$file \
-         | awk -v nCols=\$numCols '{printf("%d", \$1 + \$(nCols + 1)); \
-                                    for (i=2; i<= nCols; i++){ \
-                                       printf("\t%d", \$i + \$(nCols + i)); \
-                                    } \
-                                    printf("\n"); \
-                                   }' \
-         > $TEMP2
-      mv $TEMP2 $TEMP1
-   done
-   cp $TEMP1 $outfileQB
    rm -f ${outdir}/chr*${QBfilenameString}
 fi
 
-rm -f $tempfile $TEMP1 $TEMP2
-
 EOF
 	   )
     dependencyString2="--dependency=afterok:"${QQjobID}
@@ -438,9 +345,11 @@ if [ ! -s $totalNumSitesFile ]; then
     fi
     totalSitesJobID=$(sbatch --parsable --partition=$queueName $dependencyString2 --job-name=$totalSitesJobName --output=${outdir}/${totalSitesJobName}.o%j --error=${outdir}/${totalSitesJobName}.e%j --mem=$memSize <<EOF
 #! /bin/bash
-   cat ${outdir}/chr*_numSites.txt \
-      | awk 'BEGIN{sum=0}{sum += \$0}END{print sum}' \
-      > $totalNumSitesFile
+   $EXE1 --sum-tallies $totalNumSitesFile ${outdir}/chr*_numSites.txt
+   if [ \$? != 0 ]; then
+      echo -e "Error:  Failed to sum the numbers of sites in ${outdir}/chr*_numSites.txt."
+      exit 2
+   fi
    rm ${outdir}/chr*_numSites.txt
 EOF
 	       )
@@ -452,6 +361,8 @@ fi
 # ----------------------------------
 
 dependencies="afterok" # SLURM syntax
+# The first Part2 job to finish deriving the tables from Q writes them to this file; later jobs reuse them.
+QcacheFile=${outdir}/Qcontrib.cache
 # Important:
 # Need to code this as follows (i.e., "while read line do ... done <<< input"
 # instead of "input | while read line do ... done"),
@@ -461,18 +372,22 @@ dependencies="afterok" # SLURM syntax
 while read line
 do
     file=$line
-    chr=`head -n 1 $file | cut -f1`
+    chr=`zcat -f $file | head -n 1 | cut -f1`
     infile=${outdir}/${chr}${PfilenameString}
     infileQ=$outfileQ
     infileQB=$outfileQB # empty ("") if only one group of epigenomes was specified
     outfileObserved=${outdir}/${chr}_observed.txt
     outfileScores=${outdir}/${chr}_scores.txt
     outfileNulls=""
+    # With one group, $EXE2 writes the final observations, and collects the chromosome's exemplar regions as it does
+    # (with two groups, $EXE3 does, below); the final step merges those of every chromosome.
+    exemplarOption=""
     if [ "$groupBspec" != "" ]; then
 	outfileNulls=${outdir}/${chr}_nulls.txt
 	outfileObsFromPart3=`echo $outfileObserved | sed 's/\.txt$/_withPvals.bed/'`
     else
 	outfileObsFromPart3=`echo $outfileObserved | sed 's/txt$/bed/'`
+	exemplarOption="--exemplars ${outdir}/${chr}_exemplars.txt"
     fi
     jobName="p2_$chr"
     offset=4000     # estimated empirically
@@ -494,7 +409,7 @@ do
 	thisJobID=$(sbatch --parsable --partition=$queueName $dependencyString2 --job-name=$jobName --output=${outdir}/${jobName}.o%j --error=${outdir}/${jobName}.e%j --mem=$memSize <<EOF
 #! /bin/bash
    totalNumSites=\`cat $totalNumSitesFile\`
-   $EXE2 $infile $metric \$totalNumSites $infileQ $outfileObserved $outfileScores $chr $infileQB
+   $EXE2 --qcache $QcacheFile $exemplarOption $infile $metric \$totalNumSites $infileQ $outfileObserved $outfileScores $chr $infileQB
    if [ \$? != 0 ]; then
       exit 2
    fi
@@ -509,7 +424,8 @@ EOF
 #! /bin/bash
    totalNumSites=\`cat $totalNumSitesFile\`
    # The smaller number of arguments in the following call informs $EXE2 that it should only write the metric to $outfileNulls, with no additional info.
-   $EXE2 $infile $metric \$totalNumSites $infileQ $infileQB $outfileNulls
+   # With --sorted-nulls, the values are written sorted and tallied, so that part 2b can merge them with bounded memory.
+   $EXE2 --sorted-nulls --qcache $QcacheFile $infile $metric \$totalNumSites $infileQ $infileQB $outfileNulls
    if [ \$? != 0 ]; then
       exit 2
    else # clean up
@@ -535,7 +451,7 @@ else
 fi
 dependencyString2=""
 
-if [[ ! -s ${outdir}/scores.txt.gz || ( "$groupBspec" != "" && ! -s ${outdir}/allNullsGenomewide.txt ) ]]; then
+if [[ ! -s ${outdir}/scores.txt.gz || ( "$groupBspec" != "" && ! -s ${outdir}/allNullsGenomewide.bin ) ]]; then
     part2bJobID=$(sbatch --parsable --partition=$queueName $dependencyString --job-name=$part2bJobName --output=${outdir}/${part2bJobName}.o%j --error=${outdir}/${part2bJobName}.e%j --mem=$memSize <<EOF
 #! /bin/bash
    module load htslib
@@ -549,10 +465,10 @@ if [[ ! -s ${outdir}/scores.txt.gz || ( "$groupBspec" != "" && ! -s ${outdir}/al
    fi
    rm -f ${outdir}/*_scores.txt
           
-   if [ "$groupBspec" != "" ] && [ ! -s ${outdir}/allNullsGenomewide.txt ]; then
-      cat ${outdir}/*_nulls.txt > ${outdir}/allNullsGenomewide.txt
+   if [ "$groupBspec" != "" ] && [ ! -s ${outdir}/allNullsGenomewide.bin ]; then
+      $EXE3 --merge-nulls ${outdir}/allNullsGenomewide.bin ${outdir}/*_nulls.txt
       if [ \$? != 0 ]; then
-         echo -e "An error occurred while attempting to concatenate the per-chromosome null values."
+         echo -e "An error occurred while attempting to merge the per-chromosome null values."
          exit 2
       fi
       rm -f ${outdir}/*_nulls.txt
@@ -570,16 +486,31 @@ fi
 
 dependencies="afterok"
 
+# The genome-wide null distribution is memory-mapped from allNullsGenomewide.bin, so beyond a small constant,
+# a two-group job needs only the table:  if it has already been written (e.g. when resuming a run), its size;
+# otherwise an estimate, at one 16-byte entry per distinct null value.  Each site contributes numNullValuesPerSite null values
+# (one permutation of its states, as computeEpilogosPart1_perChrom writes them; computeEpilogosPart2_perChrom --fused
+# --permutations M would write M), and in practice no more than about half of them are distinct.
+numNullValuesPerSite=1
+if [ "$groupBspec" != "" ]; then
+    if [ -s ${outdir}/allNullsGenomewide.bin ]; then
+	nullTableBytes=`stat -c %s ${outdir}/allNullsGenomewide.bin`
+    else
+	nullTableBytes=`echo $approxTotalNumSites | awk -v M=$numNullValuesPerSite -v bytesPerTableEntry=16 '{print int(0.5*M*$1*bytesPerTableEntry)}'`
+    fi
+    part3memSize=`echo $nullTableBytes | awk '{print int(10 + $1/1000000 + 0.5)"M"}'`
+fi
+
 while read line
 do
     origFile=$line
-    chr=`head -n 1 $origFile | cut -f1`
-    begPos=`head -n 1 $origFile | cut -f2`
-    endPos=`head -n 1 $origFile | cut -f3`
+    chr=`zcat -f $origFile | head -n 1 | cut -f1`
+    begPos=`zcat -f $origFile | head -n 1 | cut -f2`
+    endPos=`zcat -f $origFile | head -n 1 | cut -f3`
     infile=${chr}_observed.txt
     if [ "$groupBspec" != "" ]; then
 	outfile=`echo $infile | sed 's/\.txt$/_withPvals.bed/'`
-	memSize=`echo $approxTotalNumSites | awk -v safeApproxMeanBytesPerField=8 '{print int(0.5*$1*safeApproxMeanBytesPerField/1000000)"M"}'`
+	memSize=$part3memSize
     else
 	outfile=`echo $infile | sed 's/txt$/bed/'`
 	memSize="2M" # all we'll be doing is renaming a file	
@@ -590,8 +521,8 @@ do
     if [[ ! -s $outfile &&  ! -s ${outdir}/observations.starch ]]; then
 	thisJobID=$(sbatch --parsable --partition=$queueName $dependencyString2 --job-name=$jobName --output=${outdir}/${jobName}.o%j --error=${outdir}/${jobName}.e%j --mem=$memSize <<EOF
 #! /bin/bash
-   if [ -s ${outdir}/allNullsGenomewide.txt ]; then
-      $EXE3 $infile ${outdir}/allNullsGenomewide.txt $outfile
+   if [ -s ${outdir}/allNullsGenomewide.bin ]; then
+      $EXE3 --exemplars ${outdir}/${chr}_exemplars.txt $infile ${outdir}/allNullsGenomewide.bin $outfile
       if [ \$? == 0 ]; then
          rm -f $infile
       fi
@@ -614,13 +545,13 @@ else
     dependencyString="--dependency=$dependencies"
 fi
 finalJobName=finalStep
-memSize="5M" # this should be sufficient, due to how bedops/starch/unstarch and awk process input
+memSize="5M" # this should be sufficient, due to how bedops/starch/unstarch process input
 
 finalJobID=$(sbatch --parsable --partition=$queueName $dependencyString --job-name=$finalJobName --output=${outdir}/${finalJobName}.o%j --error=${outdir}/${finalJobName}.e%j --mem=$memSizeFinal <<EOF
 #! /bin/bash
    module load bedops
-   if [ -s ${outdir}/allNullsGenomewide.txt ] && [ \`ls -1 ${outdir}/*_observed_withPvals.bed | wc -l\` != "0" ]; then
-      rm -f ${outdir}/allNullsGenomewide.txt
+   if [ -s ${outdir}/allNullsGenomewide.bin ] && [ \`ls -1 ${outdir}/*_observed_withPvals.bed | wc -l\` != "0" ]; then
+      rm -f ${outdir}/allNullsGenomewide.bin
    fi
    if [ ! -s ${outdir}/observations.starch ]; then
       bedops -u ${outdir}/*_observed*.bed | starch - > ${outdir}/observations.starch
@@ -631,32 +562,17 @@ finalJobID=$(sbatch --parsable --partition=$queueName $dependencyString --job-na
          exit 2
       fi
    fi
-   rm -f $outfileQ $outfileQB
-
-   unstarch ${outdir}/observations.starch \
-	 | awk -v stateCol=$STATE_COLUMN -v scoreCol=$SCORE_COLUMN 'BEGIN {OFS="\t"; chrom=""; state=""; bestScore=""; line=""} \
-           { \
-              if (\$(stateCol) != state || \$1 != chrom) { \
-                 if (state != "") { \
-                    print line; \
-                 } \
-                 chrom = \$1; \
-                 state = \$(stateCol); \
-                 bestScore = \$(scoreCol); \
-                 line = \$0; \
-              } else { \
-                 if (\$(scoreCol) >= bestScore) { \
-                    bestScore = \$(scoreCol); \
-                    line = \$0; \
-                 } \
-              } \
-           } END { \
-                      if (line != "") { \
-                         print line; \
-                      } \
-                 }' \
-	 | sort -gr -k${SCORE_COLUMN},${SCORE_COLUMN} \
-	 > ${outdir}/exemplarRegions.txt
+   rm -f $outfileQ $outfileQB $QcacheFile
+
+   if [ ! -s ${outdir}/exemplarRegions.txt ]; then
+      $EXE3 --merge-exemplars ${outdir}/exemplarRegions.txt ${outdir}/*_exemplars.txt
+      if [ \$? == 0 ]; then
+         rm -f ${outdir}/*_exemplars.txt
+      else
+         echo -e "An error occurred while trying to merge the exemplar regions of the chromosomes."
+         exit 2
+      fi
+   fi
 EOF
 	   )
 
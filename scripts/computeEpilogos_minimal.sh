@@ -25,13 +25,7 @@ if [[ $# != 5 ]] && [[ $# != 6 ]]; then # invalid number of arguments
     usage
 fi    
 
-# This script requires bgzip and starch (bedops).
-BGZIP_EXE=`which bgzip 2> /dev/null`
-if [ ! -x "$BGZIP_EXE" ]; then
-    echo -e "Error:  Required external program bgzip was not found, or it is not executable."
-    echo -e "Make sure this program is in your \$PATH, then try again."
-    exit 2
-fi
+# This script requires starch (bedops).
 STARCH_EXE=`which starch 2> /dev/null`
 if [ ! -x "$STARCH_EXE" ]; then
     echo -e "Error:  Required external program starch (part of bedops) was not found, or it is not executable."
@@ -145,182 +139,41 @@ fi
 # echo -e "Executing \"part 1a\"..."
 # ----------------------------------
 
-INFILE_IS_COMPRESSED=`echo $singleChromInputFile | awk '{len=split($0,x,".");if("gz" == x[len]){print 1}else{print 0}}'`
-if [ "$INFILE_IS_COMPRESSED" == "1" ]; then
-    ZCAT_EXE=`which zcat 2> /dev/null`
-    if [ ! -x "$ZCAT_EXE" ]; then
-	echo -e "Error:  Failed to decompress input file $singleChromInputFile using zcat."
-	echo -e "Try decompressing it yourself and specifying the decompressed version of it as input."
-	exit 2
-    fi
-    chr=`zcat $singleChromInputFile | head -n 1 | cut -f1`
-    infile1=${outdir}/uncompressedInfile_${chr}.txt
-    zcat $singleChromInputFile > $infile1
-    if [ ! -s $infile1 ]; then
-	echo -e "Error:  Failed to decompress input file $singleChromInputFile using zcat."
-	echo -e "Try decompressing it yourself and specifying the decompressed version of it as input."
-	exit 2
-    fi
-else
-    infile1=$singleChromInputFile
-    chr=`head -n 1 $infile1 | cut -f1`
-fi
-
-outfileRand="" # used only if 2 groups of epigenomes are being compared
-outfileQB=""   # used only if 2 groups of epigenomes are being compared
-PfilenameString=""
-randFilenameString=""
-
-outfileNsites=${outdir}/${chr}_numSites.txt
-if [ $S1 == 1 ]; then
-    PfilenameString="_P1numerators.txt"
-    outfileQ=${outdir}/${chr}_Q1numerators.txt
-    if [ "$groupBspec" != "" ]; then
-	randFilenameString="_randP1numerators.txt"
-	outfileRand=${outdir}/${chr}${randFilenameString}
-	outfileQ=${outdir}/${chr}_Q1Anumerators.txt
-	outfileQB=${outdir}/${chr}_Q1Bnumerators.txt
-    fi
-elif [ $S2 == 1 ]; then
-    PfilenameString="_P2numerators.txt"
-    outfileQ=${outdir}/${chr}_Q2numerators.txt
-    if [ "$groupBspec" != "" ]; then
-	randFilenameString="_randP2numerators.txt"
-	outfileRand=${outdir}/${chr}${randFilenameString}
-	outfileQ=${outdir}/${chr}_Q2Anumerators.txt
-	outfileQB=${outdir}/${chr}_Q2Bnumerators.txt
-    fi
-else
-    PfilenameString="_statePairs.txt"
-    outfileQ=${outdir}/${chr}_Q3Tallies.txt
-    if [ "$groupBspec" != "" ]; then
-	randFilenameString="_randomizedStatePairs.txt"
-	outfileRand=${outdir}/${chr}${randFilenameString}	    
-	outfileQ=${outdir}/${chr}_Q3Atallies.txt
-	outfileQB=${outdir}/${chr}_Q3Btallies.txt
-    fi
-fi
-outfileP=${outdir}/${chr}${PfilenameString}
-
-
-
-jobName="p1a_$chr"
-if [[ ! -s $outfileP || ! -s $outfileQ || ! -s $outfileNsites || ($groupBspec != "" && (! -s $outfileQB || ! -s $outfileRand)) ]]; then
-    $EXE1 $infile1 $metric $numStates $outfileP $outfileQ $outfileNsites $groupAspec $groupBspec $outfileRand $outfileQB > ${outdir}/${jobName}.stdout 2> ${outdir}/${jobName}.stderr
-    if [ $? != 0 ]; then
-        exit 2
-    fi
-fi
-
-# ----------------------------------
-# echo -e "Executing \"part 1b\"..."
-# ----------------------------------
-
-# Add up the Q1 (or Q2 or Q3) tallies to get the genome-wide Q1 (or Q2 or Q3) matrices,
-# or to get the Q1A and Q1A (or Q2A and Q2B, or Q3A and Q3B) matrices
-# if two groups of epigenomes are being compared.
-
-PID=$$
-QQjobName=QQ_1b_${PID}
-outfileQB=""
-QBfilenameString=""
-if [ $S1 == 1 ]; then
-    outfileQ=${outdir}/Q1.txt
-    QfilenameString="_Q1numerators.txt"
-    if [ "$groupBspec" != "" ]; then
-	outfileQ=${outdir}/Q1A.txt
-	outfileQB=${outdir}/Q1B.txt
-	QfilenameString="_Q1Anumerators.txt"
-	QBfilenameString="_Q1Bnumerators.txt"
-    fi
-elif [ $S2 == 1 ]; then
-    outfileQ=${outdir}/Q2.txt
-    QfilenameString="_Q2numerators.txt"
-    if [ "$groupBspec" != "" ]; then
-	outfileQ=${outdir}/Q2A.txt
-	outfileQB=${outdir}/Q2B.txt
-	QfilenameString="_Q2Anumerators.txt"
-	QBfilenameString="_Q2Bnumerators.txt"
-    fi
-else
-    outfileQ=${outdir}/Q3.txt
-    QfilenameString="_Q3Tallies.txt"
-    if [ "$groupBspec" != "" ]; then
-	outfileQ=${outdir}/Q3A.txt
-	outfileQB=${outdir}/Q3B.txt
-	QfilenameString="_Q3Atallies.txt"
-	QBfilenameString="_Q3Btallies.txt"
-    fi
-fi
-
-if [[ ! -s $outfileQ || ("$groupBspec" != "" && ! -s $outfileQB) ]]; then
-    file=${outdir}/${chr}${QfilenameString}
-    if [ ! -s $file ]; then
-	echo -e "Error:  File "$file" is empty." > ${outdir}/${QQjobName}.stdout
-	exit 2
-    fi
-    mv $file $outfileQ
-    if [ "$groupBspec" != "" ]; then
-	file=${outdir}/${chr}${QBfilenameString}
-	if [ ! -s $file ]; then
-	    echo -e "Error:  File "$file" is empty." > ${outdir}/${QQjobName}.stdout
-	    exit 2
-	fi
-	mv $file $outfileQB
-    fi
-fi
+# The executables read gzip- or bgzip-compressed input directly.
+chr=`zcat -f $singleChromInputFile | head -n 1 | cut -f1`
+infile1=$singleChromInputFile
 
-totalNumSites=`cat $outfileNsites`
-rm -f $outfileNsites
+# ------------------------------------------
+# echo -e "Executing \"parts 1 and 2a\"..."
+# ------------------------------------------
 
-# ----------------------------------
-# echo -e "Executing \"part 2a\"..."
-# ----------------------------------
+# With only a single chromosome, Q (or Q* or Q**) is tallied from that chromosome alone,
+# so $EXE2 can read the input directly, in two passes, without the intermediate files
+# that $EXE1 would otherwise write (see "usage type #3" of $EXE2).
 
-if [ "$INFILE_IS_COMPRESSED" == "1" ]; then
-    rm -f $infile1
-fi
-infile=${outdir}/${chr}${PfilenameString}
-infileQ=$outfileQ
-infileQB=$outfileQB # empty ("") if only one group of epigenomes was specified
 outfileObserved=${outdir}/${chr}_observed.txt
-outfileScores=${outdir}/${chr}_scores.txt
+# $EXE2 writes the scores with bgzip-compatible compression, because the filename ends in .gz.
+outfileScores=${outdir}/scores.txt.gz
 outfileNulls=""
+# The exemplar regions are collected as the final observations are written:
+# by $EXE2 if there's one group, and by $EXE3 (which appends the p-values) if there are two.
+exemplarRegions=${outdir}/exemplarRegions.txt
+exemplarOptionP2="--exemplars $exemplarRegions"
+exemplarOptionP3=""
 if [ "$groupBspec" != "" ]; then
     outfileNulls=${outdir}/${chr}_nulls.txt
+    exemplarOptionP2=""
+    exemplarOptionP3="--exemplars $exemplarRegions"
 fi
 jobName="p2_$chr"
 
-if [ ! -s $outfileObserved ]; then
-    $EXE2 $infile $metric $totalNumSites $infileQ $outfileObserved $outfileScores $chr $infileQB > ${outdir}/${jobName}.stdout 2> ${outdir}/${jobName}.stderr
+if [[ ! -s $outfileObserved || ("$groupBspec" != "" && ! -s $outfileNulls) ]]; then
+    $EXE2 --fused $exemplarOptionP2 $infile1 $metric $numStates $outfileObserved $outfileScores $chr $groupAspec $groupBspec $outfileNulls > ${outdir}/${jobName}.stdout 2> ${outdir}/${jobName}.stderr
     if [ $? != 0 ]; then
 	exit 2
-    else # clean up
-	rm -f $infile
     fi
 fi
 
-if [ "$groupBspec" != "" ] && [ ! -s $outfileNulls ]; then
-    infile=${outdir}/${chr}${randFilenameString}
-    jobName="p2r_$chr"
-    # The smaller number of arguments in the following call informs $EXE2 that it should only write the metric to $outfileNulls, with no additional info.
-    $EXE2 $infile $metric $totalNumSites $infileQ $infileQB $outfileNulls > ${outdir}/${jobName}.stdout 2> ${outdir}/${jobName}.stderr
-    if [ $? != 0 ]; then
-	exit 2
-    else # clean up
-	rm -f $infile
-    fi
-fi
-
-# ----------------------------------
-# echo -e "Executing \"part 2b\"..."
-# ----------------------------------
-
-cat ${outdir}/${chr}_scores.txt \
-      | bgzip \
-      > ${outdir}/scores.txt.gz
-rm -f ${outdir}/${chr}_scores.txt $outfileQ $outfileQB
-          
 # ----------------------------------
 # echo -e "Executing \"part 3\"..."
 # ----------------------------------
@@ -338,7 +191,7 @@ jobName="p3_$chr"
 if [ ! -s $outfile ]; then
     if [ "$outfileNulls" != "" ]; then
       infile=${outdir}/$infile
-      $EXE3 $infile $outfileNulls $outfile > ${outdir}/${jobName}.stdout 2> ${outdir}/${jobName}.stderr
+      $EXE3 $exemplarOptionP3 $infile $outfileNulls $outfile > ${outdir}/${jobName}.stdout 2> ${outdir}/${jobName}.stderr
       if [ $? == 0 ]; then
           rm -f $infile $outfileNulls
       else
@@ -354,38 +207,4 @@ if [ ! -s $outfile ]; then
     fi
 fi
 
-exemplarRegions=${outdir}/exemplarRegions.txt
-if [ -s $finalOutfile ] && [ ! -s $exemplarRegions ]; then
-    STATE_COLUMN=4
-    if [ $S1 == 1 ]; then
-	SCORE_COLUMN=7
-    else
-	SCORE_COLUMN=10
-    fi
-    unstarch $finalOutfile \
-	 | awk -v stateCol=$STATE_COLUMN -v scoreCol=$SCORE_COLUMN 'BEGIN {OFS="\t"; chrom=""; state=""; bestScore=""; line=""} \
-           { \
-              if ( $(stateCol) != state || $1 != chrom ) { \
-                 if ( state != "" ) { \
-                    print line; \
-                 } \
-                 chrom = $1; \
-                 state = $(stateCol); \
-                 bestScore = $(scoreCol); \
-                 line = $0; \
-              } else { \
-                 if ( $(scoreCol) >= bestScore ) { \
-                    bestScore = $(scoreCol); \
-                    line = $0; \
-                 } \
-              } \
-           } END { \
-                      if ( line != "" ) { \
-                         print line; \
-                      } \
-                 }' \
-	 | sort -gr -k${SCORE_COLUMN},${SCORE_COLUMN} \
-	 > $exemplarRegions
-fi
-
 exit 0
@@ -0,0 +1,245 @@
+#ifndef EPILOGOS_BINARY_TALLY_FORMAT_H
+#define EPILOGOS_BINARY_TALLY_FORMAT_H
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+// Packed binary alternative to the tab-delimited files that computeEpilogosPart1_perChrom writes
+// (state tallies, state-pair tallies, or state-pair IDs, one line per site)
+// and that computeEpilogosPart2_perChrom reads back in.
+//
+// The file begins with a fixed-size header; all integers are little-endian.
+//   bytes  0- 7:  magic string "EPILOGOS"
+//   bytes  8-11:  format version (1, or 2 if the values of S3 are the states of the epigenomes; see below)
+//   bytes 12-15:  metric (1 = S1, 2 = S2, 3 = S3)
+//   bytes 16-19:  number of possible states
+//   bytes 20-23:  number of epigenomes in group 1
+//   bytes 24-27:  number of epigenomes in group 2 (0 if a single group is being analyzed)
+//   bytes 28-31:  1 if each record begins with the site's coordinates, 0 otherwise
+//                 (the file of randomized tallies contains no coordinates)
+//   bytes 32-35:  number of bytes used to store each value (1, 2, or 4)
+//   bytes 36-39:  number of values per record (i.e., per site), excluding coordinates
+//   bytes 40-47:  number of records (sites); 0 if unknown, e.g. if the file was written to a pipe
+// Each record then consists of the site's begin and end coordinates (4 bytes each),
+// if present, followed by the values, each of the fixed width given in the header.
+// When numStates <= 15, the state-pair IDs written for S3 (1, 2, ..., numStates^2) fit in 1 byte each.
+// Format version 2 differs only in the values of S3 (computeEpilogosPart1_perChrom --member-states):
+// each record holds the states observed in the epigenomes of group 1, followed by those of group 2,
+// i.e. group1size + group2size values instead of group1size*(group1size-1)/2 + group2size*(group2size-1)/2,
+// from which the state pair IDs are derived as they're read.
+
+const char g_binaryTallyMagic[8] = {'E','P','I','L','O','G','O','S'};
+const unsigned int g_binaryTallyFormatVersion(1);
+const unsigned int g_binaryTallyMemberStatesFormatVersion(2);
+const unsigned int g_binaryTallyHeaderSize(48);
+const std::streamoff g_binaryTallyNsitesOffset(40);
+
+struct BinaryTallyHeader {
+  uint32_t formatVersion;
+  uint32_t metric;
+  uint32_t numStates;
+  uint32_t group1size;
+  uint32_t group2size;
+  uint32_t hasCoordinates;
+  uint32_t bytesPerValue;
+  uint32_t valuesPerRecord;
+  uint64_t Nsites;
+};
+
+inline unsigned int bytesNeededToStore(const unsigned long& maxValue);
+inline unsigned int bytesNeededToStore(const unsigned long& maxValue)
+{
+  if (maxValue <= 0xFFUL)
+    return 1;
+  if (maxValue <= 0xFFFFUL)
+    return 2;
+  return 4;
+}
+
+inline void packLittleEndian(char *pDest, const uint64_t& val, const unsigned int& numBytes);
+inline void packLittleEndian(char *pDest, const uint64_t& val, const unsigned int& numBytes)
+{
+  for (unsigned int i = 0; i < numBytes; i++)
+    pDest[i] = static_cast<char>((val >> (8*i)) & 0xFF);
+}
+
+inline uint64_t unpackLittleEndian(const char *pSrc, const unsigned int& numBytes);
+inline uint64_t unpackLittleEndian(const char *pSrc, const unsigned int& numBytes)
+{
+  uint64_t val(0);
+  for (unsigned int i = 0; i < numBytes; i++)
+    val |= static_cast<uint64_t>(static_cast<unsigned char>(pSrc[i])) << (8*i);
+  return val;
+}
+
+// Appends the decimal representation of val to buf.
+inline void appendDecimal(std::string& buf, unsigned long val);
+inline void appendDecimal(std::string& buf, unsigned long val)
+{
+  char digits[24];
+  int n(0);
+  do {
+    digits[n++] = static_cast<char>('0' + val % 10);
+    val /= 10;
+  } while (val != 0);
+  while (n > 0)
+    buf += digits[--n];
+}
+
+inline void writeBinaryTallyHeader(std::ostream& os, const BinaryTallyHeader& hdr);
+inline void writeBinaryTallyHeader(std::ostream& os, const BinaryTallyHeader& hdr)
+{
+  char buf[g_binaryTallyHeaderSize];
+  memcpy(buf, g_binaryTallyMagic, sizeof(g_binaryTallyMagic));
+  packLittleEndian(buf + 8, hdr.formatVersion, 4);
+  packLittleEndian(buf + 12, hdr.metric, 4);
+  packLittleEndian(buf + 16, hdr.numStates, 4);
+  packLittleEndian(buf + 20, hdr.group1size, 4);
+  packLittleEndian(buf + 24, hdr.group2size, 4);
+  packLittleEndian(buf + 28, hdr.hasCoordinates, 4);
+  packLittleEndian(buf + 32, hdr.bytesPerValue, 4);
+  packLittleEndian(buf + 36, hdr.valuesPerRecord, 4);
+  packLittleEndian(buf + 40, hdr.Nsites, 8);
+  os.write(buf, g_binaryTallyHeaderSize);
+}
+
+// Returns true if the stream begins with the binary header, in which case hdr is filled in
+// and the stream is positioned at the first record.
+// Otherwise the stream is rewound to its beginning, so it can be read as text.
+inline bool readBinaryTallyHeader(std::istream& is, BinaryTallyHeader& hdr);
+inline bool readBinaryTallyHeader(std::istream& is, BinaryTallyHeader& hdr)
+{
+  char buf[g_binaryTallyHeaderSize];
+  if (!is.read(buf, g_binaryTallyHeaderSize) || memcmp(buf, g_binaryTallyMagic, sizeof(g_binaryTallyMagic)) != 0)
+    {
+      is.clear();
+      is.seekg(0, std::ios::beg);
+      return false;
+    }
+  hdr.formatVersion = static_cast<uint32_t>(unpackLittleEndian(buf + 8, 4));
+  hdr.metric = static_cast<uint32_t>(unpackLittleEndian(buf + 12, 4));
+  hdr.numStates = static_cast<uint32_t>(unpackLittleEndian(buf + 16, 4));
+  hdr.group1size = static_cast<uint32_t>(unpackLittleEndian(buf + 20, 4));
+  hdr.group2size = static_cast<uint32_t>(unpackLittleEndian(buf + 24, 4));
+  hdr.hasCoordinates = static_cast<uint32_t>(unpackLittleEndian(buf + 28, 4));
+  hdr.bytesPerValue = static_cast<uint32_t>(unpackLittleEndian(buf + 32, 4));
+  hdr.valuesPerRecord = static_cast<uint32_t>(unpackLittleEndian(buf + 36, 4));
+  hdr.Nsites = unpackLittleEndian(buf + 40, 8);
+  return true;
+}
+
+// Writes one record per site, either as a line of tab-delimited text
+// (the original format, and the default) or in the packed binary format described above.
+// Records can also be formatted into a buffer (e.g. by several threads, each with its own buffer)
+// and the buffers written out later, in order.
+class TallyRecordWriter {
+public:
+  TallyRecordWriter() : m_pOfs(NULL), m_binary(false), m_numRecords(0) {};
+  void attach(std::ostream& ofs, const bool& binary, const BinaryTallyHeader& hdr);
+  void writeRecord(const char *pBeg, const char *pEnd, const std::vector<unsigned int>& values);
+  void formatRecord(std::string& buf, const char *pBeg, const char *pEnd, const std::vector<unsigned int>& values) const;
+  void writeFormattedRecords(const std::string& buf, const uint64_t& numRecords);
+  void finish(void);
+private:
+  TallyRecordWriter(const TallyRecordWriter&); // we have no need for a copy constructor, so disable it
+  std::ostream *m_pOfs;
+  bool m_binary;
+  BinaryTallyHeader m_hdr;
+  uint64_t m_numRecords;
+  std::string m_recordBuf;
+};
+
+inline void TallyRecordWriter::attach(std::ostream& ofs, const bool& binary, const BinaryTallyHeader& hdr)
+{
+  m_pOfs = &ofs;
+  m_binary = binary;
+  m_hdr = hdr;
+  m_numRecords = 0;
+  if (m_binary)
+    writeBinaryTallyHeader(*m_pOfs, m_hdr);
+}
+
+// Appends the record to buf.
+// pBeg and pEnd are the site's coordinates as they appeared in the input;
+// they're ignored if the output contains no coordinates.
+inline void TallyRecordWriter::formatRecord(std::string& buf, const char *pBeg, const char *pEnd,
+					    const std::vector<unsigned int>& values) const
+{
+  if (!m_binary)
+    {
+      if (m_hdr.hasCoordinates)
+	{
+	  buf += pBeg;
+	  buf += '\t';
+	  buf += pEnd;
+	  for (unsigned int i = 0; i < values.size(); i++)
+	    {
+	      buf += '\t';
+	      appendDecimal(buf, values[i]);
+	    }
+	}
+      else
+	{
+	  for (unsigned int i = 0; i < values.size(); i++)
+	    {
+	      if (i != 0)
+		buf += '\t';
+	      appendDecimal(buf, values[i]);
+	    }
+	}
+      buf += '\n';
+      return;
+    }
+
+  char packed[8];
+  if (m_hdr.hasCoordinates)
+    {
+      packLittleEndian(packed, pBeg != NULL ? strtoul(pBeg, NULL, 10) : 0, 4);
+      packLittleEndian(packed + 4, pEnd != NULL ? strtoul(pEnd, NULL, 10) : 0, 4);
+      buf.append(packed, 8);
+    }
+  for (unsigned int i = 0; i < values.size(); i++)
+    {
+      packLittleEndian(packed, values[i], m_hdr.bytesPerValue);
+      buf.append(packed, m_hdr.bytesPerValue);
+    }
+}
+
+inline void TallyRecordWriter::writeRecord(const char *pBeg, const char *pEnd, const std::vector<unsigned int>& values)
+{
+  m_recordBuf.clear();
+  formatRecord(m_recordBuf, pBeg, pEnd, values);
+  writeFormattedRecords(m_recordBuf, 1);
+}
+
+// buf contains numRecords records, formatted by formatRecord().
+inline void TallyRecordWriter::writeFormattedRecords(const std::string& buf, const uint64_t& numRecords)
+{
+  m_pOfs->write(buf.data(), buf.size());
+  m_numRecords += numRecords;
+}
+
+// Records the number of sites in the binary header, if the output is seekable.
+inline void TallyRecordWriter::finish(void)
+{
+  if (!m_binary || NULL == m_pOfs)
+    return;
+  char buf[8];
+  std::streampos endOfData = m_pOfs->tellp();
+  packLittleEndian(buf, m_numRecords, 8);
+  if (m_pOfs->seekp(g_binaryTallyNsitesOffset, std::ios::beg))
+    {
+      m_pOfs->write(buf, 8);
+      m_pOfs->seekp(endOfData);
+    }
+  else
+    m_pOfs->clear();
+  m_pOfs->flush();
+}
+
+#endif // EPILOGOS_BINARY_TALLY_FORMAT_H
@@ -0,0 +1,417 @@
+#ifndef EPILOGOS_COMPRESSED_STREAMS_H
+#define EPILOGOS_COMPRESSED_STREAMS_H
+
+#include <iostream>
+#include <fstream>
+#include <streambuf>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <zlib.h>
+#include "orderedPipeline.h"
+#include "tabixIndex.h"
+
+// Transparent support for compressed input and output files.
+//
+// GzInputStream reads a file that is either uncompressed or gzip-compressed (including BGZF,
+// which is a series of concatenated gzip members); the format is detected from the file's contents.
+//
+// BgzfOutputStream writes an uncompressed file, unless the filename ends in ".gz",
+// in which case the output is compressed in the BGZF format used by bgzip and tabix
+// (independently compressed blocks of at most 64 KB, followed by an empty end-of-file block).
+// Uncompressed output is written via a large buffer; compressed output can be compressed by background threads
+// (see setCompressionThreads()), so the thread writing the stream only formats the text.
+// Compressed output can also be indexed as it's written (see indexWithTabix()), as "tabix -p bed" would index it.
+
+inline bool filenameEndsInGz(const char *pFilename);
+inline bool filenameEndsInGz(const char *pFilename)
+{
+  const size_t len = strlen(pFilename);
+  return len > 3 && 0 == strcmp(pFilename + len - 3, ".gz");
+}
+
+class GzStreambuf : public std::streambuf {
+public:
+  GzStreambuf() : m_gzf(NULL), m_buf(BUFSIZE) {};
+  ~GzStreambuf() { close(); }
+  bool open(const char *pFilename);
+  bool is_open(void) const { return m_gzf != NULL; }
+  void close(void);
+protected:
+  int_type underflow(void);
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which);
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which);
+private:
+  GzStreambuf(const GzStreambuf&); // we have no need for a copy constructor, so disable it
+  static const int BUFSIZE = 262144;
+  gzFile m_gzf;
+  std::vector<char> m_buf;
+};
+
+inline bool GzStreambuf::open(const char *pFilename)
+{
+  close();
+  if (NULL == (m_gzf = gzopen(pFilename, "rb")))
+    return false;
+  gzbuffer(m_gzf, BUFSIZE);
+  setg(&m_buf[0], &m_buf[0], &m_buf[0]);
+  return true;
+}
+
+inline void GzStreambuf::close(void)
+{
+  if (m_gzf != NULL)
+    {
+      gzclose(m_gzf);
+      m_gzf = NULL;
+    }
+}
+
+inline GzStreambuf::int_type GzStreambuf::underflow(void)
+{
+  if (gptr() < egptr())
+    return traits_type::to_int_type(*gptr());
+  if (NULL == m_gzf)
+    return traits_type::eof();
+  int numBytes = gzread(m_gzf, &m_buf[0], BUFSIZE);
+  if (numBytes <= 0)
+    return traits_type::eof();
+  setg(&m_buf[0], &m_buf[0], &m_buf[0] + numBytes);
+  return traits_type::to_int_type(*gptr());
+}
+
+// Only seeking to an absolute position is supported.  That's immediate in an uncompressed file;
+// in a compressed one, the data preceding the position (or, when seeking backwards, all of it) is decompressed and discarded.
+inline GzStreambuf::pos_type GzStreambuf::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which)
+{
+  if (NULL == m_gzf || off < 0 || dir != std::ios_base::beg || !(which & std::ios_base::in)
+      || (0 == off ? gzrewind(m_gzf) != 0 : gzseek(m_gzf, static_cast<z_off_t>(off), SEEK_SET) != static_cast<z_off_t>(off)))
+    return pos_type(off_type(-1));
+  setg(&m_buf[0], &m_buf[0], &m_buf[0]);
+  return pos_type(off);
+}
+
+inline GzStreambuf::pos_type GzStreambuf::seekpos(pos_type pos, std::ios_base::openmode which)
+{
+  return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+class GzInputStream : public std::istream {
+public:
+  GzInputStream() : std::istream(NULL) { init(&m_sbuf); }
+  explicit GzInputStream(const char *pFilename) : std::istream(NULL) { init(&m_sbuf); open(pFilename); }
+  void open(const char *pFilename)
+  {
+    if (m_sbuf.open(pFilename))
+      clear();
+    else
+      setstate(std::ios_base::failbit);
+  }
+  bool is_open(void) const { return m_sbuf.is_open(); }
+  void close(void) { m_sbuf.close(); }
+private:
+  GzInputStream(const GzInputStream&); // we have no need for a copy constructor, so disable it
+  GzStreambuf m_sbuf;
+};
+
+// With compression threads, each block of input fills one of the pipeline's slots,
+// which a worker thread compresses and the writer thread writes to the file, in order.
+class BgzfStreambuf : public std::streambuf, private OrderedPipeline {
+public:
+  BgzfStreambuf() : m_fp(NULL), m_ok(true), m_buf(MAX_BLOCK_INPUT), m_compressedBlock(MAX_BLOCK_SIZE), m_numCompressionThreads(0),
+    m_pIndexer(NULL), m_fileOffset(0) {};
+  ~BgzfStreambuf() { close(); }
+  // If called before open(), numThreads threads (if any) compress the blocks in the background.
+  // A failure to write the file is then reported by close(), rather than as soon as it happens.
+  void setCompressionThreads(const unsigned int& numThreads) { m_numCompressionThreads = numThreads; }
+  // If called before open(), each block is passed to pIndexer as it's written (by the thread writing the file).
+  void setIndexer(TabixIndexer *pIndexer) { m_pIndexer = pIndexer; }
+  bool open(const char *pFilename);
+  bool is_open(void) const { return m_fp != NULL; }
+  bool close(void);
+protected:
+  int_type overflow(int_type c);
+  std::streamsize xsputn(const char *s, std::streamsize n);
+  int sync(void);
+private:
+  BgzfStreambuf(const BgzfStreambuf&); // we have no need for a copy constructor, so disable it
+  struct Slot {
+    std::vector<char> input, block;
+    unsigned int inputLen, blockSize;
+    bool ok;
+  };
+  static bool compressBlock(const char *pData, const unsigned int& len, char *pBlock, unsigned int& blockSize);
+  bool writeBlock(const char *pData, const unsigned int& len);
+  void blockWritten(const char *pData, const unsigned int& len, const unsigned int& blockSize);
+  void submitBlock(void);
+  void processBatch(const unsigned int& workerNum, const unsigned int& slot);
+  void writeBatch(const unsigned int& slot);
+  static const unsigned int MAX_BLOCK_INPUT = 0xff00; // same as bgzip, so compressed blocks always fit in 64 KB
+  static const unsigned int MAX_BLOCK_SIZE = 0x10000;
+  static const unsigned int BLOCK_HEADER_LENGTH = 18, BLOCK_FOOTER_LENGTH = 8;
+  FILE *m_fp;
+  bool m_ok;
+  std::vector<char> m_buf, m_compressedBlock;
+  unsigned int m_numCompressionThreads;
+  std::vector<Slot> m_slots; // used only with compression threads
+  bool m_writerOk; // set only by the writer thread, and read only once it's finished
+  TabixIndexer *m_pIndexer;
+  uint64_t m_fileOffset; // of the next block written
+};
+
+inline bool BgzfStreambuf::open(const char *pFilename)
+{
+  close();
+  if (NULL == (m_fp = fopen(pFilename, "wb")))
+    return false;
+  m_ok = true;
+  m_fileOffset = 0;
+  if (0 == m_numCompressionThreads)
+    setp(&m_buf[0], &m_buf[0] + m_buf.size());
+  else
+    {
+      m_slots.resize(2*m_numCompressionThreads + 2);
+      for (unsigned int i = 0; i < m_slots.size(); i++)
+	{
+	  m_slots[i].input.resize(MAX_BLOCK_INPUT);
+	  m_slots[i].block.resize(MAX_BLOCK_SIZE);
+	}
+      m_writerOk = true;
+      startPipeline(m_numCompressionThreads, static_cast<unsigned int>(m_slots.size()));
+      setp(&m_slots[currentSlot()].input[0], &m_slots[currentSlot()].input[0] + MAX_BLOCK_INPUT);
+    }
+  return true;
+}
+
+// Compresses len bytes (at most MAX_BLOCK_INPUT of them) into a single BGZF block of blockSize bytes at pBlock,
+// which must have room for MAX_BLOCK_SIZE bytes.
+inline bool BgzfStreambuf::compressBlock(const char *pData, const unsigned int& len, char *pBlock, unsigned int& blockSize)
+{
+  static const unsigned char header[BLOCK_HEADER_LENGTH] =
+    {31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0, 0, 0};
+  z_stream zs;
+
+  memset(&zs, 0, sizeof(zs));
+  if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    return false;
+  zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(pData));
+  zs.avail_in = len;
+  zs.next_out = reinterpret_cast<Bytef*>(pBlock + BLOCK_HEADER_LENGTH);
+  zs.avail_out = MAX_BLOCK_SIZE - BLOCK_HEADER_LENGTH - BLOCK_FOOTER_LENGTH;
+  const int status = deflate(&zs, Z_FINISH);
+  const unsigned int compressedLen = static_cast<unsigned int>(zs.total_out);
+  deflateEnd(&zs);
+  if (status != Z_STREAM_END)
+    return false;
+
+  blockSize = BLOCK_HEADER_LENGTH + compressedLen + BLOCK_FOOTER_LENGTH;
+  const uint32_t crc = crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef*>(pData), len);
+  memcpy(pBlock, header, BLOCK_HEADER_LENGTH);
+  pBlock[16] = static_cast<char>((blockSize - 1) & 0xFF);
+  pBlock[17] = static_cast<char>(((blockSize - 1) >> 8) & 0xFF);
+  char *pFooter = pBlock + BLOCK_HEADER_LENGTH + compressedLen;
+  for (int i = 0; i < 4; i++)
+    {
+      pFooter[i] = static_cast<char>((crc >> (8*i)) & 0xFF);
+      pFooter[4 + i] = static_cast<char>((len >> (8*i)) & 0xFF);
+    }
+  return true;
+}
+
+// Compresses len bytes (at most MAX_BLOCK_INPUT of them) into a single BGZF block and writes it.
+inline bool BgzfStreambuf::writeBlock(const char *pData, const unsigned int& len)
+{
+  unsigned int blockSize;
+  if (!compressBlock(pData, len, &m_compressedBlock[0], blockSize)
+      || fwrite(&m_compressedBlock[0], 1, blockSize, m_fp) != blockSize)
+    return false;
+  blockWritten(pData, len, blockSize);
+  return true;
+}
+
+// Called (in order) for each block written.
+inline void BgzfStreambuf::blockWritten(const char *pData, const unsigned int& len, const unsigned int& blockSize)
+{
+  if (m_pIndexer != NULL)
+    m_pIndexer->addBlock(pData, len, m_fileOffset, blockSize);
+  m_fileOffset += blockSize;
+}
+
+// Hands the buffered input to the compression threads, and continues in the next free slot.
+inline void BgzfStreambuf::submitBlock(void)
+{
+  m_slots[currentSlot()].inputLen = static_cast<unsigned int>(pptr() - pbase());
+  const unsigned int slot = submitBatch();
+  setp(&m_slots[slot].input[0], &m_slots[slot].input[0] + MAX_BLOCK_INPUT);
+}
+
+inline void BgzfStreambuf::processBatch(const unsigned int& workerNum, const unsigned int& slot)
+{
+  Slot& s = m_slots[slot];
+  s.ok = compressBlock(&s.input[0], s.inputLen, &s.block[0], s.blockSize);
+}
+
+inline void BgzfStreambuf::writeBatch(const unsigned int& slot)
+{
+  const Slot& s = m_slots[slot];
+  if (m_writerOk)
+    m_writerOk = s.ok && fwrite(&s.block[0], 1, s.blockSize, m_fp) == s.blockSize;
+  if (m_writerOk)
+    blockWritten(&s.input[0], s.inputLen, s.blockSize);
+}
+
+inline BgzfStreambuf::int_type BgzfStreambuf::overflow(int_type c)
+{
+  if (NULL == m_fp || !m_ok)
+    return traits_type::eof();
+  if (pipelineStarted())
+    submitBlock();
+  else if (pptr() > pbase())
+    {
+      if (!(m_ok = writeBlock(pbase(), static_cast<unsigned int>(pptr() - pbase()))))
+	return traits_type::eof();
+      setp(&m_buf[0], &m_buf[0] + m_buf.size());
+    }
+  if (!traits_type::eq_int_type(c, traits_type::eof()))
+    {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+  return traits_type::not_eof(c);
+}
+
+inline std::streamsize BgzfStreambuf::xsputn(const char *s, std::streamsize n)
+{
+  std::streamsize numWritten(0);
+  while (numWritten < n)
+    {
+      std::streamsize room = epptr() - pptr();
+      if (0 == room)
+	{
+	  if (traits_type::eq_int_type(overflow(traits_type::eof()), traits_type::eof()))
+	    break;
+	  room = epptr() - pptr();
+	}
+      const std::streamsize numToCopy = (n - numWritten < room ? n - numWritten : room);
+      memcpy(pptr(), s + numWritten, numToCopy);
+      pbump(static_cast<int>(numToCopy));
+      numWritten += numToCopy;
+    }
+  return numWritten;
+}
+
+// Flushing the stream (e.g. via endl) does not end the current block;
+// otherwise every line would become a separately compressed block.
+inline int BgzfStreambuf::sync(void)
+{
+  return m_ok ? 0 : -1;
+}
+
+// Writes any buffered data, followed by the empty block that marks the end of a BGZF file.
+inline bool BgzfStreambuf::close(void)
+{
+  static const unsigned char eofBlock[28] =
+    {31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0, 27, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+  if (NULL == m_fp)
+    return true;
+  if (pipelineStarted())
+    {
+      if (pptr() > pbase())
+	submitBlock();
+      finishPipeline();
+      m_ok = m_ok && m_writerOk;
+      m_slots.clear();
+    }
+  else if (m_ok && pptr() > pbase())
+    m_ok = writeBlock(pbase(), static_cast<unsigned int>(pptr() - pbase()));
+  if (m_ok)
+    m_ok = (fwrite(eofBlock, 1, sizeof(eofBlock), m_fp) == sizeof(eofBlock));
+  if (fclose(m_fp) != 0)
+    m_ok = false;
+  m_fp = NULL;
+  setp(NULL, NULL);
+  return m_ok;
+}
+
+class BgzfOutputStream : public std::ostream {
+public:
+  BgzfOutputStream() : std::ostream(NULL), m_compressed(false), m_indexWithTabix(false) {};
+  explicit BgzfOutputStream(const char *pFilename) : std::ostream(NULL), m_compressed(false), m_indexWithTabix(false) { open(pFilename); }
+  ~BgzfOutputStream() { close(); }
+  void open(const char *pFilename)
+  {
+    m_compressed = filenameEndsInGz(pFilename);
+    if (m_compressed)
+      {
+	rdbuf(&m_bgzfBuf);
+	if (m_indexWithTabix)
+	  {
+	    m_indexer.clear();
+	    m_indexFilename = std::string(pFilename) + ".tbi";
+	    m_bgzfBuf.setIndexer(&m_indexer);
+	  }
+	if (m_bgzfBuf.open(pFilename))
+	  clear();
+	else
+	  setstate(std::ios_base::failbit);
+      }
+    else
+      {
+	rdbuf(&m_fileBuf);
+	m_fileBufStorage.resize(FILE_BUFFER_SIZE);
+	m_fileBuf.pubsetbuf(&m_fileBufStorage[0], FILE_BUFFER_SIZE); // must precede open()
+	if (m_fileBuf.open(pFilename, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary))
+	  clear();
+	else
+	  setstate(std::ios_base::failbit);
+      }
+  }
+  // See BgzfStreambuf::setCompressionThreads(); this has no effect on uncompressed output.
+  void setCompressionThreads(const unsigned int& numThreads) { m_bgzfBuf.setCompressionThreads(numThreads); }
+  // If called before open(), compressed output is indexed as it's written (see tabixIndex.h),
+  // and close() writes the index to the file named by appending ".tbi" to the filename; this has no effect on uncompressed output.
+  void indexWithTabix(void) { m_indexWithTabix = true; }
+  bool is_open(void) const { return m_compressed ? m_bgzfBuf.is_open() : m_fileBuf.is_open(); }
+  void close(void)
+  {
+    if (m_compressed ? !m_bgzfBuf.close() : (m_fileBuf.is_open() && NULL == m_fileBuf.close()))
+      setstate(std::ios_base::failbit);
+    if (!m_indexFilename.empty())
+      {
+	if (!writeIndex())
+	  setstate(std::ios_base::failbit);
+	m_indexFilename.clear();
+      }
+  }
+private:
+  BgzfOutputStream(const BgzfOutputStream&); // we have no need for a copy constructor, so disable it
+  bool writeIndex(void);
+  static const unsigned int FILE_BUFFER_SIZE = 1048576;
+  bool m_compressed;
+  bool m_indexWithTabix;
+  TabixIndexer m_indexer;
+  std::string m_indexFilename; // nonempty while there's an index to write
+  std::vector<char> m_fileBufStorage; // allocated only for uncompressed output
+  std::filebuf m_fileBuf;
+  BgzfStreambuf m_bgzfBuf;
+};
+
+// The index is BGZF-compressed too, as tabix writes it.
+inline bool BgzfOutputStream::writeIndex(void)
+{
+  if (fail() || !m_indexer.ok())
+    return false;
+  BgzfStreambuf buf;
+  std::ostream os(&buf);
+  if (!buf.open(m_indexFilename.c_str()))
+    {
+      std::cerr << "Error:  Unable to open file \"" << m_indexFilename << "\" for writing." << std::endl << std::endl;
+      return false;
+    }
+  const bool OK = m_indexer.write(os);
+  return buf.close() && OK;
+}
+
+#endif // EPILOGOS_COMPRESSED_STREAMS_H
@@ -7,582 +7,905 @@
 #include <utility> // for pair
 #include <cstdlib>
 #include <cstring>
+#include <cctype>
+#include <climits>
 #include <string>
+#include <sstream>
+#include <pthread.h>
+#include <stdint.h>
+#include "binaryTallyFormat.h"
+#include "compressedStreams.h"
+#include "orderedPipeline.h"
+#include "packedStateMatrix.h"
+#include "runStats.h"
+#include "siteRange.h"
+#include "siteTallies.h"
+#include "statePermuter.h"
+#include "stateFileReader.h"
+#include "tallyStore.h"
 
 using namespace std;
 
-enum measurementType {KL = 1, KLs, KLss}; // corresponding to measurements using KL, KL*, or KL**
+// One measurement of a single group of epigenomes, or one comparison between two groups, computed by onePassThroughData(),
+// as specified on the command line or by one line of a file of comparisons (see openComparison()).
+struct GroupComparison {
+  GroupComparison() : memberStates(false) {};
+  set<int> group1, group2; // 1-based epigenomes of the input; group2 is empty if there's only one group
+  set<int> selectedGroup1, selectedGroup2; // the same groups, as epigenomes of the states read from the input (see selectGroupColumns())
+  BgzfOutputStream outfileP, outfileRand;
+  ofstream outfileQ, outfileQ2, outfileNsites;
+  TallyRecordWriter PWriter, randWriter;
+  SiteTallier tallier;
+  bool memberStates; // for S3, whether the states of the groups' epigenomes are written instead of state pair IDs
+private:
+  GroupComparison(const GroupComparison&); // we have no need for a copy constructor, so disable it
+};
 
-bool parseOneSetOfColumnSpecs(char* pString, set<int>& colsOut);
-bool parseOneSetOfColumnSpecs(char* pString, set<int>& colsOut)
+// Tallies sites in parallel.  The states observed at successive sites are collected into batches;
+// each batch is tallied by one of numThreads worker threads, each of which has its own SiteTallier for every comparison,
+// and a writer thread writes each batch's records via each comparison's PWriter and randWriter, in input order (see orderedPipeline.h).
+// Because the random permutation of each site's states depends only on the seed, the chromosome, and the site's line number
+// (see statePermuter.h), the output is identical to that of a single thread.
+// If reuseIdenticalSites is true, each worker tallies a run of sites with identical states once (see onePassThroughData()).
+// finish() must be called once all sites have been added; it adds the workers' tallies for Q, Q*, or Q** to those of each comparison.
+class ParallelTallier : private OrderedPipeline {
+public:
+  ParallelTallier(const measurementType& KLtype, const vector<GroupComparison*>& comparisons, const int& numStates,
+		  const unsigned int& numThreads, const bool& reuseIdenticalSites);
+  ~ParallelTallier();
+  // firstSiteNum is the line number of the first site to be added (see StateFileReader::restrictToRange()).
+  void setPermuter(const StatePermuter& permuter, const uint64_t& firstSiteNum);
+  void addSite(const vector<int>& allStatesAtThisSite, const char *pBeg, const char *pEnd);
+  void finish(void);
+private:
+  ParallelTallier(const ParallelTallier&); // we have no need for a copy constructor, so disable it
+  struct Batch {
+    uint64_t firstSiteNum; // 1-based
+    unsigned int numSites;
+    vector<int> states; // the states observed in all epigenomes at every site in the batch, concatenated
+    string coords; // each site's beg and end coordinates, each followed by '\0'
+    vector<string> Precords, randRecords; // for each comparison, formatted for its PWriter and randWriter
+  };
+  static const unsigned int MAX_SITES_PER_BATCH = 4096;
+  void submitCurrentBatch(void);
+  void processBatch(const unsigned int& workerNum, const unsigned int& slot);
+  void writeBatch(const unsigned int& slot);
+  const vector<GroupComparison*>& m_comparisons;
+  StatePermuter m_permuter;
+  vector<Batch*> m_batches; // indexed by slot
+  vector<vector<SiteTallier*> > m_workers; // indexed by worker, then comparison
+  Batch *m_pCurBatch; // the batch being filled
+  uint64_t m_firstSiteNum, m_numSitesSubmitted;
+  bool m_reuseIdenticalSites;
+};
+
+ParallelTallier::ParallelTallier(const measurementType& KLtype, const vector<GroupComparison*>& comparisons, const int& numStates,
+				 const unsigned int& numThreads, const bool& reuseIdenticalSites)
+  : m_comparisons(comparisons), m_firstSiteNum(1), m_numSitesSubmitted(0), m_reuseIdenticalSites(reuseIdenticalSites)
 {
-  string origString(pString);
-  char *p1 = NULL, *p2 = pString;
-  int first(-1), last(-1); // first and last column numbers in a range, e.g. 1 and 10 in the range 1-10
-  while (true)
+  // Two batches per worker keep every worker busy while the writer catches up.
+  m_batches.resize(2*numThreads + 1);
+  for (unsigned int i = 0; i < m_batches.size(); i++)
     {
-      if (',' == *p2 || '\0' == *p2)
-	{
-	  if (p1 != NULL)
-	    {
-	      if (',' == *p2)
-		*p2++ = '\0';
-	      last = atoi(p1);
-	      if (first < 0)
-		first = last;
-	      for (int i = first; i <= last; i++)
-		{
-		  set<int>::iterator it = colsOut.find(i);
-		  if (it != colsOut.end())
-		    {
-		      cerr << "Warning:  Value " << i << " specified multiple times in \""
-			   << origString << "\"" << endl;
-		      continue;
-		    }
-		  colsOut.insert(i);
-		}
-	      if ('\0' == *p2)
-		break;
-	    }
-	  else
-	    cerr << "Warning:  Range string \"" << origString << "\" begins with \',\'; anything intended to precede it "
-		 << "will necessarily be excluded." << endl << endl;
-	  p1 = p2;
-	  first = last = -1;
-	  continue;
-	}
+      m_batches[i] = new Batch;
+      m_batches[i]->numSites = 0;
+      m_batches[i]->Precords.resize(m_comparisons.size());
+      m_batches[i]->randRecords.resize(m_comparisons.size());
+    }
+  m_workers.resize(numThreads);
+  for (unsigned int i = 0; i < numThreads; i++)
+    for (unsigned int c = 0; c < m_comparisons.size(); c++)
+      {
+	m_workers[i].push_back(new SiteTallier);
+	m_workers[i].back()->init(KLtype, m_comparisons[c]->selectedGroup1, m_comparisons[c]->selectedGroup2, numStates);
+	if (m_comparisons[c]->memberStates)
+	  m_workers[i].back()->recordMemberStates();
+      }
+  startPipeline(numThreads, m_batches.size());
+  m_pCurBatch = m_batches[currentSlot()];
+  m_pCurBatch->firstSiteNum = 1;
+}
+
+ParallelTallier::~ParallelTallier()
+{
+  finishPipeline();
+  for (unsigned int i = 0; i < m_workers.size(); i++)
+    for (unsigned int c = 0; c < m_workers[i].size(); c++)
+      delete m_workers[i][c];
+  for (unsigned int i = 0; i < m_batches.size(); i++)
+    delete m_batches[i];
+}
+
+void ParallelTallier::setPermuter(const StatePermuter& permuter, const uint64_t& firstSiteNum)
+{
+  m_permuter = permuter;
+  m_firstSiteNum = firstSiteNum;
+  m_pCurBatch->firstSiteNum = m_firstSiteNum + m_numSitesSubmitted;
+}
+
+// The permuter must be set before the first site is added.
+void ParallelTallier::addSite(const vector<int>& allStatesAtThisSite, const char *pBeg, const char *pEnd)
+{
+  m_pCurBatch->states.insert(m_pCurBatch->states.end(), allStatesAtThisSite.begin(), allStatesAtThisSite.end());
+  m_pCurBatch->coords += pBeg;
+  m_pCurBatch->coords += '\0';
+  m_pCurBatch->coords += pEnd;
+  m_pCurBatch->coords += '\0';
+  if (++m_pCurBatch->numSites >= MAX_SITES_PER_BATCH)
+    submitCurrentBatch();
+}
+
+void ParallelTallier::submitCurrentBatch(void)
+{
+  m_numSitesSubmitted += m_pCurBatch->numSites;
+  m_pCurBatch = m_batches[submitBatch()];
+  m_pCurBatch->firstSiteNum = m_firstSiteNum + m_numSitesSubmitted;
+}
+
+void ParallelTallier::processBatch(const unsigned int& workerNum, const unsigned int& slot)
+{
+  Batch& b = *m_batches[slot];
+  vector<int> allStatesAtThisSite;
+  vector<vector<unsigned int> > Prows(m_comparisons.size());
+  vector<unsigned int> randRow;
+  const size_t numCols = b.states.size() / b.numSites;
+  const char *pCoords = b.coords.c_str();
+  unsigned long numRepeats(0);
+
+  for (unsigned int site = 0; site < b.numSites; site++)
+    {
+      const char *pBeg = pCoords, *pEnd = pBeg + strlen(pBeg) + 1;
+      pCoords = pEnd + strlen(pEnd) + 1;
+      const bool repeat = m_reuseIdenticalSites && site != 0
+	&& equal(b.states.begin() + site*numCols, b.states.begin() + (site + 1)*numCols, allStatesAtThisSite.begin());
+      if (repeat)
+	numRepeats++;
       else
+	allStatesAtThisSite.assign(b.states.begin() + site*numCols, b.states.begin() + (site + 1)*numCols);
+      for (unsigned int c = 0; c < m_comparisons.size(); c++)
 	{
-	  if ('-' == *p2)
+	  SiteTallier& tallier = *m_workers[workerNum][c];
+	  vector<unsigned int>& Prow = Prows[c];
+	  if (!repeat)
 	    {
-	      if (p1 != NULL)
-		{
-		  *p2++ = '\0';
-		  first = atoi(p1);
-		  p1 = p2;
-		  if ('\0' == *p1)
-		    {
-		      cerr << "Error:  Range \"" << origString << "\" ends with \'-\'. The final value in the range must be explicitly specified."
-			   << endl << endl;
-		      return false;
-		    }
-		  continue;
-		}
-	      else
-		{
-		  cerr << "Error:  Range \"" << origString << "\" begins with \'-\'. Must begin with a valid column number, 1 or greater."
-		       << endl << endl;
-		  return false;
-		}
+	      tallier.repeatSite(numRepeats);
+	      Prow.clear();
+	      tallier.processSite(allStatesAtThisSite, &Prow, true);
 	    }
-	  else
+	  m_comparisons[c]->PWriter.formatRecord(b.Precords[c], pBeg, pEnd, Prow);
+	  if (tallier.comparisonOfGroups())
 	    {
-	      if (!isdigit(*p2))
-		{
-		  cerr << "Error:  Invalid character \'" << *p2 << "\' in range \"" << origString << "\"."
-		       << endl << endl;
-		  return false;
-		}
-	      if (NULL == p1)
-		p1 = p2;
-	      p2++;
-	      continue;
+	      randRow.clear();
+	      tallier.processPermutedSite(allStatesAtThisSite, m_permuter, b.firstSiteNum + site, 0, randRow);
+	      m_comparisons[c]->randWriter.formatRecord(b.randRecords[c], pBeg, pEnd, randRow); // randWriter ignores them;
 	    }
 	}
+      if (!repeat)
+	numRepeats = 0;
     }
-  return true;
+  for (unsigned int c = 0; c < m_comparisons.size(); c++)
+    m_workers[workerNum][c]->repeatSite(numRepeats);
+}
+
+void ParallelTallier::writeBatch(const unsigned int& slot)
+{
+  Batch& b = *m_batches[slot];
+  for (unsigned int c = 0; c < m_comparisons.size(); c++)
+    {
+      m_comparisons[c]->PWriter.writeFormattedRecords(b.Precords[c], b.numSites);
+      if (m_comparisons[c]->tallier.comparisonOfGroups())
+	m_comparisons[c]->randWriter.writeFormattedRecords(b.randRecords[c], b.numSites);
+      b.Precords[c].clear();
+      b.randRecords[c].clear();
+    }
+  b.numSites = 0;
+  b.states.clear();
+  b.coords.clear();
+}
+
+// Waits for all records to be written.
+void ParallelTallier::finish(void)
+{
+  if (m_pCurBatch->numSites != 0)
+    submitCurrentBatch();
+  finishPipeline();
+  for (unsigned int i = 0; i < m_workers.size(); i++)
+    for (unsigned int c = 0; c < m_comparisons.size(); c++)
+      m_comparisons[c]->tallier.addQ(*m_workers[i][c]);
 }
 
 // The format of the input file is chromosome, beg position, end position,
 // state of epigenome 1 at that site/region, state of epigenome 2 there, ....
-// group1 and group2 define the columns of input data that should be assigned to groups 1 and 2
+// For each comparison, group1 and group2 define the columns of input data that should be assigned to groups 1 and 2
 // (input column 4 = epigenome 1, column 5 = epigenome 2, etc., since columns 1-3 = chr:beg-end).
 // group1 and group2 are guaranteed to have no entries in common;
 // we only need to ensure there's actually a column for each entry.
 // group2 may be empty, in which case we're measuring the properties of a single group of epigenomes.
 // If group2 is not empty, then we're comparing the properties of two groups of epigenomes,
 // and at each site, we shuffle the states observed in the union of epigenomes from the two groups
-// and write additional results to ofsRand, to be used later to estimate P-values for the observations.
+// and write additional results to randWriter, to be used later to estimate P-values for the observations.
+// The shuffle is determined by seed, the chromosome, and the site's line number (see statePermuter.h).
+// The per-site results are written via PWriter and randWriter, as tab-delimited text or in packed binary format.
+// If numThreads > 1, the sites are tallied in parallel (see ParallelTallier); the results are the same.
 // If group2 is not empty, tallies contributing to Q1, Q1*, or Q1** (measurement types KL, KLs, KLss
-// respectively) are written to output file ofsQ and tallies contributing to Q2, Q2*, or Q2**
-// (tallies for group 2) are written to output file ofsQ2.
-// If group2 is empty, then tallies contributing to Q, Q*, or Q** are written to ofsQ
-// and nothing is written to ofsQ2 (which is not an open ofstream in this case).
-// The total number of sites (i.e., the number of lines in input file ifs) is written to ofsNsites.
-
-bool onePassThroughData(ifstream& ifs, const measurementType& KLtype, const set<int>& group1, const set<int>& group2,
-			const int& numStates, ofstream& ofsP, ofstream& ofsQ,
-			ofstream& ofsQ2, ofstream& ofsRand, ofstream& ofsNsites);
-bool onePassThroughData(ifstream& ifs, const measurementType& KLtype, const set<int>& group1, const set<int>& group2,
-			const int& numStates, ofstream& ofsP, ofstream& ofsQ,
-			ofstream& ofsQ2, ofstream& ofsRand, ofstream& ofsNsites)
+// respectively) are written to output file outfileQ and tallies contributing to Q2, Q2*, or Q2**
+// (tallies for group 2) are written to output file outfileQ2.
+// If group2 is empty, then tallies contributing to Q, Q*, or Q** are written to outfileQ
+// and nothing is written to outfileQ2 (which is not an open ofstream in this case).
+// The total number of sites (i.e., the number of lines in the input file, or of the sites in the range to which
+// reader is restricted) is written to outfileNsites.
+// Every comparison is computed from the same pass through the input, exactly as if it were the only one.
+// The input is read via reader, which has been opened but not yet read from.
+// Only the states in the columns of the groups are read; those in the other columns are checked only if checkAllColumns is true.
+// If reuseIdenticalSites is true, a site whose states (in the groups' columns) are identical to those of the previous site
+// isn't tallied again:  its values are those of the previous site, and the tallies of a run of identical sites are added
+// to Q, Q*, or Q** at once (see SiteTallier::repeatSite()).  Each site is still permuted on its own, and the output is unchanged.
+
+bool onePassThroughData(StateFileReader& reader, const measurementType& KLtype, const vector<GroupComparison*>& comparisons,
+			const int& numStates, const uint64_t& seed, const unsigned int& numThreads, const bool& checkAllColumns,
+			const bool& reuseIdenticalSites);
+bool onePassThroughData(StateFileReader& reader, const measurementType& KLtype, const vector<GroupComparison*>& comparisons,
+			const int& numStates, const uint64_t& seed, const unsigned int& numThreads, const bool& checkAllColumns,
+			const bool& reuseIdenticalSites)
 {
-  const int BUFSIZE(10000);
-  char buf[BUFSIZE], *p;
-  const bool comparisonOfGroups(group2.empty() ? false : true);
-  const int numStatePairs(numStates * numStates), numUniqueStatePairs(numStates*(numStates+1)/2);
-  int numEpiPairs1, numEpiPairs2;
-  vector<int> allStatesAtThisSite, shuffledStatesInThe2groupsAtThisSite;
-  vector<int> P1, P2, Ps1, Ps2, randP1, randP2, randPs1, randPs2;
-  vector<unsigned long>  Q1, Q2, Qs1, Qs2, zeroes;
-  vector<vector<unsigned long> > Qss1, Qss2;
-  unsigned int linenum(0), fieldnum, numFieldsOnLineOne, k(0);
-
-  // Set up the variables which will hold the parsed state data.
-  
-  if (KLtype != KL)
+  StatePermuter permuter;
+  ParallelTallier *pParallelTallier(NULL);
+  set<int> allGroupCols;
+  vector<int> groupCols, statesAtThisSite, statesAtPrevSite; // the states in groupCols only
+  vector<vector<unsigned int> > Prows(comparisons.size()); // the values to be written for each site, for each comparison
+  vector<unsigned int> randRow;
+  unsigned long numRepeats(0); // of the most recently tallied site
+
+  for (unsigned int c = 0; c < comparisons.size(); c++)
     {
-      if (KLss == KLtype)
-	{
-	  // We track specific state pairs in specific epigenome pairs.
-	  numEpiPairs1 = (group1.size() * (group1.size()-1)) / 2;
-	  zeroes.assign(numStatePairs, 0);
-	  for (int i = 0; i < numEpiPairs1; i++)
-	    Qss1.push_back(zeroes);
-	}
-      else
-	{
-	  // We tally observances of state pairs across epigenome pairs.
-	  // For numStates states, there are numStates*numStates ordered state pairs,
-	  // and (numStates*numStates - numStates)/2 + numStates = numStates*(numStates+1)/2
-	  // unique (unordered) state pairs.
-	  Ps1.assign(numUniqueStatePairs, 0);
-	  Qs1.assign(numUniqueStatePairs, 0);
-	}
+      allGroupCols.insert(comparisons[c]->group1.begin(), comparisons[c]->group1.end());
+      allGroupCols.insert(comparisons[c]->group2.begin(), comparisons[c]->group2.end());
     }
-  else
+  for (set<int>::const_iterator it = allGroupCols.begin(); it != allGroupCols.end(); it++)
+    groupCols.push_back(*it - 1);
+  for (unsigned int c = 0; c < comparisons.size(); c++)
     {
-      // We tally observances of states.
-      P1.assign(numStates, 0);
-      Q1.assign(numStates, 0);
+      GroupComparison& comp = *comparisons[c];
+      selectGroupColumns(comp.group1, groupCols, comp.selectedGroup1);
+      selectGroupColumns(comp.group2, groupCols, comp.selectedGroup2);
+      comp.tallier.init(KLtype, comp.selectedGroup1, comp.selectedGroup2, numStates);
+      if (comp.memberStates)
+	comp.tallier.recordMemberStates();
     }
-  
-  if (comparisonOfGroups)
+  reader.selectColumns(groupCols, checkAllColumns);
+  if (numThreads > 1)
+    pParallelTallier = new ParallelTallier(KLtype, comparisons, numStates, numThreads, reuseIdenticalSites);
+
+  // One line at a time, read in the states observed in the epigenomes of interest,
+  // skipping (and possibly checking) those observed in all others.
+  // Then, for each comparison, select the states observed in its epigenomes,
+  // possibly in two groups of epigenomes that will be compared later.
+  // If there are two groups, shuffle the observations between them
+  // and write those random observations via randWriter.
+
+  while (reader.readSite(statesAtThisSite))
     {
-      shuffledStatesInThe2groupsAtThisSite.assign(group1.size() + group2.size(), 0);
-      if (KLtype != KL)
+      if (1 == reader.numSitesRead())
+	{
+	  for (unsigned int c = 0; c < comparisons.size(); c++)
+	    if (!groupsFitInput(comparisons[c]->group1, comparisons[c]->group2, reader.numEpigenomes()))
+	      {
+		delete pParallelTallier;
+		return false;
+	      }
+	  permuter.init(seed, reader.chrom());
+	  if (pParallelTallier != NULL)
+	    pParallelTallier->setPermuter(permuter, reader.linenum());
+	}
+      if (pParallelTallier != NULL)
+	{
+	  pParallelTallier->addSite(statesAtThisSite, reader.beg(), reader.end());
+	  continue;
+	}
+      const bool repeat = reuseIdenticalSites && reader.numSitesRead() > 1 && statesAtThisSite == statesAtPrevSite;
+      if (repeat)
+	numRepeats++;
+      else if (reuseIdenticalSites)
+	statesAtPrevSite = statesAtThisSite;
+      for (unsigned int c = 0; c < comparisons.size(); c++)
 	{
-	  if (KLss == KLtype)
+	  GroupComparison& comp = *comparisons[c];
+	  vector<unsigned int>& Prow = Prows[c];
+	  if (!repeat)
 	    {
-	      numEpiPairs2 = (group2.size() * (group2.size()-1)) / 2;
-	      for (int i = 0; i < numEpiPairs2; i++)
-		Qss2.push_back(zeroes);
+	      comp.tallier.repeatSite(numRepeats);
+	      Prow.clear();
+	      comp.tallier.processSite(statesAtThisSite, &Prow, true);
 	    }
-	  else
+	  comp.PWriter.writeRecord(reader.beg(), reader.end(), Prow);
+	  if (comp.tallier.comparisonOfGroups())
 	    {
-	      Ps2.assign(numUniqueStatePairs, 0);
-	      Qs2.assign(numUniqueStatePairs, 0);
-	      randPs1.assign(numUniqueStatePairs, 0);
-	      randPs2.assign(numUniqueStatePairs, 0);
+	      randRow.clear();
+	      comp.tallier.processPermutedSite(statesAtThisSite, permuter, reader.linenum(), 0, randRow);
+	      comp.randWriter.writeRecord(NULL, NULL, randRow);
 	    }
 	}
-      else
-	{
-	  P2.assign(numStates, 0);
-	  Q2.assign(numStates, 0);
-	  randP1.assign(numStates, 0);
-	  randP2.assign(numStates, 0);
-	}
+      if (!repeat)
+	numRepeats = 0;
+    } // end of loop for reading and processing all input data
+  for (unsigned int c = 0; c < comparisons.size(); c++)
+    comparisons[c]->tallier.repeatSite(numRepeats);
+  if (pParallelTallier != NULL)
+    {
+      pParallelTallier->finish();
+      delete pParallelTallier;
     }
+  if (reader.failed())
+    return false;
 
-  // One line at a time, read in the states observed in all epignomes,
-  // including all epigenomes _not_ being analyzed.
-  // Then select the states observed in the epigenomes of interest,
-  // possibly in two groups of epigenomes that will be compared later.
-  // If there are two groups, shuffle the observations between them
-  // and write those random observations to ofsRand.
+  for (unsigned int c = 0; c < comparisons.size(); c++)
+    {
+      GroupComparison& comp = *comparisons[c];
+      comp.PWriter.finish();
+      if (comp.tallier.comparisonOfGroups())
+	comp.randWriter.finish();
+
+      // Write out the tallies over sites, for eventual use in Q, Q*, or Q**.
+      comp.tallier.writeQ(comp.outfileQ, comp.outfileQ2);
+
+      comp.outfileNsites << reader.numSitesRead() << endl;
+    }
   
-  while (ifs.getline(buf,BUFSIZE))
+  return true;
+}
+
+// Genome-wide sums of the per-chromosome tallies written by onePassThroughData()
+// (the tallies contributing to Q, Q*, or Q**, or the numbers of sites), accumulated as 64-bit integers.
+// Every file must have the same number of rows as the first, and every row the same number of tab-delimited columns.
+// The files are divided among numThreads threads, each of which sums its share of them into its own matrix;
+// those matrices are then added together.
+struct TallySummationJob {
+  const vector<const char*> *pFilenames;
+  unsigned int firstFileIdx, fileIdxIncrement;
+  unsigned int numRows, numCols; // of the first file
+  vector<uint64_t> sums; // numRows*numCols, row by row; empty until the thread's first file is read
+  bool OK;
+};
+
+// Adds the tallies in the file to sums.  If sums is empty, the file determines the dimensions of the matrix.
+bool addTalliesFromFile(const char *pFilename, unsigned int& numRows, unsigned int& numCols, vector<uint64_t>& sums);
+bool addTalliesFromFile(const char *pFilename, unsigned int& numRows, unsigned int& numCols, vector<uint64_t>& sums)
+{
+  GzInputStream ifs(pFilename);
+  string line;
+  vector<uint64_t> rowVals;
+  const bool firstFile(sums.empty());
+  unsigned int row(0);
+
+  if (!ifs)
     {
-      linenum++;
-      fieldnum = 1;
-      p = strtok(buf, "\t");
-      // field 1:  chromosome, ignore
-      fieldnum++;
-      if (!(p = strtok(NULL, "\t")))
+      cerr << "Error:  Unable to open file \"" << pFilename << "\" for read." << endl << endl;
+      return false;
+    }
+  while (getline(ifs, line))
+    {
+      const char *p = line.c_str();
+      char *pEnd;
+      rowVals.clear();
+      for (;;)
 	{
-	MissingField:
-	  cerr << "Error:  Failed to find field " << fieldnum
-	       << " on line " << linenum << " of the input file."
-	       << endl << endl;
-	  return false;
+	  const unsigned long val = strtoul(p, &pEnd, 10);
+	  if (pEnd == p)
+	    break;
+	  rowVals.push_back(val);
+	  p = pEnd;
 	}
-      // field 2:  begin site
-      ofsP << p;
-      fieldnum++;
-      if (!(p = strtok(NULL, "\t")))
-	goto MissingField;
-      // field 3:  end site
-      ofsP << '\t' << p;
-
-      if (1 == linenum)
+      while (isspace(static_cast<unsigned char>(*p)))
+	p++;
+      if (firstFile && 0 == row)
+	numCols = static_cast<unsigned int>(rowVals.size());
+      if (*p != '\0' || rowVals.empty() || rowVals.size() != numCols || (!firstFile && row >= numRows))
 	{
-	  while ((p = strtok(NULL, "\t")))
-	    {
-	      const int thisState(atoi(p));
-	      if (thisState > numStates || thisState < 1)
-		{
-		  cerr << "Error:  Illegal state (" << thisState
-		       << ") detected in field " << ++fieldnum << " on line "
-		       << linenum << ".  Re-specify the correct number of possible states,\n"
-		       << "and/or ensure each state label is a positive (nonzero) integer."
-		       << endl << endl;
-		  return false;
-		}
-	      allStatesAtThisSite.push_back(thisState);
-	      fieldnum++;
-	    }
-	  numFieldsOnLineOne = fieldnum;
-	  set<int>::const_iterator it_group1(group1.end()), it_group2(group2.end());
-	  it_group1--;
-	  const int totalNumEpigenomes(static_cast<int>(allStatesAtThisSite.size()));
-	  if (*it_group1 > totalNumEpigenomes)
-	    {
-	      cerr << "Error:  Specification for group 1 calls for data for " << *it_group1
-		   << " epigenomes to be provided, but data for only "
-		   << totalNumEpigenomes << " were found." << endl << endl;
-	      return false;
-	    }
-	  if (comparisonOfGroups)
-	    {
-	      it_group2--;
-	      if (*it_group2 > totalNumEpigenomes)
-		{
-		  cerr << "Error:  Specification for group 2 calls for data for " << *it_group2
-		       << " epigenomes to be provided, but data for only "
-		       << totalNumEpigenomes << " were found." << endl << endl;
-		  return false;
-		}
-	    }      
+	  cerr << "Error:  Line " << row + 1 << " of file \"" << pFilename << "\" is not a row of "
+	       << numCols << " tab-delimited tallies, as expected." << endl << endl;
+	  return false;
 	}
+      if (firstFile)
+	sums.insert(sums.end(), rowVals.begin(), rowVals.end());
       else
-	{
-	  while ((p = strtok(NULL, "\t")))
-	    {
-	      const int thisState(atoi(p));
-	      if (thisState > numStates || thisState < 1)
-		{
-		  cerr << "Error:  Illegal state (" << thisState
-		       << ") detected in field " << ++fieldnum << " on line "
-		       << linenum << ".  Re-specify the correct number of possible states,\n"
-		       << "and/or ensure each state label is a positive (nonzero) integer."
-		       << endl << endl;
-		  return false;
-		}
-	      if (fieldnum - 3 < allStatesAtThisSite.size())
-		allStatesAtThisSite[fieldnum - 3] = thisState;
-	      else
-		{
-		  cerr << "Error:  Expected to find " << numFieldsOnLineOne
-		       << " fields of data on line " << linenum
-		       << ", to match the # found on line 1; found at least "
-		       << ++fieldnum << " instead." << endl << endl;
-		  return false;
-		}
-	      fieldnum++;
-	    }
-	  if (fieldnum != numFieldsOnLineOne)
-	    {
-	      cerr << "Error:  Expected to find " << numFieldsOnLineOne
-		   << " fields of data on line " << linenum
-		   << ", to match the # found on line 1; but only found "
-		   << fieldnum << "." << endl << endl;
-	      return false;
-	    }
-	}
+	for (unsigned int col = 0; col < numCols; col++)
+	  sums[row*numCols + col] += rowVals[col];
+      row++;
+    }
+  if (firstFile)
+    numRows = row;
+  if (0 == row || row != numRows)
+    {
+      cerr << "Error:  File \"" << pFilename << "\" has " << row << " rows, but " << numRows << " were expected." << endl << endl;
+      return false;
+    }
+  return true;
+}
+
+void* tallySummationThread(void *pArgs);
+void* tallySummationThread(void *pArgs)
+{
+  TallySummationJob& job = *static_cast<TallySummationJob*>(pArgs);
+  for (unsigned int i = job.firstFileIdx; i < job.pFilenames->size() && job.OK; i += job.fileIdxIncrement)
+    job.OK = addTalliesFromFile((*job.pFilenames)[i], job.numRows, job.numCols, job.sums);
+  return NULL;
+}
+
+bool sumTallyFiles(const vector<const char*>& filenames, const unsigned int& numThreads, ostream& ofs);
+bool sumTallyFiles(const vector<const char*>& filenames, const unsigned int& numThreads, ostream& ofs)
+{
+  const unsigned int numJobs = min(numThreads, static_cast<unsigned int>(filenames.size()));
+  vector<TallySummationJob> jobs(numJobs);
+  vector<pthread_t> threads(numJobs);
+
+  // The first file is read on its own, to establish the dimensions every other file must match.
+  jobs[0].OK = addTalliesFromFile(filenames[0], jobs[0].numRows, jobs[0].numCols, jobs[0].sums);
+  if (!jobs[0].OK)
+    return false;
+  for (unsigned int j = 0; j < numJobs; j++)
+    {
+      jobs[j].pFilenames = &filenames;
+      jobs[j].firstFileIdx = j + 1;
+      jobs[j].fileIdxIncrement = numJobs;
+      jobs[j].numRows = jobs[0].numRows;
+      jobs[j].numCols = jobs[0].numCols;
+      jobs[j].OK = true;
+      if (j != 0)
+	jobs[j].sums.assign(jobs[0].sums.size(), 0);
+      pthread_create(&threads[j], NULL, tallySummationThread, &jobs[j]);
+    }
+  bool OK(true);
+  for (unsigned int j = 0; j < numJobs; j++)
+    {
+      pthread_join(threads[j], NULL);
+      if (!jobs[j].OK)
+	OK = false;
+    }
+  if (!OK)
+    return false;
 
-      if (comparisonOfGroups)
+  vector<uint64_t>& sums = jobs[0].sums;
+  for (unsigned int j = 1; j < numJobs; j++)
+    for (size_t i = 0; i < sums.size(); i++)
+      sums[i] += jobs[j].sums[i];
+  for (unsigned int row = 0; row < jobs[0].numRows; row++)
+    {
+      for (unsigned int col = 0; col < jobs[0].numCols; col++)
 	{
-	  // Shuffle the subset of states observed in the two groups at this site.
-	  k = 0;
-	  for (set<int>::const_iterator it = group1.begin(); it != group1.end(); it++)
-	    shuffledStatesInThe2groupsAtThisSite[k++] = allStatesAtThisSite[*it - 1];
-	  for (set<int>::const_iterator it = group2.begin(); it != group2.end(); it++)
-	    shuffledStatesInThe2groupsAtThisSite[k++] = allStatesAtThisSite[*it - 1];
-	  random_shuffle(shuffledStatesInThe2groupsAtThisSite.begin(), shuffledStatesInThe2groupsAtThisSite.end());
+	  if (col != 0)
+	    ofs << '\t';
+	  ofs << sums[row*jobs[0].numCols + col];
 	}
+      ofs << '\n';
+    }
+  ofs.flush();
+  return static_cast<bool>(ofs);
+}
+
+// Opens the outputs of comparison c and parses its groups, given as they'd be given on the command line;
+// pGroup2spec is NULL if there's only one group, in which case pRandFilename and pQ2filename are ignored.
+// Returns false after reporting an error.
+bool openComparison(GroupComparison& c, const int& measurementTypeInt, const int& numStates, const bool& writeBinary,
+		    const bool& memberStates, const char *pPfilename, const char *pQfilename, const char *pNsitesFilename, char *pGroupSpec,
+		    char *pGroup2spec, const char *pRandFilename, const char *pQ2filename);
+bool openComparison(GroupComparison& c, const int& measurementTypeInt, const int& numStates, const bool& writeBinary,
+		    const bool& memberStates, const char *pPfilename, const char *pQfilename, const char *pNsitesFilename, char *pGroupSpec,
+		    char *pGroup2spec, const char *pRandFilename, const char *pQ2filename)
+{
+  set<int>& group1 = c.group1;
+  set<int>& group2 = c.group2;
+  BinaryTallyHeader hdr;
+
+  c.outfileP.open(pPfilename);
+  if (!c.outfileP)
+    {
+      cerr << "Error:  Unable to open output file \"" << pPfilename << "\" for write." << endl << endl;
+      return false;
+    }
+  c.outfileQ.open(pQfilename);
+  if (!c.outfileQ)
+    {
+      cerr << "Error:  Unable to open output file \"" << pQfilename << "\" for write." << endl << endl;
+      return false;
+    }
+  c.outfileNsites.open(pNsitesFilename);
+  if (!c.outfileNsites)
+    {
+      cerr << "Error:  Unable to open output file \"" << pNsitesFilename << "\" for write." << endl << endl;
+      return false;
+    }
+  if (!parseOneSetOfColumnSpecs(pGroupSpec, group1))
+    return false;
 
-      if (KL == KLtype)
+  if (pGroup2spec != NULL)
+    {
+      if (!parseOneSetOfColumnSpecs(pGroup2spec, group2))
+	return false;
+      for (set<int>::const_iterator it2 = group2.begin(); it2 != group2.end(); it2++)
 	{
-	  P1.assign(P1.size(), 0);
-	  if (comparisonOfGroups)
-	    {
-	      randP1.assign(P1.size(), 0);
-	      k = 0;
-	    }
-	  for (set<int>::const_iterator it = group1.begin(); it != group1.end(); it++)
-	    {
-	      P1[allStatesAtThisSite[*it - 1] - 1]++;
-	      Q1[allStatesAtThisSite[*it - 1] - 1]++;
-	      if (comparisonOfGroups)
-		randP1[shuffledStatesInThe2groupsAtThisSite[k++] - 1]++;
-	    }
-	  // ofsP << P1[0];
-	  ofsP << '\t' << P1[0]; // we're now writing 
-	  if (comparisonOfGroups)
-	    ofsRand << randP1[0];
-	  for (unsigned int i = 1; i < P1.size(); i++)
-	    {
-	      ofsP << '\t' << P1[i];
-	      if (comparisonOfGroups)
-		ofsRand << '\t' << randP1[i];
-	    }
-	  if (comparisonOfGroups)
+	  set<int>::const_iterator it1 = group1.find(*it2);
+	  if (it1 != group1.end())
 	    {
-	      P2.assign(P2.size(), 0);
-	      randP2.assign(P1.size(), 0);
-	      for (set<int>::const_iterator it = group2.begin(); it != group2.end(); it++)
-		{
-		  P2[allStatesAtThisSite[*it - 1] - 1]++;
-		  Q2[allStatesAtThisSite[*it - 1] - 1]++;
-		  randP2[shuffledStatesInThe2groupsAtThisSite[k++] - 1]++;
-		}
-	      for (unsigned int i = 0; i < P2.size(); i++)
-		{
-		  ofsP << '\t' << P2[i];
-		  ofsRand << '\t' << randP2[i];
-		}
+	      cerr << "Error:  Value " << *it1 << " was found in both group specifications." << endl << endl;
+	      return false;
 	    }
 	}
-      else
+      c.outfileRand.open(pRandFilename);
+      if (!c.outfileRand)
 	{
-	  unsigned int k2, j(0);
-	  if (KLs == KLtype)
-	    {
-	      Ps1.assign(numUniqueStatePairs, 0);
-	      if (comparisonOfGroups)
-		{
-		  Ps2.assign(numUniqueStatePairs, 0);
-		  randPs1.assign(numUniqueStatePairs, 0);
-		  randPs2.assign(numUniqueStatePairs, 0);
-		}
-	    }
-	  // Loop over all ordered state pairs in all ordered epigenome IDs,
-	  // recording each such observation in P* or P**,
-	  // and recording the tally of such observations in Q* or Q**.
-	  // (Technically, these aren't P*, P**, Q*, or Q**,
-	  // but rather the main components of them; they'll be "completed"
-	  // during subsequent processing by another program.)
-	  k = 0;
-	  k2 = k + 1;
-	  for (set<int>::const_iterator it1 = group1.begin(); it1 != group1.end(); it1++)
-	    {
-	      set<int>::const_iterator it2 = it1;
-	      it2++;
-	      for (; it2 != group1.end(); it2++)
-		{
-		  // Example with 15 states:  Ordered state pairs (1,1), (1,2), ..., (1,15) map to 1, 2, ..., 15;
-		  // ordered state pairs (2,1), (2,2), ..., (2,15) map to 16, 17, ..., 30;
-		  // state pair (15,15) maps to 225.
-		  int stateOfEpi1 = allStatesAtThisSite[*it1 - 1], stateOfEpi2 = allStatesAtThisSite[*it2 - 1];
-		  if (KLss == KLtype)
-		    {
-		      int thisStatePairID = (stateOfEpi1 - 1)*numStates + stateOfEpi2;
-		      //		      if (0 == j)
-		      //			ofsP << thisStatePairID;
-		      //		      else
-		      ofsP << '\t' << thisStatePairID;
-		      Qss1[j++][thisStatePairID - 1]++;
-		    }
-		  else // KLs == KLtype
-		    {
-		      int thisUniqueStatePairID;
-		      if (stateOfEpi1 > stateOfEpi2)
-			{
-			  // swap these, to make the calculation simpler
-			  int temp = stateOfEpi1;
-			  stateOfEpi1 = stateOfEpi2;
-			  stateOfEpi2 = temp;
-			}
-		      // Upper triangular matrix, entries = 0, 1, ..., numStates-1 in row 1; numStates, ..., 2*numStates - 2 in row 2;
-		      // entry for the bottom right corner is numStates*(numStates+1)/2 - 1.
-		      thisUniqueStatePairID = (stateOfEpi1 - 1)*numStates - (stateOfEpi1-2)*(stateOfEpi1-1)/2 + (stateOfEpi2-stateOfEpi1);
-		      Ps1[thisUniqueStatePairID]++;
-		      Qs1[thisUniqueStatePairID]++;
-		    }
-		  if (comparisonOfGroups)
-		    {
-		      stateOfEpi1 = shuffledStatesInThe2groupsAtThisSite[k];
-		      stateOfEpi2 = shuffledStatesInThe2groupsAtThisSite[k2];
-		      if (KLss == KLtype)
-			{
-			  int thisStatePairID = (stateOfEpi1 - 1)*numStates + stateOfEpi2;
-			  if (0 == k && 1 == k2)
-			    ofsRand << thisStatePairID;
-			  else
-			    ofsRand << '\t' << thisStatePairID;
-			}
-		      else // KLs == KLtype
-			{
-			  int thisUniqueStatePairID;
-			  if (stateOfEpi1 > stateOfEpi2)
-			    {
-			      // swap these, to make the calculation simpler
-			      int temp = stateOfEpi1;
-			      stateOfEpi1 = stateOfEpi2;
-			      stateOfEpi2 = temp;
-			    }
-			  thisUniqueStatePairID = (stateOfEpi1 - 1)*numStates - (stateOfEpi1-2)*(stateOfEpi1-1)/2 + (stateOfEpi2-stateOfEpi1);
-			  randPs1[thisUniqueStatePairID]++;
-			}
-		      if (group1.size() == ++k2)
-			{
-			  k++;
-			  k2 = k + 1;
-			}
-		    }
-		}
-	    }
-	  if (comparisonOfGroups)
-	    {
-	      k = j = 0;
-	      k2 = k + 1;
-	      for (set<int>::const_iterator it1 = group2.begin(); it1 != group2.end(); it1++)
-		{
-		  set<int>::const_iterator it2 = it1;
-		  it2++;
-		  for (; it2 != group2.end(); it2++)
-		    {
-		      // See the comments a few lines above for an explanation of the mapping
-		      // from state pair to a unique ID (integer) representing the ordered (or unordered, unique) state pair.
-		      int stateOfEpi1 = allStatesAtThisSite[*it1 - 1], stateOfEpi2 = allStatesAtThisSite[*it2 - 1];
-		      if (KLss == KLtype)
-			{
-			  int thisStatePairID = (stateOfEpi1 - 1)*numStates + stateOfEpi2;
-			  ofsP << '\t' << thisStatePairID;
-			  Qss2[j++][thisStatePairID - 1]++;
-			}
-		      else // KLs == KLtype
-			{
-			  int thisUniqueStatePairID;
-			  if (stateOfEpi1 > stateOfEpi2)
-			    {
-			      int temp = stateOfEpi1;
-			      stateOfEpi1 = stateOfEpi2;
-			      stateOfEpi2 = temp;
-			    }
-			  thisUniqueStatePairID = (stateOfEpi1 - 1)*numStates - (stateOfEpi1-2)*(stateOfEpi1-1)/2 + (stateOfEpi2-stateOfEpi1);
-			  Ps2[thisUniqueStatePairID]++;
-			  Qs2[thisUniqueStatePairID]++;
-			}
-		      stateOfEpi1 = shuffledStatesInThe2groupsAtThisSite[k + group1.size()];
-		      stateOfEpi2 = shuffledStatesInThe2groupsAtThisSite[k2 + group1.size()];
-		      if (KLss == KLtype)
-			{
-			  int thisStatePairID = (stateOfEpi1 - 1)*numStates + stateOfEpi2;			  
-			  ofsRand << '\t' << thisStatePairID;
-			}
-		      else
-			{
-			  int thisUniqueStatePairID;
-			  if (stateOfEpi1 > stateOfEpi2)
-			    {
-			      int temp = stateOfEpi1;
-			      stateOfEpi1 = stateOfEpi2;
-			      stateOfEpi2 = temp;
-			    }
-			  thisUniqueStatePairID = (stateOfEpi1 - 1)*numStates - (stateOfEpi1-2)*(stateOfEpi1-1)/2 + (stateOfEpi2-stateOfEpi1);
-			  randPs2[thisUniqueStatePairID]++;
-			}
-		      if (++k2 + group1.size() == shuffledStatesInThe2groupsAtThisSite.size())
-			{
-			  k++;
-			  k2 = k + 1;
-			}
-		    }
-		}
-	    }
-	  if (KLs == KLtype) // then we haven't yet written the P* contributions to disk
-	    {
-	      ofsP << '\t' << Ps1[0]; // we're now writing "beg" and "end" prior to writing P1
-	      if (comparisonOfGroups)
-		ofsRand << randPs1[0];
-	      for (unsigned int i = 1; i < Ps1.size(); i++)
-		{
-		  ofsP << '\t' << Ps1[i];
-		  if (comparisonOfGroups)
-		    ofsRand << '\t' << randPs1[i];
-		}
-	      if (comparisonOfGroups)
-		{
-		  for (unsigned int i = 0; i < Ps2.size(); i++)
-		    {
-		      ofsP << '\t' << Ps2[i];
-		      ofsRand << '\t' << randPs2[i];
-		    }
-		}
-	    }
-	} // end of if/else to handle choice of KL, KL*, or KL**
-
-      ofsP << endl;
-      if (comparisonOfGroups)
-	ofsRand << endl;
-    } // end of loop for reading and processing all input data
-
-  // Write out the tallies over sites, for eventual use in Q, Q*, or Q**.
-
-  switch (KLtype) {
+	  cerr << "Error:  Unable to open output file \"" << pRandFilename << "\" for write." << endl << endl;
+	  return false;
+	}
+      c.outfileQ2.open(pQ2filename);
+      if (!c.outfileQ2)
+	{
+	  cerr << "Error:  Unable to open output file \"" << pQ2filename << "\" for write." << endl << endl;
+	  return false;
+	}
+    }
 
+  // Describe the per-site records, for the binary header.
+  hdr.formatVersion = g_binaryTallyFormatVersion;
+  hdr.metric = measurementTypeInt;
+  hdr.numStates = numStates;
+  hdr.group1size = group1.size();
+  hdr.group2size = group2.size();
+  hdr.hasCoordinates = 1;
+  hdr.Nsites = 0; // filled in after all sites have been processed
+  c.memberStates = memberStates && KLss == measurementTypeInt;
+  switch (measurementTypeInt) {
   case KL:
-    ofsQ << Q1[0];
-    for (unsigned int i = 1; i < Q1.size(); i++)
-      ofsQ << '\t' << Q1[i];
-    if (comparisonOfGroups)
-      {
-	ofsQ2 << Q2[0];
-	for (unsigned int i = 1; i < Q2.size(); i++)
-	  ofsQ2 << '\t' << Q2[i];
-	ofsQ2 << endl;
-      }
-    ofsQ << endl;
+    hdr.valuesPerRecord = numStates * (group2.empty() ? 1 : 2);
+    hdr.bytesPerValue = bytesNeededToStore(max(group1.size(), group2.size()));
     break;
-
   case KLs:
-    ofsQ << Qs1[0];
-    for (unsigned int i = 1; i < Qs1.size(); i++)
-      ofsQ << '\t' << Qs1[i];
-    if (comparisonOfGroups)
-      {
-	ofsQ2 << Qs2[0];
-	for (unsigned int i = 1; i < Qs2.size(); i++)
-	  ofsQ2 << '\t' << Qs2[i];
-	ofsQ2 << endl;
-      }
-    ofsQ << endl;
+    hdr.valuesPerRecord = (numStates*(numStates+1)/2) * (group2.empty() ? 1 : 2);
+    hdr.bytesPerValue = bytesNeededToStore(max(group1.size()*(group1.size()-1)/2, group2.size()*(group2.size()-1)/2));
     break;
-    
-  case KLss:  
-    for (unsigned int i = 0; i < Qss1.size(); i++)
+  default: // KLss
+    if (c.memberStates)
       {
-	ofsQ << Qss1[i][0];
-	for (unsigned int j = 1; j < Qss1[0].size(); j++)
-	  ofsQ << '\t' << Qss1[i][j];
-	ofsQ << endl;
+	hdr.formatVersion = g_binaryTallyMemberStatesFormatVersion;
+	hdr.valuesPerRecord = group1.size() + group2.size();
+	hdr.bytesPerValue = bytesNeededToStore(numStates);
       }
-    if (comparisonOfGroups)
+    else
       {
-	for (unsigned int i = 0; i < Qss2.size(); i++)
-	  {
-	    ofsQ2 << Qss2[i][0];
-	    for (unsigned int j = 1; j < Qss2[0].size(); j++)
-	      ofsQ2 << '\t' << Qss2[i][j];
-	    ofsQ2 << endl;
-	  }
+	hdr.valuesPerRecord = group1.size()*(group1.size()-1)/2 + group2.size()*(group2.size()-1)/2;
+	hdr.bytesPerValue = bytesNeededToStore(numStates*numStates);
       }
     break;
   }
+  c.PWriter.attach(c.outfileP, writeBinary, hdr);
+  if (c.outfileRand.is_open())
+    {
+      hdr.hasCoordinates = 0;
+      c.randWriter.attach(c.outfileRand, writeBinary, hdr);
+    }
 
-  ofsNsites << linenum << endl;
-  
+  return true;
+}
+
+// Reads a file of comparisons (--comparisons), one per line.  Each line lists the 4 or 7 arguments that would otherwise
+// follow numStates on the command line (outfileP outfileQ outfileNsites groupSpec [group2spec outfileRandP outfileQ2]),
+// separated by whitespace; blank lines and lines beginning with '#' are ignored.
+// A GroupComparison is allocated and opened for each line; the caller must delete them.
+bool readComparisons(const char *pFilename, const int& measurementTypeInt, const int& numStates, const bool& writeBinary,
+		     const bool& memberStates, vector<GroupComparison*>& comparisons);
+bool readComparisons(const char *pFilename, const int& measurementTypeInt, const int& numStates, const bool& writeBinary,
+		     const bool& memberStates, vector<GroupComparison*>& comparisons)
+{
+  ifstream ifs(pFilename);
+  string line, arg;
+  unsigned int linenum(0);
+
+  if (!ifs)
+    {
+      cerr << "Error:  Unable to open file \"" << pFilename << "\" for read." << endl << endl;
+      return false;
+    }
+  while (getline(ifs, line))
+    {
+      istringstream iss(line);
+      vector<string> args;
+      linenum++;
+      while (iss >> arg)
+	args.push_back(arg);
+      if (args.empty() || '#' == args[0][0])
+	continue;
+      if (args.size() != 4 && args.size() != 7)
+	{
+	  cerr << "Error:  Line " << linenum << " of file \"" << pFilename << "\" contains " << args.size()
+	       << " fields; 4 (outfileP outfileQ outfileNsites groupSpec)\n"
+	       << "or 7 (outfileP outfileQ outfileNsites groupSpec group2spec outfileRandP outfileQ2) were expected." << endl << endl;
+	  return false;
+	}
+      vector<char> groupSpec(args[3].begin(), args[3].end()), group2spec;
+      groupSpec.push_back('\0');
+      if (7 == args.size())
+	{
+	  group2spec.assign(args[4].begin(), args[4].end());
+	  group2spec.push_back('\0');
+	}
+      comparisons.push_back(new GroupComparison);
+      if (!openComparison(*comparisons.back(), measurementTypeInt, numStates, writeBinary, memberStates,
+			  args[0].c_str(), args[1].c_str(), args[2].c_str(), &groupSpec[0],
+			  7 == args.size() ? &group2spec[0] : NULL,
+			  7 == args.size() ? args[5].c_str() : NULL, 7 == args.size() ? args[6].c_str() : NULL))
+	{
+	  cerr << "(The error occurred for the comparison on line " << linenum << " of file \"" << pFilename << "\".)" << endl << endl;
+	  return false;
+	}
+    }
+  if (comparisons.empty())
+    {
+      cerr << "Error:  File \"" << pFilename << "\" specifies no comparisons." << endl << endl;
+      return false;
+    }
+  return true;
+}
+
+// Converts the input read via reader into a packed state file (see packedStateMatrix.h), written to pOutfilename.
+bool packStateFile(StateFileReader& reader, const int& numStates, const char *pOutfilename);
+bool packStateFile(StateFileReader& reader, const int& numStates, const char *pOutfilename)
+{
+  ofstream ofs(pOutfilename, ios::binary);
+  PackedStateWriter writer;
+  vector<int> allStatesAtThisSite;
+
+  if (!ofs)
+    {
+      cerr << "Error:  Unable to open output file \"" << pOutfilename << "\" for write." << endl << endl;
+      return false;
+    }
+  writer.attach(ofs, numStates);
+  while (reader.readSite(allStatesAtThisSite))
+    if (!writer.addSite(allStatesAtThisSite, reader.chrom(), reader.beg(), reader.end()))
+      return false;
+  if (reader.failed())
+    return false;
+  return writer.finish();
+}
+
+// Writes the site index of the input read via reader (see siteRange.h), which must be uncompressed text or packed.
+bool indexSites(StateFileReader& reader, const char *pFilename);
+bool indexSites(StateFileReader& reader, const char *pFilename)
+{
+  SiteIndex index;
+  vector<int> firstState;
+
+  if (!reader.mapped())
+    {
+      cerr << "Error:  File " << pFilename << " is compressed, so it can't be indexed;\n"
+	   << "decompress it, or pack it with --pack-states, and index the result." << endl << endl;
+      return false;
+    }
+  reader.selectColumns(vector<int>(1, 0), false); // only the coordinates are needed
+  for (uint64_t offset = reader.nextSiteOffset(); reader.readSite(firstState); offset = reader.nextSiteOffset())
+    index.addSite(offset, strtoul(reader.beg(), NULL, 10));
+  if (reader.failed())
+    return false;
+  return index.write(pFilename, reader.fileSize());
+}
+
+// Writes Q (and Q2) of the groups, and the number of sites, as onePassThroughData() does, but derived from the tally store
+// pStoreFilename of the state file (see tallyStore.h).  Whatever the store doesn't hold yet is first tallied in one pass
+// through the file via reader, reading only the columns of the epigenomes involved, and added to the store.
+bool tallyQfromStore(StateFileReader& reader, const char *pStateFilename, const char *pStoreFilename, const measurementType& KLtype,
+		     const int& numStates, const set<int>& group1, const set<int>& group2, const bool& checkAllColumns,
+		     ostream& osQ, ostream& osQ2, ostream& osNsites, RunStats& stats);
+bool tallyQfromStore(StateFileReader& reader, const char *pStateFilename, const char *pStoreFilename, const measurementType& KLtype,
+		     const int& numStates, const set<int>& group1, const set<int>& group2, const bool& checkAllColumns,
+		     ostream& osQ, ostream& osQ2, ostream& osNsites, RunStats& stats)
+{
+  TallyStore store;
+  set<int> missingEpigenomes;
+  set<pair<int,int> > missingPairs;
+  SiteTallier tallier;
+
+  stats.beginPhase("loadStore");
+  if (!store.load(pStoreFilename, pStateFilename, numStates))
+    return false;
+  store.findMissing(KLtype, group1, group2, missingEpigenomes, missingPairs);
+  if (!missingEpigenomes.empty() || !missingPairs.empty())
+    {
+      stats.beginPhase("tally");
+      if (!store.tallyMissing(reader, checkAllColumns, missingEpigenomes, missingPairs))
+	return false;
+      stats.addValue("epigenomesTallied", static_cast<double>(missingEpigenomes.size()));
+      stats.addValue("epigenomePairsTallied", static_cast<double>(missingPairs.size()));
+      stats.beginPhase("writeStore");
+      if (!store.write(pStoreFilename))
+	return false;
+    }
+  stats.endPhase();
+  if (!store.groupsFit(group1, group2))
+    return false;
+  tallier.init(KLtype, group1, group2, numStates);
+  store.addQ(KLtype, group1, group2, tallier);
+  tallier.writeQ(osQ, osQ2);
+  osNsites << store.numSites() << endl;
+  stats.setNumSites(store.numSites());
   return true;
 }
 
 int main(int argc, char* argv[])
 {
-  if (8 != argc && 11 != argc && 2 != argc && 3 != argc)
+  RunStats stats; // declared first, so that it reports once everything else has been cleaned up
+  bool writeBinary(false), memberStates(false), reportStats(false);
+  unsigned long seed(0);
+  int numThreads(1);
+  bool sumTallies(false), packStates(false), indexSiteOffsets(false);
+  SiteRange range;
+  bool checkAllColumns(true), reuseIdenticalSites(false);
+  const char *pComparisonsFilename(NULL), *pTallyStoreFilename(NULL);
+
+  // Options (arguments beginning with "--") may appear anywhere on the command line;
+  // remove them, so that the remaining arguments can be interpreted by position.
+  int numPositionalArgs(1);
+  for (int i = 1; i < argc; i++)
+    {
+      if (0 == strcmp(argv[i], "--binary"))
+	writeBinary = true;
+      else if (0 == strcmp(argv[i], "--member-states"))
+	memberStates = true;
+      else if (0 == strcmp(argv[i], "--sum-tallies"))
+	sumTallies = true;
+      else if (0 == strcmp(argv[i], "--pack-states"))
+	packStates = true;
+      else if (0 == strcmp(argv[i], "--index-sites"))
+	indexSiteOffsets = true;
+      else if ((0 == strcmp(argv[i], "--region") || 0 == strcmp(argv[i], "--tile")) && i + 1 < argc)
+	{
+	  if (!range.parseOption(argv[i], argv[i + 1]))
+	    return -1;
+	  i++;
+	}
+      else if (0 == strcmp(argv[i], "--check-group-columns-only"))
+	checkAllColumns = false;
+      else if (0 == strcmp(argv[i], "--reuse-identical-sites"))
+	reuseIdenticalSites = true;
+      else if (0 == strcmp(argv[i], "--stats"))
+	reportStats = true;
+      else if (0 == strcmp(argv[i], "--comparisons") && i + 1 < argc)
+	pComparisonsFilename = argv[++i];
+      else if (0 == strcmp(argv[i], "--tally-store") && i + 1 < argc)
+	pTallyStoreFilename = argv[++i];
+      else if (0 == strcmp(argv[i], "--seed") && i + 1 < argc)
+	{
+	  char *pEnd;
+	  seed = strtoul(argv[++i], &pEnd, 10);
+	  if (pEnd == argv[i] || *pEnd != '\0')
+	    {
+	      cerr << "Error:  Invalid random number seed (\"" << argv[i] << "\") received." << endl << endl;
+	      return -1;
+	    }
+	}
+      else if (0 == strcmp(argv[i], "--threads") && i + 1 < argc)
+	{
+	  numThreads = atoi(argv[++i]);
+	  if (numThreads < 1)
+	    {
+	      cerr << "Error:  Invalid number of threads (\"" << argv[i] << "\") received." << endl << endl;
+	      return -1;
+	    }
+	}
+      else
+	argv[numPositionalArgs++] = argv[i];
+    }
+  argc = numPositionalArgs;
+  if (reportStats)
+    stats.enable(argv[0]);
+
+  if (sumTallies && argc >= 3)
+    {
+      BgzfOutputStream outfile(argv[1]);
+      vector<const char*> infiles(argv + 2, argv + argc);
+      if (!outfile)
+	{
+	  cerr << "Error:  Unable to open output file \"" << argv[1] << "\" for write." << endl << endl;
+	  return -1;
+	}
+      for (unsigned int i = 0; i < infiles.size(); i++)
+	stats.addInputFile(infiles[i]);
+      stats.beginPhase("sumTallies");
+      return sumTallyFiles(infiles, static_cast<unsigned int>(numThreads), outfile) ? 0 : -1;
+    }
+
+  if (indexSiteOffsets && 2 == argc)
+    {
+      StateFileReader reader;
+      if (!reader.open(argv[1], INT_MAX)) // the states aren't read
+	{
+	  cerr << "Error:  Unable to open input file \"" << argv[1] << "\" for read." << endl << endl;
+	  return -1;
+	}
+      stats.addInputFile(argv[1]);
+      stats.beginPhase("indexSites");
+      const bool OK = indexSites(reader, argv[1]);
+      stats.endPhase();
+      stats.setNumSites(reader.numSitesRead());
+      return OK ? 0 : -1;
+    }
+
+  if (packStates && 4 == argc)
+    {
+      StateFileReader reader;
+      const int numStates(atoi(argv[2]));
+      if (numStates < 1 || numStates > 256)
+	{
+	  cerr << "Error:  Invalid number of states (\"" << argv[2] << "\") received; at most 256 states can be packed." << endl << endl;
+	  return -1;
+	}
+      if (!reader.open(argv[1], numStates))
+	{
+	  cerr << "Error:  Unable to open input file \"" << argv[1] << "\" for read." << endl << endl;
+	  return -1;
+	}
+      if (!reader.restrictToRange(range))
+	return -1;
+      stats.addInputFile(argv[1]);
+      stats.beginPhase("packStates");
+      const bool OK = packStateFile(reader, numStates, argv[3]);
+      stats.endPhase();
+      stats.setNumSites(reader.numSitesRead());
+      return OK ? 0 : -1;
+    }
+
+  if (pTallyStoreFilename != NULL && (7 == argc || 9 == argc) && !range.restricted())
+    {
+      const int measurementTypeInt(atoi(argv[2])), numStates(atoi(argv[3]));
+      StateFileReader reader;
+      set<int> group1, group2;
+      ofstream outfileQ, outfileQ2, outfileNsites;
+
+      if (KL != measurementTypeInt && KLs != measurementTypeInt && KLss != measurementTypeInt)
+	{
+	  cerr << "Error:  Invalid \"measurementType\" received (2nd argument, \"" << argv[2] << "\").\n"
+	       << "The valid options are " << KL << " (to use S1), " << KLs << " (to use S2), and " << KLss << " (to use S3)." << endl << endl;
+	  return -1;
+	}
+      if (numStates < 1)
+	{
+	  cerr << "Error:  Invalid number of states (\"" << argv[3] << "\") received." << endl << endl;
+	  return -1;
+	}
+      if (!parseOneSetOfColumnSpecs(argv[6], group1) || (9 == argc && !parseOneSetOfColumnSpecs(argv[7], group2)))
+	return -1;
+      for (set<int>::const_iterator it2 = group2.begin(); it2 != group2.end(); it2++)
+	if (group1.find(*it2) != group1.end())
+	  {
+	    cerr << "Error:  Value " << *it2 << " found in both group specifications." << endl << endl;
+	    return -1;
+	  }
+      if (!reader.open(argv[1], numStates))
+	{
+	  cerr << "Error:  Unable to open input file \"" << argv[1] << "\" for read." << endl << endl;
+	  return -1;
+	}
+      const char *pQfilenames[3] = {argv[4], argv[5], 9 == argc ? argv[8] : NULL};
+      ofstream *pOutfiles[3] = {&outfileQ, &outfileNsites, &outfileQ2};
+      for (int i = 0; i < 3; i++)
+	{
+	  if (NULL == pQfilenames[i])
+	    continue;
+	  pOutfiles[i]->open(pQfilenames[i]);
+	  if (!*pOutfiles[i])
+	    {
+	      cerr << "Error:  Unable to open output file \"" << pQfilenames[i] << "\" for write." << endl << endl;
+	      return -1;
+	    }
+	}
+      stats.addInputFile(argv[1]);
+      return tallyQfromStore(reader, argv[1], pTallyStoreFilename, static_cast<measurementType>(measurementTypeInt), numStates,
+			     group1, group2, checkAllColumns, outfileQ, outfileQ2, outfileNsites, stats) ? 0 : -1;
+    }
+
+  if (sumTallies || packStates || indexSiteOffsets || pTallyStoreFilename != NULL || (pComparisonsFilename != NULL ? 4 != argc : (8 != argc && 11 != argc && 2 != argc && 3 != argc)))
     {
     Usage:
-      cerr << "Usage flavor 1:  " << argv[0] << " infile metric numStates outfileP outfileQ outfileNsites groupSpec [group2spec outfileRandP outfileQ2]\n"
+      cerr << "Usage flavor 1:  " << argv[0] << " [--binary] [--member-states] [--seed S] [--threads N] [--check-group-columns-only] [--reuse-identical-sites] [--region chrom:beg-end | --tile i/N] [--stats] infile metric numStates outfileP outfileQ outfileNsites groupSpec [group2spec outfileRandP outfileQ2]\n"
+	   << "              " << argv[0] << " [options] --comparisons FILE infile metric numStates\n"
 	   << "where\n"
 	   << "* infile is tab-delimited: chrom, start, stop, state of epigenome1, state of epigenome2, ...\n"
 	   << "* metric is either 1 (to use S1), 2 (S2), or 3 (S3)\n"
@@ -596,12 +919,62 @@ int main(int argc, char* argv[])
 	   << "Specification of optional additional arguments group2spec, outfileRandP, and outfileQ2  will instigate a comparison between specified groups 1 and 2;\n"
 	   << "outfileP will contain tallies for both groups, outfileQ will contain tallies for group1, outfileQ2 will contain tallies for group2,\n"
 	   << "and outfileRandP will contain tallies obtained after randomly permuting the states observed in group 1 and group 2 among the union of all epigenomes.\n"
+	   << "If the --binary option is given, outfileP and outfileRandP are written in a packed binary format instead of as tab-delimited text;\n"
+	   << "computeEpilogosPart2_perChrom detects this format automatically.\n"
+	   << "For metric S3, --member-states writes the states of the epigenomes in groupSpec (and group2spec) to outfileP and outfileRandP,\n"
+	   << "one per epigenome, in place of the state pair of every pair of epigenomes (far fewer values for a large group);\n"
+	   << "computeEpilogosPart2_perChrom derives the state pairs from them.  It detects this in binary files, but it must be given\n"
+	   << "--member-states to read such text files.\n"
+	   << "infile can be gzip- or bgzip-compressed, and if the name of outfileP or outfileRandP ends in \".gz\",\n"
+	   << "that file will be written with bgzip-compatible (BGZF) compression.\n"
+	   << "The random permutation of each site's states is determined by the seed S (a nonnegative integer, default 0),\n"
+	   << "the chromosome, and the site's line number in \"infile,\" so outfileRandP is reproducible on every platform.\n"
+	   << "If --threads N is given, N threads tally the sites in parallel; the output is the same for any N.\n"
+	   << "Only the columns in groupSpec and group2spec are used; with --check-group-columns-only, the states in the other columns\n"
+	   << "are not checked (saving time when the groups are small subsets of the input), only counted.\n"
+	   << "With --reuse-identical-sites, a site whose states in those columns are the same as at the previous site (e.g. in a long quiescent region)\n"
+	   << "isn't tallied again, and the tallies of a run of such sites are added to outfileQ and outfileQ2 at once; the output is the same.\n"
+	   << "With --comparisons FILE, the arguments following numStates are instead given for any number of groups or pairs of groups,\n"
+	   << "one per line of FILE (outfileP outfileQ outfileNsites groupSpec [group2spec outfileRandP outfileQ2], separated by whitespace;\n"
+	   << "lines beginning with '#' are ignored), and all of them are computed in a single pass through \"infile.\"\n"
+	   << "With --region chrom:beg-end, only the sites beginning in [beg, end) are processed; with --tile i/N, the sites are\n"
+	   << "divided into N tiles of consecutive sites (as nearly equal in number as possible), and only those of tile i are processed.\n"
+	   << "Either way, outfileQ (and outfileQ2) and outfileNsites only count those sites, and can be summed over the tiles\n"
+	   << "of a chromosome with usage flavor 3; each site's random permutation is the same as in a run over all of \"infile.\"\n"
+	   << "Given a site index of \"infile\" (see usage flavor 5), the run seeks directly to the first of its sites.\n"
+	   << "With --stats (which can also be given in usage flavors 3, 4, and 5), a report (a JSON object) is written to standard error\n"
+	   << "on exit:  wall and CPU time in total and per phase, sites per second, the total size of the input files, bytes written, and peak memory use.\n"
 	   << "\n"
 	   << "Usage flavor 2:  " << argv[0] << " groupSpec [group2spec]\n"
 	   << "where groupSpec (and optional group2spec) are defined as above.\n"
 	   << "In this case, the group definition is parsed, and its size (number of epigenomes) is written to standard output;\n"
 	   << "if two group specifications are provided, the numbers of epigenomes in the two groups are written to standard output, separated by a tab character.\n"
-	   << "The program does nothing further in this scenario."
+	   << "The program does nothing further in this scenario.\n"
+	   << "\n"
+	   << "Usage flavor 3:  " << argv[0] << " --sum-tallies [--threads N] outfile infile1 [infile2 ...]\n"
+	   << "where the infiles are outfileQ, outfileQ2, or outfileNsites files written for different chromosomes.\n"
+	   << "Their tallies are summed, element by element, and the genome-wide tallies are written to outfile.\n"
+	   << "Every infile must have as many rows and columns as infile1.  If --threads N is given, N threads read the infiles.\n"
+	   << "\n"
+	   << "Usage flavor 4:  " << argv[0] << " --pack-states infile numStates outfile\n"
+	   << "where infile is as in usage flavor 1.  Its states are packed into outfile in a compact binary format\n"
+	   << "(4 bits per state if numStates <= 16), along with its coordinates, which must all be on one chromosome.\n"
+	   << "outfile can then be given in place of infile, to usage flavor 1 or to computeEpilogosPart2_perChrom --fused;\n"
+	   << "it's read much faster than the text, with the same results.  With --region or --tile, only those sites are packed.\n"
+	   << "\n"
+	   << "Usage flavor 5:  " << argv[0] << " --index-sites infile\n"
+	   << "where infile is as in usage flavor 1 (uncompressed) or 4 (packed).  A site index of infile, i.e. the file offsets\n"
+	   << "and begin coordinates of every " << SiteIndex::INTERVAL << "th site, is written to infile.sidx;\n"
+	   << "it lets --region and --tile, in this program and in computeEpilogosPart2_perChrom --fused, seek to their sites.\n"
+	   << "\n"
+	   << "Usage flavor 6:  " << argv[0] << " --tally-store storeFile [--check-group-columns-only] [--stats] infile metric numStates outfileQ outfileNsites groupSpec [group2spec outfileQ2]\n"
+	   << "where the arguments are as in usage flavor 1.  Only outfileQ (and outfileQ2) and outfileNsites are written, the same as\n"
+	   << "in usage flavor 1, but they're derived from storeFile, which holds the state counts of individual epigenomes (for S1) or the\n"
+	   << "state pair counts of individual pairs of epigenomes (for S2 and S3) over the sites of infile.  Whatever the groups need\n"
+	   << "that storeFile doesn't hold yet is tallied first, in one pass through infile, and added to it (storeFile is created if necessary).\n"
+	   << "So once a group has been tallied, adding epigenomes to it only requires tallying the new ones (for S2 and S3,\n"
+	   << "the pairs that include them), and removing epigenomes requires no tallying at all.  storeFile records a checksum of infile;\n"
+	   << "if infile's contents have changed since then, the tallies in storeFile are discarded (with a warning) and tallied again."
 	   << endl << endl;
       return -1;
     }
@@ -632,11 +1005,10 @@ int main(int argc, char* argv[])
       return 0;
     }
   
-  ifstream infile(argv[1]);
   const int measurementTypeInt(atoi(argv[2])), numStates(atoi(argv[3]));
-  ofstream outfileP(argv[4]), outfileQ(argv[5]), outfileNsites(argv[6]), outfileRand, outfileQ2;
-
-  set<int> group1, group2;
+  StateFileReader reader;
+  vector<GroupComparison*> comparisons;
+  bool OK;
 
   if (KL != measurementTypeInt && KLs != measurementTypeInt && KLss != measurementTypeInt)
     {
@@ -644,59 +1016,35 @@ int main(int argc, char* argv[])
 	   << "The valid options are " << KL << " (to use S1), " << KLs << " (to use S2), and " << KLss << " (to use S3)." << endl << endl;
       goto Usage;
     }
-  if (!infile)
+  if (!reader.open(argv[1], numStates))
     {
       cerr << "Error:  Unable to open input file \"" << argv[1] << "\" for read." << endl << endl;
       return -1;
     }
-  if (!outfileP)
-    {
-      cerr << "Error:  Unable to open output file \"" << argv[4] << "\" for write." << endl << endl;
-      return -1;
-    }
-  if (!outfileQ)
-    {
-      cerr << "Error:  Unable to open output file \"" << argv[5] << "\" for write." << endl << endl;
-      return -1;
-    }
-  if (!outfileNsites)
+  if (!reader.restrictToRange(range))
+    return -1;
+  stats.addInputFile(argv[1]);
+  if (pComparisonsFilename != NULL)
+    OK = readComparisons(pComparisonsFilename, measurementTypeInt, numStates, writeBinary, memberStates, comparisons);
+  else
     {
-      cerr << "Error:  Unable to open output file \"" << argv[6] << "\" for write." << endl << endl;
-      return -1;
+      comparisons.push_back(new GroupComparison);
+      OK = openComparison(*comparisons.back(), measurementTypeInt, numStates, writeBinary, memberStates, argv[4], argv[5], argv[6], argv[7],
+			  11 == argc ? argv[8] : NULL, 11 == argc ? argv[9] : NULL, 11 == argc ? argv[10] : NULL);
     }
-  if (!parseOneSetOfColumnSpecs(argv[7], group1))
-    return -1;
 
-  if (11 == argc)
+  if (OK)
     {
-      if (!parseOneSetOfColumnSpecs(argv[8], group2))
-	return -1;
-      for (set<int>::const_iterator it2 = group2.begin(); it2 != group2.end(); it2++)
-	{
-	  set<int>::const_iterator it1 = group1.find(*it2);
-	  if (it1 != group1.end())
-	    {
-	      cerr << "Error:  Value " << *it1 << " was found in both group specifications." << endl << endl;
-	      return -1;
-	    }
-	}
-      outfileRand.open(argv[9]);
-      if (!outfileRand)
-	{
-	  cerr << "Error:  Unable to open output file \"" << argv[9] << "\" for write." << endl << endl;
-	  return -1;
-	}
-      outfileQ2.open(argv[10]);
-      if (!outfileQ2)
-	{
-	  cerr << "Error:  Unable to open output file \"" << argv[10] << "\" for write." << endl << endl;
-	  return -1;
-	}
+      stats.beginPhase("tally");
+      OK = onePassThroughData(reader, static_cast<measurementType>(measurementTypeInt), comparisons, numStates,
+			      seed, static_cast<unsigned int>(numThreads), checkAllColumns,
+			      reuseIdenticalSites);
+      stats.endPhase();
+      stats.setNumSites(reader.numSitesRead());
     }
 
-  if (!onePassThroughData(infile, static_cast<measurementType>(measurementTypeInt), group1, group2, numStates,
-			  outfileP, outfileQ, outfileQ2, outfileRand, outfileNsites))
-    return -1;
+  for (unsigned int c = 0; c < comparisons.size(); c++)
+    delete comparisons[c];
 
-  return 0;
+  return OK ? 0 : -1;
 }
@@ -10,916 +10,516 @@
 #include <cmath>
 #include <cfloat>
 #include <string>
+#include <sstream>
+#include <stdint.h>
+#include "binaryTallyFormat.h"
+#include "compressedStreams.h"
+#include "exemplarRegions.h"
+#include "metricModels.h"
+#include "qcontribCache.h"
+#include "runStats.h"
+#include "siteRange.h"
+#include "siteTallies.h"
+#include "statePermuter.h"
+#include "stateFileReader.h"
 
 using namespace std;
 
-enum measurementType {KL = 1, KLs, KLss}; // corresponding to measurements using S1 (KL), S2 (KL*), or S3 (KL**)
-
-bool FloatAbs_LT(const float& a, const float& b);
-bool FloatAbs_LT(const float& a, const float& b)
-{
-  return fabs(a) < fabs(b);
-}
-
-class Model {
-public:
-  virtual bool init(const char *pObsFname, const char *pScoresFname, const char *pNullsFname, const string& chrom) = 0;
-  virtual unsigned int size(void) const = 0;
-  virtual bool writingNulls(void) const = 0;
-  virtual bool getQcontrib(ifstream& infile, const char *pFilename, const unsigned int& Nsites) = 0;
-  virtual bool processInputValue(const unsigned int& val) = 0;
-  virtual void computeAndWriteMetric(void) = 0;
-};
-
-class KLModel : public Model {
-public:
-  KLModel() {};
-  bool init(const char *pObsFname, const char *pScoresFname, const char *pNullsFname, const string& chrom);
-  unsigned int size(void) const { return m_size; }
-  bool writingNulls(void) const { return m_writeNullMetric; }
-  bool getQcontrib(ifstream& infile, const char *pFilename, const unsigned int& Nsites);
-  bool processInputValue(const unsigned int& val);
-  void computeAndWriteMetric(void);
-protected:
-  unsigned int m_numStates;
-  unsigned int m_size; // number of values required on each line of input
-  unsigned int m_group1size, m_group2size;
-  unsigned int m_numValsProcessedForGroup1, m_numValsProcessedForGroup2;
-  bool m_writeNullMetric;
-  ofstream m_ofsObs, m_ofsNullValues, m_ofsScores;
-  string m_chrom;
-  int m_curBegPos, m_curEndPos;
-private:
-  KLModel(const KLModel&); // we have no need for a copy constructor, so disable it
-  vector<unsigned int> m_P1numerators, m_P2numerators; 
-  vector<float> m_Q1contrib, m_Q2contrib;
-  vector<float> m_logsOfObservationTallies;
-};
-
-class KLsModel : public KLModel {
-public:
-  KLsModel() {};
-  bool getQcontrib(ifstream& infile, const char *pFilename, const unsigned int& Nsites);
-  bool processInputValue(const unsigned int& val);
-  void computeAndWriteMetric(void);
-private:
-  KLsModel(const KLsModel&); // we have no need for a copy constructor, so disable it
-  vector<unsigned int> m_Ps1numerators, m_Ps2numerators;
-  vector<float> m_Qs1contrib, m_Qs2contrib;
-  vector<float> m_logsOfObservationTallies;
-  vector<pair<unsigned int, unsigned int> > m_unorderedStatePairDecompositions;
-};
-
-class KLssModel : public KLModel {
-public:
-  KLssModel() {};
-  bool getQcontrib(ifstream& infile, const char *pFilename, const unsigned int& Nsites);
-  bool processInputValue(const unsigned int& val);
-  void computeAndWriteMetric(void);
-private:
-  KLssModel(const KLssModel&); // we have no need for a copy constructor, so disable it
-  map<unsigned int, map<unsigned int,float> > m_Qss1contrib, m_Qss2contrib;
-  map<unsigned int, pair<map<unsigned int, set<unsigned int> >, map<unsigned int, set<unsigned int> > > > m_statePairGroupObservationsAtThisSite;
-};
-
-
-bool KLModel::init(const char *pObsFname, const char *pScoresFname, const char *pNullsFname, const string& chrom)
+// Only the lines in range (whose tile, if any, must have been resolved) are scored; a region is matched
+// against the begin coordinate in the first column, so it requires observations rather than null values.
+// numSites receives the number of lines scored.
+// If pModel reusesIdenticalSites(), a line whose values (following the coordinates, for observations) are the same
+// as those of the previous line isn't parsed or scored; the model repeats the previous site instead.
+// parseTime times the reading and parsing of the input, i.e. everything but the calls of pModel's computeAndWriteMetric()
+// and repeatPreviousSite() (which the model itself can time; see Model::timeScoring()).
+bool parseInputWriteOutput(istream& ifs, const char *pFilename, Model* pModel, const SiteRange& range, uint64_t& numSites,
+			   Stopwatch& parseTime);
+bool parseInputWriteOutput(istream& ifs, const char *pFilename, Model* pModel, const SiteRange& range, uint64_t& numSites,
+			   Stopwatch& parseTime)
 {
-  if (pObsFname != NULL)
+  const int BUFSIZE(2000000);
+  char buf[BUFSIZE], *p;
+  unsigned int linenum(0), numColsProcessed;
+  const unsigned int numExpected = pModel->writingNulls() ? pModel->size() : pModel->size() + 2;
+  const bool reuseIdenticalSites = pModel->reusesIdenticalSites();
+  string prevValues;
+  
+  numSites = 0;
+  parseTime.start();
+  while (ifs.getline(buf,BUFSIZE))
     {
-      m_ofsObs.open(pObsFname);
-      if (!m_ofsObs)
+      linenum++;
+      if (range.restricted())
 	{
-	  cerr << "Error:  Unable to open file \"" << pObsFname << "\" for writing." << endl << endl;
-	  return false;
+	  const int cmp = range.compare(linenum, NULL, strtoul(buf, NULL, 10));
+	  if (cmp < 0)
+	    continue;
+	  if (cmp > 0)
+	    break;
 	}
-    }
-  if (pScoresFname != NULL)
-    {
-      m_ofsScores.open(pScoresFname);
-      if (!m_ofsScores)
+      if (reuseIdenticalSites)
 	{
-	  cerr << "Error:  Unable to open file \"" << pScoresFname << "\" for writing." << endl << endl;
-	  return false;
+	  const char *pValues = buf;
+	  for (int i = 0; i < (pModel->writingNulls() ? 0 : 2) && pValues != NULL; i++)
+	    if ((pValues = strchr(pValues, '\t')) != NULL)
+	      pValues++;
+	  if (pValues != NULL && numSites != 0 && 0 == prevValues.compare(pValues))
+	    {
+	      const char *pEnd = strchr(buf, '\t');
+	      const unsigned int begPos = static_cast<unsigned int>(atoi(buf)), endPos = pEnd != NULL ? static_cast<unsigned int>(atoi(pEnd + 1)) : 0;
+	      parseTime.stop();
+	      pModel->repeatPreviousSite(begPos, endPos);
+	      parseTime.start();
+	      numSites++;
+	      continue;
+	    }
+	  prevValues.assign(pValues != NULL ? pValues : "");
 	}
-    }
-    if (pNullsFname != NULL)
-    {
-      m_ofsNullValues.open(pNullsFname);
-      if (!m_ofsNullValues)
+      numColsProcessed = 0;
+
+      p = strtok(buf, "\t");
+      do {
+	unsigned int inputValue(atoi(p));
+	numColsProcessed++;
+	if (!pModel->processInputValue(inputValue))
+	  {
+	    cerr << "The error was detected in column " << numColsProcessed
+		 << " of line " << linenum << " of file " << pFilename
+		 << "." << endl << endl;
+	    return false;
+	  }
+      } while ((p = strtok(NULL, "\t")));
+
+      if (numColsProcessed != numExpected)
 	{
-	  cerr << "Error:  Unable to open file \"" << pNullsFname << "\" for writing." << endl << endl;
+	  cerr << "Error:  Expected to find " << numExpected << " columns of integers "
+	       << "on line " << linenum << " of " << pFilename
+	       << ", but instead found " << numColsProcessed << "." << endl << endl;
 	  return false;
 	}
+
+      parseTime.stop();
+      pModel->computeAndWriteMetric();
+      parseTime.start();
+      numSites++;
     }
-  m_chrom = chrom;
-  m_curBegPos = m_curEndPos = -1;
-  m_numValsProcessedForGroup1 = m_numValsProcessedForGroup2 = 0;
-  m_group1size = m_group2size = 0;
-  m_writeNullMetric = m_ofsNullValues.is_open();
-  m_numStates = m_size = 0; // these will be set by getQcontrib()
+  parseTime.stop();
   return true;
 }
 
-bool KLModel::getQcontrib(ifstream& infile, const char *pFilename, const unsigned int& Nsites)
+// Same as above, but for input written in the packed binary format (see binaryTallyFormat.h);
+// the header has already been read from ifs into hdr.  The records are of fixed size,
+// so the first record of a tile is found by seeking to it.  Identical sites are detected as above, from the records' values.
+bool parseBinaryInputWriteOutput(istream& ifs, const char *pFilename, const BinaryTallyHeader& hdr, Model* pModel,
+				 const SiteRange& range, uint64_t& numSites, Stopwatch& parseTime);
+bool parseBinaryInputWriteOutput(istream& ifs, const char *pFilename, const BinaryTallyHeader& hdr, Model* pModel,
+				 const SiteRange& range, uint64_t& numSites, Stopwatch& parseTime)
 {
-  const int BUFSIZE(100000);
-  char buf[BUFSIZE], *p;
-  const float LOG_Nsites(log(static_cast<float>(Nsites)));
-  unsigned long thisNumTallies, totalNumTallies(0);
+  const unsigned int bytesPerValue(hdr.bytesPerValue);
+  uint64_t recordnum(0);
 
-  if (!infile.getline(buf, BUFSIZE))
+  if (hdr.valuesPerRecord != pModel->size())
     {
-      cerr << "Error:  File " << pFilename << " is empty." << endl << endl;
+      cerr << "Error:  File " << pFilename << " contains " << hdr.valuesPerRecord << " values per site, "
+	   << "but the Q file(s) imply there should be " << pModel->size() << "." << endl << endl;
       return false;
     }
-  p = strtok(buf, "\t");
-  thisNumTallies = atol(p);
-  totalNumTallies += thisNumTallies;
-  if (0 == m_group1size)
-    m_Q1contrib.push_back(0 == thisNumTallies ? -999999. : LOG_Nsites - log(static_cast<float>(thisNumTallies)));
-  else
-    m_Q2contrib.push_back(0 == thisNumTallies ? -999999. : LOG_Nsites - log(static_cast<float>(thisNumTallies)));
-  while ((p = strtok(NULL, "\t")))
-    {
-      thisNumTallies = atol(p);
-      totalNumTallies += thisNumTallies;
-      if (0 == m_group1size)
-	m_Q1contrib.push_back(0 == thisNumTallies ? -999999. : LOG_Nsites - log(static_cast<float>(thisNumTallies)));
-      else
-	m_Q2contrib.push_back(0 == thisNumTallies ? -999999. : LOG_Nsites - log(static_cast<float>(thisNumTallies)));
-    }
-  // infile should only contain 1 line of data
-  if (infile.getline(buf, BUFSIZE))
+  if ((hdr.hasCoordinates != 0) == pModel->writingNulls())
     {
-      cerr << "Error:  File " << pFilename << " contains multiple lines of data; "
-	   << "it should contain a single line of tab-delimited state-pair tallies."
-	   << endl << endl;
+      cerr << "Error:  File " << pFilename << (hdr.hasCoordinates ? " contains" : " does not contain")
+	   << " genomic coordinates, which is inconsistent with the requested output." << endl << endl;
       return false;
     }
-
-  // The Q vector contains one element for each possible state.
-  if (0 == m_group1size)
-    m_numStates = m_Q1contrib.size();
-  else
+  if (bytesPerValue != 1 && bytesPerValue != 2 && bytesPerValue != 4)
     {
-      // Perform a sanity check for safety's sake.
-      unsigned int thisNumStates = m_Q2contrib.size();
-      if (thisNumStates != m_numStates)
-	{
-	  cerr << "Error:  The file containing tallies for Q for group 1 implies there are "
-	       << m_numStates << " possible states,\n"
-	       << "but file " << pFilename << " (containing Q for group 2) implies there are "
-	       << thisNumStates << " possible states." << endl << endl;
-	  return false;
-	}
-    }
-
-  // The sum of the tallies in this Q equals the total number of sites
-  // times the number of epigenomes
-  if (0 == m_group1size)
-    {
-      m_group1size = static_cast<unsigned int>(floor(static_cast<float>(totalNumTallies)/static_cast<float>(Nsites) + 0.01));
-      m_P1numerators.assign(m_Q1contrib.size(), 0);
-    }
-  else
-    {
-      m_group2size = static_cast<unsigned int>(floor(static_cast<float>(totalNumTallies)/static_cast<float>(Nsites) + 0.01));
-      m_P2numerators.assign(m_Q2contrib.size(), 0);
+      cerr << "Error:  Invalid value width (" << bytesPerValue << " bytes) found in the header of file "
+	   << pFilename << '.' << endl << endl;
+      return false;
     }
-  // Note:  The factor of m_group1size in each element of Q
-  // is not stored in m_Qcontrib, because each term of Q enters into the metric
-  // only via the ratio P/Q, and this factor cancels out within this ratio.
 
-  // At any site, the number of times any state is observed
-  // is a number between 0 and numEpigenomes, inclusive.
-  // At each site, we'll need the log2 of one or more of these tallies.
-  // We compute them here to avoid needlessly computing logs of the same numbers thousands or millions of times.
-  if (0 == m_group2size)
+  if (range.isRegion() && !hdr.hasCoordinates)
     {
-      m_logsOfObservationTallies.push_back(0); // unused
-      for (unsigned int i = 1; i <= m_group1size; i++)
-	m_logsOfObservationTallies.push_back(log(static_cast<float>(i)));
-    }
-  else
-    {
-      if (m_group2size > m_logsOfObservationTallies.size() - 1)
-	for (unsigned int i = m_logsOfObservationTallies.size(); i <= m_group2size; i++)
-	  m_logsOfObservationTallies.push_back(log(static_cast<float>(i)));
+      cerr << "Error:  File " << pFilename << " contains no genomic coordinates, so it can't be restricted to a region; use --tile instead." << endl << endl;
+      return false;
     }
 
-  m_size = m_P1numerators.size() + m_P2numerators.size();
-  return true;
-}
-
-bool KLModel::processInputValue(const unsigned int& thisTally)
-{
-  bool processingGroup1(true);
-
-  if (!m_writeNullMetric && 0 == m_numValsProcessedForGroup1)
+  vector<char> record((hdr.hasCoordinates ? 8 : 0) + hdr.valuesPerRecord * bytesPerValue), prevRecord;
+  const bool reuseIdenticalSites = pModel->reusesIdenticalSites();
+  numSites = 0;
+  if (range.isTile() && range.firstSite() > 1)
     {
-      if (-1 == m_curBegPos)
-	{
-	  m_curBegPos = thisTally; // actually a position, not a "tally"
-	  return true;
-	}
-      if (-1 == m_curEndPos)
+      recordnum = range.firstSite() - 1;
+      if (!ifs.seekg(static_cast<std::streamoff>(g_binaryTallyHeaderSize + recordnum * record.size()), std::ios::beg))
 	{
-	  m_curEndPos = thisTally; // actually a position, not a "tally"
-	  return true;
+	  cerr << "Error:  Unable to seek to record " << recordnum + 1 << " of file " << pFilename << '.' << endl << endl;
+	  return false;
 	}
     }
-  
-  // Check these variables, in case excess columns appear in this line of input.
-  // This is also how we determine, in the case of two groups of epigenomes being compared,
-  // whether the input value is for group 1 or group 2.
-  if (m_numValsProcessedForGroup1 == m_numStates)
+  parseTime.start();
+  while (ifs.read(&record[0], record.size()))
     {
-      if (0 == m_group2size)
+      const char *p = &record[0];
+      recordnum++;
+      if (range.restricted())
 	{
-	  cerr << "Error:  Found excess columns in a line of input; expected "
-	       << m_numStates << "." << endl;
-	  return false;
+	  const int cmp = range.compare(recordnum, NULL, hdr.hasCoordinates ? unpackLittleEndian(p, 4) : 0);
+	  if (cmp < 0)
+	    continue;
+	  if (cmp > 0)
+	    break;
 	}
-      else
+      if (reuseIdenticalSites)
 	{
-	  if (m_numValsProcessedForGroup2 == m_numStates)
+	  const size_t coordsSize(hdr.hasCoordinates ? 8 : 0);
+	  if (numSites != 0 && equal(record.begin() + coordsSize, record.end(), prevRecord.begin() + coordsSize))
 	    {
-	      cerr << "Error:  Found excess columns in a line of input; expected "
-		   << m_numStates * 2 << "." << endl;
-	      return false;
+	      parseTime.stop();
+	      pModel->repeatPreviousSite(static_cast<unsigned int>(hdr.hasCoordinates ? unpackLittleEndian(p, 4) : 0),
+					 static_cast<unsigned int>(hdr.hasCoordinates ? unpackLittleEndian(p + 4, 4) : 0));
+	      parseTime.start();
+	      numSites++;
+	      continue;
 	    }
-	  else
-	    processingGroup1 = false;
+	  prevRecord = record;
 	}
-    }
-
-  if (processingGroup1)
-    m_P1numerators[m_numValsProcessedForGroup1++] = thisTally;
-  else
-    m_P2numerators[m_numValsProcessedForGroup2++] = thisTally;
-
-  return true;
-}
-
-void KLModel::computeAndWriteMetric(void)
-{
-  static const float LOG2(0.6931471806);
-  static const float denom1 = LOG2 * static_cast<float>(m_group1size);
-  static const float denom2 = LOG2 * static_cast<float>(m_group2size);
-  vector<float> contribOfEachState(m_numStates, 0);
-  float retVal(0);
-  
-  for (unsigned int i = 0; i < m_P1numerators.size(); i++)
-    {
-      float term(0);
-      if (m_P1numerators[i] != 0)
+      if (hdr.hasCoordinates)
 	{
-	  if (m_Q1contrib[i] < -999.)
-	    term = m_Q1contrib[i];
-	  else
-	    term += (static_cast<float>(m_P1numerators[i])/denom1) *
-	      (m_logsOfObservationTallies[m_P1numerators[i]] + m_Q1contrib[i]);
+	  pModel->processInputValue(static_cast<unsigned int>(unpackLittleEndian(p, 4)));
+	  pModel->processInputValue(static_cast<unsigned int>(unpackLittleEndian(p + 4, 4)));
+	  p += 8;
 	}
-      if (m_group2size != 0)
+      for (unsigned int i = 0; i < hdr.valuesPerRecord; i++, p += bytesPerValue)
 	{
-	  if (m_P2numerators[i] != 0)
+	  if (!pModel->processInputValue(static_cast<unsigned int>(unpackLittleEndian(p, bytesPerValue))))
 	    {
-	      if (m_Q2contrib[i] < -999.)
-		term = -m_Q2contrib[i];
-	      else
-		term -= (static_cast<float>(m_P2numerators[i])/denom2) *
-		  (m_logsOfObservationTallies[m_P2numerators[i]] + m_Q2contrib[i]);
+	      cerr << "The error was detected in value " << i + 1 << " of record " << recordnum
+		   << " of file " << pFilename << "." << endl << endl;
+	      return false;
 	    }
 	}
-      if (!m_writeNullMetric) // no need to break down the metric by state if we're solely tasked with writing null metric values
-	contribOfEachState[i] = term;
-
-      retVal += (0 == m_group2size ? term : fabs(term));
+      parseTime.stop();
+      pModel->computeAndWriteMetric();
+      parseTime.start();
+      numSites++;
     }
-
-  if (!m_writeNullMetric)
+  parseTime.stop();
+  if ((ifs.gcount() != 0 && ifs.gcount() != static_cast<std::streamsize>(record.size()))
+      || (!range.restricted() && hdr.Nsites != 0 && hdr.Nsites != recordnum))
     {
-      vector<float>::iterator itMaxContributor = max_element(contribOfEachState.begin(), contribOfEachState.end(), FloatAbs_LT);
-      char formattedScoreFloat[10];
-      m_ofsObs << m_chrom << '\t' << m_curBegPos << '\t' << m_curEndPos << '\t'
-	       << distance(contribOfEachState.begin(), itMaxContributor) + 1 << '\t' // the state with the max contribution
-	       << fabs(*itMaxContributor) << '\t'
-	       << (*itMaxContributor > 0 ? "1" : "-1") << '\t'
-	       << retVal << endl;
-      m_ofsScores << m_chrom << '\t' << m_curBegPos << '\t' << m_curEndPos;
-      for (unsigned int i = 0; i < contribOfEachState.size(); i++)
-	{
-	  sprintf(formattedScoreFloat, "%.4g", contribOfEachState[i]);
-	  m_ofsScores << '\t' << formattedScoreFloat;
-	}
-      m_ofsScores << endl;
+      cerr << "Error:  File " << pFilename << " appears to be truncated; the header specifies "
+	   << hdr.Nsites << " sites, but " << recordnum << " complete records were found." << endl << endl;
+      return false;
     }
-  else
-    m_ofsNullValues << retVal << endl;
-  
-  // reset the counting variables and the "P numerator" (m_P1numerators, m_P2numerators) tallies
-  m_numValsProcessedForGroup1 = m_numValsProcessedForGroup2 = 0;
-  m_curBegPos = m_curEndPos = -1;
-  m_P1numerators.assign(m_P1numerators.size(), 0);
-  if (!m_P2numerators.empty())
-    m_P2numerators.assign(m_P2numerators.size(), 0);
+  return true;
 }
 
+// The number of records following the header of a binary file whose header doesn't record it
+// (e.g. because it was written to a pipe); the stream is then returned to the first record.
+bool countBinaryRecords(istream& ifs, const BinaryTallyHeader& hdr, uint64_t& numRecords);
+bool countBinaryRecords(istream& ifs, const BinaryTallyHeader& hdr, uint64_t& numRecords)
+{
+  const uint64_t recordSize((hdr.hasCoordinates ? 8 : 0) + static_cast<uint64_t>(hdr.valuesPerRecord) * hdr.bytesPerValue);
+  vector<char> buf(262144);
+  uint64_t numBytes(0);
+
+  while (ifs.read(&buf[0], buf.size()) || ifs.gcount() > 0)
+    numBytes += static_cast<uint64_t>(ifs.gcount());
+  numRecords = numBytes / recordSize;
+  ifs.clear();
+  return static_cast<bool>(ifs.seekg(static_cast<std::streamoff>(g_binaryTallyHeaderSize), std::ios::beg));
+}
 
-bool KLsModel::getQcontrib(ifstream& infile, const char *pFilename, const unsigned int& Nsites)
+// "Fused" alternative to running computeEpilogosPart1_perChrom and then this program on its output.
+// The input is the original data (chromosome, beg position, end position, state of epigenome 1, state of epigenome 2, ...).
+// Pass 1 reads it and only tallies Q, Q*, or Q** over all sites, as computeEpilogosPart1_perChrom does;
+// pass 2 rereads it and feeds each site's values directly to pObsModel, and, if two groups are being compared,
+// also feeds the values obtained by randomly permuting the states between the two groups to pNullModel.
+// The permutations are the same as those computeEpilogosPart1_perChrom makes with the same seed (see statePermuter.h).
+// If numPermutations > 1, each site is permuted that many times (permutation numbers 0, 1, ..., numPermutations-1),
+// and every permutation is scored by pNullModel, so each site contributes numPermutations null values;
+// the first is the one computeEpilogosPart1_perChrom would have written.
+// The per-site intermediate values are never written to disk.  The two passes are timed as separate phases in stats.
+// Pass 1 always reads every site, so that Q is that of the whole chromosome; only the sites in range are scored by pass 2.
+// If pObsModel writes qcat lines, the one for the file's first site has ID qcatID (so a tile's lines continue from there).
+bool twoPassesThroughStates(StateFileReader& reader, const char *pFilename, const measurementType& KLtype, const int& numStates,
+			    const set<int>& group1, const set<int>& group2, const uint64_t& seed, const unsigned int& numPermutations,
+			    const SiteRange& range, const uint64_t& qcatID, Model* pObsModel, Model* pNullModel, RunStats& stats);
+bool twoPassesThroughStates(StateFileReader& reader, const char *pFilename, const measurementType& KLtype, const int& numStates,
+			    const set<int>& group1, const set<int>& group2, const uint64_t& seed, const unsigned int& numPermutations,
+			    const SiteRange& range, const uint64_t& qcatID, Model* pObsModel, Model* pNullModel, RunStats& stats)
 {
-  const int BUFSIZE(100000);
-  char buf[BUFSIZE], *p;
-  const float LOG_Nsites(log(static_cast<float>(Nsites)));
-  unsigned long thisNumTallies, totalNumTallies(0);
+  SiteTallier tallier;
+  vector<int> allStatesAtThisSite;
+  ostringstream ossQ1, ossQ2;
+  const string Q1description = string("(Q tallies for group 1 computed from ") + pFilename + ")",
+    Q2description = string("(Q tallies for group 2 computed from ") + pFilename + ")";
 
-  if (!infile.getline(buf, BUFSIZE))
+  // Pass 1
+  stats.beginPhase("tallyQ");
+  tallier.init(KLtype, group1, group2, numStates);
+  while (reader.readSite(allStatesAtThisSite))
     {
-      cerr << "Error:  File " << pFilename << " is empty." << endl << endl;
-      return false;
-    }
-  p = strtok(buf, "\t");
-  thisNumTallies = atol(p);
-  totalNumTallies += thisNumTallies;
-  if (0 == m_group1size)
-    m_Qs1contrib.push_back(0 == thisNumTallies ? -999999. : LOG_Nsites - log(static_cast<float>(thisNumTallies)));
-  else
-    m_Qs2contrib.push_back(0 == thisNumTallies ? -999999. : LOG_Nsites - log(static_cast<float>(thisNumTallies)));
-  while ((p = strtok(NULL, "\t")))
-    {
-      thisNumTallies = atol(p);
-      totalNumTallies += thisNumTallies;
-      if (0 == m_group1size)
-	m_Qs1contrib.push_back(0 == thisNumTallies ? -999999. : LOG_Nsites - log(static_cast<float>(thisNumTallies)));
-      else
-	m_Qs2contrib.push_back(0 == thisNumTallies ? -999999. : LOG_Nsites - log(static_cast<float>(thisNumTallies)));
+      if (1 == reader.linenum() && !groupsFitInput(group1, group2, static_cast<int>(allStatesAtThisSite.size())))
+	return false;
+      tallier.processSite(allStatesAtThisSite, NULL, true);
     }
-  // infile should only contain 1 line of data
-  if (infile.getline(buf, BUFSIZE))
+  if (reader.failed())
+    return false;
+  if (0 == reader.linenum())
     {
-      cerr << "Error:  File " << pFilename << " contains multiple lines of data; "
-	   << "it should contain a single line of tab-delimited state-pair tallies."
-	   << endl << endl;
+      cerr << "Error:  File " << pFilename << " is empty." << endl << endl;
       return false;
     }
 
-  // The number of unique (unordered) state pairs is numStates*(numStates + 1)/2
-  // (yes, +1, not -1).  Thus if x is the number of elements in the Q* vector,
-  // numStates satisfies numStates^2 + numStates - 2*x == 0.
-  if (0 == m_group1size)
-    m_numStates = static_cast<unsigned int>(floor((sqrt(1. + 8.*static_cast<float>(m_Qs1contrib.size())) - 1.)/2. + 0.01));
-  else
+  const unsigned int Nsites(reader.linenum());
+  SiteRange resolvedRange(range);
+  resolvedRange.setNumSites(Nsites);
+  pObsModel->setQcatID(qcatID + resolvedRange.firstSite() - 1);
+  tallier.writeQ(ossQ1, ossQ2);
+  Model* models[2] = {pObsModel, pNullModel};
+  for (int i = 0; i < 2; i++)
     {
-      // Perform a sanity check for safety's sake.
-      unsigned int thisNumStates = static_cast<unsigned int>(floor((sqrt(1. + 8.*static_cast<float>(m_Qs2contrib.size())) - 1.)/2. + 0.01));
-      if (thisNumStates != m_numStates)
+      if (NULL == models[i])
+	continue;
+      istringstream issQ1(ossQ1.str());
+      if (!models[i]->getQcontrib(issQ1, Q1description.c_str(), Nsites))
+	return false;
+      if (!group2.empty())
 	{
-	  cerr << "Error:  The file containing tallies for Q* for group 1 implies there are "
-	       << m_numStates << " possible states,\n"
-	       << "but file " << pFilename << " (containing Q* for group 2) implies there are "
-	       << thisNumStates << " possible states." << endl << endl;
-	  return false;
+	  istringstream issQ2(ossQ2.str());
+	  if (!models[i]->getQcontrib(issQ2, Q2description.c_str(), Nsites))
+	    return false;
 	}
     }
 
-  // The sum of the tallies in this Q* equals the total number of sites
-  // times the number of unique epigenome pairs (the latter of which equals numEpigenomes*(numEpigenomes-1)/2).
-  if (0 == m_group1size)
-    {
-      m_group1size = static_cast<unsigned int>(floor((sqrt(1. + 8.*static_cast<float>(totalNumTallies)/static_cast<float>(Nsites)) + 1.)/2. + 0.01));
-      m_Ps1numerators.assign(m_Qs1contrib.size(), 0);
-    }
-  else
-    {
-      m_group2size = static_cast<unsigned int>(floor((sqrt(1. + 8.*static_cast<float>(totalNumTallies)/static_cast<float>(Nsites)) + 1.)/2. + 0.01));
-      m_Ps2numerators.assign(m_Qs2contrib.size(), 0);
-    }
-  // Note:  The factor of numEpiPairs*(numEpiPairs-1)/2 in each nonzero element of Q*
-  // is not stored in m_QsContrib, because each term of Q* enters into the metric
-  // only via the ratio P*/Q*, and this factor cancels out within this ratio.
-
-  // At any site, the number of times any unique state pair is observed
-  // is a number between 0 and numEpigenomes*(numEpigenomes-1)/2, inclusive.
-  // At each site, we'll need the log2 of one or more of these tallies.
-  // We compute them here to avoid needlessly computing logs of the same numbers thousands or millions of times.
-  if (0 == m_group2size)
+  // Pass 2
+  stats.beginPhase("score");
+  if (!reader.rewind())
     {
-      m_logsOfObservationTallies.push_back(0); // unused
-      for (unsigned int i = 1; i <= m_group1size*(m_group1size-1)/2; i++)
-	m_logsOfObservationTallies.push_back(log(static_cast<float>(i)));
+      cerr << "Error:  Unable to reread " << pFilename << '.' << endl << endl;
+      return false;
     }
-  else
+  if (!reader.restrictToRange(range))
+    return false;
+  uint64_t numSitesScored(0);
+  if (!scoreStates(reader, tallier, seed, numPermutations, pObsModel, pNullModel, numSitesScored))
+    return false;
+  if (!range.restricted() && numSitesScored != Nsites)
     {
-      if (m_group2size*(m_group2size-1)/2 > m_logsOfObservationTallies.size() - 1)
-	for (unsigned int i = m_logsOfObservationTallies.size(); i <= m_group2size*(m_group2size-1)/2; i++)
-	  m_logsOfObservationTallies.push_back(log(static_cast<float>(i)));
+      cerr << "Error:  Found " << Nsites << " lines in " << pFilename << " on the first pass through it, but "
+	   << numSitesScored << " lines on the second pass." << endl << endl;
+      return false;
     }
+  stats.setNumSites(numSitesScored);
 
-  // Lastly, it's helpful to have a lookup table to map from unique unordered state pairs 0, 1, 2, ...
-  // to the states that form those state pairs (i.e., 0 --> (1,1), 1 --> (1,2), ...,
-  // and 119 --> (15,15) if m_numStates = 15).
-  // Imagine assigning the unique unordered state pairs to the upper triangle (including the diagonal)
-  // of a matrix of m_numStates*m_numStates values, and imagine starting from the lower right corner element
-  // (maxUniqueStatePairID, which maps to (m_numStates,m_numStates)) and subtracting increments from it
-  // (delta = 0, 1, 2, ...) and deriving from those deltas the amount that needs to be subtracted
-  // from each row index of the matrix (delta_row) and each column index of the matrix (delta_column)
-  // to transform the state pair (m_numStates,m_numStates) into
-  // (row index, column index) = (state1, state2).
-  unsigned int maxUniqueStatePairID(m_numStates*(m_numStates+1)/2 - 1);
-  m_unorderedStatePairDecompositions.assign(maxUniqueStatePairID+1, make_pair(0,0));
-  for (unsigned int delta = 0; delta <= maxUniqueStatePairID; delta++)
-    {
-      unsigned int delta_row, delta_column;
-      delta_row = static_cast<unsigned int>(floor((-1. + sqrt(1. + 8.*static_cast<float>(delta)))/2. + 0.01));
-      if (delta <= 2)
-	{
-	  // Edge cases for delta = 0, 1, 2
-	  if (2 == delta)
-	    delta_column = 1;
-	  else
-	    delta_column = 0;
-	}
-      else
-	delta_column = delta - delta_row*(delta_row + 1)/2;
-      m_unorderedStatePairDecompositions[maxUniqueStatePairID - delta].first = m_numStates - delta_row;
-      m_unorderedStatePairDecompositions[maxUniqueStatePairID - delta].second = m_numStates - delta_column;
-    }
-  
-  m_size = m_Ps1numerators.size() + m_Ps2numerators.size();
   return true;
 }
 
-bool KLsModel::processInputValue(const unsigned int& thisTally)
+// Parse the group specification(s) for the "fused" mode of operation, as computeEpilogosPart1_perChrom does.
+// Used with --exemplars:  the observations and scores that pModel would otherwise write to the files it opens in init()
+// are instead written to ofsObs and ofsScores, opened here, and the observations are also collected into exemplars.
+// pModel must have been initialized without output files.
+bool openOutputWithExemplars(Model *pModel, const char *pObsFname, const char *pScoresFname, BgzfOutputStream& ofsObs,
+			     BgzfOutputStream& ofsScores, ExemplarOutputStream& obsWithExemplars, ExemplarRegions& exemplars);
+bool openOutputWithExemplars(Model *pModel, const char *pObsFname, const char *pScoresFname, BgzfOutputStream& ofsObs,
+			     BgzfOutputStream& ofsScores, ExemplarOutputStream& obsWithExemplars, ExemplarRegions& exemplars)
 {
-  bool processingGroup1(true);
-
-  if (!m_writeNullMetric && 0 == m_numValsProcessedForGroup1)
+  ofsObs.open(pObsFname);
+  if (!ofsObs)
     {
-      if (-1 == m_curBegPos)
-	{
-	  m_curBegPos = thisTally; // actually a position, not a "tally"
-	  return true;
-	}
-      if (-1 == m_curEndPos)
-	{
-	  m_curEndPos = thisTally; // actually a position, not a "tally"
-	  return true;
-	}
+      cerr << "Error:  Unable to open file \"" << pObsFname << "\" for writing." << endl << endl;
+      return false;
     }
-  
-  // Check these variables, in case excess columns appear in this line of input.
-  // This is also how we determine, in the case of two groups of epigenomes being compared,
-  // whether the input value is for group 1 or group 2.
-  if (m_numValsProcessedForGroup1 == m_Ps1numerators.size())
+  ofsScores.open(pScoresFname);
+  if (!ofsScores)
     {
-      if (m_numValsProcessedForGroup2 == m_Ps2numerators.size())
-	{
-	  cerr << "Error:  Found excess columns in a line of input; expected "
-	       << m_group1size + m_group2size << "." << endl;
-	  return false;
-	}
-      else
-	processingGroup1 = false;
+      cerr << "Error:  Unable to open file \"" << pScoresFname << "\" for writing." << endl << endl;
+      return false;
     }
-
-  if (processingGroup1)
-    m_Ps1numerators[m_numValsProcessedForGroup1++] = thisTally;
-  else
-    m_Ps2numerators[m_numValsProcessedForGroup2++] = thisTally;
-
+  obsWithExemplars.attach(ofsObs, exemplars);
+  pModel->redirectOutput(&obsWithExemplars, &ofsScores, NULL);
   return true;
 }
 
-void KLsModel::computeAndWriteMetric(void)
+// Called once every observation has been written via obsWithExemplars.
+bool writeExemplars(ExemplarOutputStream& obsWithExemplars, ExemplarRegions& exemplars, const char *pFilename);
+bool writeExemplars(ExemplarOutputStream& obsWithExemplars, ExemplarRegions& exemplars, const char *pFilename)
 {
-  static const float LOG2(0.6931471806);
-  static const float denom1 = LOG2 * static_cast<float>(m_group1size)*static_cast<float>(m_group1size - 1)/2.;
-  static const float denom2 = LOG2 * static_cast<float>(m_group2size)*static_cast<float>(m_group2size - 1)/2.;
-  vector<float> contribOfEachState(m_numStates, 0);
-  float retVal(0), contribOfMaxStatePairTerm(0);
-  unsigned int statePairWithMaxTerm_1based(0); // initialized to 0 to suppress compiler warnings
-
-  for (unsigned int uniqueStatePairID = 0; uniqueStatePairID < m_Ps1numerators.size(); uniqueStatePairID++)
+  obsWithExemplars.close();
+  if (!obsWithExemplars)
+    return false;
+  BgzfOutputStream ofs(pFilename);
+  if (!ofs)
     {
-      float term = 0;
-      float absTerm; // |term|
-      unsigned int stateOfEpi1_1based, stateOfEpi2_1based;
-
-      if (!m_writeNullMetric) // no need to break down the metric by state if we're solely tasked with writing null metric values
-	{
-	  stateOfEpi1_1based = m_unorderedStatePairDecompositions[uniqueStatePairID].first;
-	  stateOfEpi2_1based = m_unorderedStatePairDecompositions[uniqueStatePairID].second;
-	}
-      if (m_Ps1numerators[uniqueStatePairID] != 0)
-	{
-	  if (m_Qs1contrib[uniqueStatePairID] < -999.)
-	    term = m_Qs1contrib[uniqueStatePairID];
-	  else
-	    term += (static_cast<float>(m_Ps1numerators[uniqueStatePairID])/denom1) *
-	      (m_logsOfObservationTallies[m_Ps1numerators[uniqueStatePairID]] + m_Qs1contrib[uniqueStatePairID]);
-	}
-      if (m_group2size != 0)
-	{
-	  if (m_Ps2numerators[uniqueStatePairID] != 0)
-	    {
-	      if (m_Qs2contrib[uniqueStatePairID] < -999.)
-		term = -m_Qs2contrib[uniqueStatePairID];
-	      else
-		term -= (static_cast<float>(m_Ps2numerators[uniqueStatePairID])/denom2) *
-		  (m_logsOfObservationTallies[m_Ps2numerators[uniqueStatePairID]] + m_Qs2contrib[uniqueStatePairID]);
-	    }
-	}
-      absTerm = fabs(term);
-
-      if (!m_writeNullMetric) // no need to break down the metric by state if we're solely tasked with writing null metric values
-	{
-	  if (absTerm > fabs(contribOfMaxStatePairTerm))
-	    {
-	      contribOfMaxStatePairTerm = term;
-	      statePairWithMaxTerm_1based = uniqueStatePairID + 1;
-	    }
-	  contribOfEachState[stateOfEpi1_1based - 1] += 0.5*term;
-	  contribOfEachState[stateOfEpi2_1based - 1] += 0.5*term;
-	}
-
-      retVal += (0 == m_group2size ? term : absTerm);
-    }
-
-  if (!m_writeNullMetric)
-    {
-      // extract the states (s1,s2) from the unique unordered state pair
-      // that contributed the most to the metric
-      unsigned int s1 = m_unorderedStatePairDecompositions[statePairWithMaxTerm_1based - 1].first,
-	s2 = m_unorderedStatePairDecompositions[statePairWithMaxTerm_1based - 1].second;
-      vector<float>::iterator itMaxContributor = max_element(contribOfEachState.begin(), contribOfEachState.end(), FloatAbs_LT);
-      char formattedScoreFloat[10];
-      m_ofsObs << m_chrom << '\t' << m_curBegPos << '\t' << m_curEndPos << '\t'
-	       << distance(contribOfEachState.begin(), itMaxContributor) + 1 << '\t' // the state with the max contribution
-	       << fabs(*itMaxContributor) << '\t'
-	       << (*itMaxContributor > 0 ? "1" : "-1") << '\t'
-	       << '(' << s1 << ',' << s2 << ')' << '\t'
-	       << fabs(contribOfMaxStatePairTerm) << '\t'
-	       << (contribOfMaxStatePairTerm > 0 ? "1" : "-1") << '\t'
-	       << retVal << endl;
-      sprintf(formattedScoreFloat, "%.4g", contribOfEachState[0]);
-      m_ofsScores << m_chrom << '\t' << m_curBegPos << '\t' << m_curEndPos;
-      for (unsigned int i = 0; i < contribOfEachState.size(); i++)
-	{
-	  sprintf(formattedScoreFloat, "%.4g", contribOfEachState[i]);
-	  m_ofsScores << '\t' << formattedScoreFloat;
-	}
-      m_ofsScores << endl;
+      cerr << "Error:  Unable to open file \"" << pFilename << "\" for writing." << endl << endl;
+      return false;
     }
-  else
-    m_ofsNullValues << retVal << endl;
-  
-  // reset the counting variables and the "P* numerator" (m_Ps1numerators, m_Ps2numerators) tallies
-  m_numValsProcessedForGroup1 = m_numValsProcessedForGroup2 = 0;
-  m_curBegPos = m_curEndPos = -1;
-  m_Ps1numerators.assign(m_Ps1numerators.size(), 0);
-  if (!m_Ps2numerators.empty())
-    m_Ps2numerators.assign(m_Ps2numerators.size(), 0);
+  return exemplars.write(ofs);
 }
 
+// Adds the S3 statistics gathered by pModel (which may be a ParallelModel) to stats.
+void addStatePairGroupStats(const Model *pModel, RunStats& stats);
+void addStatePairGroupStats(const Model *pModel, RunStats& stats)
+{
+  StatePairGroupStats s;
+  pModel->addStatePairGroupStats(s);
+  if (0 == s.numSites)
+    return;
+  stats.addValue("statePairGroupsPerSiteMean", static_cast<double>(s.total)/static_cast<double>(s.numSites));
+  stats.addValue("statePairGroupsPerSiteMax", static_cast<double>(s.maximum));
+}
 
-bool KLssModel::getQcontrib(ifstream& infile, const char *pFilename, const unsigned int& Nsites)
+// Adds the times of the stages of scoring that pModel (and pModel2, if it isn't NULL) measured to stats,
+// following the time spent parsing the input, if that was measured.
+void addScoringTimes(const Model *pModel, const Model *pModel2, const Stopwatch *pParseTime, RunStats& stats);
+void addScoringTimes(const Model *pModel, const Model *pModel2, const Stopwatch *pParseTime, RunStats& stats)
 {
-  const int BUFSIZE(100000);
-  char buf[BUFSIZE], *p;
-  const float LOG2(0.6931471806), LOG_Nsites(log(static_cast<float>(Nsites)));
-  float denom;
-  vector<unsigned int> row, transposeRow;
-  vector<vector<unsigned int> > tallyMatrix, transposedTallyMatrix;
-  map<unsigned int, map<unsigned int,float> > *pQss = m_Qss1contrib.empty() ? &m_Qss1contrib : &m_Qss2contrib;
-  unsigned int linenum(0), fieldnum, numCols(0);
+  ScoringTimes t;
+  pModel->addScoringTimes(t);
+  if (pModel2 != NULL)
+    pModel2->addScoringTimes(t);
+  if (pParseTime != NULL)
+    stats.addValue("parseSeconds", pParseTime->seconds());
+  stats.addValue("scoreSeconds", t.scoreSeconds);
+  stats.addValue("formatSeconds", t.formatSeconds);
+}
 
-  while (infile.getline(buf, BUFSIZE))
+bool parseGroupSpecs(const char *pGroup1spec, const char *pGroup2spec, set<int>& group1, set<int>& group2);
+bool parseGroupSpecs(const char *pGroup1spec, const char *pGroup2spec, set<int>& group1, set<int>& group2)
+{
+  vector<char> spec(pGroup1spec, pGroup1spec + strlen(pGroup1spec) + 1);
+  if (!parseOneSetOfColumnSpecs(&spec[0], group1))
+    return false;
+  if (pGroup2spec != NULL)
     {
-      linenum++;
-      fieldnum = 0;
-      if (!(p = strtok(buf, "\t")))
-	{
-	  cerr << "Error:  Failed to parse line " << linenum << " of file " << pFilename << '.'
-	       << endl << endl;
-	  return false;
-	}
-      if (1 == linenum)
+      spec.assign(pGroup2spec, pGroup2spec + strlen(pGroup2spec) + 1);
+      if (!parseOneSetOfColumnSpecs(&spec[0], group2))
+	return false;
+      for (set<int>::const_iterator it2 = group2.begin(); it2 != group2.end(); it2++)
 	{
-	  row.push_back(atoi(p));
-	  numCols++;
-	  while ((p = strtok(NULL, "\t")))
+	  if (group1.find(*it2) != group1.end())
 	    {
-	      row.push_back(atoi(p));
-	      numCols++;
-	    }
-	  m_numStates = static_cast<unsigned int>(floor(sqrt(static_cast<float>(numCols)) + 0.01));
-	}
-      else
-	{
-	  row[fieldnum++] = atoi(p);
-	  while ((p = strtok(NULL, "\t")) && fieldnum < row.size())
-	    row[fieldnum++] = atoi(p);
-	  if (fieldnum != numCols)
-	    {
-	      cerr << "Error:  Found " << numCols << " columns on line 1 of " << pFilename
-		   << " but only " << fieldnum << " columns on line " << linenum
-		   << ".\nEach row must have the same number of columns; the # of columns "
-		   << "must equal the square of the number of possible states\n"
-		   << "(i.e., it must equal the number of possible state pairs)." << endl << endl;
+	      cerr << "Error:  Value " << *it2 << " was found in both group specifications." << endl << endl;
 	      return false;
 	    }
-	  else
-	    {
-	      if ((p = strtok(NULL, "\t")))
-		{
-		  cerr << "Error:  Found " << numCols << " columns on line 1 of " << pFilename
-		       << " but at least " << numCols+1 << " columns on line " << linenum
-		       << ".\nEach row must have the same number of columns; the # of columns "
-		       << "must equal the square of the number of possible states\n"
-		       << "(i.e., it must equal the number of possible state pairs)." << endl << endl;
-		  return false;
-		}
-	    }
-	}
-      tallyMatrix.push_back(row);
-    }
-
-  // The number of rows (linenum) equals numEpigenomes*(numEpigenomes - 1)/2,
-  // so the number of epigenomes satisfies numEpigenomes^2 - numEpigenomes - 2*linenum == 0.
-  if (0 == m_group1size)
-    m_group1size = static_cast<unsigned int>(floor(1. + (sqrt(1. + 8.*static_cast<float>(linenum)))/2. + 0.001));
-  else
-    m_group2size = static_cast<unsigned int>(floor(1. + (sqrt(1. + 8.*static_cast<float>(linenum)))/2. + 0.001));
-  
-  transposeRow.assign(tallyMatrix.size(), 0);
-  for (unsigned int c = 0; c < numCols; c++)
-    {
-      for (unsigned int r = 0; r < tallyMatrix.size(); r++)
-	transposeRow[r] = tallyMatrix[r][c];
-      transposedTallyMatrix.push_back(transposeRow);
-    }
-  
-  denom = LOG2 * static_cast<float>(tallyMatrix.size());
-
-  for (unsigned int statePairID = 0; statePairID < transposedTallyMatrix.size(); statePairID++)
-    {
-      map<unsigned int,float> epigenomePairID_to_QssContrib;
-      for (unsigned int epigenomePairID = 0; epigenomePairID < transposedTallyMatrix[0].size(); epigenomePairID++)
-	{
-	  if (transposedTallyMatrix[statePairID][epigenomePairID] != 0)
-	    epigenomePairID_to_QssContrib[epigenomePairID] =
-	      (LOG_Nsites - log(static_cast<float>(transposedTallyMatrix[statePairID][epigenomePairID]))) / denom;
-	  else
-	    epigenomePairID_to_QssContrib[epigenomePairID] = 999999.;	    
 	}
-      (*pQss)[statePairID + 1] = epigenomePairID_to_QssContrib;
     }
-
-  m_size = m_group1size*(m_group1size - 1)/2 + m_group2size*(m_group2size - 1)/2;
   return true;
 }
 
-bool KLssModel::processInputValue(const unsigned int& statePairID)
-{
-  static map<unsigned int, set<unsigned int> > emptyMap;
-  static pair<map<unsigned int, set<unsigned int> >, map<unsigned int, set<unsigned int> > > pairOfEmptyMaps(emptyMap, emptyMap);
-  bool processingGroup1(true);
-  unsigned int remainder = statePairID % m_numStates, statePairGroupID;
-
-  if (!m_writeNullMetric && 0 == m_numValsProcessedForGroup1)
-    {
-      if (-1 == m_curBegPos)
-	{
-	  m_curBegPos = statePairID; // actually a position, not a "statePairID"
-	  return true;
-	}
-      if (-1 == m_curEndPos)
-	{
-	  m_curEndPos = statePairID; // actually a position, not a "statePairID"
-	  return true;
-	}
-    }
-  
-  // Check these variables, in case excess columns appear in this line of input.
-  // This is also how we determine, in the case of two groups of epigenomes being compared,
-  // whether the input value is for group 1 or group 2.
-  if (m_numValsProcessedForGroup1 == m_group1size*(m_group1size-1)/2)
-    {
-      if (m_numValsProcessedForGroup2 == m_group2size*(m_group2size-1)/2)
-	{
-	  cerr << "Error:  Found excess columns in a line of input; expected "
-	       << m_group1size + m_group2size << "." << endl;
-	  return false;
-	}
-      else
-	processingGroup1 = false;
-    }
 
-  if (remainder != 0)
-    {
-      unsigned int quotient = statePairID / m_numStates;
-      if (quotient + 1 > remainder) // reflect statePairID across the matrix diagonal, from the lower triangular matrix to the upper one
-	statePairGroupID = m_numStates*(remainder - 1) + (quotient + 1);
-      else
-	statePairGroupID = statePairID;
-    }
-  else
-    statePairGroupID = statePairID;
-  map<unsigned int, pair<map<unsigned int, set<unsigned int> >, map<unsigned int, set<unsigned int> > > >::iterator it =
-    m_statePairGroupObservationsAtThisSite.find(statePairGroupID);
-  if (m_statePairGroupObservationsAtThisSite.end() == it)
-    {
-      set<unsigned int> thisEpigenomePairID;      
-      m_statePairGroupObservationsAtThisSite[statePairGroupID] = pairOfEmptyMaps;
-      if (processingGroup1)
-	{
-	  thisEpigenomePairID.insert(m_numValsProcessedForGroup1++);
-	  m_statePairGroupObservationsAtThisSite[statePairGroupID].first[statePairID] = thisEpigenomePairID;
-	}
-      else
-	{
-	  thisEpigenomePairID.insert(m_numValsProcessedForGroup2++);
-	  m_statePairGroupObservationsAtThisSite[statePairGroupID].second[statePairID] = thisEpigenomePairID;
-	}
-    }
-  else
-    {
-      map<unsigned int, set<unsigned int> >::iterator it2;
-      if (processingGroup1)
-	{
-	  it2 = it->second.first.find(statePairID);
-	  if (it->second.first.end() == it2)
+int main(int argc, const char* argv[])
+{
+  RunStats stats; // declared first, so that it reports once everything else has been cleaned up
+  bool fused(false), reportStats(false);
+  int numThreads(1), numCompressionThreads(0);
+  unsigned long seed(0);
+  int numPermutations(1);
+  bool nullHistogram(false), sortedNulls(false), memberStates(false), reuseIdenticalSites(false);
+  const char *pQcacheFilename(NULL), *pExemplarsFilename(NULL), *pQcatFilename(NULL);
+  unsigned long qcatID(1);
+  int maxExemplars(0);
+  ExemplarRegions exemplars;
+  ExemplarOutputStream obsWithExemplars;
+  BgzfOutputStream ofsObs, ofsScores; // used instead of the model's own files with --exemplars
+  SiteRange range;
+
+  // Options (arguments beginning with "--") may appear anywhere on the command line;
+  // remove them, so that the remaining arguments can be interpreted by position.
+  int numPositionalArgs(1);
+  for (int i = 1; i < argc; i++)
+    {
+      if (0 == strcmp(argv[i], "--fused"))
+	fused = true;
+      else if (0 == strcmp(argv[i], "--null-histogram"))
+	nullHistogram = true;
+      else if (0 == strcmp(argv[i], "--sorted-nulls"))
+	sortedNulls = true;
+      else if (0 == strcmp(argv[i], "--member-states"))
+	memberStates = true;
+      else if (0 == strcmp(argv[i], "--reuse-identical-sites"))
+	reuseIdenticalSites = true;
+      else if (0 == strcmp(argv[i], "--stats"))
+	reportStats = true;
+      else if (0 == strcmp(argv[i], "--qcache") && i + 1 < argc)
+	pQcacheFilename = argv[++i];
+      else if (0 == strcmp(argv[i], "--exemplars") && i + 1 < argc)
+	pExemplarsFilename = argv[++i];
+      else if (0 == strcmp(argv[i], "--qcat") && i + 1 < argc)
+	pQcatFilename = argv[++i];
+      else if (0 == strcmp(argv[i], "--qcat-id") && i + 1 < argc)
+	{
+	  char *pEnd;
+	  qcatID = strtoul(argv[++i], &pEnd, 10);
+	  if (pEnd == argv[i] || *pEnd != '\0' || 0 == qcatID)
 	    {
-	      set<unsigned int> thisEpigenomePairID;
-	      thisEpigenomePairID.insert(m_numValsProcessedForGroup1++);
-	      it->second.first[statePairID] = thisEpigenomePairID;
+	      cerr << "Error:  Invalid qcat ID (\"" << argv[i] << "\") received." << endl << endl;
+	      return -1;
 	    }
-	  else
-	    it2->second.insert(m_numValsProcessedForGroup1++);
 	}
-      else
+      else if ((0 == strcmp(argv[i], "--region") || 0 == strcmp(argv[i], "--tile")) && i + 1 < argc)
 	{
-	  it2 = it->second.second.find(statePairID);
-	  if (it->second.second.end() == it2)
-	    {
-	      set<unsigned int> thisEpigenomePairID;
-	      thisEpigenomePairID.insert(m_numValsProcessedForGroup2++);
-	      it->second.second[statePairID] = thisEpigenomePairID;
-	    }
-	  else
-	    it2->second.insert(m_numValsProcessedForGroup2++);
+	  if (!range.parseOption(argv[i], argv[i + 1]))
+	    return -1;
+	  i++;
 	}
-    }
-
-  return true;
-}
-
-void KLssModel::computeAndWriteMetric(void)
-{
-  float retVal(0);
-  vector<float> contribOfEachState(m_numStates, 0);
-  float contribOfMaxStatePairGroupTerm(0);
-  unsigned int statePairGroupWithMaxTerm_1based(0); // initialized to 0 to suppress compiler warnings
-
-  for (map<unsigned int, pair<map<unsigned int, set<unsigned int> >, map<unsigned int, set<unsigned int> > > >::const_iterator statePairGroup_it =
-	 m_statePairGroupObservationsAtThisSite.begin();
-       statePairGroup_it != m_statePairGroupObservationsAtThisSite.end(); statePairGroup_it++)
-    {
-      const unsigned int &statePairGroupID = statePairGroup_it->first;
-      float term = 0; // The contribution to D_KL from each state pair group.  Each encompasses state pairs (a,b) and (b,a), or (a,a) alone.
-      float absTerm; // |term|
-      unsigned int row, column; // 1-based row and column numbers of the upper triangular matrix of state pair groups;
-                                // these are the states of the two epigenomes within an epigenome pair
-      if (!m_writeNullMetric) // no need to break down the metric by state if we're solely tasked with writing null metric values
+      else if (0 == strcmp(argv[i], "--top") && i + 1 < argc)
 	{
-	  column = statePairGroupID % m_numStates;
-	  row = statePairGroupID / m_numStates + 1;
-	  if (0 == column)
+	  maxExemplars = atoi(argv[++i]);
+	  if (maxExemplars < 1)
 	    {
-	      column = m_numStates;
-	      row -= 1;
+	      cerr << "Error:  Invalid number of exemplar regions (\"" << argv[i] << "\") received." << endl << endl;
+	      return -1;
 	    }
 	}
-
-      for (map<unsigned int, set<unsigned int> >::const_iterator group1_it = statePairGroup_it->second.first.begin();
-	   group1_it != statePairGroup_it->second.first.end(); group1_it++)
+      else if (0 == strcmp(argv[i], "--seed") && i + 1 < argc)
 	{
-	  const unsigned int &statePairID = group1_it->first;
-	  for (set<unsigned int>::const_iterator epigenomePair_it = group1_it->second.begin();
-	       epigenomePair_it != group1_it->second.end(); epigenomePair_it++)
+	  char *pEnd;
+	  seed = strtoul(argv[++i], &pEnd, 10);
+	  if (pEnd == argv[i] || *pEnd != '\0')
 	    {
-	      const unsigned int &epigenomePairID = *epigenomePair_it;
-	      term += (m_Qss1contrib.find(statePairID)->second).find(epigenomePairID)->second;
+	      cerr << "Error:  Invalid random number seed (\"" << argv[i] << "\") received." << endl << endl;
+	      return -1;
 	    }
 	}
-      // The following loop will only be executed if a comparison between groups is being made.
-      for (map<unsigned int, set<unsigned int> >::const_iterator group2_it = statePairGroup_it->second.second.begin();
-	   group2_it != statePairGroup_it->second.second.end(); group2_it++)
+      else if (0 == strcmp(argv[i], "--permutations") && i + 1 < argc)
 	{
-	  const unsigned int &statePairID = group2_it->first;
-	  for (set<unsigned int>::const_iterator epigenomePair_it = group2_it->second.begin();
-	       epigenomePair_it != group2_it->second.end(); epigenomePair_it++)
+	  numPermutations = atoi(argv[++i]);
+	  if (numPermutations < 1)
 	    {
-	      const unsigned int &epigenomePairID = *epigenomePair_it;
-	      term -= (m_Qss2contrib.find(statePairID)->second).find(epigenomePairID)->second;
+	      cerr << "Error:  Invalid number of permutations (\"" << argv[i] << "\") received." << endl << endl;
+	      return -1;
 	    }
 	}
-
-      absTerm = fabs(term);
-      if (!m_writeNullMetric) // no need to break down the metric by state if we're solely tasked with writing null metric values
+      else if (0 == strcmp(argv[i], "--threads") && i + 1 < argc)
 	{
-	  if (absTerm > fabs(contribOfMaxStatePairGroupTerm))
+	  numThreads = atoi(argv[++i]);
+	  if (numThreads < 1)
 	    {
-	      contribOfMaxStatePairGroupTerm = term;
-	      statePairGroupWithMaxTerm_1based = statePairGroupID;
+	      cerr << "Error:  Invalid number of threads (\"" << argv[i] << "\") received." << endl << endl;
+	      return -1;
 	    }
-	  contribOfEachState[row - 1] += 0.5*term;    // row = state of epigenome 1 (1-based)
-	  contribOfEachState[column - 1] += 0.5*term; // column = state of epigenome 2 (1-based)
 	}
-      retVal += (0 == m_group2size ? term : absTerm);
-    }
-
-  if (!m_writeNullMetric)
-    {
-      unsigned int s1 = statePairGroupWithMaxTerm_1based / m_numStates + 1,
-	s2 = statePairGroupWithMaxTerm_1based % m_numStates; // statePairGroupID = (s1,s2)
-      vector<float>::iterator itMaxContributor = max_element(contribOfEachState.begin(), contribOfEachState.end(), FloatAbs_LT);
-      char formattedScoreFloat[10];
-      if (0 == s2)
-	{
-	  s2 = m_numStates;
-	  s1 -= 1;
-	}
-      m_ofsObs << m_chrom << '\t' << m_curBegPos << '\t' << m_curEndPos << '\t'
-	       << distance(contribOfEachState.begin(), itMaxContributor) + 1 << '\t' // the state with the max contribution
-	       << fabs(*itMaxContributor) << '\t'
-	       << (*itMaxContributor > 0 ? "1" : "-1") << '\t'
-	       << '(' << s1 << ',' << s2 << ')' << '\t'
-	       << fabs(contribOfMaxStatePairGroupTerm) << '\t'
-	       << (contribOfMaxStatePairGroupTerm > 0 ? "1" : "-1") << '\t'
-	       << retVal << endl;
-      m_ofsScores << m_chrom << '\t' << m_curBegPos << '\t' << m_curEndPos;
-      for (unsigned int i = 0; i < contribOfEachState.size(); i++)
+      else if (0 == strcmp(argv[i], "--compression-threads") && i + 1 < argc)
 	{
-	  sprintf(formattedScoreFloat, "%.4g", contribOfEachState[i]);
-	  m_ofsScores << '\t' << formattedScoreFloat;
-	}
-      m_ofsScores << endl;
-    }
-  else
-    m_ofsNullValues << retVal << endl;
-  
-  // reset counting variables and the map
-  m_numValsProcessedForGroup1 = m_numValsProcessedForGroup2 = 0;
-  m_curBegPos = m_curEndPos = -1;
-  m_statePairGroupObservationsAtThisSite.clear();
-}
-
-
-bool parseInputWriteOutput(ifstream& ifs, const char *pFilename, Model* pModel);
-bool parseInputWriteOutput(ifstream& ifs, const char *pFilename, Model* pModel)
-{
-  const int BUFSIZE(2000000);
-  char buf[BUFSIZE], *p;
-  unsigned int linenum(0), numColsProcessed;
-  const unsigned int numExpected = pModel->writingNulls() ? pModel->size() : pModel->size() + 2;
-  
-  while (ifs.getline(buf,BUFSIZE))
-    {
-      linenum++;
-      numColsProcessed = 0;
-
-      p = strtok(buf, "\t");
-      do {
-	unsigned int inputValue(atoi(p));
-	numColsProcessed++;
-	if (!pModel->processInputValue(inputValue))
-	  {
-	    cerr << "The error was detected in column " << numColsProcessed
-		 << " of line " << linenum << " of file " << pFilename
-		 << "." << endl << endl;
-	    return false;
-	  }
-      } while ((p = strtok(NULL, "\t")));
-
-      if (numColsProcessed != numExpected)
-	{
-	  cerr << "Error:  Expected to find " << numExpected << " columns of integers "
-	       << "on line " << linenum << " of " << pFilename
-	       << ", but instead found " << numColsProcessed << "." << endl << endl;
-	  return false;
+	  numCompressionThreads = atoi(argv[++i]);
+	  if (numCompressionThreads < 0)
+	    {
+	      cerr << "Error:  Invalid number of compression threads (\"" << argv[i] << "\") received." << endl << endl;
+	      return -1;
+	    }
 	}
-
-      pModel->computeAndWriteMetric();
+      else
+	argv[numPositionalArgs++] = argv[i];
     }
-  return true;
-}
-
+  argc = numPositionalArgs;
+  ofsObs.setCompressionThreads(static_cast<unsigned int>(numCompressionThreads));
+  ofsScores.setCompressionThreads(static_cast<unsigned int>(numCompressionThreads));
+  exemplars.setMaxRegions(static_cast<size_t>(maxExemplars));
+  if (reportStats)
+    stats.enable(argv[0]);
 
-int main(int argc, const char* argv[])
-{
-  if (8 != argc && 9 != argc && 7 != argc)
+  if ((!fused && 8 != argc && 9 != argc && 7 != argc) || (fused && 8 != argc && 10 != argc))
     {
     Usage:
       cerr << "Usage type #1:  " << argv[0] << " infile metric NsitesGenomewide infileQ outfileObs outfileScores chr [infileQ2]\n"
@@ -934,7 +534,7 @@ int main(int argc, const char* argv[])
 	   << "  the magnitude of that contribution, and the total value of the metric.\n"
 	   << "  If two groups are specified (see below), it will also include a column containing +/-1,\n"
 	   << "  specifying whether the first group (+1) or the second (-1) contributes more to the overall metric.\n"
-	   << "* outfileScores will receive per-state score contributions in state order (uncompressed)\n"
+	   << "* outfileScores will receive per-state score contributions in state order\n"
 	   << "* Optional additional argument infileQ2 can be used to specify Q, Q*, or Q** for a 2nd group of epigenomes,\n"
 	   << "  in which case the metric quantifies the difference (distance) between them.\n"
 	   << "\n"
@@ -944,22 +544,199 @@ int main(int argc, const char* argv[])
 	   << "* outfileNulls will receive the total difference metric for each line of permuted states (or state pairs)\n"
 	   << "* the remaining arguments are the same as described above\n"
 	   << "This second \"usage type\" is used to generate a null distribution, for estimating significance\n"
-	   << "of the metric values calculated via \"usage type 1.\""
+	   << "of the metric values calculated via \"usage type 1.\"\n"
+	   << "\n"
+	   << "In both cases, infile can be tab-delimited text or the packed binary format written by computeEpilogosPart1_perChrom --binary;\n"
+	   << "the format is detected automatically.\n"
+	   << "\n"
+	   << "Usage type #3:  " << argv[0] << " --fused [--seed S] [--permutations M] stateFile metric numStates outfileObs outfileScores chr groupSpec [group2spec outfileNulls]\n"
+	   << "where\n"
+	   << "* stateFile is the input to computeEpilogosPart1_perChrom (tab-delimited chrom, start, stop, state of epigenome1, ...)\n"
+	   << "* numStates, groupSpec, and group2spec are as described for computeEpilogosPart1_perChrom\n"
+	   << "* outfileNulls will receive the metric for each site after randomly permuting the states between the two groups;\n"
+	   << "  the permutations are the same as those of computeEpilogosPart1_perChrom --seed S (default 0);\n"
+	   << "  with --permutations M, each site is permuted M times (default 1), and outfileNulls receives M lines per site\n"
+	   << "* the remaining arguments are the same as described above\n"
+	   << "This third \"usage type\" makes two passes through stateFile, the first to tally Q (or Q* or Q**) over its sites\n"
+	   << "and the second to compute the metric at each site, without writing any intermediate files.\n"
+	   << "It is equivalent to running computeEpilogosPart1_perChrom on stateFile, followed by usage type 1 (and usage type 2\n"
+	   << "if two groups are specified), with NsitesGenomewide and Q taken from stateFile alone.\n"
+	   << "\n"
+	   << "Every input file can be gzip- or bgzip-compressed; every output file whose name ends in \".gz\"\n"
+	   << "is written with bgzip-compatible (BGZF) compression, so it can be indexed with tabix.\n"
+	   << "\n"
+	   << "The option --null-histogram can be added to usage types 2 and 3, to write a histogram of the null values\n"
+	   << "to outfileNulls instead of the values themselves; computeEpilogosPart3_perChrom accepts either,\n"
+	   << "and histograms of different chromosomes can be merged by concatenating them.\n"
+	   << "The option --sorted-nulls can be added instead, to write the null values as a sorted run (the distinct values and their tallies,\n"
+	   << "in decreasing order); computeEpilogosPart3_perChrom --merge-nulls merges the runs of all chromosomes into a null table\n"
+	   << "with bounded memory, and the p-values obtained from the table are exactly those obtained from the values themselves.\n"
+	   << "\n"
+	   << "The option --qcache cacheFile can be added to usage types 1 and 2:  the tables derived from Q (and Q2) are read\n"
+	   << "from cacheFile if it was written for the same metric, NsitesGenomewide, and contents of the Q file(s); otherwise they're computed\n"
+	   << "as usual and written to cacheFile, so every later run using the same Q can map them into memory instead.\n"
+	   << "\n"
+	   << "The option --member-states can be added to usage types 1 and 2 for metric S3, if infile holds the states of the epigenomes\n"
+	   << "in group 1 (and group 2) instead of state pairs (see computeEpilogosPart1_perChrom --member-states);\n"
+	   << "this is detected automatically if infile is in the binary format.\n"
+	   << "\n"
+	   << "The option --exemplars exemplarFile can be added to usage types 1 and 3:  the exemplar regions of the chromosome\n"
+	   << "(the highest-scoring site of each run of sites with the same dominant state, ranked by score) are written to exemplarFile,\n"
+	   << "as the observations are written; with --top K, only the K highest-ranked regions are written.\n"
+	   << "With two groups, give --exemplars to computeEpilogosPart3_perChrom instead, so that the regions include p-values.\n"
+	   << "\n"
+	   << "The option --qcat qcatFile can be added to usage types 1 and 3:  each site's scores are also written to qcatFile,\n"
+	   << "sorted, in the \"qcat\" format of HiGlass and WashU Epigenome Browser tracks, exactly as scripts/qcatCreator.py\n"
+	   << "would write them from outfileScores.  If qcatFile ends in \".gz\", it's indexed by tabix as it's written (qcatFile.tbi).\n"
+	   << "The sites' IDs are their line numbers; with --qcat-id N, they begin at N instead of 1,\n"
+	   << "so e.g. the qcat files of consecutive chromosomes can be numbered as if they were one file.\n"
+	   << "\n"
+	   << "The option --region chrom:beg-end or --tile i/N can be added to any of the above, to score only the sites\n"
+	   << "whose begin coordinates are in [beg, end), or only tile i of N tiles of nearly equal numbers of consecutive sites\n"
+	   << "(as computeEpilogosPart1_perChrom numbers them; null values can only be divided into tiles).  NsitesGenomewide and Q\n"
+	   << "are unaffected, as is every site's output, so e.g. the outputs of tiles 1, 2, ..., N concatenated are those of the whole chromosome.\n"
+	   << "In usage type 3, Q is still tallied over every site of stateFile; if stateFile has a site index\n"
+	   << "(see computeEpilogosPart1_perChrom --index-sites), the second pass begins near the first site in range.\n"
+	   << "\n"
+	   << "The option --reuse-identical-sites can be added to any of the above:  a site whose values are the same as those\n"
+	   << "of the previous site (e.g. in a long quiescent region) isn't scored again; its output is the previous site's\n"
+	   << "with its own coordinates, so the output is unchanged.  In usage type 3, each site's states are still permuted.\n"
+	   << "\n"
+	   << "The option --threads N can be added to any of the above, to score the sites using N threads;\n"
+	   << "the output is the same, and in the same order, as with a single thread (the default).\n"
+	   << "Similarly, with --compression-threads N, the output files whose names end in \".gz\" are compressed\n"
+	   << "by N background threads (default 0, i.e. by the thread writing them); the files are the same either way.\n"
+	   << "\n"
+	   << "The option --stats can be added to any of the above, to write a report (a JSON object) to standard error on exit:\n"
+	   << "wall and CPU time in total and per phase, sites per second, the total size of the input files, bytes written, peak memory use,\n"
+	   << "for S3, the mean and maximum number of state pair groups observed per site, and the time spent on each stage of the \"score\" phase:\n"
+	   << "parseSeconds (reading and parsing the input, except in usage type 3), scoreSeconds (computing the metric),\n"
+	   << "and formatSeconds (formatting and writing the output).  With --threads, the last two are summed over the threads,\n"
+	   << "so they can exceed the phase's wall time.  Timing the stages of each site takes a little time itself."
 	   << endl << endl;
       return -1;
     }
 
+  if (fused)
+    {
+      const char *pStateFilename(argv[1]);
+      const int measurementTypeInt(atoi(argv[2])), numStates(atoi(argv[3]));
+      StateFileReader stateFile;
+      set<int> group1, group2;
+      Model *pObsModel(NULL), *pNullModel(NULL);
+      ParallelModel *pParallelObsModel(NULL), *pParallelNullModel(NULL);
+      bool OK(true);
+
+      if (KL != measurementTypeInt && KLs != measurementTypeInt && KLss != measurementTypeInt)
+	{
+	  cerr << "Error:  Invalid \"metric\" received (2nd argument, \"" << argv[2] << "\").\n"
+	       << "The valid options are 1 (to use S1), 2 (to use S2), and 3 (to use S3)." << endl << endl;
+	  goto Usage;
+	}
+      if (numStates < 1)
+	{
+	  cerr << "Error:  Invalid number of states (\"" << argv[3] << "\") received." << endl << endl;
+	  goto Usage;
+	}
+      if (!stateFile.open(pStateFilename, numStates))
+	{
+	  cerr << "Error:  Unable to open file \"" << pStateFilename << "\" for reading." << endl << endl;
+	  goto Usage;
+	}
+      stats.addInputFile(pStateFilename);
+      if (!parseGroupSpecs(argv[7], 10 == argc ? argv[8] : NULL, group1, group2))
+	return -1;
+
+      pObsModel = createModel(static_cast<measurementType>(measurementTypeInt));
+      pObsModel->setCompressionThreads(static_cast<unsigned int>(numCompressionThreads));
+      if (pQcatFilename != NULL)
+	pObsModel->writeQcat(pQcatFilename);
+      if (reuseIdenticalSites)
+	pObsModel->reuseIdenticalSites();
+      if (reportStats)
+	pObsModel->timeScoring();
+      if (NULL == pExemplarsFilename)
+	OK = pObsModel->init(argv[4], argv[5], NULL, string(argv[6]));
+      else
+	OK = pObsModel->init(NULL, NULL, NULL, string(argv[6]))
+	  && openOutputWithExemplars(pObsModel, argv[4], argv[5], ofsObs, ofsScores, obsWithExemplars, exemplars);
+      if (OK && 10 == argc)
+	{
+	  pNullModel = createModel(static_cast<measurementType>(measurementTypeInt));
+	  pNullModel->setCompressionThreads(static_cast<unsigned int>(numCompressionThreads));
+	  if (nullHistogram)
+	    pNullModel->writeNullsAsHistogram();
+	  else if (sortedNulls)
+	    pNullModel->writeNullsAsSortedRun();
+	  if (reuseIdenticalSites)
+	    pNullModel->reuseIdenticalSites();
+	  if (reportStats)
+	    pNullModel->timeScoring();
+	  if (!pNullModel->init(NULL, NULL, argv[9], string(argv[6])))
+	    OK = false;
+	}
+      if (OK && numThreads > 1)
+	{
+	  // The null values are computed alongside the observations, so the threads are divided between them.
+	  pParallelObsModel = new ParallelModel(pObsModel, NULL == pNullModel ? numThreads : (numThreads + 1)/2);
+	  pObsModel = pParallelObsModel;
+	  if (pNullModel != NULL)
+	    {
+	      pParallelNullModel = new ParallelModel(pNullModel, numThreads/2);
+	      pNullModel = pParallelNullModel;
+	    }
+	}
+      if (OK)
+	OK = twoPassesThroughStates(stateFile, pStateFilename, static_cast<measurementType>(measurementTypeInt),
+				    numStates, group1, group2, seed,
+				    static_cast<unsigned int>(numPermutations), range, qcatID, pObsModel, pNullModel, stats);
+      if (pParallelObsModel != NULL)
+	{
+	  if (!pParallelObsModel->finish())
+	    OK = false;
+	  if (pParallelNullModel != NULL && !pParallelNullModel->finish())
+	    OK = false;
+	}
+      stats.endPhase();
+      if (OK && stats.enabled())
+	{
+	  addStatePairGroupStats(pObsModel, stats);
+	  addScoringTimes(pObsModel, pNullModel, NULL, stats);
+	}
+      if (pParallelObsModel != NULL)
+	{
+	  pObsModel = pParallelObsModel->wrappedModel();
+	  delete pParallelObsModel;
+	  if (pParallelNullModel != NULL)
+	    {
+	      pNullModel = pParallelNullModel->wrappedModel();
+	      delete pParallelNullModel;
+	    }
+	}
+      if (OK && pExemplarsFilename != NULL)
+	OK = writeExemplars(obsWithExemplars, exemplars, pExemplarsFilename);
+      delete pObsModel;
+      delete pNullModel;
+      return OK ? 0 : -1;
+    }
+
   const char *pOutfileObsFilename(NULL), *pOutfileScoresFilename(NULL), *pOutfileNullValsFilename(NULL),
     *pInfilename(argv[1]), *pQ1filename(argv[4]), *pQ2filename(NULL);
-  ifstream infile(pInfilename), infileQ1(pQ1filename), infileQ2;
+  GzInputStream infile(pInfilename), infileQ1(pQ1filename), infileQ2;
+  BinaryTallyHeader hdr;
   ofstream outfileObs, outfileScores, outfileNulls;
   const int measurementTypeInt(atoi(argv[2]));
   const unsigned int Nsites(atoi(argv[3]));
+  uint64_t numSites(0);
   string chrom;
+  QcontribCache qcache; // declared before the models, because KLssModel can use its tables in place
+  QcontribCacheKey qcacheKey;
+  bool haveQcacheKey(false);
   KLModel mKL;
   KLsModel mKLs;
   KLssModel mKLss;
   Model *pM;
+  Stopwatch parseTime;
   
   if (KL != measurementTypeInt && KLs != measurementTypeInt && KLss != measurementTypeInt)
     {
@@ -977,6 +754,8 @@ int main(int argc, const char* argv[])
       cerr << "Error:  Unable to open file \"" << pQ1filename << "\" for reading." << endl << endl;
       goto Usage;
     }  
+  stats.addInputFile(pInfilename);
+  stats.addInputFile(pQ1filename);
   if (7 == argc)
     {
       pQ2filename = argv[5];
@@ -998,6 +777,7 @@ int main(int argc, const char* argv[])
 	  cerr << "Error:  Unable to open file \"" << pQ2filename << "\" for reading." << endl << endl;
 	  goto Usage;
 	}
+      stats.addInputFile(pQ2filename);
     }
 
   if (KL == measurementTypeInt)
@@ -1010,14 +790,117 @@ int main(int argc, const char* argv[])
 	pM = &mKLss;
     }
 
-  if (!pM->init(pOutfileObsFilename, pOutfileScoresFilename, pOutfileNullValsFilename, chrom))
+  if (nullHistogram)
+    pM->writeNullsAsHistogram();
+  else if (sortedNulls)
+    pM->writeNullsAsSortedRun();
+  if (reuseIdenticalSites)
+    pM->reuseIdenticalSites();
+  if (reportStats)
+    pM->timeScoring();
+  pM->setCompressionThreads(static_cast<unsigned int>(numCompressionThreads));
+  if (pQcatFilename != NULL)
+    {
+      if (NULL == pOutfileScoresFilename)
+	{
+	  cerr << "Error:  --qcat requires scores, which usage type 2 doesn't write." << endl << endl;
+	  return -1;
+	}
+      pM->writeQcat(pQcatFilename);
+    }
+  if (pExemplarsFilename != NULL)
+    {
+      if (NULL == pOutfileObsFilename)
+	{
+	  cerr << "Error:  --exemplars requires observations, which usage type 2 doesn't write." << endl << endl;
+	  return -1;
+	}
+      if (!pM->init(NULL, NULL, NULL, chrom)
+	  || !openOutputWithExemplars(pM, pOutfileObsFilename, pOutfileScoresFilename, ofsObs, ofsScores, obsWithExemplars, exemplars))
+	return -1;
+    }
+  else if (!pM->init(pOutfileObsFilename, pOutfileScoresFilename, pOutfileNullValsFilename, chrom))
     return -1;
-  if (!pM->getQcontrib(infileQ1, pQ1filename, Nsites))
+  stats.beginPhase("readQ");
+  if (pQcacheFilename != NULL)
+    {
+      qcacheKey.metric = measurementTypeInt;
+      qcacheKey.Nsites = Nsites;
+      haveQcacheKey = getQcontribCacheKey(pQ1filename, pQ2filename, qcacheKey);
+    }
+  if (!(haveQcacheKey && qcache.open(pQcacheFilename, qcacheKey) && pM->useQcontribCache(qcache)))
+    {
+      if (!pM->getQcontrib(infileQ1, pQ1filename, Nsites))
+	return -1;
+      if (infileQ2.is_open() && !pM->getQcontrib(infileQ2, pQ2filename, Nsites))
+	return -1;
+      if (haveQcacheKey)
+	pM->writeQcontribCache(pQcacheFilename, qcacheKey); // a failure here only costs later jobs time
+    }
+
+  ParallelModel parallelModel(pM, numThreads);
+  if (numThreads > 1)
+    pM = &parallelModel;
+
+  const bool binaryInput = readBinaryTallyHeader(infile, hdr);
+  if (binaryInput)
+    {
+      if (static_cast<int>(hdr.metric) != measurementTypeInt)
+	{
+	  cerr << "Error:  File " << pInfilename << " was written for metric S" << hdr.metric
+	       << ", but metric S" << measurementTypeInt << " was requested." << endl << endl;
+	  return -1;
+	}
+      if (hdr.formatVersion != g_binaryTallyFormatVersion && hdr.formatVersion != g_binaryTallyMemberStatesFormatVersion)
+	{
+	  cerr << "Error:  File " << pInfilename << " is in version " << hdr.formatVersion
+	       << " of the binary format, which this program can't read." << endl << endl;
+	  return -1;
+	}
+      memberStates = (g_binaryTallyMemberStatesFormatVersion == hdr.formatVersion);
+    }
+  if (memberStates && !pM->useMemberStates())
+    {
+      cerr << "Error:  Only input for metric S3 can hold the states of the epigenomes (--member-states)." << endl << endl;
+      return -1;
+    }
+  if (range.isRegion() && pM->writingNulls())
+    {
+      cerr << "Error:  Null values have no genomic coordinates, so they can't be restricted to a region; use --tile instead." << endl << endl;
+      return -1;
+    }
+  stats.beginPhase("score");
+  if (range.isTile())
+    {
+      uint64_t numLines(hdr.Nsites);
+      if ((binaryInput && 0 == hdr.Nsites && !countBinaryRecords(infile, hdr, numLines))
+	  || (!binaryInput && !countLines(infile, numLines)))
+	{
+	  cerr << "Error:  Unable to count the sites of " << pInfilename << ", to divide them into tiles." << endl << endl;
+	  return -1;
+	}
+      range.setNumSites(numLines);
+    }
+  pM->setQcatID(qcatID + range.firstSite() - 1);
+  if (reportStats)
+    parseTime.enable();
+  if (binaryInput)
+    {
+      if (!parseBinaryInputWriteOutput(infile, pInfilename, hdr, pM, range, numSites, parseTime))
+	return -1;
+    }
+  else if (!parseInputWriteOutput(infile, pInfilename, pM, range, numSites, parseTime))
     return -1;
-  if (infileQ2.is_open() && !pM->getQcontrib(infileQ2, pQ2filename, Nsites))
+  if (!parallelModel.finish())
     return -1;
-
-  if (!parseInputWriteOutput(infile, pInfilename, pM))
+  stats.endPhase();
+  stats.setNumSites(numSites);
+  if (stats.enabled())
+    {
+      addStatePairGroupStats(pM, stats);
+      addScoringTimes(pM, NULL, &parseTime, stats);
+    }
+  if (pExemplarsFilename != NULL && !writeExemplars(obsWithExemplars, exemplars, pExemplarsFilename))
     return -1;
 
   return 0;
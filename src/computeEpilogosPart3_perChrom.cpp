@@ -7,209 +7,239 @@
 #include <cstring>
 #include <cmath>
 #include <cfloat>
+#include <climits>
 #include <string>
 #include <utility> // for pair()
+#include "compressedStreams.h"
+#include "exemplarRegions.h"
+#include "nullDistribution.h"
+#include "nullHistogram.h"
+#include "nullTable.h"
+#include "runStats.h"
+#include "siteRange.h"
 
 using namespace std;
 
-const float g_changeOfScale(1.0e+7); // for converting metrics to integers
-
-struct NullData {
-  long metricAsInt;
-  int numOccs;
-  float pvalue;
-};
-
-struct OutputValue {
-  string inputEntry;
-  long metricAsInt;
-  long outputOrder;
-  float pvalue;
-};
-
-bool Metric_GT(const OutputValue& a, const OutputValue& b);
-bool Metric_GT(const OutputValue& a, const OutputValue& b)
+// Merges files of exemplar regions (e.g. one per chromosome, written with --exemplars) into one, ranked as in each file.
+bool mergeExemplarFiles(const vector<const char*>& infiles, ExemplarRegions& exemplars, ostream& ofs);
+bool mergeExemplarFiles(const vector<const char*>& infiles, ExemplarRegions& exemplars, ostream& ofs)
 {
-  return a.metricAsInt > b.metricAsInt;
-}
+  string line;
 
-bool OutputOrder_LT(const OutputValue& a, const OutputValue& b);
-bool OutputOrder_LT(const OutputValue& a, const OutputValue& b)
-{
-  return a.outputOrder < b.outputOrder;
-}
-
-// The input file is assumed to contain an arbitrary number of columns of data,
-// the last of which is the metric for which a p-value will be estimated.
-// Columns 1-3 are assumed to be genomic coordinates (chr, begin, end).
-// The output file will be same as the input file, but with p-value estimates appended.
-// FDR estimates will need to be made for the p-values by another program/procedure.
-
-bool loadDataAndReport(ifstream& ifs, ofstream& ofs, const vector<NullData>& nullDistn);
-bool loadDataAndReport(ifstream& ifs, ofstream& ofs, const vector<NullData>& nullDistn)
-{
-  const int BUFSIZE(10000);
-  char buf[BUFSIZE], *p;
-  string prevColumnStr;
-  OutputValue ov;
-  vector<OutputValue> outvec;
-  long linenum(0);
-  int fieldnum, expectedFinalFieldNum(-1);
-  
-  while (ifs.getline(buf,BUFSIZE))
+  for (unsigned int i = 0; i < infiles.size(); i++)
     {
-      linenum++;
-      fieldnum = 0;
-      ov.inputEntry = string(buf);
-      ov.outputOrder = linenum;
-      prevColumnStr.clear();
-      p = strtok(buf, "\t");
-      while (p != NULL)
-	{
-	  fieldnum++;
-	  prevColumnStr = string(p);
-	  p = strtok(NULL, "\t");
-	}
-      if (1 == linenum)
-	expectedFinalFieldNum = fieldnum;
-      else
+      GzInputStream ifs(infiles[i]);
+      if (!ifs)
 	{
-	  if (fieldnum != expectedFinalFieldNum)
-	    {
-	      cerr << "Error:  Detected " << expectedFinalFieldNum << " column(s) of data on line 1 of the input file,\n"
-		   << "but detected " << fieldnum << " column(s) of data on line " << linenum << '.' << endl << endl;
-	      return false;
-	    }
+	  cerr << "Error:  Failed to open file \"" << infiles[i] << "\" for read." << endl << endl;
+	  return false;
 	}
-      ov.metricAsInt = static_cast<long>(floor(atof(prevColumnStr.c_str())*g_changeOfScale + 0.5));
-      outvec.push_back(ov);
+      while (getline(ifs, line))
+	if (!line.empty() && !exemplars.addRegion(line.data(), line.size()))
+	  {
+	    cerr << "The error was detected in file \"" << infiles[i] << "\"." << endl << endl;
+	    return false;
+	  }
     }
+  return exemplars.write(ofs);
+}
 
-  sort(outvec.begin(), outvec.end(), Metric_GT);
-  float pval(0);
-  unsigned int idxNull(0);
-  for (unsigned int idxObs = 0; idxObs < outvec.size(); idxObs++)
+// Writes infile, with p-values appended, to outfile, and the exemplar regions to pExemplarsFilename (unless it's NULL).
+template<class NullDistn>
+bool report(istream& infile, ostream& outfile, const NullDistn& nullDistn, const char *pExemplarsFilename,
+	    ExemplarRegions& exemplars, const SiteRange& range, long& numSites);
+template<class NullDistn>
+bool report(istream& infile, ostream& outfile, const NullDistn& nullDistn, const char *pExemplarsFilename,
+	    ExemplarRegions& exemplars, const SiteRange& range, long& numSites)
+{
+  if (NULL == pExemplarsFilename)
+    return loadDataAndReport(infile, outfile, nullDistn, &numSites, &range);
+
+  ExemplarOutputStream outfileWithExemplars;
+  outfileWithExemplars.attach(outfile, exemplars);
+  if (!loadDataAndReport(infile, outfileWithExemplars, nullDistn, &numSites, &range))
+    return false;
+  outfileWithExemplars.close();
+  if (!outfileWithExemplars)
+    return false;
+  BgzfOutputStream exemplarFile(pExemplarsFilename);
+  if (!exemplarFile)
     {
-      while (idxNull < nullDistn.size() && nullDistn[idxNull].metricAsInt > outvec[idxObs].metricAsInt)
-	idxNull++;
-      if (nullDistn.size() == idxNull || (idxNull != 0 && nullDistn[idxNull].metricAsInt < outvec[idxObs].metricAsInt))
-	idxNull--;
-      if (!(0 == idxNull && nullDistn[idxNull].metricAsInt < outvec[idxObs].metricAsInt))
-	pval = nullDistn[idxNull].pvalue;
-      outvec[idxObs].pvalue = pval;
+      cerr << "Error:  Failed to open file \"" << pExemplarsFilename << "\" for write." << endl << endl;
+      return false;
     }
-  sort(outvec.begin(), outvec.end(), OutputOrder_LT);
-  for (unsigned int idxObs = 0; idxObs < outvec.size(); idxObs++)
-    ofs << outvec[idxObs].inputEntry << '\t' << outvec[idxObs].pvalue << endl;
-
-  return true;
+  return exemplars.write(exemplarFile);
 }
 
-void loadNullDistn(ifstream& ifs, vector<NullData>& ndistn);
-void loadNullDistn(ifstream& ifs, vector<NullData>& ndistn)
+int main(int argc, const char* argv[])
 {
-  const int BUFSIZE(100);
-  char buf[BUFSIZE];
-  int numNullValues(0);
-  map<int,int> tempMap; // This map provides an efficient means for tallying occurrences of values.
-  map<int,int>::iterator it;
-  pair<int,int> mapElementToInsert;
-  mapElementToInsert.second = 1;
-
-  while (ifs.getline(buf,BUFSIZE))
+  RunStats stats; // declared first, so that it reports once everything else has been cleaned up
+  bool useHistogram(false), mergeExemplars(false), mergeNulls(false), reportStats(false);
+  const char *pExemplarsFilename(NULL);
+  int maxExemplars(0);
+  ExemplarRegions exemplars;
+  SiteRange range;
+
+  // Options (arguments beginning with "--") may appear anywhere on the command line;
+  // remove them, so that the remaining arguments can be interpreted by position.
+  int numPositionalArgs(1);
+  for (int i = 1; i < argc; i++)
     {
-      int value = static_cast<int>(floor(atof(buf)*g_changeOfScale + 0.5));
-      // We use lower_bound() rather than find() because for values that haven't yet been inserted
-      // into the map, the former will give us a "hint" of where the new value should be inserted.
-      it = tempMap.lower_bound(value); // >=
-      if (tempMap.end() == it)
+      if (0 == strcmp(argv[i], "--histogram"))
+	useHistogram = true;
+      else if (0 == strcmp(argv[i], "--merge-exemplars"))
+	mergeExemplars = true;
+      else if (0 == strcmp(argv[i], "--merge-nulls"))
+	mergeNulls = true;
+      else if (0 == strcmp(argv[i], "--stats"))
+	reportStats = true;
+      else if (0 == strcmp(argv[i], "--exemplars") && i + 1 < argc)
+	pExemplarsFilename = argv[++i];
+      else if ((0 == strcmp(argv[i], "--region") || 0 == strcmp(argv[i], "--tile")) && i + 1 < argc)
 	{
-	  // no lower bound found in the map; every map element is smaller, or the map is empty
-	  mapElementToInsert.first = value;
-	  if (tempMap.begin() != it)
-	    tempMap.insert(--it, mapElementToInsert);
-	  else // map is empty
-	    tempMap.insert(mapElementToInsert);
+	  if (!range.parseOption(argv[i], argv[i + 1]))
+	    return -1;
+	  i++;
 	}
-      else
+      else if (0 == strcmp(argv[i], "--top") && i + 1 < argc)
 	{
-	  if (it->first == value)
-	    it->second++;
-	  else
+	  maxExemplars = atoi(argv[++i]);
+	  if (maxExemplars < 1)
 	    {
-	      if (it != tempMap.begin())
-		it--;
-	      mapElementToInsert.first = value;
-	      tempMap.insert(it, mapElementToInsert);
+	      cerr << "Error:  Invalid number of exemplar regions (\"" << argv[i] << "\") received." << endl << endl;
+	      return -1;
 	    }
 	}
-      numNullValues++;
+      else
+	argv[numPositionalArgs++] = argv[i];
     }
+  argc = numPositionalArgs;
+  exemplars.setMaxRegions(static_cast<size_t>(maxExemplars));
+  if (reportStats)
+    stats.enable(argv[0]);
 
-  if (0 == numNullValues)
+  if (mergeExemplars && argc >= 3)
     {
-      cerr << "Error:  Received an empty file of null values." << endl << endl;
-      exit(2);
+      BgzfOutputStream outfile(argv[1]);
+      vector<const char*> infiles(argv + 2, argv + argc);
+      if (!outfile)
+	{
+	  cerr << "Error:  Failed to open file \"" << argv[1] << "\" for write." << endl << endl;
+	  return -1;
+	}
+      for (unsigned int i = 0; i < infiles.size(); i++)
+	stats.addInputFile(infiles[i]);
+      stats.beginPhase("mergeExemplars");
+      return mergeExemplarFiles(infiles, exemplars, outfile) ? 0 : -1;
     }
 
-  float N(static_cast<float>(numNullValues));
-  int runningTallyOfOccurrences(0);
-  NullData ndata;
-  it = tempMap.end();
-  it--;
-  while (it != tempMap.begin())
+  if (mergeNulls && !mergeExemplars && argc >= 3)
     {
-      ndata.metricAsInt = it->first;
-      ndata.numOccs = it->second;
-      runningTallyOfOccurrences += ndata.numOccs;
-      ndata.pvalue = static_cast<float>(runningTallyOfOccurrences) / N;
-      ndistn.push_back(ndata);
-      it--;
+      vector<const char*> infiles(argv + 2, argv + argc);
+      for (unsigned int i = 0; i < infiles.size(); i++)
+	stats.addInputFile(infiles[i]);
+      stats.beginPhase("mergeNulls");
+      return NullTable::merge(infiles, argv[1]) ? 0 : -1;
     }
-  ndata.metricAsInt = it->first;
-  ndata.numOccs = it->second;
-  ndata.pvalue = 1.;
-  ndistn.push_back(ndata);
-
-}
 
-int main(int argc, const char* argv[])
-{
-  if (4 != argc)
+  if (mergeExemplars || mergeNulls || 4 != argc)
     {
-      cerr << "Usage:  " << argv[0] << " infile nullDistnFile outfile\n"
+      cerr << "Usage:  " << argv[0] << " [--histogram] [--exemplars exemplarFile [--top K]] [--region chrom:beg-end | --tile i/N] [--stats]\n"
+	   << "        infile nullDistnFile outfile\n"
 	   << "where \"nullDistnFile\" contains random values that constitute a null distribution,\n"
 	   << "and the values in the final column of \"infile\" are to be compared with the null values\n"
 	   << "to obtain p-value estimates.\n"
 	   << "The contents of \"infile,\", with p-values appended, are written to \"outfile.\"\n"
-	   << "FDR estimates will need to be made for the p-values by another program/procedure."
+	   << "FDR estimates will need to be made for the p-values by another program/procedure.\n"
+	   << "Both input files can be gzip- or bgzip-compressed, and if the name of \"outfile\" ends in \".gz\",\n"
+	   << "it will be written with bgzip-compatible (BGZF) compression.\n"
+	   << "If --histogram is given, the null values are tallied into a histogram with bins of relative width 1e-4,\n"
+	   << "so memory use is bounded regardless of the number of null values, but the p-values become slight overestimates.\n"
+	   << "\"nullDistnFile\" can also contain histograms written by computeEpilogosPart2_perChrom --null-histogram\n"
+	   << "(e.g. the concatenated histograms of all chromosomes), in which case --histogram is implied,\n"
+	   << "or it can be a null table written by --merge-nulls (see below), which is mapped into memory rather than read.\n"
+	   << "If --exemplars is given, the exemplar regions of \"outfile\" (the highest-scoring site of each run of sites\n"
+	   << "with the same dominant state, ranked by score) are written to exemplarFile; with --top K, only the K highest-ranked.\n"
+	   << "If --region or --tile is given, only the lines of \"infile\" whose begin coordinates (column 2) are in [beg, end) on chrom,\n"
+	   << "or only those of tile i of N tiles of nearly equal numbers of consecutive lines, are written to \"outfile\"\n"
+	   << "(and to exemplarFile); the null distribution is unaffected.\n"
+	   << "If --stats is given (in any usage), a report (a JSON object) is written to standard error on exit:\n"
+	   << "wall and CPU time in total and per phase, sites per second, the total size of the input files, bytes written, and peak memory use.\n"
+	   << "\n"
+	   << "Alternative usage:  " << argv[0] << " --merge-exemplars [--top K] outfile infile1 [infile2 ...]\n"
+	   << "where the infiles are exemplar regions, e.g. those of each chromosome written with --exemplars\n"
+	   << "(or by computeEpilogosPart2_perChrom --exemplars), and outfile receives all of them (or the K highest-ranked), ranked by score.\n"
+	   << "\n"
+	   << "Alternative usage:  " << argv[0] << " --merge-nulls nullTable infile1 [infile2 ...]\n"
+	   << "where the infiles are null values, e.g. those of each chromosome, as sorted runs written by computeEpilogosPart2_perChrom --sorted-nulls\n"
+	   << "(or files of null values, which are sorted in memory one at a time, or histograms written with --null-histogram),\n"
+	   << "and nullTable receives their null distribution in a binary form that's mapped into memory when given as \"nullDistnFile\" above.\n"
+	   << "The sorted runs are merged reading one line of each at a time, so memory use doesn't depend on the number of null values.\n"
+	   << "The table's p-values are identical to those obtained from all of the null values together (or from the histograms, with --histogram);\n"
+	   << "it can only be read on a machine with the byte order of the one that wrote it."
 	   << endl << endl;
       return -1;
     }
 
-  ifstream infile(argv[1]);
+  GzInputStream infile(argv[1]);
   if (!infile)
     {
       cerr << "Error:  Failed to open file \"" << argv[1] << "\" for read." << endl << endl;
       return -1;
     }
-  ifstream nullDistnFile(argv[2]);
-  if (!nullDistnFile)
-    {
-      cerr << "Error:  Failed to open file \"" << argv[2] << "\" for read." << endl << endl;
-      return -1;
-    }
-  ofstream outfile(argv[3]);
+  BgzfOutputStream outfile(argv[3]);
   if (!outfile)
     {
       cerr << "Error:  Failed to open file \"" << argv[3] << "\" for write." << endl << endl;
       return -1;
     }
   vector<NullData> nullDistn;
-
-  loadNullDistn(nullDistnFile, nullDistn);
-  if (!loadDataAndReport(infile, outfile, nullDistn))
+  NullTable nullTable;
+  const bool useNullTable = NullTable::isNullTable(argv[2]);
+  long numSites(0);
+
+  stats.addInputFile(argv[1]);
+  stats.addInputFile(argv[2]);
+  stats.beginPhase("loadNulls");
+  if (useNullTable)
+    {
+      if (!nullTable.open(argv[2]))
+	return -1;
+    }
+  else
+    {
+      GzInputStream nullDistnFile(argv[2]);
+      if (!nullDistnFile)
+	{
+	  cerr << "Error:  Failed to open file \"" << argv[2] << "\" for read." << endl << endl;
+	  return -1;
+	}
+      if (!useHistogram && '#' == nullDistnFile.peek())
+	useHistogram = true; // the file begins with a histogram's header
+      if (useHistogram)
+	{
+	  if (!loadNullDistnAsHistogram(nullDistnFile, nullDistn))
+	    return -1;
+	}
+      else
+	loadNullDistn(nullDistnFile, nullDistn);
+    }
+  stats.beginPhase("report");
+  if (range.isTile())
+    {
+      uint64_t numLines;
+      if (!countLines(infile, numLines))
+	{
+	  cerr << "Error:  Unable to count the lines of " << argv[1] << ", to divide them into tiles." << endl << endl;
+	  return -1;
+	}
+      range.setNumSites(numLines);
+    }
+  if (useNullTable ? !report(infile, outfile, nullTable, pExemplarsFilename, exemplars, range, numSites)
+      : !report(infile, outfile, nullDistn, pExemplarsFilename, exemplars, range, numSites))
     return -1;
+  stats.endPhase();
+  stats.setNumSites(static_cast<uint64_t>(numSites));
 
   return 0;
 }
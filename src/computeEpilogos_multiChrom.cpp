@@ -0,0 +1,556 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <vector>
+#include <set>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "compressedStreams.h"
+#include "jobPool.h"
+#include "metricModels.h"
+#include "nullDistribution.h"
+#include "nullHistogram.h"
+#include "siteTallies.h"
+#include "stateFileReader.h"
+
+using namespace std;
+
+// Computes epilogos for many chromosomes in a single process, running the equivalent of
+// computeEpilogosPart1_perChrom, computeEpilogosPart2_perChrom, and computeEpilogosPart3_perChrom for every chromosome
+// with a pool of threads, one chromosome per thread at a time.  The work proceeds in three stages:
+//   1. Each chromosome's state file is read, and its sites are tallied into Q (or Q* or Q**).
+//      Each thread accumulates the chromosomes it reads into its own tallies; these are then summed,
+//      giving the genome-wide Q and the genome-wide number of sites.
+//   2. Each chromosome's state file is read again, and every site is scored using the genome-wide Q
+//      (as computeEpilogosPart2_perChrom --fused does, but with Q taken from every chromosome).
+//      If two groups are being compared, the sites are also permuted and scored to generate null values,
+//      which are tallied into a genome-wide histogram (see nullHistogram.h).
+//   3. If two groups are being compared, p-values are appended to each chromosome's observations.
+// The per-site tallies, Q, and the null values never leave memory.  Observations awaiting their p-values
+// are held in memory too, as long as the estimated total stays within the memory budget;
+// the remaining chromosomes' observations are written to temporary files and read back in stage 3.
+
+class MultiChromDriver : private JobPool {
+public:
+  MultiChromDriver();
+  ~MultiChromDriver();
+  bool init(const vector<string>& stateFilenames, const measurementType& KLtype, const int& numStates,
+	    const string& outdir, const set<int>& group1, const set<int>& group2, const uint64_t& seed,
+	    const unsigned int& numPermutations, const unsigned int& numThreads, const uint64_t& memoryBudget);
+  bool run(void);
+private:
+  MultiChromDriver(const MultiChromDriver&); // we have no need for a copy constructor, so disable it
+  struct Chromosome {
+    string stateFilename;
+    string chrom;
+    uint64_t numSites;
+    uint64_t fileSize;
+    bool observationsInMemory;
+    string observations; // with two groups, if observationsInMemory
+  };
+  enum Stage {TALLY, SCORE, REPORT};
+  // A generous estimate of the memory needed to hold one site's observations (the line of text,
+  // plus the spare capacity of the string it's accumulated in).
+  static const uint64_t BYTES_PER_OBSERVATION_ESTIMATE = 256;
+  bool runJob(const unsigned int& threadNum, const unsigned int& jobNum);
+  bool tallyChromosome(const unsigned int& threadNum, Chromosome& c);
+  bool scoreChromosome(const unsigned int& threadNum, Chromosome& c);
+  bool reportChromosome(Chromosome& c);
+  bool prepareModels(void);
+  string outfilename(const Chromosome& c, const char *pSuffix) const { return m_outdir + "/" + c.chrom + pSuffix; }
+  Stage m_stage;
+  vector<Chromosome> m_chroms;
+  vector<unsigned int> m_jobOrder; // largest state files first, so the longest jobs don't start last
+  measurementType m_KLtype;
+  int m_numStates;
+  string m_outdir;
+  set<int> m_group1, m_group2;
+  uint64_t m_seed;
+  unsigned int m_numPermutations, m_numThreads;
+  uint64_t m_memoryBudget, m_memoryReserved;
+  vector<SiteTallier*> m_talliers; // one per thread
+  Model *m_pObsModel, *m_pNullModel; // hold the genome-wide Q; each chromosome is scored by workers created from them
+  NullHistogram m_nullHistogram;
+  vector<NullData> m_nullDistn;
+  pthread_mutex_t m_mutex; // guards m_memoryReserved and m_nullHistogram
+};
+
+MultiChromDriver::MultiChromDriver()
+  : m_stage(TALLY), m_KLtype(KL), m_numStates(0), m_seed(0), m_numPermutations(1), m_numThreads(1),
+    m_memoryBudget(0), m_memoryReserved(0), m_pObsModel(NULL), m_pNullModel(NULL)
+{
+  pthread_mutex_init(&m_mutex, NULL);
+}
+
+MultiChromDriver::~MultiChromDriver()
+{
+  for (unsigned int i = 0; i < m_talliers.size(); i++)
+    delete m_talliers[i];
+  delete m_pObsModel;
+  delete m_pNullModel;
+  pthread_mutex_destroy(&m_mutex);
+}
+
+// Used to order the jobs by decreasing file size.
+struct ChromJob_GT {
+  const vector<uint64_t> *pSizes;
+  bool operator()(const unsigned int& a, const unsigned int& b) const { return (*pSizes)[a] > (*pSizes)[b]; }
+};
+
+bool MultiChromDriver::init(const vector<string>& stateFilenames, const measurementType& KLtype, const int& numStates,
+			    const string& outdir, const set<int>& group1, const set<int>& group2, const uint64_t& seed,
+			    const unsigned int& numPermutations, const unsigned int& numThreads, const uint64_t& memoryBudget)
+{
+  vector<uint64_t> sizes;
+  ChromJob_GT gt;
+  struct stat st;
+
+  m_KLtype = KLtype;
+  m_numStates = numStates;
+  m_outdir = outdir;
+  m_group1 = group1;
+  m_group2 = group2;
+  m_seed = seed;
+  m_numPermutations = numPermutations;
+  m_numThreads = min(numThreads, static_cast<unsigned int>(stateFilenames.size()));
+  m_memoryBudget = memoryBudget;
+  for (unsigned int i = 0; i < stateFilenames.size(); i++)
+    {
+      Chromosome c;
+      if (stat(stateFilenames[i].c_str(), &st) != 0)
+	{
+	  cerr << "Error:  Unable to open file \"" << stateFilenames[i] << "\" for reading." << endl << endl;
+	  return false;
+	}
+      c.stateFilename = stateFilenames[i];
+      c.numSites = 0;
+      c.fileSize = static_cast<uint64_t>(st.st_size);
+      c.observationsInMemory = false;
+      m_chroms.push_back(c);
+      sizes.push_back(c.fileSize);
+      m_jobOrder.push_back(i);
+    }
+  gt.pSizes = &sizes;
+  stable_sort(m_jobOrder.begin(), m_jobOrder.end(), gt);
+  for (unsigned int i = 0; i < m_numThreads; i++)
+    {
+      m_talliers.push_back(new SiteTallier);
+      m_talliers.back()->init(m_KLtype, m_group1, m_group2, m_numStates);
+    }
+  return true;
+}
+
+bool MultiChromDriver::runJob(const unsigned int& threadNum, const unsigned int& jobNum)
+{
+  switch (m_stage) {
+  case TALLY:
+    return tallyChromosome(threadNum, m_chroms[jobNum]);
+  case SCORE:
+    return scoreChromosome(threadNum, m_chroms[jobNum]);
+  default: // REPORT
+    return reportChromosome(m_chroms[jobNum]);
+  }
+}
+
+// Stage 1:  Adds the chromosome's sites to this thread's Q tallies.
+bool MultiChromDriver::tallyChromosome(const unsigned int& threadNum, Chromosome& c)
+{
+  StateFileReader reader;
+  vector<int> allStatesAtThisSite;
+
+  if (!reader.open(c.stateFilename.c_str(), m_numStates))
+    {
+      cerr << "Error:  Unable to open file \"" << c.stateFilename << "\" for reading." << endl << endl;
+      return false;
+    }
+  while (reader.readSite(allStatesAtThisSite))
+    {
+      if (1 == reader.linenum())
+	{
+	  if (!groupsFitInput(m_group1, m_group2, static_cast<int>(allStatesAtThisSite.size())))
+	    {
+	      cerr << "(in file " << c.stateFilename << ")" << endl << endl;
+	      return false;
+	    }
+	  c.chrom = reader.chrom();
+	}
+      m_talliers[threadNum]->processSite(allStatesAtThisSite, NULL, true);
+    }
+  if (reader.failed())
+    {
+      cerr << "(in file " << c.stateFilename << ")" << endl << endl;
+      return false;
+    }
+  if (0 == reader.linenum())
+    {
+      cerr << "Error:  File " << c.stateFilename << " is empty." << endl << endl;
+      return false;
+    }
+  c.numSites = reader.linenum();
+  return true;
+}
+
+// Between stages 1 and 2:  sums the threads' tallies, and derives what the models need from the genome-wide Q.
+bool MultiChromDriver::prepareModels(void)
+{
+  uint64_t Nsites(0);
+  set<string> chroms;
+  ostringstream ossQ1, ossQ2;
+
+  for (unsigned int i = 0; i < m_chroms.size(); i++)
+    {
+      if (!chroms.insert(m_chroms[i].chrom).second)
+	{
+	  cerr << "Error:  Chromosome " << m_chroms[i].chrom << " was found in more than one of the input files." << endl << endl;
+	  return false;
+	}
+      Nsites += m_chroms[i].numSites;
+    }
+  for (unsigned int i = 1; i < m_talliers.size(); i++)
+    m_talliers[0]->addQ(*m_talliers[i]);
+  m_talliers[0]->writeQ(ossQ1, ossQ2);
+
+  Model* models[2] = {NULL, NULL};
+  models[0] = m_pObsModel = createModel(m_KLtype);
+  if (!m_pObsModel->init(NULL, NULL, NULL, string("")))
+    return false;
+  if (!m_group2.empty())
+    {
+      models[1] = m_pNullModel = createModel(m_KLtype);
+      if (!m_pNullModel->init(NULL, NULL, "", string(""))) // the workers' null values go to the histogram
+	return false;
+    }
+  for (int i = 0; i < 2; i++)
+    {
+      if (NULL == models[i])
+	continue;
+      istringstream issQ1(ossQ1.str());
+      if (!models[i]->getQcontrib(issQ1, "(genome-wide Q tallies for group 1)", static_cast<unsigned int>(Nsites)))
+	return false;
+      if (!m_group2.empty())
+	{
+	  istringstream issQ2(ossQ2.str());
+	  if (!models[i]->getQcontrib(issQ2, "(genome-wide Q tallies for group 2)", static_cast<unsigned int>(Nsites)))
+	    return false;
+	}
+    }
+  return true;
+}
+
+// Stage 2:  Scores the chromosome's sites, and adds its null values to the genome-wide histogram.
+// With one group, the observations are written straight to their final file (chr_observed.bed);
+// with two, they're held in memory if they fit within the budget, and otherwise written to chr_observed.txt.
+bool MultiChromDriver::scoreChromosome(const unsigned int& threadNum, Chromosome& c)
+{
+  StateFileReader reader;
+  const string scoresFilename(outfilename(c, "_scores.txt"));
+  BgzfOutputStream ofsScores(scoresFilename.c_str()), ofsObs;
+  ostringstream ossObs, ossNullHistogram;
+  NullHistogramOutputStream nullHistogram;
+  ostream *pObs(&ofsObs);
+  Model *pObsModel(NULL), *pNullModel(NULL);
+  uint64_t numSites(0), memoryEstimate(c.numSites * BYTES_PER_OBSERVATION_ESTIMATE);
+  bool OK(true);
+
+  if (!reader.open(c.stateFilename.c_str(), m_numStates))
+    {
+      cerr << "Error:  Unable to open file \"" << c.stateFilename << "\" for reading." << endl << endl;
+      return false;
+    }
+  if (!ofsScores)
+    {
+      cerr << "Error:  Unable to open file \"" << scoresFilename << "\" for writing." << endl << endl;
+      return false;
+    }
+  if (m_pNullModel != NULL)
+    {
+      pthread_mutex_lock(&m_mutex);
+      if (m_memoryReserved + memoryEstimate <= m_memoryBudget)
+	{
+	  m_memoryReserved += memoryEstimate;
+	  c.observationsInMemory = true;
+	}
+      pthread_mutex_unlock(&m_mutex);
+    }
+  if (c.observationsInMemory)
+    pObs = &ossObs;
+  else
+    {
+      const string obsFilename(outfilename(c, m_pNullModel != NULL ? "_observed.txt" : "_observed.bed"));
+      ofsObs.open(obsFilename.c_str());
+      if (!ofsObs)
+	{
+	  cerr << "Error:  Unable to open file \"" << obsFilename << "\" for writing." << endl << endl;
+	  return false;
+	}
+    }
+
+  pObsModel = m_pObsModel->createWorker();
+  pObsModel->setChrom(c.chrom);
+  pObsModel->redirectOutput(pObs, &ofsScores, NULL);
+  if (m_pNullModel != NULL)
+    {
+      nullHistogram.attach(ossNullHistogram);
+      pNullModel = m_pNullModel->createWorker();
+      pNullModel->redirectOutput(NULL, NULL, &nullHistogram);
+    }
+  if (!scoreStates(reader, *m_talliers[threadNum], m_seed, m_numPermutations, pObsModel, pNullModel, numSites))
+    {
+      cerr << "(in file " << c.stateFilename << ")" << endl << endl;
+      OK = false;
+    }
+  else if (numSites != c.numSites)
+    {
+      cerr << "Error:  Found " << c.numSites << " lines in " << c.stateFilename << " on the first pass through it, but "
+	   << numSites << " lines on the second pass." << endl << endl;
+      OK = false;
+    }
+  delete pObsModel;
+  delete pNullModel;
+
+  if (OK && m_pNullModel != NULL)
+    {
+      nullHistogram.close();
+      istringstream issNullHistogram(ossNullHistogram.str());
+      pthread_mutex_lock(&m_mutex);
+      if (!m_nullHistogram.load(issNullHistogram))
+	OK = false;
+      pthread_mutex_unlock(&m_mutex);
+    }
+  if (c.observationsInMemory)
+    {
+      c.observations = ossObs.str();
+      pthread_mutex_lock(&m_mutex);
+      m_memoryReserved = m_memoryReserved - memoryEstimate + c.observations.size();
+      pthread_mutex_unlock(&m_mutex);
+    }
+  ofsScores.close();
+  if (!c.observationsInMemory)
+    ofsObs.close();
+  if (OK && (!ofsScores || (!c.observationsInMemory && !ofsObs)))
+    {
+      cerr << "Error:  Failed to write the scores or observations for chromosome " << c.chrom << '.' << endl << endl;
+      OK = false;
+    }
+  return OK;
+}
+
+// Stage 3:  Writes the chromosome's observations with their p-values appended, to chr_observed_withPvals.bed.
+bool MultiChromDriver::reportChromosome(Chromosome& c)
+{
+  const string obsFilename(outfilename(c, "_observed.txt")), outFilename(outfilename(c, "_observed_withPvals.bed"));
+  BgzfOutputStream ofs(outFilename.c_str());
+  bool OK;
+
+  if (!ofs)
+    {
+      cerr << "Error:  Unable to open file \"" << outFilename << "\" for writing." << endl << endl;
+      return false;
+    }
+  if (c.observationsInMemory)
+    {
+      istringstream iss(c.observations);
+      OK = loadDataAndReport(iss, ofs, m_nullDistn);
+      string().swap(c.observations); // free the memory
+    }
+  else
+    {
+      GzInputStream ifs(obsFilename.c_str());
+      if (!ifs)
+	{
+	  cerr << "Error:  Unable to open file \"" << obsFilename << "\" for reading." << endl << endl;
+	  return false;
+	}
+      OK = loadDataAndReport(ifs, ofs, m_nullDistn);
+      if (OK)
+	remove(obsFilename.c_str());
+    }
+  ofs.close();
+  if (OK && !ofs)
+    {
+      cerr << "Error:  Failed to write file " << outFilename << '.' << endl << endl;
+      OK = false;
+    }
+  return OK;
+}
+
+bool MultiChromDriver::run(void)
+{
+  m_stage = TALLY;
+  if (!runJobs(m_jobOrder, m_numThreads) || !prepareModels())
+    return false;
+
+  m_stage = SCORE;
+  if (!runJobs(m_jobOrder, m_numThreads))
+    return false;
+  if (NULL == m_pNullModel)
+    return true;
+
+  // Keep the genome-wide null distribution, in the format computeEpilogosPart3_perChrom reads.
+  const string nullsFilename(m_outdir + "/allNullsGenomewide.txt");
+  BgzfOutputStream ofsNulls(nullsFilename.c_str());
+  if (!ofsNulls || !m_nullHistogram.write(ofsNulls))
+    {
+      cerr << "Error:  Failed to write file " << nullsFilename << '.' << endl << endl;
+      return false;
+    }
+  if (!nullDistnFromHistogram(m_nullHistogram, m_nullDistn))
+    return false;
+
+  m_stage = REPORT;
+  return runJobs(m_jobOrder, m_numThreads);
+}
+
+
+int main(int argc, const char* argv[])
+{
+  unsigned long seed(0);
+  int numThreads(1), numPermutations(1);
+  long memoryBudgetMB(1024);
+
+  // Options (arguments beginning with "--") may appear anywhere on the command line;
+  // remove them, so that the remaining arguments can be interpreted by position.
+  int numPositionalArgs(1);
+  for (int i = 1; i < argc; i++)
+    {
+      if (0 == strcmp(argv[i], "--seed") && i + 1 < argc)
+	{
+	  char *pEnd;
+	  seed = strtoul(argv[++i], &pEnd, 10);
+	  if (pEnd == argv[i] || *pEnd != '\0')
+	    {
+	      cerr << "Error:  Invalid random number seed (\"" << argv[i] << "\") received." << endl << endl;
+	      return -1;
+	    }
+	}
+      else if (0 == strcmp(argv[i], "--permutations") && i + 1 < argc)
+	{
+	  numPermutations = atoi(argv[++i]);
+	  if (numPermutations < 1)
+	    {
+	      cerr << "Error:  Invalid number of permutations (\"" << argv[i] << "\") received." << endl << endl;
+	      return -1;
+	    }
+	}
+      else if (0 == strcmp(argv[i], "--threads") && i + 1 < argc)
+	{
+	  numThreads = atoi(argv[++i]);
+	  if (numThreads < 1)
+	    {
+	      cerr << "Error:  Invalid number of threads (\"" << argv[i] << "\") received." << endl << endl;
+	      return -1;
+	    }
+	}
+      else if (0 == strcmp(argv[i], "--memory") && i + 1 < argc)
+	{
+	  memoryBudgetMB = atol(argv[++i]);
+	  if (memoryBudgetMB < 0)
+	    {
+	      cerr << "Error:  Invalid memory budget (\"" << argv[i] << "\") received." << endl << endl;
+	      return -1;
+	    }
+	}
+      else
+	argv[numPositionalArgs++] = argv[i];
+    }
+  argc = numPositionalArgs;
+
+  if (6 != argc && 7 != argc)
+    {
+    Usage:
+      cerr << "Usage:  " << argv[0] << " [--threads N] [--memory MB] [--seed S] [--permutations M] fileOfPerChromFilenames metric numStates outdir groupSpec [group2spec]\n"
+	   << "where\n"
+	   << "* fileOfPerChromFilenames contains one input filename per line; each file is the input to computeEpilogosPart1_perChrom\n"
+	   << "  for a single chromosome (tab-delimited chrom, start, stop, state of epigenome1, state of epigenome2, ...)\n"
+	   << "* metric is either 1 (to use S1), 2 (S2), or 3 (S3)\n"
+	   << "* numStates is the number of possible states (e.g. 15)\n"
+	   << "* outdir will receive the results (it will be created if necessary)\n"
+	   << "* groupSpec and group2spec are as described for computeEpilogosPart1_perChrom\n"
+	   << "This runs computeEpilogosPart1_perChrom, computeEpilogosPart2_perChrom, and computeEpilogosPart3_perChrom\n"
+	   << "for every chromosome, as computeEpilogos.sh does, but in a single process, without intermediate files.\n"
+	   << "For each chromosome chr, outdir receives chr_scores.txt, and either chr_observed.bed (one group)\n"
+	   << "or chr_observed_withPvals.bed (two groups); in the latter case, outdir also receives allNullsGenomewide.txt,\n"
+	   << "a histogram of the null values (see computeEpilogosPart2_perChrom --null-histogram),\n"
+	   << "from which the p-values are estimated (see computeEpilogosPart3_perChrom --histogram).\n"
+	   << "Q (or Q* or Q**) is tallied over all of the chromosomes, and the null values are generated as\n"
+	   << "computeEpilogosPart2_perChrom --fused --seed S --permutations M generates them (by default, S = 0 and M = 1).\n"
+	   << "The chromosomes are processed by N threads (default 1), one chromosome per thread at a time.\n"
+	   << "With two groups, up to about MB megabytes (default 1024) of observations are held in memory\n"
+	   << "until their p-values can be computed; the remaining chromosomes' observations are written to temporary files."
+	   << endl << endl;
+      return -1;
+    }
+
+  const int measurementTypeInt(atoi(argv[2])), numStates(atoi(argv[3]));
+  const string outdir(argv[4]);
+  vector<string> stateFilenames;
+  set<int> group1, group2;
+  vector<char> spec;
+  MultiChromDriver driver;
+
+  if (KL != measurementTypeInt && KLs != measurementTypeInt && KLss != measurementTypeInt)
+    {
+      cerr << "Error:  Invalid \"metric\" received (2nd argument, \"" << argv[2] << "\").\n"
+	   << "The valid options are 1 (to use S1), 2 (to use S2), and 3 (to use S3)." << endl << endl;
+      goto Usage;
+    }
+  if (numStates < 1)
+    {
+      cerr << "Error:  Invalid number of states (\"" << argv[3] << "\") received." << endl << endl;
+      goto Usage;
+    }
+  spec.assign(argv[5], argv[5] + strlen(argv[5]) + 1);
+  if (!parseOneSetOfColumnSpecs(&spec[0], group1))
+    return -1;
+  if (7 == argc)
+    {
+      spec.assign(argv[6], argv[6] + strlen(argv[6]) + 1);
+      if (!parseOneSetOfColumnSpecs(&spec[0], group2))
+	return -1;
+      for (set<int>::const_iterator it2 = group2.begin(); it2 != group2.end(); it2++)
+	{
+	  if (group1.find(*it2) != group1.end())
+	    {
+	      cerr << "Error:  Value " << *it2 << " was found in both group specifications." << endl << endl;
+	      return -1;
+	    }
+	}
+    }
+
+  ifstream fileOfFilenames(argv[1]);
+  string line;
+  if (!fileOfFilenames)
+    {
+      cerr << "Error:  Unable to open file \"" << argv[1] << "\" for reading." << endl << endl;
+      return -1;
+    }
+  while (getline(fileOfFilenames, line))
+    if (!line.empty())
+      stateFilenames.push_back(line);
+  if (stateFilenames.empty())
+    {
+      cerr << "Error:  File " << argv[1] << " is empty." << endl << endl;
+      return -1;
+    }
+  if (mkdir(outdir.c_str(), 0777) != 0 && errno != EEXIST)
+    {
+      cerr << "Error:  Unable to create directory \"" << outdir << "\"." << endl << endl;
+      return -1;
+    }
+
+  if (!driver.init(stateFilenames, static_cast<measurementType>(measurementTypeInt), numStates, outdir, group1, group2,
+		   seed, static_cast<unsigned int>(numPermutations), static_cast<unsigned int>(numThreads),
+		   static_cast<uint64_t>(memoryBudgetMB) * 1024 * 1024))
+    return -1;
+  if (!driver.run())
+    return -1;
+
+  return 0;
+}
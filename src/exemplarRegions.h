@@ -0,0 +1,241 @@
+#ifndef EPILOGOS_EXEMPLAR_REGIONS_H
+#define EPILOGOS_EXEMPLAR_REGIONS_H
+
+#include <iostream>
+#include <streambuf>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+
+// The exemplar regions (exemplarRegions.txt):  the lines of observations (as written by computeEpilogosPart2_perChrom,
+// or by computeEpilogosPart3_perChrom with p-values appended) are divided into runs of consecutive sites
+// on the same chromosome with the same dominant state (column 4), and each run is represented by the line of its
+// highest-scoring site (the last one, if several share the highest score).  The score is in column 7 for S1
+// and column 10 for S2 and S3, so it's taken from column 10 of lines with at least 10 columns and from column 7 otherwise.
+// The lines are written in decreasing order of score, and lines with equal scores in decreasing (byte) order,
+// which is the order in which "sort -gr -kN,N" (with N the score column) would write them in the C locale.
+//
+// If a maximum number of regions is given, only that many of the highest-ranked regions are kept, in a heap,
+// so memory use is bounded no matter how many runs there are.  Since regions of different chromosomes never belong to
+// the same run, the genome-wide exemplar regions can be obtained by merging the exemplar regions of every chromosome.
+
+class ExemplarRegions {
+public:
+  ExemplarRegions() : m_maxRegions(0), m_inRun(false) {};
+  void setMaxRegions(const size_t& maxRegions) { m_maxRegions = maxRegions; } // 0 (the default) means no limit
+  // Returns false after reporting an error if the line doesn't contain a state and a score.
+  bool addObservation(const char *pLine, const size_t& len);
+  // Adds a line of previously derived exemplar regions, e.g. of one chromosome, without dividing it into runs.
+  bool addRegion(const char *pLine, const size_t& len);
+  // Ends the current run, and writes the regions in order.  The regions are then discarded.
+  bool write(std::ostream& os);
+private:
+  ExemplarRegions(const ExemplarRegions&); // we have no need for a copy constructor, so disable it
+  struct Region {
+    double score;
+    std::string line;
+  };
+  struct RanksHigher {
+    bool operator()(const Region& a, const Region& b) const
+    { return a.score != b.score ? a.score > b.score : a.line > b.line; }
+  };
+  static bool findFields(const char *pLine, const size_t& len, size_t& stateBeg, size_t& stateLen, double& score);
+  void endRun(void);
+  void keep(Region& r);
+  size_t m_maxRegions;
+  // Ranked highest first if m_maxRegions is 0; otherwise a heap whose front is the lowest-ranked region.
+  std::vector<Region> m_regions;
+  bool m_inRun;
+  std::string m_runChrom, m_runState;
+  Region m_runBest;
+};
+
+// Finds the state (column 4) and the score (column 10, or column 7 if there are fewer than 10 columns) of a line.
+inline bool ExemplarRegions::findFields(const char *pLine, const size_t& len, size_t& stateBeg, size_t& stateLen, double& score)
+{
+  size_t fieldBegs[11], numFields(1);
+  fieldBegs[0] = 0;
+  for (const char *p = pLine; (p = static_cast<const char*>(memchr(p, '\t', pLine + len - p))) != NULL && numFields < 11; )
+    fieldBegs[numFields++] = ++p - pLine;
+  if (numFields < 7)
+    {
+      std::cerr << "Error:  Found " << numFields << " column(s) in line \"" << std::string(pLine, len)
+		<< "\" of observations; at least 7 were expected." << std::endl << std::endl;
+      return false;
+    }
+  const size_t scoreField = numFields >= 10 ? 9 : 6; // 0-based
+  const size_t scoreEnd = scoreField + 1 < numFields ? fieldBegs[scoreField + 1] - 1 : len;
+  stateBeg = fieldBegs[3];
+  stateLen = fieldBegs[4] - 1 - stateBeg;
+  score = strtod(std::string(pLine + fieldBegs[scoreField], scoreEnd - fieldBegs[scoreField]).c_str(), NULL);
+  return true;
+}
+
+inline void ExemplarRegions::keep(Region& r)
+{
+  if (0 == m_maxRegions || m_regions.size() < m_maxRegions)
+    {
+      m_regions.push_back(Region());
+      m_regions.back().score = r.score;
+      m_regions.back().line.swap(r.line);
+      if (m_maxRegions != 0)
+	std::push_heap(m_regions.begin(), m_regions.end(), RanksHigher());
+    }
+  else if (RanksHigher()(r, m_regions.front()))
+    {
+      std::pop_heap(m_regions.begin(), m_regions.end(), RanksHigher());
+      m_regions.back().score = r.score;
+      m_regions.back().line.swap(r.line);
+      std::push_heap(m_regions.begin(), m_regions.end(), RanksHigher());
+    }
+}
+
+inline void ExemplarRegions::endRun(void)
+{
+  if (m_inRun)
+    keep(m_runBest);
+  m_inRun = false;
+}
+
+inline bool ExemplarRegions::addObservation(const char *pLine, const size_t& len)
+{
+  size_t stateBeg, stateLen;
+  double score;
+
+  if (!findFields(pLine, len, stateBeg, stateLen, score))
+    return false;
+  const char *pTab = static_cast<const char*>(memchr(pLine, '\t', len));
+  const size_t chromLen = pTab - pLine;
+  if (m_inRun && m_runChrom.size() == chromLen && 0 == m_runChrom.compare(0, chromLen, pLine, chromLen)
+      && m_runState.size() == stateLen && 0 == m_runState.compare(0, stateLen, pLine + stateBeg, stateLen))
+    {
+      if (score >= m_runBest.score)
+	{
+	  m_runBest.score = score;
+	  m_runBest.line.assign(pLine, len);
+	}
+      return true;
+    }
+  endRun();
+  m_inRun = true;
+  m_runChrom.assign(pLine, chromLen);
+  m_runState.assign(pLine + stateBeg, stateLen);
+  m_runBest.score = score;
+  m_runBest.line.assign(pLine, len);
+  return true;
+}
+
+inline bool ExemplarRegions::addRegion(const char *pLine, const size_t& len)
+{
+  size_t stateBeg, stateLen;
+  Region r;
+
+  if (!findFields(pLine, len, stateBeg, stateLen, r.score))
+    return false;
+  r.line.assign(pLine, len);
+  keep(r);
+  return true;
+}
+
+inline bool ExemplarRegions::write(std::ostream& os)
+{
+  endRun();
+  std::sort(m_regions.begin(), m_regions.end(), RanksHigher());
+  for (size_t i = 0; i < m_regions.size(); i++)
+    os << m_regions[i].line << '\n';
+  m_regions.clear();
+  os.flush();
+  return static_cast<bool>(os);
+}
+
+// An output stream that passes every line written to it on to the attached stream, unchanged,
+// and adds it to the attached ExemplarRegions as an observation.
+// Lines are passed on as the buffer fills; close() (or the destructor) passes on the rest.
+class ExemplarStreambuf : public std::streambuf {
+public:
+  ExemplarStreambuf() : m_pDest(NULL), m_pExemplars(NULL), m_failed(false), m_buf(BUFSIZE) { setp(&m_buf[0], &m_buf[0] + m_buf.size()); }
+  ~ExemplarStreambuf() { close(); }
+  void attach(std::ostream& dest, ExemplarRegions& exemplars) { m_pDest = &dest; m_pExemplars = &exemplars; m_failed = false; }
+  bool close(void);
+protected:
+  int_type overflow(int_type c);
+private:
+  ExemplarStreambuf(const ExemplarStreambuf&); // we have no need for a copy constructor, so disable it
+  void passOnCompleteLines(void);
+  static const unsigned int BUFSIZE = 65536;
+  std::ostream *m_pDest;
+  ExemplarRegions *m_pExemplars;
+  bool m_failed;
+  std::vector<char> m_buf;
+};
+
+// Passes on every complete line in the buffer and moves any incomplete one to the beginning of it.
+inline void ExemplarStreambuf::passOnCompleteLines(void)
+{
+  char *pLine = pbase(), *pEol;
+  while (pLine < pptr() && (pEol = static_cast<char*>(memchr(pLine, '\n', pptr() - pLine))) != NULL)
+    {
+      if (!m_failed && !m_pExemplars->addObservation(pLine, pEol - pLine))
+	m_failed = true;
+      pLine = pEol + 1;
+    }
+  m_pDest->write(pbase(), pLine - pbase());
+  const std::ptrdiff_t numLeftover = pptr() - pLine;
+  memmove(&m_buf[0], pLine, numLeftover);
+  if (numLeftover == static_cast<std::ptrdiff_t>(m_buf.size()))
+    m_buf.resize(2*m_buf.size()); // a line longer than the buffer
+  setp(&m_buf[0], &m_buf[0] + m_buf.size());
+  pbump(static_cast<int>(numLeftover));
+}
+
+inline ExemplarStreambuf::int_type ExemplarStreambuf::overflow(int_type c)
+{
+  if (NULL == m_pDest)
+    return traits_type::eof();
+  passOnCompleteLines();
+  if (!traits_type::eq_int_type(c, traits_type::eof()))
+    {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+  return traits_type::not_eof(c);
+}
+
+// Returns false if a line couldn't be added to the exemplar regions, or if the attached stream failed.
+inline bool ExemplarStreambuf::close(void)
+{
+  if (NULL == m_pDest)
+    return true;
+  passOnCompleteLines();
+  if (pptr() > pbase())
+    {
+      // the last line has no newline
+      if (!m_failed && !m_pExemplars->addObservation(pbase(), pptr() - pbase()))
+	m_failed = true;
+      m_pDest->write(pbase(), pptr() - pbase());
+      setp(&m_buf[0], &m_buf[0] + m_buf.size());
+    }
+  const bool retVal = !m_failed && static_cast<bool>(*m_pDest);
+  m_pDest = NULL;
+  m_pExemplars = NULL;
+  return retVal;
+}
+
+class ExemplarOutputStream : public std::ostream {
+public:
+  ExemplarOutputStream() : std::ostream(NULL) { init(&m_sbuf); }
+  void attach(std::ostream& dest, ExemplarRegions& exemplars) { m_sbuf.attach(dest, exemplars); }
+  void close(void)
+  {
+    if (!m_sbuf.close())
+      setstate(std::ios_base::failbit);
+  }
+private:
+  ExemplarOutputStream(const ExemplarOutputStream&); // we have no need for a copy constructor, so disable it
+  ExemplarStreambuf m_sbuf;
+};
+
+#endif // EPILOGOS_EXEMPLAR_REGIONS_H
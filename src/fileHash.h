@@ -0,0 +1,36 @@
+#ifndef EPILOGOS_FILE_HASH_H
+#define EPILOGOS_FILE_HASH_H
+
+#include <cstdio>
+#include <stdint.h>
+#include "statePermuter.h" // for makeUint64()
+
+// Identifies the contents of the files that a cached or stored result was derived from (see qcontribCache.h and tallyStore.h),
+// so that a file rewritten with different contents is never mistaken for the original, however soon it's rewritten
+// and whatever its size.
+
+// The size and 64-bit FNV-1a hash of the bytes of a file (as stored, i.e. compressed if it's compressed).
+inline bool hashFileContents(const char *pFilename, uint64_t& size, uint64_t& hash);
+inline bool hashFileContents(const char *pFilename, uint64_t& size, uint64_t& hash)
+{
+  const uint64_t FNV_PRIME(makeUint64(0x00000100U, 0x000001B3U));
+  unsigned char buf[65536];
+  size_t numBytes;
+  FILE *fp = fopen(pFilename, "rb");
+
+  if (NULL == fp)
+    return false;
+  size = 0;
+  hash = makeUint64(0xCBF29CE4U, 0x84222325U);
+  while ((numBytes = fread(buf, 1, sizeof(buf), fp)) > 0)
+    {
+      for (size_t i = 0; i < numBytes; i++)
+	hash = (hash ^ buf[i]) * FNV_PRIME;
+      size += numBytes;
+    }
+  const bool OK = !ferror(fp);
+  fclose(fp);
+  return OK;
+}
+
+#endif // EPILOGOS_FILE_HASH_H
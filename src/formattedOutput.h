@@ -0,0 +1,131 @@
+#ifndef EPILOGOS_FORMATTED_OUTPUT_H
+#define EPILOGOS_FORMATTED_OUTPUT_H
+
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <stdint.h>
+
+// Fast formatting of numbers, appended to a string (e.g. a line that's reused for every site, so it never reallocates),
+// producing exactly the same text as printf() or an ostream would.  The lines of output are
+// assembled this way and then written to their streams with a single write() each, instead of one << per field.
+
+// Appends val as printf("%ld") would.
+inline void appendInteger(std::string& buf, long val);
+inline void appendInteger(std::string& buf, long val)
+{
+  char digits[24], *p = digits + sizeof(digits);
+  unsigned long u = (val < 0 ? 0UL - static_cast<unsigned long>(val) : static_cast<unsigned long>(val));
+  do {
+    *--p = static_cast<char>('0' + u % 10);
+    u /= 10;
+  } while (u != 0);
+  if (val < 0)
+    *--p = '-';
+  buf.append(p, digits + sizeof(digits) - p);
+}
+
+// Appends val as printf("%.*g", precision, val) would, for precision 1 through 9;
+// precision 6 is also what an ostream with the default settings writes.
+// The significant digits are obtained by scaling val by an exactly representable power of 10 and rounding.
+// The result of the scaling is within about 1e-10 of the exact value, so it rounds the same way as the exact value,
+// except when it's very close to halfway between two integers; in that case, or if val is very large or very small,
+// or not finite, the work is left to sprintf().
+inline void appendFloat(std::string& buf, const double& val, const int& precision);
+inline void appendFloat(std::string& buf, const double& val, const int& precision)
+{
+  static const double powersOf10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+				      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22}; // all exact
+  static const int MAX_EXACT_POWER(22);
+
+  if (0 == val)
+    {
+      uint64_t bits;
+      memcpy(&bits, &val, sizeof(bits));
+      buf.append(bits >> 63 ? "-0" : "0");
+      return;
+    }
+  const double a = std::fabs(val);
+  int exponent = static_cast<int>(std::floor(std::log10(a))); // possibly off by 1, corrected below
+  double scaled(0);
+  bool fastPath(a == a && a <= 1e300); // not NaN or infinity
+  for (int attempt = 0; fastPath && attempt < 2; attempt++)
+    {
+      // scaled = a * 10^(precision - 1 - exponent), which should be in [10^(precision-1), 10^precision)
+      const int k = precision - 1 - exponent;
+      if (k > MAX_EXACT_POWER || -k > MAX_EXACT_POWER)
+	fastPath = false;
+      else
+	scaled = (k >= 0 ? a * powersOf10[k] : a / powersOf10[-k]);
+      if (fastPath && scaled >= powersOf10[precision])
+	exponent++;
+      else if (fastPath && scaled < powersOf10[precision - 1])
+	exponent--;
+      else
+	break;
+    }
+  double mantissa(std::floor(scaled));
+  const double fraction = scaled - mantissa;
+  if (!fastPath || scaled < powersOf10[precision - 1] || scaled >= powersOf10[precision] || std::fabs(fraction - 0.5) < 1e-6)
+    {
+      char formatted[40];
+      sprintf(formatted, "%.*g", precision, val);
+      buf.append(formatted);
+      return;
+    }
+  if (fraction > 0.5)
+    mantissa += 1;
+  if (mantissa >= powersOf10[precision])
+    {
+      // e.g. 9.9999996 rounded to 6 significant digits
+      mantissa = powersOf10[precision - 1];
+      exponent++;
+    }
+
+  // The significant digits, without trailing zeros.
+  char digits[12];
+  unsigned long m = static_cast<unsigned long>(mantissa);
+  int numDigits(precision);
+  for (int i = precision - 1; i >= 0; i--, m /= 10)
+    digits[i] = static_cast<char>('0' + m % 10);
+  while (numDigits > 1 && '0' == digits[numDigits - 1])
+    numDigits--;
+
+  if (val < 0)
+    buf += '-';
+  if (exponent < -4 || exponent >= precision)
+    {
+      // scientific notation, with an exponent of at least 2 digits
+      buf += digits[0];
+      if (numDigits > 1)
+	{
+	  buf += '.';
+	  buf.append(digits + 1, numDigits - 1);
+	}
+      buf += 'e';
+      buf += (exponent < 0 ? '-' : '+');
+      if (exponent > -10 && exponent < 10)
+	buf += '0';
+      appendInteger(buf, exponent < 0 ? -exponent : exponent);
+    }
+  else if (exponent >= 0)
+    {
+      const int numIntegerDigits = exponent + 1;
+      for (int i = 0; i < numIntegerDigits; i++)
+	buf += (i < numDigits ? digits[i] : '0');
+      if (numDigits > numIntegerDigits)
+	{
+	  buf += '.';
+	  buf.append(digits + numIntegerDigits, numDigits - numIntegerDigits);
+	}
+    }
+  else
+    {
+      buf.append("0.");
+      buf.append(-exponent - 1, '0');
+      buf.append(digits, numDigits);
+    }
+}
+
+#endif // EPILOGOS_FORMATTED_OUTPUT_H
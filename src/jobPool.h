@@ -0,0 +1,100 @@
+#ifndef EPILOGOS_JOB_POOL_H
+#define EPILOGOS_JOB_POOL_H
+
+#include <vector>
+#include <pthread.h>
+
+// Runs a set of independent jobs on a fixed number of threads.
+// Jobs are taken in the order given to runJobs(); each thread starts the next job as soon as it finishes one,
+// so jobs of very different sizes (e.g. one per chromosome) keep every thread busy without any planning.
+// The jobs themselves are defined by the derived class, which implements runJob().
+class JobPool {
+public:
+  JobPool();
+  virtual ~JobPool();
+protected:
+  // Runs the jobs numbered jobOrder[0], jobOrder[1], ... on numThreads threads, and returns once they're all done.
+  // Returns false if any job returned false (every job is still run).
+  bool runJobs(const std::vector<unsigned int>& jobOrder, const unsigned int& numThreads);
+  // threadNum (0, 1, ..., numThreads-1) identifies the calling thread, e.g. to select per-thread state.
+  virtual bool runJob(const unsigned int& threadNum, const unsigned int& jobNum) = 0;
+private:
+  JobPool(const JobPool&); // we have no need for a copy constructor, so disable it
+  struct ThreadArgs {
+    JobPool *pPool;
+    unsigned int threadNum;
+  };
+  static void* thread(void *pArgs);
+  void runThread(const unsigned int& threadNum);
+  const std::vector<unsigned int> *m_pJobOrder;
+  size_t m_nextJob; // index in *m_pJobOrder of the next job to start
+  bool m_failed;
+  pthread_mutex_t m_mutex;
+};
+
+inline JobPool::JobPool()
+  : m_pJobOrder(NULL), m_nextJob(0), m_failed(false)
+{
+  pthread_mutex_init(&m_mutex, NULL);
+}
+
+inline JobPool::~JobPool()
+{
+  pthread_mutex_destroy(&m_mutex);
+}
+
+inline void* JobPool::thread(void *pArgs)
+{
+  ThreadArgs *pThreadArgs = static_cast<ThreadArgs*>(pArgs);
+  pThreadArgs->pPool->runThread(pThreadArgs->threadNum);
+  return NULL;
+}
+
+inline void JobPool::runThread(const unsigned int& threadNum)
+{
+  for (;;)
+    {
+      pthread_mutex_lock(&m_mutex);
+      if (m_nextJob == m_pJobOrder->size())
+	{
+	  pthread_mutex_unlock(&m_mutex);
+	  return;
+	}
+      const unsigned int jobNum = (*m_pJobOrder)[m_nextJob++];
+      pthread_mutex_unlock(&m_mutex);
+      const bool OK = runJob(threadNum, jobNum);
+      if (!OK)
+	{
+	  pthread_mutex_lock(&m_mutex);
+	  m_failed = true;
+	  pthread_mutex_unlock(&m_mutex);
+	}
+    }
+}
+
+inline bool JobPool::runJobs(const std::vector<unsigned int>& jobOrder, const unsigned int& numThreads)
+{
+  std::vector<ThreadArgs> threadArgs(numThreads > 1 ? numThreads : 1);
+  std::vector<pthread_t> threads(threadArgs.size());
+
+  m_pJobOrder = &jobOrder;
+  m_nextJob = 0;
+  m_failed = false;
+  if (1 == threadArgs.size())
+    runThread(0); // no need for another thread
+  else
+    {
+      for (unsigned int i = 0; i < threadArgs.size(); i++)
+	{
+	  threadArgs[i].pPool = this;
+	  threadArgs[i].threadNum = i;
+	  pthread_create(&threads[i], NULL, thread, &threadArgs[i]);
+	}
+      for (unsigned int i = 0; i < threads.size(); i++)
+	pthread_join(threads[i], NULL);
+    }
+  m_pJobOrder = NULL;
+  return !m_failed;
+}
+
+#endif // EPILOGOS_JOB_POOL_H
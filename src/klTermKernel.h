@@ -0,0 +1,117 @@
+#ifndef EPILOGOS_KL_TERM_KERNEL_H
+#define EPILOGOS_KL_TERM_KERNEL_H
+
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Computes the per-state (or per-state-pair) terms of the S1 and S2 metrics of computeEpilogosPart2_perChrom
+// for one site, without branching on the data.  For term i, with tallies P1 = pP1[i] and P2 = pP2[i],
+// and with Qn = the (log) contribution of Q for group n (< -999 if the state was never observed in Q):
+//   t = 0 if P1 == 0;  Q1 if Q1 < -999;  otherwise (P1/denom1) * (log(P1) + Q1);
+//   then, with two groups and P2 != 0:  t = -Q2 if Q2 < -999;  otherwise t - (P2/denom2) * (log(P2) + Q2).
+// P/denom and log(P) are looked up in tables indexed by tally, and the special cases are selected with masks,
+// so the result is bit-for-bit what the straightforward branching code computes.
+// With SSE2, 4 terms are computed at once from the structure-of-arrays layout of the tallies and Q contributions;
+// the remaining terms (and every term, without SSE2) are computed by the scalar code.
+
+class KLTermKernel {
+public:
+  KLTermKernel() : m_numTerms(0), m_twoGroups(false) {};
+  // logsOfObservationTallies[t] = log(t) for every tally t that can occur (element 0 is unused);
+  // Q2contrib is empty if there's only one group.
+  void init(const std::vector<float>& Q1contrib, const std::vector<float>& Q2contrib,
+	    const std::vector<float>& logsOfObservationTallies, const float& denom1, const float& denom2);
+  bool initialized(void) const { return m_numTerms != 0; }
+  // pP2 is ignored if there's only one group.
+  void computeTerms(const unsigned int *pP1, const unsigned int *pP2, float *pTerms) const;
+private:
+  float scalarTerm(const size_t& i, const unsigned int& P1, const unsigned int& P2) const;
+  size_t m_numTerms;
+  bool m_twoGroups;
+  std::vector<float> m_logs, m_ratios1, m_ratios2; // indexed by tally; element 0 of each is 0
+  std::vector<float> m_Q1, m_Q2;
+  std::vector<int32_t> m_unobserved1, m_unobserved2; // -1 (all bits set) where Q < -999, otherwise 0
+};
+
+inline void KLTermKernel::init(const std::vector<float>& Q1contrib, const std::vector<float>& Q2contrib,
+			       const std::vector<float>& logsOfObservationTallies, const float& denom1, const float& denom2)
+{
+  m_numTerms = Q1contrib.size();
+  m_twoGroups = !Q2contrib.empty();
+  m_logs = logsOfObservationTallies;
+  if (!m_logs.empty())
+    m_logs[0] = 0;
+  m_ratios1.assign(m_logs.size(), 0);
+  m_ratios2.assign(m_logs.size(), 0);
+  for (size_t t = 1; t < m_logs.size(); t++)
+    {
+      m_ratios1[t] = static_cast<float>(t)/denom1;
+      if (m_twoGroups)
+	m_ratios2[t] = static_cast<float>(t)/denom2;
+    }
+  m_Q1 = Q1contrib;
+  m_Q2 = m_twoGroups ? Q2contrib : std::vector<float>(m_numTerms, 0);
+  m_unobserved1.assign(m_numTerms, 0);
+  m_unobserved2.assign(m_numTerms, 0);
+  for (size_t i = 0; i < m_numTerms; i++)
+    {
+      m_unobserved1[i] = m_Q1[i] < -999. ? -1 : 0;
+      m_unobserved2[i] = m_Q2[i] < -999. ? -1 : 0;
+    }
+}
+
+inline float KLTermKernel::scalarTerm(const size_t& i, const unsigned int& P1, const unsigned int& P2) const
+{
+  const float a1 = m_ratios1[P1] * (m_logs[P1] + m_Q1[i]);
+  float t = m_unobserved1[i] ? m_Q1[i] : a1;
+  t = (P1 != 0) ? t : 0.f;
+  if (m_twoGroups)
+    {
+      const float a2 = m_ratios2[P2] * (m_logs[P2] + m_Q2[i]);
+      const float t2 = m_unobserved2[i] ? -m_Q2[i] : t - a2;
+      t = (P2 != 0) ? t2 : t;
+    }
+  return t;
+}
+
+inline void KLTermKernel::computeTerms(const unsigned int *pP1, const unsigned int *pP2, float *pTerms) const
+{
+  size_t i(0);
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128();
+  const __m128 signBit = _mm_set1_ps(-0.f);
+  for (; i + 4 <= m_numTerms; i += 4)
+    {
+      const unsigned int *p1 = pP1 + i;
+      const __m128 ratio1 = _mm_set_ps(m_ratios1[p1[3]], m_ratios1[p1[2]], m_ratios1[p1[1]], m_ratios1[p1[0]]);
+      const __m128 log1 = _mm_set_ps(m_logs[p1[3]], m_logs[p1[2]], m_logs[p1[1]], m_logs[p1[0]]);
+      const __m128 q1 = _mm_loadu_ps(&m_Q1[i]);
+      const __m128 unobserved1 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&m_unobserved1[i])));
+      const __m128 isZero1 = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p1)), zero));
+      const __m128 a1 = _mm_mul_ps(ratio1, _mm_add_ps(log1, q1));
+      __m128 t = _mm_or_ps(_mm_and_ps(unobserved1, q1), _mm_andnot_ps(unobserved1, a1));
+      t = _mm_andnot_ps(isZero1, t);
+      if (m_twoGroups)
+	{
+	  const unsigned int *p2 = pP2 + i;
+	  const __m128 ratio2 = _mm_set_ps(m_ratios2[p2[3]], m_ratios2[p2[2]], m_ratios2[p2[1]], m_ratios2[p2[0]]);
+	  const __m128 log2 = _mm_set_ps(m_logs[p2[3]], m_logs[p2[2]], m_logs[p2[1]], m_logs[p2[0]]);
+	  const __m128 q2 = _mm_loadu_ps(&m_Q2[i]);
+	  const __m128 unobserved2 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&m_unobserved2[i])));
+	  const __m128 isZero2 = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p2)), zero));
+	  const __m128 a2 = _mm_andnot_ps(isZero2, _mm_mul_ps(ratio2, _mm_add_ps(log2, q2)));
+	  const __m128 replace = _mm_andnot_ps(isZero2, unobserved2); // t = -Q2
+	  t = _mm_or_ps(_mm_and_ps(replace, _mm_xor_ps(q2, signBit)), _mm_andnot_ps(replace, _mm_sub_ps(t, a2)));
+	}
+      _mm_storeu_ps(pTerms + i, t);
+    }
+#endif
+  for (; i < m_numTerms; i++)
+    pTerms[i] = scalarTerm(i, pP1[i], m_twoGroups ? pP2[i] : 0);
+}
+
+#endif // EPILOGOS_KL_TERM_KERNEL_H
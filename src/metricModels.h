@@ -0,0 +1,1747 @@
+#ifndef EPILOGOS_METRIC_MODELS_H
+#define EPILOGOS_METRIC_MODELS_H
+
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <utility> // for pair()
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <stdint.h>
+#include "compressedStreams.h"
+#include "formattedOutput.h"
+#include "klTermKernel.h"
+#include "nullHistogram.h"
+#include "nullTable.h"
+#include "orderedPipeline.h"
+#include "qcontribCache.h"
+#include "runStats.h"
+#include "siteTallies.h"
+#include "stateFileReader.h"
+#include "statePermuter.h"
+
+// The models that compute the metrics S1 (KLModel), S2 (KLsModel), and S3 (KLssModel) at each site,
+// from the per-site tallies written by computeEpilogosPart1_perChrom (or computed from the states directly),
+// and ParallelModel, which scores sites with any of them in parallel.
+// They're used by computeEpilogosPart2_perChrom and computeEpilogos_multiChrom.
+
+inline bool FloatAbs_LT(const float& a, const float& b);
+inline bool FloatAbs_LT(const float& a, const float& b)
+{
+  return std::fabs(a) < std::fabs(b);
+}
+
+// The number of distinct state pair groups (see KLssModel) that contribute to the S3 metric at each site,
+// which determines the work done per site; reported by computeEpilogosPart2_perChrom --stats.
+struct StatePairGroupStats {
+  StatePairGroupStats() : numSites(0), total(0), maximum(0) {};
+  void add(const StatePairGroupStats& other)
+  {
+    numSites += other.numSites;
+    total += other.total;
+    if (other.maximum > maximum)
+      maximum = other.maximum;
+  }
+  uint64_t numSites, total, maximum;
+};
+
+// The time spent computing the metric at each site, and formatting and writing the site's output,
+// by a model and any workers that timeScoring() was called for; reported by computeEpilogosPart2_perChrom --stats.
+struct ScoringTimes {
+  ScoringTimes() : scoreSeconds(0), formatSeconds(0) {};
+  void add(const double& score, const double& format)
+  {
+    scoreSeconds += score;
+    formatSeconds += format;
+  }
+  double scoreSeconds, formatSeconds;
+};
+
+class Model {
+public:
+  virtual ~Model() {};
+  // A model writes either observations and scores or, if pNullsFname isn't NULL, null values.
+  // pNullsFname can be "" for a model whose null values will be written wherever redirectOutput() directs them.
+  virtual bool init(const char *pObsFname, const char *pScoresFname, const char *pNullsFname, const std::string& chrom) = 0;
+  virtual unsigned int size(void) const = 0;
+  virtual bool writingNulls(void) const = 0;
+  virtual bool getQcontrib(std::istream& infile, const char *pFilename, const unsigned int& Nsites) = 0;
+  virtual bool processInputValue(const unsigned int& val) = 0;
+  virtual void computeAndWriteMetric(void) = 0;
+  // If reuseIdenticalSites() is called before init(), repeatPreviousSite() can be called in place of processInputValue()
+  // and computeAndWriteMetric() for a site whose input values (other than its coordinates) are those of the previous site:
+  // it writes the previous site's output again, with the site's own coordinates (which are ignored for null values),
+  // without scoring the site.  The callers (e.g. parseInputWriteOutput()) detect such sites if reusesIdenticalSites().
+  virtual void reuseIdenticalSites(void) = 0;
+  virtual bool reusesIdenticalSites(void) const = 0;
+  virtual void repeatPreviousSite(const unsigned int& begPos, const unsigned int& endPos) = 0;
+  // The following support scoring sites in parallel (see ParallelModel).
+  // createWorker() returns a new model, ready to process input values once getQcontrib() has been called for this one;
+  // it shares this model's Q, and it writes its output wherever redirectOutput() tells it to.
+  virtual Model* createWorker(void) const = 0;
+  virtual void redirectOutput(std::ostream *pObs, std::ostream *pScores, std::ostream *pNulls) = 0;
+  virtual void appendOutput(const std::string& obs, const std::string& scores, const std::string& nulls, const std::string& qcat) = 0;
+  // Sets the chromosome written with each observation, e.g. for a worker scoring a different chromosome than this model.
+  virtual void setChrom(const std::string& chrom) = 0;
+  // If called before init(), the null values are tallied into a histogram (see nullHistogram.h),
+  // which is written to the file of null values in place of the values themselves.
+  virtual void writeNullsAsHistogram(void) = 0;
+  // If called before init(), the null values are written as a sorted run (see nullTable.h) in place of the values themselves,
+  // so that computeEpilogosPart3_perChrom --merge-nulls can merge the runs of all chromosomes without holding their values in memory.
+  virtual void writeNullsAsSortedRun(void) = 0;
+  // If called before init(), each site's scores are also written to pQcatFname, sorted, as a line in the "qcat" format
+  // of HiGlass and WashU Epigenome Browser tracks, exactly as scripts/qcatCreator.py would write it from the scores file.
+  // If pQcatFname ends in ".gz", the file is indexed by tabix as it's written.
+  // The lines' IDs count up from the one given to setQcatID() (by default, 1); redirectQcat() redirects them, e.g. for a worker.
+  virtual void writeQcat(const char *pQcatFname) = 0;
+  virtual void setQcatID(const uint64_t& id) = 0;
+  virtual void redirectQcat(std::ostream *pQcat) = 0;
+  // If called before init(), each of the model's output files that's BGZF-compressed is compressed by numThreads
+  // background threads (see BgzfStreambuf::setCompressionThreads()).
+  virtual void setCompressionThreads(const unsigned int& numThreads) = 0;
+  // The following support caching what getQcontrib() derives from Q (see qcontribCache.h).
+  // useQcontribCache() is an alternative to calling getQcontrib(); the cache must remain open while the model is in use.
+  virtual bool writeQcontribCache(const char *pFilename, const QcontribCacheKey& key) const = 0;
+  virtual bool useQcontribCache(const QcontribCache& cache) = 0;
+  // If called after getQcontrib() (or useQcontribCache()), the input values of each site are the states
+  // of the epigenomes in group 1 followed by those in group 2, rather than the values described by size() until then.
+  // Only S3 (KLssModel) supports this; it returns false for the other metrics.
+  virtual bool useMemberStates(void) = 0;
+  // Adds the statistics gathered while scoring sites (by this model and any workers) to stats; only KLssModel gathers any.
+  virtual void addStatePairGroupStats(StatePairGroupStats& stats) const = 0;
+  // If called before the first site is scored, the two stages of scoring each site (computing the metric,
+  // and formatting and writing the output) are timed; each site's are timed separately, which takes a little time itself.
+  // addScoringTimes() adds the times (of this model and any workers) to times.
+  virtual void timeScoring(void) = 0;
+  virtual void addScoringTimes(ScoringTimes& times) const = 0;
+};
+
+class KLModel : public Model {
+public:
+  KLModel() : m_pOsObs(&m_ofsObs), m_pOsNullValues(&m_ofsNullValues), m_pOsScores(&m_ofsScores), m_nullsAsHistogram(false),
+    m_nullsAsSortedRun(false), m_writeQcat(false), m_pOsQcat(&m_ofsQcat), m_qcatID(1), m_reuseIdenticalSites(false), m_siteLength(0), m_timeScoring(false) {};
+  ~KLModel() { m_nullHistogram.close(); m_nullRun.close(); }
+  bool init(const char *pObsFname, const char *pScoresFname, const char *pNullsFname, const std::string& chrom);
+  unsigned int size(void) const { return m_size; }
+  bool writingNulls(void) const { return m_writeNullMetric; }
+  bool getQcontrib(std::istream& infile, const char *pFilename, const unsigned int& Nsites);
+  bool processInputValue(const unsigned int& val);
+  void computeAndWriteMetric(void);
+  void reuseIdenticalSites(void) { m_reuseIdenticalSites = true; }
+  bool reusesIdenticalSites(void) const { return m_reuseIdenticalSites; }
+  void repeatPreviousSite(const unsigned int& begPos, const unsigned int& endPos);
+  Model* createWorker(void) const;
+  void redirectOutput(std::ostream *pObs, std::ostream *pScores, std::ostream *pNulls);
+  void appendOutput(const std::string& obs, const std::string& scores, const std::string& nulls, const std::string& qcat);
+  void setChrom(const std::string& chrom) { m_chrom = chrom; }
+  void writeNullsAsHistogram(void) { m_nullsAsHistogram = true; }
+  void writeNullsAsSortedRun(void) { m_nullsAsSortedRun = true; }
+  void writeQcat(const char *pQcatFname) { m_writeQcat = true; m_qcatFilename = pQcatFname; }
+  void setQcatID(const uint64_t& id) { m_qcatID = id; }
+  void redirectQcat(std::ostream *pQcat) { m_pOsQcat = pQcat; }
+  void setCompressionThreads(const unsigned int& numThreads);
+  bool writeQcontribCache(const char *pFilename, const QcontribCacheKey& key) const;
+  bool useQcontribCache(const QcontribCache& cache);
+  bool useMemberStates(void) { return false; }
+  void addStatePairGroupStats(StatePairGroupStats& stats) const {}
+  void timeScoring(void);
+  void addScoringTimes(ScoringTimes& times) const { times.add(m_scoreTime.seconds(), m_formatTime.seconds()); }
+protected:
+  void copySettingsFrom(const KLModel& src);
+  virtual void getQcontribTables(std::vector<QcontribTable>& tables) const;
+  // Each line of output is formatted into m_line (see formattedOutput.h), then written with a single write().
+  void beginLineWithSite(void);
+  void beginObservationLine(const std::vector<float>& contribOfEachState);
+  void appendStatePair(const unsigned int& s1, const unsigned int& s2, const float& contrib);
+  void endLine(std::ostream& os, const float& lastValue);
+  void writeScores(const std::vector<float>& contribOfEachState);
+  void writeQcatLine(void);
+  unsigned int m_numStates;
+  unsigned int m_size; // number of values required on each line of input
+  unsigned int m_group1size, m_group2size;
+  unsigned int m_numValsProcessedForGroup1, m_numValsProcessedForGroup2;
+  bool m_writeNullMetric;
+  BgzfOutputStream m_ofsObs, m_ofsNullValues, m_ofsScores;
+  std::ostream *m_pOsObs, *m_pOsNullValues, *m_pOsScores; // where the output is written; by default, the above files
+  bool m_nullsAsHistogram;
+  NullHistogramOutputStream m_nullHistogram; // writes to m_ofsNullValues when it's closed
+  bool m_nullsAsSortedRun;
+  NullRunOutputStream m_nullRun; // likewise
+  bool m_writeQcat;
+  std::string m_qcatFilename;
+  BgzfOutputStream m_ofsQcat;
+  std::ostream *m_pOsQcat; // by default, m_ofsQcat
+  uint64_t m_qcatID; // of the next qcat line
+  std::vector<size_t> m_scoreBegs; // where each score begins in m_line, when writing qcat lines
+  std::vector<double> m_scoreValues;
+  std::vector<unsigned int> m_scoreOrder;
+  std::string m_qcatLine;
+  bool m_reuseIdenticalSites;
+  size_t m_siteLength; // of the site (chromosome and coordinates) at the beginning of m_line
+  std::string m_prevLine, m_prevScores; // the previous site's lines of output (observations or null value, and scores), minus the site
+  bool m_timeScoring;
+  Stopwatch m_scoreTime, m_formatTime;
+  std::string m_chrom;
+  int m_curBegPos, m_curEndPos;
+  // Used by KLModel and KLsModel; initialized by the first call to computeAndWriteMetric().
+  KLTermKernel m_termKernel;
+  std::vector<float> m_terms; // the terms of the metric at the current site
+  std::vector<float> m_contribOfEachState; // used by KLsModel and KLssModel, and reused from site to site
+  std::string m_line;
+private:
+  KLModel(const KLModel&); // we have no need for a copy constructor, so disable it
+  std::vector<unsigned int> m_P1numerators, m_P2numerators; 
+  std::vector<float> m_Q1contrib, m_Q2contrib;
+  std::vector<float> m_logsOfObservationTallies;
+};
+
+class KLsModel : public KLModel {
+public:
+  KLsModel() {};
+  bool getQcontrib(std::istream& infile, const char *pFilename, const unsigned int& Nsites);
+  bool processInputValue(const unsigned int& val);
+  void computeAndWriteMetric(void);
+  Model* createWorker(void) const;
+  bool useQcontribCache(const QcontribCache& cache);
+protected:
+  void getQcontribTables(std::vector<QcontribTable>& tables) const;
+private:
+  KLsModel(const KLsModel&); // we have no need for a copy constructor, so disable it
+  void computeUnorderedStatePairDecompositions(void);
+  std::vector<unsigned int> m_Ps1numerators, m_Ps2numerators;
+  std::vector<float> m_Qs1contrib, m_Qs2contrib;
+  std::vector<float> m_logsOfObservationTallies;
+  std::vector<std::pair<unsigned int, unsigned int> > m_unorderedStatePairDecompositions;
+};
+
+class KLssModel : public KLModel {
+public:
+  KLssModel() : m_pAddStatePairsOfGroup(&KLssModel::addStatePairsOfGroup<0>), m_pSumStatePairGroupTerms(&KLssModel::sumStatePairGroupTerms<0>),
+    m_pQss1contrib(NULL), m_pQss2contrib(NULL), m_numMemberStatesAtThisSite(0) {};
+  bool getQcontrib(std::istream& infile, const char *pFilename, const unsigned int& Nsites);
+  bool processInputValue(const unsigned int& val);
+  void computeAndWriteMetric(void);
+  Model* createWorker(void) const;
+  bool useQcontribCache(const QcontribCache& cache);
+  bool useMemberStates(void);
+  void addStatePairGroupStats(StatePairGroupStats& stats) const { stats.add(m_statePairGroupStats); }
+protected:
+  void getQcontribTables(std::vector<QcontribTable>& tables) const;
+private:
+  KLssModel(const KLssModel&); // we have no need for a copy constructor, so disable it
+  static unsigned int statePairGroupID(const unsigned int& statePairID, const unsigned int& numStates);
+  bool processMemberState(const unsigned int& state);
+  void selectKernels(void);
+  // The per-site loops are instantiated for NUM_STATES = 15 and 18 (the ChromHMM models nearly every run uses),
+  // so the number of states is a compile-time constant, and for NUM_STATES = 0, which uses m_numStates instead;
+  // selectKernels() picks one once the number of states is known.
+  template<unsigned int NUM_STATES>
+  void addStatePairsOfGroup(const unsigned int *pStates, const unsigned int& groupSize, const float *pQss, const double& sign);
+  template<unsigned int NUM_STATES>
+  void sumStatePairGroupTerms(float& retVal, float& contribOfMaxTerm, unsigned int& statePairGroupWithMaxTerm_1based, uint64_t& numStatePairGroups);
+  void (KLssModel::*m_pAddStatePairsOfGroup)(const unsigned int*, const unsigned int&, const float*, const double&);
+  void (KLssModel::*m_pSumStatePairGroupTerms)(float&, float&, unsigned int&, uint64_t&);
+  std::vector<unsigned int> m_statePairGroupIDs; // statePairGroupID() of every state pair ID
+  // The Q** contributions for each group form one contiguous table, aligned on a cache-line boundary,
+  // with one row per epigenome pair and one column per state pair:
+  // the contribution for (epigenomePairID, statePairID) is pQss[epigenomePairID*m_numStates*m_numStates + statePairID - 1].
+  // This is the order in which each site's values are read, so successive lookups fall in successive rows.
+  std::vector<float> m_Qss1storage, m_Qss2storage;
+  const float *m_pQss1contrib, *m_pQss2contrib;
+  // Contributions to the metric at the current site, accumulated as the input values are read,
+  // indexed by state pair group ID (1, 2, ..., numStates^2; see processInputValue()).
+  // Group 1 contributions are added, group 2 contributions subtracted; the sums are kept in double precision,
+  // because the large values assigned to state pairs never observed in Q** (see getQcontrib()) often cancel.
+  // computeAndWriteMetric() resets every element to 0 after it's used, so the array is reused from site to site.
+  std::vector<double> m_statePairGroupTermsAtThisSite;
+  // Whether each state pair group was observed at the current site (its term can be 0 even so); reset likewise.
+  std::vector<unsigned char> m_statePairGroupObservedAtThisSite;
+  // If useMemberStates() has been called, the states of the epigenomes in groups 1 and 2 at the current site
+  // (sized accordingly, and otherwise empty); the state pairs are derived from them once they've all been read.
+  std::vector<unsigned int> m_memberStatesAtThisSite;
+  unsigned int m_numMemberStatesAtThisSite;
+  StatePairGroupStats m_statePairGroupStats;
+};
+
+
+inline bool KLModel::init(const char *pObsFname, const char *pScoresFname, const char *pNullsFname, const std::string& chrom)
+{
+  if (pObsFname != NULL)
+    {
+      m_ofsObs.open(pObsFname);
+      if (!m_ofsObs)
+	{
+	  std::cerr << "Error:  Unable to open file \"" << pObsFname << "\" for writing." << std::endl << std::endl;
+	  return false;
+	}
+    }
+  if (pScoresFname != NULL)
+    {
+      m_ofsScores.open(pScoresFname);
+      if (!m_ofsScores)
+	{
+	  std::cerr << "Error:  Unable to open file \"" << pScoresFname << "\" for writing." << std::endl << std::endl;
+	  return false;
+	}
+    }
+    if (pNullsFname != NULL && *pNullsFname != '\0')
+    {
+      m_ofsNullValues.open(pNullsFname);
+      if (!m_ofsNullValues)
+	{
+	  std::cerr << "Error:  Unable to open file \"" << pNullsFname << "\" for writing." << std::endl << std::endl;
+	  return false;
+	}
+      if (m_nullsAsHistogram)
+	{
+	  m_nullHistogram.attach(m_ofsNullValues);
+	  m_pOsNullValues = &m_nullHistogram;
+	}
+      else if (m_nullsAsSortedRun)
+	{
+	  m_nullRun.attach(m_ofsNullValues);
+	  m_pOsNullValues = &m_nullRun;
+	}
+    }
+  if (m_writeQcat)
+    {
+      m_ofsQcat.indexWithTabix();
+      m_ofsQcat.open(m_qcatFilename.c_str());
+      if (!m_ofsQcat)
+	{
+	  std::cerr << "Error:  Unable to open file \"" << m_qcatFilename << "\" for writing." << std::endl << std::endl;
+	  return false;
+	}
+    }
+  m_chrom = chrom;
+  m_curBegPos = m_curEndPos = -1;
+  m_numValsProcessedForGroup1 = m_numValsProcessedForGroup2 = 0;
+  m_group1size = m_group2size = 0;
+  m_writeNullMetric = (pNullsFname != NULL);
+  m_numStates = m_size = 0; // these will be set by getQcontrib()
+  return true;
+}
+
+// Copies the settings that every model derives from init() and getQcontrib(), but not the output files.
+inline void KLModel::copySettingsFrom(const KLModel& src)
+{
+  m_numStates = src.m_numStates;
+  m_size = src.m_size;
+  m_group1size = src.m_group1size;
+  m_group2size = src.m_group2size;
+  m_numValsProcessedForGroup1 = m_numValsProcessedForGroup2 = 0;
+  m_writeNullMetric = src.m_writeNullMetric;
+  m_chrom = src.m_chrom;
+  m_curBegPos = m_curEndPos = -1;
+  m_pOsObs = m_pOsNullValues = m_pOsScores = NULL;
+  m_writeQcat = src.m_writeQcat;
+  m_pOsQcat = NULL;
+  m_reuseIdenticalSites = src.m_reuseIdenticalSites;
+  if (src.m_timeScoring)
+    timeScoring();
+}
+
+inline Model* KLModel::createWorker(void) const
+{
+  KLModel *pWorker = new KLModel;
+  pWorker->copySettingsFrom(*this);
+  pWorker->m_P1numerators.assign(m_P1numerators.size(), 0);
+  pWorker->m_P2numerators.assign(m_P2numerators.size(), 0);
+  pWorker->m_Q1contrib = m_Q1contrib;
+  pWorker->m_Q2contrib = m_Q2contrib;
+  pWorker->m_logsOfObservationTallies = m_logsOfObservationTallies;
+  return pWorker;
+}
+
+inline void KLModel::timeScoring(void)
+{
+  m_timeScoring = true;
+  m_scoreTime.enable();
+  m_formatTime.enable();
+}
+
+inline void KLModel::setCompressionThreads(const unsigned int& numThreads)
+{
+  m_ofsObs.setCompressionThreads(numThreads);
+  m_ofsScores.setCompressionThreads(numThreads);
+  m_ofsNullValues.setCompressionThreads(numThreads);
+  m_ofsQcat.setCompressionThreads(numThreads);
+}
+
+inline void KLModel::redirectOutput(std::ostream *pObs, std::ostream *pScores, std::ostream *pNulls)
+{
+  m_pOsObs = pObs;
+  m_pOsScores = pScores;
+  m_pOsNullValues = pNulls;
+}
+
+inline void KLModel::appendOutput(const std::string& obs, const std::string& scores, const std::string& nulls, const std::string& qcat)
+{
+  if (!obs.empty())
+    m_pOsObs->write(obs.data(), obs.size());
+  if (!scores.empty())
+    m_pOsScores->write(scores.data(), scores.size());
+  if (!nulls.empty())
+    m_pOsNullValues->write(nulls.data(), nulls.size());
+  if (!qcat.empty())
+    m_pOsQcat->write(qcat.data(), qcat.size());
+}
+
+// Returns a table (pointer and length) for the contents of the vector.
+inline QcontribTable qcontribTable(const std::vector<float>& v);
+inline QcontribTable qcontribTable(const std::vector<float>& v)
+{
+  QcontribTable t;
+  t.pData = v.empty() ? NULL : &v[0];
+  t.length = v.size();
+  return t;
+}
+
+// Copies a cached table into a vector.
+inline void copyQcontribTable(const QcontribTable& t, std::vector<float>& v);
+inline void copyQcontribTable(const QcontribTable& t, std::vector<float>& v)
+{
+  v.assign(t.pData, t.pData + t.length);
+}
+
+// KLModel's tables are Q1contrib, Q2contrib, and the logs of the observation tallies.
+inline void KLModel::getQcontribTables(std::vector<QcontribTable>& tables) const
+{
+  tables.push_back(qcontribTable(m_Q1contrib));
+  tables.push_back(qcontribTable(m_Q2contrib));
+  tables.push_back(qcontribTable(m_logsOfObservationTallies));
+}
+
+// Called after getQcontrib() has been called for every Q file.
+inline bool KLModel::writeQcontribCache(const char *pFilename, const QcontribCacheKey& key) const
+{
+  std::vector<QcontribTable> tables;
+  getQcontribTables(tables);
+  if (!QcontribCache::write(pFilename, key, m_numStates, m_group1size, m_group2size, tables))
+    {
+      std::cerr << "Warning:  Failed to write file " << pFilename << "." << std::endl;
+      return false;
+    }
+  return true;
+}
+
+inline bool KLModel::useQcontribCache(const QcontribCache& cache)
+{
+  if (cache.numTables() != 3)
+    return false;
+  m_numStates = cache.numStates();
+  m_group1size = cache.group1size();
+  m_group2size = cache.group2size();
+  copyQcontribTable(cache.table(0), m_Q1contrib);
+  copyQcontribTable(cache.table(1), m_Q2contrib);
+  copyQcontribTable(cache.table(2), m_logsOfObservationTallies);
+  m_P1numerators.assign(m_Q1contrib.size(), 0);
+  m_P2numerators.assign(m_Q2contrib.size(), 0);
+  m_size = m_P1numerators.size() + m_P2numerators.size();
+  return true;
+}
+
+inline bool KLModel::getQcontrib(std::istream& infile, const char *pFilename, const unsigned int& Nsites)
+{
+  const int BUFSIZE(100000);
+  char buf[BUFSIZE], *p, *pSave;
+  const float LOG_Nsites(std::log(static_cast<float>(Nsites)));
+  unsigned long thisNumTallies, totalNumTallies(0);
+
+  if (!infile.getline(buf, BUFSIZE))
+    {
+      std::cerr << "Error:  File " << pFilename << " is empty." << std::endl << std::endl;
+      return false;
+    }
+  p = strtok_r(buf, "\t", &pSave);
+  thisNumTallies = atol(p);
+  totalNumTallies += thisNumTallies;
+  if (0 == m_group1size)
+    m_Q1contrib.push_back(0 == thisNumTallies ? -999999. : LOG_Nsites - std::log(static_cast<float>(thisNumTallies)));
+  else
+    m_Q2contrib.push_back(0 == thisNumTallies ? -999999. : LOG_Nsites - std::log(static_cast<float>(thisNumTallies)));
+  while ((p = strtok_r(NULL, "\t", &pSave)))
+    {
+      thisNumTallies = atol(p);
+      totalNumTallies += thisNumTallies;
+      if (0 == m_group1size)
+	m_Q1contrib.push_back(0 == thisNumTallies ? -999999. : LOG_Nsites - std::log(static_cast<float>(thisNumTallies)));
+      else
+	m_Q2contrib.push_back(0 == thisNumTallies ? -999999. : LOG_Nsites - std::log(static_cast<float>(thisNumTallies)));
+    }
+  // infile should only contain 1 line of data
+  if (infile.getline(buf, BUFSIZE))
+    {
+      std::cerr << "Error:  File " << pFilename << " contains multiple lines of data; "
+	   << "it should contain a single line of tab-delimited state-pair tallies."
+	   << std::endl << std::endl;
+      return false;
+    }
+
+  // The Q vector contains one element for each possible state.
+  if (0 == m_group1size)
+    m_numStates = m_Q1contrib.size();
+  else
+    {
+      // Perform a sanity check for safety's sake.
+      unsigned int thisNumStates = m_Q2contrib.size();
+      if (thisNumStates != m_numStates)
+	{
+	  std::cerr << "Error:  The file containing tallies for Q for group 1 implies there are "
+	       << m_numStates << " possible states,\n"
+	       << "but file " << pFilename << " (containing Q for group 2) implies there are "
+	       << thisNumStates << " possible states." << std::endl << std::endl;
+	  return false;
+	}
+    }
+
+  // The sum of the tallies in this Q equals the total number of sites
+  // times the number of epigenomes
+  if (0 == m_group1size)
+    {
+      m_group1size = static_cast<unsigned int>(std::floor(static_cast<float>(totalNumTallies)/static_cast<float>(Nsites) + 0.01));
+      m_P1numerators.assign(m_Q1contrib.size(), 0);
+    }
+  else
+    {
+      m_group2size = static_cast<unsigned int>(std::floor(static_cast<float>(totalNumTallies)/static_cast<float>(Nsites) + 0.01));
+      m_P2numerators.assign(m_Q2contrib.size(), 0);
+    }
+  // Note:  The factor of m_group1size in each element of Q
+  // is not stored in m_Qcontrib, because each term of Q enters into the metric
+  // only via the ratio P/Q, and this factor cancels out within this ratio.
+
+  // At any site, the number of times any state is observed
+  // is a number between 0 and numEpigenomes, inclusive.
+  // At each site, we'll need the log2 of one or more of these tallies.
+  // We compute them here to avoid needlessly computing logs of the same numbers thousands or millions of times.
+  if (0 == m_group2size)
+    {
+      m_logsOfObservationTallies.push_back(0); // unused
+      for (unsigned int i = 1; i <= m_group1size; i++)
+	m_logsOfObservationTallies.push_back(std::log(static_cast<float>(i)));
+    }
+  else
+    {
+      if (m_group2size > m_logsOfObservationTallies.size() - 1)
+	for (unsigned int i = m_logsOfObservationTallies.size(); i <= m_group2size; i++)
+	  m_logsOfObservationTallies.push_back(std::log(static_cast<float>(i)));
+    }
+
+  m_size = m_P1numerators.size() + m_P2numerators.size();
+  return true;
+}
+
+inline bool KLModel::processInputValue(const unsigned int& thisTally)
+{
+  bool processingGroup1(true);
+
+  if (!m_writeNullMetric && 0 == m_numValsProcessedForGroup1)
+    {
+      if (-1 == m_curBegPos)
+	{
+	  m_curBegPos = thisTally; // actually a position, not a "tally"
+	  return true;
+	}
+      if (-1 == m_curEndPos)
+	{
+	  m_curEndPos = thisTally; // actually a position, not a "tally"
+	  return true;
+	}
+    }
+  
+  // Check these variables, in case excess columns appear in this line of input.
+  // This is also how we determine, in the case of two groups of epigenomes being compared,
+  // whether the input value is for group 1 or group 2.
+  if (m_numValsProcessedForGroup1 == m_numStates)
+    {
+      if (0 == m_group2size)
+	{
+	  std::cerr << "Error:  Found excess columns in a line of input; expected "
+	       << m_numStates << "." << std::endl;
+	  return false;
+	}
+      else
+	{
+	  if (m_numValsProcessedForGroup2 == m_numStates)
+	    {
+	      std::cerr << "Error:  Found excess columns in a line of input; expected "
+		   << m_numStates * 2 << "." << std::endl;
+	      return false;
+	    }
+	  else
+	    processingGroup1 = false;
+	}
+    }
+
+  if (processingGroup1)
+    m_P1numerators[m_numValsProcessedForGroup1++] = thisTally;
+  else
+    m_P2numerators[m_numValsProcessedForGroup2++] = thisTally;
+
+  return true;
+}
+
+inline void KLModel::beginLineWithSite(void)
+{
+  m_line.clear();
+  m_line.append(m_chrom);
+  m_line += '\t';
+  appendInteger(m_line, m_curBegPos);
+  m_line += '\t';
+  appendInteger(m_line, m_curEndPos);
+  m_siteLength = m_line.size();
+}
+
+// Begins a line of observations with the site, the state with the max contribution, and that contribution (abs. value and sign).
+inline void KLModel::beginObservationLine(const std::vector<float>& contribOfEachState)
+{
+  std::vector<float>::const_iterator itMaxContributor = std::max_element(contribOfEachState.begin(), contribOfEachState.end(), FloatAbs_LT);
+  beginLineWithSite();
+  m_line += '\t';
+  appendInteger(m_line, std::distance(contribOfEachState.begin(), itMaxContributor) + 1); // the state with the max contribution
+  m_line += '\t';
+  appendFloat(m_line, std::fabs(*itMaxContributor), 6); // as written by an ostream
+  m_line.append(*itMaxContributor > 0 ? "\t1\t" : "\t-1\t");
+}
+
+// Appends lastValue to the line and writes it to os.
+inline void KLModel::endLine(std::ostream& os, const float& lastValue)
+{
+  appendFloat(m_line, lastValue, 6);
+  m_line += '\n';
+  os.write(m_line.data(), m_line.size());
+  if (m_reuseIdenticalSites)
+    m_prevLine.assign(m_line, m_writeNullMetric ? 0 : m_siteLength, std::string::npos);
+}
+
+inline void KLModel::writeScores(const std::vector<float>& contribOfEachState)
+{
+  beginLineWithSite();
+  m_scoreBegs.resize(contribOfEachState.size());
+  for (unsigned int i = 0; i < contribOfEachState.size(); i++)
+    {
+      m_line += '\t';
+      m_scoreBegs[i] = m_line.size();
+      appendFloat(m_line, contribOfEachState[i], 4);
+    }
+  m_line += '\n';
+  m_pOsScores->write(m_line.data(), m_line.size());
+  if (m_reuseIdenticalSites)
+    m_prevScores.assign(m_line, m_siteLength, std::string::npos);
+  if (m_writeQcat)
+    writeQcatLine();
+}
+
+// The lines are those of every metric, so this serves KLsModel and KLssModel too.
+inline void KLModel::repeatPreviousSite(const unsigned int& begPos, const unsigned int& endPos)
+{
+  m_formatTime.start();
+  if (m_writeNullMetric)
+    {
+      m_pOsNullValues->write(m_prevLine.data(), m_prevLine.size());
+      m_formatTime.stop();
+      return;
+    }
+  const size_t prevSiteLength(m_siteLength);
+  m_curBegPos = static_cast<int>(begPos);
+  m_curEndPos = static_cast<int>(endPos);
+  beginLineWithSite();
+  m_line.append(m_prevLine);
+  m_pOsObs->write(m_line.data(), m_line.size());
+  beginLineWithSite();
+  m_line.append(m_prevScores);
+  for (unsigned int i = 0; i < m_scoreBegs.size(); i++)
+    m_scoreBegs[i] = m_scoreBegs[i] - prevSiteLength + m_siteLength;
+  m_pOsScores->write(m_line.data(), m_line.size());
+  if (m_writeQcat)
+    writeQcatLine();
+  m_curBegPos = m_curEndPos = -1;
+  m_formatTime.stop();
+}
+
+// Rewrites the line of scores in m_line as a line of qcat output:  the site, "id:" and its ID, then ",qcat:[ ",
+// the pairs [score,state] separated by ", " in increasing order of score, and " ]".  As in scripts/qcatCreator.py,
+// the scores are compared as they're written (with 4 significant digits), and equal scores remain in state order.
+inline void KLModel::writeQcatLine(void)
+{
+  const unsigned int numScores = static_cast<unsigned int>(m_scoreBegs.size());
+  const char *pLine = m_line.c_str();
+
+  m_scoreValues.resize(numScores);
+  m_scoreOrder.resize(numScores);
+  for (unsigned int i = 0; i < numScores; i++)
+    {
+      m_scoreValues[i] = strtod(pLine + m_scoreBegs[i], NULL);
+      // insertion sort, which is stable, and fast for so few scores
+      unsigned int j = i;
+      for (; j > 0 && m_scoreValues[m_scoreOrder[j - 1]] > m_scoreValues[i]; j--)
+	m_scoreOrder[j] = m_scoreOrder[j - 1];
+      m_scoreOrder[j] = i;
+    }
+
+  m_qcatLine.assign(pLine, m_scoreBegs[0] - 1); // the site
+  m_qcatLine.append("\tid:");
+  appendInteger(m_qcatLine, static_cast<long>(m_qcatID++));
+  m_qcatLine.append(",qcat:[ ");
+  for (unsigned int k = 0; k < numScores; k++)
+    {
+      const unsigned int i = m_scoreOrder[k];
+      const size_t scoreEnd = (i + 1 < numScores ? m_scoreBegs[i + 1] : m_line.size()) - 1;
+      if (k != 0)
+	m_qcatLine.append(", ");
+      m_qcatLine += '[';
+      m_qcatLine.append(pLine + m_scoreBegs[i], scoreEnd - m_scoreBegs[i]);
+      m_qcatLine += ',';
+      appendInteger(m_qcatLine, i + 1);
+      m_qcatLine += ']';
+    }
+  m_qcatLine.append(" ]\n");
+  m_pOsQcat->write(m_qcatLine.data(), m_qcatLine.size());
+}
+
+// Appends the state pair (s1,s2) with the max contribution, and that contribution (abs. value and sign), to a line of observations.
+inline void KLModel::appendStatePair(const unsigned int& s1, const unsigned int& s2, const float& contrib)
+{
+  m_line += '(';
+  appendInteger(m_line, s1);
+  m_line += ',';
+  appendInteger(m_line, s2);
+  m_line.append(")\t");
+  appendFloat(m_line, std::fabs(contrib), 6);
+  m_line.append(contrib > 0 ? "\t1\t" : "\t-1\t");
+}
+
+inline void KLModel::computeAndWriteMetric(void)
+{
+  static const float LOG2(0.6931471806);
+  float retVal(0);
+
+  m_scoreTime.start();
+  if (!m_termKernel.initialized())
+    {
+      const float denom1 = LOG2 * static_cast<float>(m_group1size);
+      const float denom2 = LOG2 * static_cast<float>(m_group2size);
+      m_termKernel.init(m_Q1contrib, m_Q2contrib, m_logsOfObservationTallies, denom1, denom2);
+      m_terms.assign(m_P1numerators.size(), 0);
+    }
+  m_termKernel.computeTerms(&m_P1numerators[0], m_P2numerators.empty() ? NULL : &m_P2numerators[0], &m_terms[0]);
+  const std::vector<float>& contribOfEachState = m_terms;
+  for (unsigned int i = 0; i < m_terms.size(); i++)
+    retVal += (0 == m_group2size ? m_terms[i] : std::fabs(m_terms[i]));
+  m_scoreTime.stop();
+
+  m_formatTime.start();
+  if (!m_writeNullMetric)
+    {
+      beginObservationLine(contribOfEachState);
+      endLine(*m_pOsObs, retVal);
+      writeScores(contribOfEachState);
+    }
+  else
+    {
+      m_line.clear();
+      endLine(*m_pOsNullValues, retVal);
+    }
+  m_formatTime.stop();
+  
+  // reset the counting variables and the "P numerator" (m_P1numerators, m_P2numerators) tallies
+  m_numValsProcessedForGroup1 = m_numValsProcessedForGroup2 = 0;
+  m_curBegPos = m_curEndPos = -1;
+  m_P1numerators.assign(m_P1numerators.size(), 0);
+  if (!m_P2numerators.empty())
+    m_P2numerators.assign(m_P2numerators.size(), 0);
+}
+
+
+inline bool KLsModel::getQcontrib(std::istream& infile, const char *pFilename, const unsigned int& Nsites)
+{
+  const int BUFSIZE(100000);
+  char buf[BUFSIZE], *p, *pSave;
+  const float LOG_Nsites(std::log(static_cast<float>(Nsites)));
+  unsigned long thisNumTallies, totalNumTallies(0);
+
+  if (!infile.getline(buf, BUFSIZE))
+    {
+      std::cerr << "Error:  File " << pFilename << " is empty." << std::endl << std::endl;
+      return false;
+    }
+  p = strtok_r(buf, "\t", &pSave);
+  thisNumTallies = atol(p);
+  totalNumTallies += thisNumTallies;
+  if (0 == m_group1size)
+    m_Qs1contrib.push_back(0 == thisNumTallies ? -999999. : LOG_Nsites - std::log(static_cast<float>(thisNumTallies)));
+  else
+    m_Qs2contrib.push_back(0 == thisNumTallies ? -999999. : LOG_Nsites - std::log(static_cast<float>(thisNumTallies)));
+  while ((p = strtok_r(NULL, "\t", &pSave)))
+    {
+      thisNumTallies = atol(p);
+      totalNumTallies += thisNumTallies;
+      if (0 == m_group1size)
+	m_Qs1contrib.push_back(0 == thisNumTallies ? -999999. : LOG_Nsites - std::log(static_cast<float>(thisNumTallies)));
+      else
+	m_Qs2contrib.push_back(0 == thisNumTallies ? -999999. : LOG_Nsites - std::log(static_cast<float>(thisNumTallies)));
+    }
+  // infile should only contain 1 line of data
+  if (infile.getline(buf, BUFSIZE))
+    {
+      std::cerr << "Error:  File " << pFilename << " contains multiple lines of data; "
+	   << "it should contain a single line of tab-delimited state-pair tallies."
+	   << std::endl << std::endl;
+      return false;
+    }
+
+  // The number of unique (unordered) state pairs is numStates*(numStates + 1)/2
+  // (yes, +1, not -1).  Thus if x is the number of elements in the Q* vector,
+  // numStates satisfies numStates^2 + numStates - 2*x == 0.
+  if (0 == m_group1size)
+    m_numStates = static_cast<unsigned int>(std::floor((std::sqrt(1. + 8.*static_cast<float>(m_Qs1contrib.size())) - 1.)/2. + 0.01));
+  else
+    {
+      // Perform a sanity check for safety's sake.
+      unsigned int thisNumStates = static_cast<unsigned int>(std::floor((std::sqrt(1. + 8.*static_cast<float>(m_Qs2contrib.size())) - 1.)/2. + 0.01));
+      if (thisNumStates != m_numStates)
+	{
+	  std::cerr << "Error:  The file containing tallies for Q* for group 1 implies there are "
+	       << m_numStates << " possible states,\n"
+	       << "but file " << pFilename << " (containing Q* for group 2) implies there are "
+	       << thisNumStates << " possible states." << std::endl << std::endl;
+	  return false;
+	}
+    }
+
+  // The sum of the tallies in this Q* equals the total number of sites
+  // times the number of unique epigenome pairs (the latter of which equals numEpigenomes*(numEpigenomes-1)/2).
+  if (0 == m_group1size)
+    {
+      m_group1size = static_cast<unsigned int>(std::floor((std::sqrt(1. + 8.*static_cast<float>(totalNumTallies)/static_cast<float>(Nsites)) + 1.)/2. + 0.01));
+      m_Ps1numerators.assign(m_Qs1contrib.size(), 0);
+    }
+  else
+    {
+      m_group2size = static_cast<unsigned int>(std::floor((std::sqrt(1. + 8.*static_cast<float>(totalNumTallies)/static_cast<float>(Nsites)) + 1.)/2. + 0.01));
+      m_Ps2numerators.assign(m_Qs2contrib.size(), 0);
+    }
+  // Note:  The factor of numEpiPairs*(numEpiPairs-1)/2 in each nonzero element of Q*
+  // is not stored in m_QsContrib, because each term of Q* enters into the metric
+  // only via the ratio P*/Q*, and this factor cancels out within this ratio.
+
+  // At any site, the number of times any unique state pair is observed
+  // is a number between 0 and numEpigenomes*(numEpigenomes-1)/2, inclusive.
+  // At each site, we'll need the log2 of one or more of these tallies.
+  // We compute them here to avoid needlessly computing logs of the same numbers thousands or millions of times.
+  if (0 == m_group2size)
+    {
+      m_logsOfObservationTallies.push_back(0); // unused
+      for (unsigned int i = 1; i <= m_group1size*(m_group1size-1)/2; i++)
+	m_logsOfObservationTallies.push_back(std::log(static_cast<float>(i)));
+    }
+  else
+    {
+      if (m_group2size*(m_group2size-1)/2 > m_logsOfObservationTallies.size() - 1)
+	for (unsigned int i = m_logsOfObservationTallies.size(); i <= m_group2size*(m_group2size-1)/2; i++)
+	  m_logsOfObservationTallies.push_back(std::log(static_cast<float>(i)));
+    }
+
+  computeUnorderedStatePairDecompositions();
+  
+  m_size = m_Ps1numerators.size() + m_Ps2numerators.size();
+  return true;
+}
+
+inline void KLsModel::computeUnorderedStatePairDecompositions(void)
+{
+  // It's helpful to have a lookup table to map from unique unordered state pairs 0, 1, 2, ...
+  // to the states that form those state pairs (i.e., 0 --> (1,1), 1 --> (1,2), ...,
+  // and 119 --> (15,15) if m_numStates = 15).
+  // Imagine assigning the unique unordered state pairs to the upper triangle (including the diagonal)
+  // of a matrix of m_numStates*m_numStates values, and imagine starting from the lower right corner element
+  // (maxUniqueStatePairID, which maps to (m_numStates,m_numStates)) and subtracting increments from it
+  // (delta = 0, 1, 2, ...) and deriving from those deltas the amount that needs to be subtracted
+  // from each row index of the matrix (delta_row) and each column index of the matrix (delta_column)
+  // to transform the state pair (m_numStates,m_numStates) into
+  // (row index, column index) = (state1, state2).
+  unsigned int maxUniqueStatePairID(m_numStates*(m_numStates+1)/2 - 1);
+  m_unorderedStatePairDecompositions.assign(maxUniqueStatePairID+1, std::make_pair(0,0));
+  for (unsigned int delta = 0; delta <= maxUniqueStatePairID; delta++)
+    {
+      unsigned int delta_row, delta_column;
+      delta_row = static_cast<unsigned int>(std::floor((-1. + std::sqrt(1. + 8.*static_cast<float>(delta)))/2. + 0.01));
+      if (delta <= 2)
+	{
+	  // Edge cases for delta = 0, 1, 2
+	  if (2 == delta)
+	    delta_column = 1;
+	  else
+	    delta_column = 0;
+	}
+      else
+	delta_column = delta - delta_row*(delta_row + 1)/2;
+      m_unorderedStatePairDecompositions[maxUniqueStatePairID - delta].first = m_numStates - delta_row;
+      m_unorderedStatePairDecompositions[maxUniqueStatePairID - delta].second = m_numStates - delta_column;
+    }
+}
+
+// KLsModel's tables are Qs1contrib, Qs2contrib, and the logs of the observation tallies.
+inline void KLsModel::getQcontribTables(std::vector<QcontribTable>& tables) const
+{
+  tables.push_back(qcontribTable(m_Qs1contrib));
+  tables.push_back(qcontribTable(m_Qs2contrib));
+  tables.push_back(qcontribTable(m_logsOfObservationTallies));
+}
+
+inline bool KLsModel::useQcontribCache(const QcontribCache& cache)
+{
+  if (cache.numTables() != 3)
+    return false;
+  m_numStates = cache.numStates();
+  m_group1size = cache.group1size();
+  m_group2size = cache.group2size();
+  copyQcontribTable(cache.table(0), m_Qs1contrib);
+  copyQcontribTable(cache.table(1), m_Qs2contrib);
+  copyQcontribTable(cache.table(2), m_logsOfObservationTallies);
+  m_Ps1numerators.assign(m_Qs1contrib.size(), 0);
+  m_Ps2numerators.assign(m_Qs2contrib.size(), 0);
+  computeUnorderedStatePairDecompositions();
+  m_size = m_Ps1numerators.size() + m_Ps2numerators.size();
+  return true;
+}
+
+inline Model* KLsModel::createWorker(void) const
+{
+  KLsModel *pWorker = new KLsModel;
+  pWorker->copySettingsFrom(*this);
+  pWorker->m_Ps1numerators.assign(m_Ps1numerators.size(), 0);
+  pWorker->m_Ps2numerators.assign(m_Ps2numerators.size(), 0);
+  pWorker->m_Qs1contrib = m_Qs1contrib;
+  pWorker->m_Qs2contrib = m_Qs2contrib;
+  pWorker->m_logsOfObservationTallies = m_logsOfObservationTallies;
+  pWorker->m_unorderedStatePairDecompositions = m_unorderedStatePairDecompositions;
+  return pWorker;
+}
+
+inline bool KLsModel::processInputValue(const unsigned int& thisTally)
+{
+  bool processingGroup1(true);
+
+  if (!m_writeNullMetric && 0 == m_numValsProcessedForGroup1)
+    {
+      if (-1 == m_curBegPos)
+	{
+	  m_curBegPos = thisTally; // actually a position, not a "tally"
+	  return true;
+	}
+      if (-1 == m_curEndPos)
+	{
+	  m_curEndPos = thisTally; // actually a position, not a "tally"
+	  return true;
+	}
+    }
+  
+  // Check these variables, in case excess columns appear in this line of input.
+  // This is also how we determine, in the case of two groups of epigenomes being compared,
+  // whether the input value is for group 1 or group 2.
+  if (m_numValsProcessedForGroup1 == m_Ps1numerators.size())
+    {
+      if (m_numValsProcessedForGroup2 == m_Ps2numerators.size())
+	{
+	  std::cerr << "Error:  Found excess columns in a line of input; expected "
+	       << m_group1size + m_group2size << "." << std::endl;
+	  return false;
+	}
+      else
+	processingGroup1 = false;
+    }
+
+  if (processingGroup1)
+    m_Ps1numerators[m_numValsProcessedForGroup1++] = thisTally;
+  else
+    m_Ps2numerators[m_numValsProcessedForGroup2++] = thisTally;
+
+  return true;
+}
+
+inline void KLsModel::computeAndWriteMetric(void)
+{
+  static const float LOG2(0.6931471806);
+  std::vector<float>& contribOfEachState = m_contribOfEachState;
+  float retVal(0), contribOfMaxStatePairTerm(0);
+  unsigned int statePairWithMaxTerm_1based(0); // initialized to 0 to suppress compiler warnings
+
+  m_scoreTime.start();
+  if (!m_termKernel.initialized())
+    {
+      const float denom1 = LOG2 * static_cast<float>(m_group1size)*static_cast<float>(m_group1size - 1)/2.;
+      const float denom2 = LOG2 * static_cast<float>(m_group2size)*static_cast<float>(m_group2size - 1)/2.;
+      m_termKernel.init(m_Qs1contrib, m_Qs2contrib, m_logsOfObservationTallies, denom1, denom2);
+      m_terms.assign(m_Ps1numerators.size(), 0);
+    }
+  m_termKernel.computeTerms(&m_Ps1numerators[0], m_Ps2numerators.empty() ? NULL : &m_Ps2numerators[0], &m_terms[0]);
+  contribOfEachState.assign(m_numStates, 0);
+
+  for (unsigned int uniqueStatePairID = 0; uniqueStatePairID < m_Ps1numerators.size(); uniqueStatePairID++)
+    {
+      const float term = m_terms[uniqueStatePairID];
+      float absTerm; // |term|
+      unsigned int stateOfEpi1_1based, stateOfEpi2_1based;
+
+      if (!m_writeNullMetric) // no need to break down the metric by state if we're solely tasked with writing null metric values
+	{
+	  stateOfEpi1_1based = m_unorderedStatePairDecompositions[uniqueStatePairID].first;
+	  stateOfEpi2_1based = m_unorderedStatePairDecompositions[uniqueStatePairID].second;
+	}
+      absTerm = std::fabs(term);
+
+      if (!m_writeNullMetric) // no need to break down the metric by state if we're solely tasked with writing null metric values
+	{
+	  if (absTerm > std::fabs(contribOfMaxStatePairTerm))
+	    {
+	      contribOfMaxStatePairTerm = term;
+	      statePairWithMaxTerm_1based = uniqueStatePairID + 1;
+	    }
+	  contribOfEachState[stateOfEpi1_1based - 1] += 0.5*term;
+	  contribOfEachState[stateOfEpi2_1based - 1] += 0.5*term;
+	}
+
+      retVal += (0 == m_group2size ? term : absTerm);
+    }
+  m_scoreTime.stop();
+
+  m_formatTime.start();
+  if (!m_writeNullMetric)
+    {
+      // extract the states (s1,s2) from the unique unordered state pair
+      // that contributed the most to the metric
+      unsigned int s1 = m_unorderedStatePairDecompositions[statePairWithMaxTerm_1based - 1].first,
+	s2 = m_unorderedStatePairDecompositions[statePairWithMaxTerm_1based - 1].second;
+      beginObservationLine(contribOfEachState);
+      appendStatePair(s1, s2, contribOfMaxStatePairTerm);
+      endLine(*m_pOsObs, retVal);
+      writeScores(contribOfEachState);
+    }
+  else
+    {
+      m_line.clear();
+      endLine(*m_pOsNullValues, retVal);
+    }
+  m_formatTime.stop();
+  
+  // reset the counting variables and the "P* numerator" (m_Ps1numerators, m_Ps2numerators) tallies
+  m_numValsProcessedForGroup1 = m_numValsProcessedForGroup2 = 0;
+  m_curBegPos = m_curEndPos = -1;
+  m_Ps1numerators.assign(m_Ps1numerators.size(), 0);
+  if (!m_Ps2numerators.empty())
+    m_Ps2numerators.assign(m_Ps2numerators.size(), 0);
+}
+
+
+inline bool KLssModel::getQcontrib(std::istream& infile, const char *pFilename, const unsigned int& Nsites)
+{
+  const int BUFSIZE(100000);
+  const size_t FLOATS_PER_CACHE_LINE(64/sizeof(float));
+  char buf[BUFSIZE], *p, *pSave;
+  const float LOG2(0.6931471806), LOG_Nsites(std::log(static_cast<float>(Nsites)));
+  float denom;
+  std::vector<unsigned int> tallies; // the tally matrix, row by row
+  std::vector<float>& Qss = (NULL == m_pQss1contrib) ? m_Qss1storage : m_Qss2storage;
+  unsigned int linenum(0), fieldnum, numCols(0);
+
+  while (infile.getline(buf, BUFSIZE))
+    {
+      linenum++;
+      fieldnum = 0;
+      if (!(p = strtok_r(buf, "\t", &pSave)))
+	{
+	  std::cerr << "Error:  Failed to parse line " << linenum << " of file " << pFilename << '.'
+	       << std::endl << std::endl;
+	  return false;
+	}
+      if (1 == linenum)
+	{
+	  tallies.push_back(atoi(p));
+	  numCols++;
+	  while ((p = strtok_r(NULL, "\t", &pSave)))
+	    {
+	      tallies.push_back(atoi(p));
+	      numCols++;
+	    }
+	  m_numStates = static_cast<unsigned int>(std::floor(std::sqrt(static_cast<float>(numCols)) + 0.01));
+	}
+      else
+	{
+	  tallies.push_back(atoi(p));
+	  fieldnum++;
+	  while (fieldnum < numCols && (p = strtok_r(NULL, "\t", &pSave)))
+	    {
+	      tallies.push_back(atoi(p));
+	      fieldnum++;
+	    }
+	  if (fieldnum != numCols)
+	    {
+	      std::cerr << "Error:  Found " << numCols << " columns on line 1 of " << pFilename
+		   << " but only " << fieldnum << " columns on line " << linenum
+		   << ".\nEach row must have the same number of columns; the # of columns "
+		   << "must equal the square of the number of possible states\n"
+		   << "(i.e., it must equal the number of possible state pairs)." << std::endl << std::endl;
+	      return false;
+	    }
+	  else
+	    {
+	      if ((p = strtok_r(NULL, "\t", &pSave)))
+		{
+		  std::cerr << "Error:  Found " << numCols << " columns on line 1 of " << pFilename
+		       << " but at least " << numCols+1 << " columns on line " << linenum
+		       << ".\nEach row must have the same number of columns; the # of columns "
+		       << "must equal the square of the number of possible states\n"
+		       << "(i.e., it must equal the number of possible state pairs)." << std::endl << std::endl;
+		  return false;
+		}
+	    }
+	}
+    }
+
+  if (numCols != m_numStates*m_numStates)
+    {
+      std::cerr << "Error:  Found " << numCols << " columns in " << pFilename
+	   << "; the # of columns must equal the square of the number of possible states\n"
+	   << "(i.e., it must equal the number of possible state pairs)." << std::endl << std::endl;
+      return false;
+    }
+
+  // The number of rows (linenum) equals numEpigenomes*(numEpigenomes - 1)/2,
+  // so the number of epigenomes satisfies numEpigenomes^2 - numEpigenomes - 2*linenum == 0.
+  if (0 == m_group1size)
+    m_group1size = static_cast<unsigned int>(std::floor(1. + (std::sqrt(1. + 8.*static_cast<float>(linenum)))/2. + 0.001));
+  else
+    m_group2size = static_cast<unsigned int>(std::floor(1. + (std::sqrt(1. + 8.*static_cast<float>(linenum)))/2. + 0.001));
+
+  denom = LOG2 * static_cast<float>(linenum);
+
+  // Allocate enough extra space to start the table on a cache-line boundary.
+  Qss.assign(tallies.size() + FLOATS_PER_CACHE_LINE, 0);
+  float *pQss = &Qss[0];
+  while (reinterpret_cast<size_t>(pQss) % (FLOATS_PER_CACHE_LINE*sizeof(float)) != 0)
+    pQss++;
+  for (size_t i = 0; i < tallies.size(); i++)
+    {
+      if (tallies[i] != 0)
+	pQss[i] = (LOG_Nsites - std::log(static_cast<float>(tallies[i]))) / denom;
+      else
+	pQss[i] = 999999.;
+    }
+  if (NULL == m_pQss1contrib)
+    m_pQss1contrib = pQss;
+  else
+    m_pQss2contrib = pQss;
+
+  m_size = m_group1size*(m_group1size - 1)/2 + m_group2size*(m_group2size - 1)/2;
+  selectKernels();
+  return true;
+}
+
+// KLssModel's tables are the Q** contributions for groups 1 and 2 (the latter empty if there's no group 2).
+inline void KLssModel::getQcontribTables(std::vector<QcontribTable>& tables) const
+{
+  const uint64_t tableSize = static_cast<uint64_t>(m_numStates)*m_numStates;
+  QcontribTable t;
+  t.pData = m_pQss1contrib;
+  t.length = tableSize * (m_group1size*(m_group1size - 1)/2);
+  tables.push_back(t);
+  t.pData = m_pQss2contrib;
+  t.length = NULL == m_pQss2contrib ? 0 : tableSize * (m_group2size*(m_group2size - 1)/2);
+  tables.push_back(t);
+}
+
+// The Q** tables are used in place, in the memory to which the cache is mapped.
+inline bool KLssModel::useQcontribCache(const QcontribCache& cache)
+{
+  if (cache.numTables() != 2)
+    return false;
+  m_numStates = cache.numStates();
+  m_group1size = cache.group1size();
+  m_group2size = cache.group2size();
+  const uint64_t tableSize = static_cast<uint64_t>(m_numStates)*m_numStates;
+  if (cache.table(0).length != tableSize * (m_group1size*(m_group1size - 1)/2)
+      || cache.table(1).length != tableSize * (m_group2size*(m_group2size - 1)/2))
+    return false;
+  m_pQss1contrib = cache.table(0).pData;
+  m_pQss2contrib = 0 == cache.table(1).length ? NULL : cache.table(1).pData;
+  m_size = m_group1size*(m_group1size - 1)/2 + m_group2size*(m_group2size - 1)/2;
+  selectKernels();
+  return true;
+}
+
+// The worker shares this model's Q** tables, rather than copying them, because they can be large.
+inline Model* KLssModel::createWorker(void) const
+{
+  KLssModel *pWorker = new KLssModel;
+  pWorker->copySettingsFrom(*this);
+  pWorker->m_pQss1contrib = m_pQss1contrib;
+  pWorker->m_pQss2contrib = m_pQss2contrib;
+  pWorker->selectKernels();
+  pWorker->m_memberStatesAtThisSite.assign(m_memberStatesAtThisSite.size(), 0);
+  return pWorker;
+}
+
+inline bool KLssModel::useMemberStates(void)
+{
+  m_size = m_group1size + m_group2size;
+  m_memberStatesAtThisSite.assign(m_size, 0);
+  m_numMemberStatesAtThisSite = 0;
+  return true;
+}
+
+// Reflects statePairID across the matrix diagonal, from the lower triangular matrix to the upper one,
+// so that state pairs (a,b) and (b,a) map to the same state pair group ID.
+inline unsigned int KLssModel::statePairGroupID(const unsigned int& statePairID, const unsigned int& numStates)
+{
+  const unsigned int remainder = statePairID % numStates;
+  if (remainder != 0)
+    {
+      const unsigned int quotient = statePairID / numStates;
+      if (quotient + 1 > remainder)
+	return numStates*(remainder - 1) + (quotient + 1);
+    }
+  return statePairID;
+}
+
+// Called once m_numStates is known.
+inline void KLssModel::selectKernels(void)
+{
+  m_statePairGroupTermsAtThisSite.assign(m_numStates*m_numStates + 1, 0);
+  m_statePairGroupObservedAtThisSite.assign(m_numStates*m_numStates + 1, 0);
+  m_statePairGroupIDs.assign(m_numStates*m_numStates + 1, 0);
+  for (unsigned int statePairID = 1; statePairID < m_statePairGroupIDs.size(); statePairID++)
+    m_statePairGroupIDs[statePairID] = statePairGroupID(statePairID, m_numStates);
+  switch (m_numStates) {
+  case 15:
+    m_pAddStatePairsOfGroup = &KLssModel::addStatePairsOfGroup<15>;
+    m_pSumStatePairGroupTerms = &KLssModel::sumStatePairGroupTerms<15>;
+    break;
+  case 18:
+    m_pAddStatePairsOfGroup = &KLssModel::addStatePairsOfGroup<18>;
+    m_pSumStatePairGroupTerms = &KLssModel::sumStatePairGroupTerms<18>;
+    break;
+  default:
+    m_pAddStatePairsOfGroup = &KLssModel::addStatePairsOfGroup<0>;
+    m_pSumStatePairGroupTerms = &KLssModel::sumStatePairGroupTerms<0>;
+    break;
+  }
+}
+
+// Accumulates the contributions of the state pairs observed in every pair of epigenomes (pStates[i], pStates[j]),
+// 0 <= i < j < groupSize, in the same order as they'd be read if the state pair IDs had been written out.
+template<unsigned int NUM_STATES>
+inline void KLssModel::addStatePairsOfGroup(const unsigned int *pStates, const unsigned int& groupSize, const float *pQss, const double& sign)
+{
+  const unsigned int numStates(NUM_STATES != 0 ? NUM_STATES : m_numStates), numStatePairs(numStates*numStates);
+  double *pTerms = &m_statePairGroupTermsAtThisSite[0];
+  unsigned char *pObserved = &m_statePairGroupObservedAtThisSite[0];
+  for (unsigned int i = 0; i < groupSize; i++)
+    {
+      const unsigned int rowOffset = (pStates[i] - 1)*numStates;
+      for (unsigned int j = i + 1; j < groupSize; j++, pQss += numStatePairs)
+	{
+	  const unsigned int statePairID = rowOffset + pStates[j], groupID = statePairGroupID(statePairID, numStates);
+	  pTerms[groupID] += sign * pQss[statePairID - 1];
+	  pObserved[groupID] = 1;
+	}
+    }
+}
+
+inline bool KLssModel::processMemberState(const unsigned int& state)
+{
+  if (m_numMemberStatesAtThisSite == m_memberStatesAtThisSite.size())
+    {
+      std::cerr << "Error:  Found excess columns in a line of input; expected "
+		<< m_memberStatesAtThisSite.size() << " states." << std::endl;
+      return false;
+    }
+  if (state < 1 || state > m_numStates)
+    {
+      std::cerr << "Error:  Invalid state (" << state << ") found in a line of input; expected an integer between 1 and "
+		<< m_numStates << '.' << std::endl;
+      return false;
+    }
+  m_memberStatesAtThisSite[m_numMemberStatesAtThisSite++] = state;
+  if (m_numMemberStatesAtThisSite == m_memberStatesAtThisSite.size())
+    {
+      (this->*m_pAddStatePairsOfGroup)(&m_memberStatesAtThisSite[0], m_group1size, m_pQss1contrib, 1.);
+      if (m_group2size != 0)
+	(this->*m_pAddStatePairsOfGroup)(&m_memberStatesAtThisSite[m_group1size], m_group2size, m_pQss2contrib, -1.);
+    }
+  return true;
+}
+
+inline bool KLssModel::processInputValue(const unsigned int& statePairID)
+{
+  bool processingGroup1(true);
+
+  if (!m_writeNullMetric && 0 == m_numValsProcessedForGroup1)
+    {
+      if (-1 == m_curBegPos)
+	{
+	  m_curBegPos = statePairID; // actually a position, not a "statePairID"
+	  return true;
+	}
+      if (-1 == m_curEndPos)
+	{
+	  m_curEndPos = statePairID; // actually a position, not a "statePairID"
+	  return true;
+	}
+    }
+  if (!m_memberStatesAtThisSite.empty())
+    return processMemberState(statePairID); // actually a state, not a "statePairID"
+
+  // Check these variables, in case excess columns appear in this line of input.
+  // This is also how we determine, in the case of two groups of epigenomes being compared,
+  // whether the input value is for group 1 or group 2.
+  if (m_numValsProcessedForGroup1 == m_group1size*(m_group1size-1)/2)
+    {
+      if (m_numValsProcessedForGroup2 == m_group2size*(m_group2size-1)/2)
+	{
+	  std::cerr << "Error:  Found excess columns in a line of input; expected "
+	       << m_group1size + m_group2size << "." << std::endl;
+	  return false;
+	}
+      else
+	processingGroup1 = false;
+    }
+
+  if (statePairID < 1 || statePairID > m_numStates*m_numStates)
+    {
+      std::cerr << "Error:  Invalid state pair ID (" << statePairID << ") found in a line of input; expected an integer between 1 and "
+	   << m_numStates*m_numStates << '.' << std::endl;
+      return false;
+    }
+
+  const unsigned int groupID = m_statePairGroupIDs[statePairID];
+  if (processingGroup1)
+    m_statePairGroupTermsAtThisSite[groupID] += m_pQss1contrib[m_numValsProcessedForGroup1++ * m_numStates*m_numStates + statePairID - 1];
+  else
+    m_statePairGroupTermsAtThisSite[groupID] -= m_pQss2contrib[m_numValsProcessedForGroup2++ * m_numStates*m_numStates + statePairID - 1];
+  m_statePairGroupObservedAtThisSite[groupID] = 1;
+
+  return true;
+}
+
+// Sums the terms of the state pair groups observed at this site, and (unless writing null values)
+// their contributions to each state, in m_contribOfEachState, resetting m_statePairGroupTermsAtThisSite
+// and m_statePairGroupObservedAtThisSite for the next site.  As in the original implementation, which kept the observed groups
+// in a map, every observed group is compared in increasing order of ID, and the first group with the largest |term| is reported.
+template<unsigned int NUM_STATES>
+inline void KLssModel::sumStatePairGroupTerms(float& retVal, float& contribOfMaxStatePairGroupTerm, unsigned int& statePairGroupWithMaxTerm_1based,
+					      uint64_t& numStatePairGroups)
+{
+  const unsigned int numStates(NUM_STATES != 0 ? NUM_STATES : m_numStates), numStatePairGroupIDs(numStates*numStates + 1);
+  double *pTerms = &m_statePairGroupTermsAtThisSite[0];
+  unsigned char *pObserved = &m_statePairGroupObservedAtThisSite[0];
+  float *pContribOfEachState = &m_contribOfEachState[0];
+
+  // State pair groups that weren't observed at this site contribute 0 to every sum computed below, so they're skipped.
+  for (unsigned int statePairGroupID = 1; statePairGroupID < numStatePairGroupIDs; statePairGroupID++)
+    {
+      if (!pObserved[statePairGroupID])
+	continue;
+      pObserved[statePairGroupID] = 0;
+      numStatePairGroups++;
+      const float term = static_cast<float>(pTerms[statePairGroupID]); // The contribution to D_KL from each state pair group.
+                                                                      // Each encompasses state pairs (a,b) and (b,a), or (a,a) alone.
+      float absTerm; // |term|
+      unsigned int row, column; // 1-based row and column numbers of the upper triangular matrix of state pair groups;
+                                // these are the states of the two epigenomes within an epigenome pair
+      pTerms[statePairGroupID] = 0; // reset, for the next site
+      absTerm = std::fabs(term);
+      if (!m_writeNullMetric) // no need to break down the metric by state if we're solely tasked with writing null metric values
+	{
+	  column = statePairGroupID % numStates;
+	  row = statePairGroupID / numStates + 1;
+	  if (0 == column)
+	    {
+	      column = numStates;
+	      row -= 1;
+	    }
+	  if (absTerm > std::fabs(contribOfMaxStatePairGroupTerm))
+	    {
+	      contribOfMaxStatePairGroupTerm = term;
+	      statePairGroupWithMaxTerm_1based = statePairGroupID;
+	    }
+	  pContribOfEachState[row - 1] += 0.5*term;    // row = state of epigenome 1 (1-based)
+	  pContribOfEachState[column - 1] += 0.5*term; // column = state of epigenome 2 (1-based)
+	}
+      retVal += (0 == m_group2size ? term : absTerm);
+    }
+}
+
+inline void KLssModel::computeAndWriteMetric(void)
+{
+  float retVal(0);
+  float contribOfMaxStatePairGroupTerm(0);
+  unsigned int statePairGroupWithMaxTerm_1based(0); // initialized to 0 to suppress compiler warnings
+  uint64_t numStatePairGroups(0);
+  std::vector<float>& contribOfEachState = m_contribOfEachState;
+
+  m_scoreTime.start();
+  contribOfEachState.assign(m_numStates, 0);
+  (this->*m_pSumStatePairGroupTerms)(retVal, contribOfMaxStatePairGroupTerm, statePairGroupWithMaxTerm_1based, numStatePairGroups);
+  m_statePairGroupStats.numSites++;
+  m_statePairGroupStats.total += numStatePairGroups;
+  if (numStatePairGroups > m_statePairGroupStats.maximum)
+    m_statePairGroupStats.maximum = numStatePairGroups;
+  m_scoreTime.stop();
+
+  m_formatTime.start();
+  if (!m_writeNullMetric)
+    {
+      unsigned int s1 = statePairGroupWithMaxTerm_1based / m_numStates + 1,
+	s2 = statePairGroupWithMaxTerm_1based % m_numStates; // statePairGroupID = (s1,s2)
+      if (0 == s2)
+	{
+	  s2 = m_numStates;
+	  s1 -= 1;
+	}
+      beginObservationLine(contribOfEachState);
+      appendStatePair(s1, s2, contribOfMaxStatePairGroupTerm);
+      endLine(*m_pOsObs, retVal);
+      writeScores(contribOfEachState);
+    }
+  else
+    {
+      m_line.clear();
+      endLine(*m_pOsNullValues, retVal);
+    }
+  m_formatTime.stop();
+  
+  // reset counting variables
+  m_numValsProcessedForGroup1 = m_numValsProcessedForGroup2 = 0;
+  m_numMemberStatesAtThisSite = 0;
+  m_curBegPos = m_curEndPos = -1;
+}
+
+
+inline Model* createModel(const measurementType& KLtype);
+inline Model* createModel(const measurementType& KLtype)
+{
+  switch (KLtype) {
+  case KL:
+    return new KLModel;
+  case KLs:
+    return new KLsModel;
+  default:
+    return new KLssModel;
+  }
+}
+
+
+// Scores sites in parallel.  The input values of successive sites are collected into batches;
+// each batch is scored by one of numThreads worker threads, each of which has its own copy of the wrapped model
+// (obtained via createWorker(), so the Q tables are shared, not duplicated), and a writer thread
+// appends each batch's results to the wrapped model's output files, in input order (see orderedPipeline.h).
+// The threads are started by the first call to processInputValue(), i.e. after getQcontrib() has been called;
+// finish() must be called once all sites have been submitted.
+// Errors detected by a worker while processing a site are reported by finish().
+class ParallelModel : public Model, private OrderedPipeline {
+public:
+  ParallelModel(Model *pModel, const unsigned int& numThreads);
+  ~ParallelModel();
+  bool init(const char *pObsFname, const char *pScoresFname, const char *pNullsFname, const std::string& chrom)
+  { return m_pModel->init(pObsFname, pScoresFname, pNullsFname, chrom); }
+  unsigned int size(void) const { return m_pModel->size(); }
+  bool writingNulls(void) const { return m_pModel->writingNulls(); }
+  bool getQcontrib(std::istream& infile, const char *pFilename, const unsigned int& Nsites)
+  { return m_pModel->getQcontrib(infile, pFilename, Nsites); }
+  bool processInputValue(const unsigned int& val);
+  void computeAndWriteMetric(void);
+  void reuseIdenticalSites(void) { m_pModel->reuseIdenticalSites(); }
+  bool reusesIdenticalSites(void) const { return m_pModel->reusesIdenticalSites(); }
+  // A repeated site is repeated by the worker that scored the previous site, unless it's the first site of its batch.
+  void repeatPreviousSite(const unsigned int& begPos, const unsigned int& endPos);
+  Model* createWorker(void) const { return m_pModel->createWorker(); }
+  void redirectOutput(std::ostream *pObs, std::ostream *pScores, std::ostream *pNulls) { m_pModel->redirectOutput(pObs, pScores, pNulls); }
+  void appendOutput(const std::string& obs, const std::string& scores, const std::string& nulls, const std::string& qcat)
+  { m_pModel->appendOutput(obs, scores, nulls, qcat); }
+  void setChrom(const std::string& chrom) { m_pModel->setChrom(chrom); }
+  void writeNullsAsHistogram(void) { m_pModel->writeNullsAsHistogram(); }
+  void writeNullsAsSortedRun(void) { m_pModel->writeNullsAsSortedRun(); }
+  void writeQcat(const char *pQcatFname) { m_pModel->writeQcat(pQcatFname); }
+  // Each worker numbers its batch's qcat lines from this ID plus the number of sites preceding the batch.
+  void setQcatID(const uint64_t& id) { m_qcatID = id; m_pModel->setQcatID(id); }
+  void redirectQcat(std::ostream *pQcat) { m_pModel->redirectQcat(pQcat); }
+  void setCompressionThreads(const unsigned int& numThreads) { m_pModel->setCompressionThreads(numThreads); }
+  bool writeQcontribCache(const char *pFilename, const QcontribCacheKey& key) const
+  { return m_pModel->writeQcontribCache(pFilename, key); }
+  bool useQcontribCache(const QcontribCache& cache) { return m_pModel->useQcontribCache(cache); }
+  bool useMemberStates(void) { return m_pModel->useMemberStates(); }
+  void addStatePairGroupStats(StatePairGroupStats& stats) const;
+  void timeScoring(void) { m_pModel->timeScoring(); }
+  void addScoringTimes(ScoringTimes& times) const;
+  bool finish(void);
+  Model* wrappedModel(void) const { return m_pModel; }
+private:
+  ParallelModel(const ParallelModel&); // we have no need for a copy constructor, so disable it
+  struct Batch {
+    uint64_t firstSiteNum; // 1-based
+    std::vector<unsigned int> values; // the input values of every site in the batch, concatenated
+    std::vector<size_t> siteEnds; // the index in values just past each site's last value
+    std::vector<bool> repeated; // whether each site repeats the previous one, in which case its values are just its coordinates
+    std::ostringstream obs, scores, nulls, qcat;
+    bool failed;
+    uint64_t failedSiteNum;
+  };
+  static const size_t MAX_SITES_PER_BATCH = 4096;
+  static const size_t MAX_VALUES_PER_BATCH = 262144;
+  void start(void);
+  void submitCurrentBatch(void);
+  void processBatch(const unsigned int& workerNum, const unsigned int& slot);
+  void writeBatch(const unsigned int& slot);
+  Model *m_pModel;
+  unsigned int m_numThreads;
+  bool m_failed;
+  std::vector<Batch*> m_batches; // indexed by slot
+  std::vector<Model*> m_workers;
+  Batch *m_pCurBatch; // the batch being filled
+  uint64_t m_numSitesSubmitted;
+  uint64_t m_qcatID;
+  std::vector<unsigned int> m_lastSiteValues; // of the last site submitted that wasn't repeated, if reusesIdenticalSites()
+};
+
+inline ParallelModel::ParallelModel(Model *pModel, const unsigned int& numThreads)
+  : m_pModel(pModel), m_numThreads(numThreads), m_failed(false), m_pCurBatch(NULL), m_numSitesSubmitted(0), m_qcatID(1)
+{
+}
+
+inline ParallelModel::~ParallelModel()
+{
+  finish();
+  for (unsigned int i = 0; i < m_workers.size(); i++)
+    delete m_workers[i];
+  for (unsigned int i = 0; i < m_batches.size(); i++)
+    delete m_batches[i];
+}
+
+inline void ParallelModel::start(void)
+{
+  // Two batches per worker keep every worker busy while the writer catches up.
+  m_batches.resize(2*m_numThreads + 1);
+  for (unsigned int i = 0; i < m_batches.size(); i++)
+    {
+      m_batches[i] = new Batch;
+      m_batches[i]->failed = false;
+    }
+  for (unsigned int i = 0; i < m_numThreads; i++)
+    m_workers.push_back(m_pModel->createWorker());
+  startPipeline(m_numThreads, m_batches.size());
+  m_pCurBatch = m_batches[currentSlot()];
+  m_pCurBatch->firstSiteNum = 1;
+}
+
+inline bool ParallelModel::processInputValue(const unsigned int& val)
+{
+  if (!pipelineStarted())
+    start();
+  m_pCurBatch->values.push_back(val);
+  return true;
+}
+
+inline void ParallelModel::computeAndWriteMetric(void)
+{
+  if (!pipelineStarted())
+    start();
+  m_pCurBatch->siteEnds.push_back(m_pCurBatch->values.size());
+  m_pCurBatch->repeated.push_back(false);
+  if (m_pCurBatch->siteEnds.size() >= MAX_SITES_PER_BATCH || m_pCurBatch->values.size() >= MAX_VALUES_PER_BATCH)
+    submitCurrentBatch();
+}
+
+inline void ParallelModel::repeatPreviousSite(const unsigned int& begPos, const unsigned int& endPos)
+{
+  Batch& b = *m_pCurBatch;
+  const bool withCoords = !m_pModel->writingNulls();
+  if (b.siteEnds.empty())
+    {
+      // The previous site was in the previous batch, so this site is scored from the values saved from that batch.
+      b.values = m_lastSiteValues;
+      if (withCoords)
+	{
+	  b.values[0] = begPos;
+	  b.values[1] = endPos;
+	}
+      b.repeated.push_back(false);
+    }
+  else
+    {
+      if (withCoords)
+	{
+	  b.values.push_back(begPos);
+	  b.values.push_back(endPos);
+	}
+      b.repeated.push_back(true);
+    }
+  b.siteEnds.push_back(b.values.size());
+  if (b.siteEnds.size() >= MAX_SITES_PER_BATCH || b.values.size() >= MAX_VALUES_PER_BATCH)
+    submitCurrentBatch();
+}
+
+inline void ParallelModel::submitCurrentBatch(void)
+{
+  if (m_pModel->reusesIdenticalSites())
+    {
+      const Batch& b = *m_pCurBatch;
+      size_t site = b.siteEnds.size() - 1;
+      while (b.repeated[site])
+	site--;
+      m_lastSiteValues.assign(b.values.begin() + (0 == site ? 0 : b.siteEnds[site - 1]), b.values.begin() + b.siteEnds[site]);
+    }
+  m_numSitesSubmitted += m_pCurBatch->siteEnds.size();
+  m_pCurBatch = m_batches[submitBatch()];
+  m_pCurBatch->firstSiteNum = m_numSitesSubmitted + 1;
+}
+
+inline void ParallelModel::processBatch(const unsigned int& workerNum, const unsigned int& slot)
+{
+  Batch& b = *m_batches[slot];
+  Model *pWorker = m_workers[workerNum];
+  size_t i(0);
+
+  pWorker->redirectOutput(&b.obs, &b.scores, &b.nulls);
+  pWorker->redirectQcat(&b.qcat);
+  pWorker->setQcatID(m_qcatID + b.firstSiteNum - 1);
+  for (size_t site = 0; site < b.siteEnds.size() && !b.failed; site++)
+    {
+      if (b.repeated[site])
+	{
+	  if (i < b.siteEnds[site])
+	    pWorker->repeatPreviousSite(b.values[i], b.values[i + 1]);
+	  else
+	    pWorker->repeatPreviousSite(0, 0);
+	  i = b.siteEnds[site];
+	  continue;
+	}
+      for (; i < b.siteEnds[site]; i++)
+	{
+	  if (!pWorker->processInputValue(b.values[i]))
+	    {
+	      b.failed = true;
+	      b.failedSiteNum = b.firstSiteNum + site;
+	      break;
+	    }
+	}
+      if (!b.failed)
+	pWorker->computeAndWriteMetric();
+    }
+}
+
+inline void ParallelModel::writeBatch(const unsigned int& slot)
+{
+  Batch& b = *m_batches[slot];
+  if (b.failed && !m_failed)
+    {
+      std::cerr << "The error was detected at site " << b.failedSiteNum << " of the input." << std::endl << std::endl;
+      m_failed = true;
+    }
+  if (!m_failed)
+    m_pModel->appendOutput(b.obs.str(), b.scores.str(), b.nulls.str(), b.qcat.str());
+  b.values.clear();
+  b.siteEnds.clear();
+  b.repeated.clear();
+  b.obs.str("");
+  b.scores.str("");
+  b.nulls.str("");
+  b.qcat.str("");
+  b.failed = false;
+}
+
+inline void ParallelModel::addStatePairGroupStats(StatePairGroupStats& stats) const
+{
+  m_pModel->addStatePairGroupStats(stats);
+  for (unsigned int i = 0; i < m_workers.size(); i++)
+    m_workers[i]->addStatePairGroupStats(stats);
+}
+
+inline void ParallelModel::addScoringTimes(ScoringTimes& times) const
+{
+  m_pModel->addScoringTimes(times);
+  for (unsigned int i = 0; i < m_workers.size(); i++)
+    m_workers[i]->addScoringTimes(times);
+}
+
+// Scores any remaining sites and waits for all output to be written.
+// Returns false if an error was detected in the input.
+inline bool ParallelModel::finish(void)
+{
+  if (!pipelineStarted())
+    return !m_failed;
+  if (!m_pCurBatch->siteEnds.empty())
+    submitCurrentBatch();
+  finishPipeline();
+  return !m_failed;
+}
+
+// Reads the states at each site of a file in the format of computeEpilogosPart1_perChrom's input via reader,
+// which must be positioned at the first site, and scores each site with pObsModel; if pNullModel isn't NULL, it also scores numPermutations random permutations
+// of each site's states (permutation numbers 0, 1, ..., numPermutations-1; see statePermuter.h) with pNullModel.
+// The permutations are determined by seed, the chromosome, and the site's line number,
+// so they're the same as those computeEpilogosPart1_perChrom makes with the same seed.
+// tallier must have been initialized for the groups being scored; Q is not accumulated.
+// getQcontrib() (or useQcontribCache()) must already have been called for the models.
+// A model that reusesIdenticalSites() repeats its previous site (see Model::repeatPreviousSite()) for a site
+// whose states (for pObsModel) or permuted values (for pNullModel) are the same; the permutations are still made for every site.
+// numSites receives the number of sites read.
+inline bool scoreStates(StateFileReader& reader, SiteTallier& tallier, const uint64_t& seed,
+			const unsigned int& numPermutations, Model *pObsModel, Model *pNullModel, uint64_t& numSites);
+inline bool scoreStates(StateFileReader& reader, SiteTallier& tallier, const uint64_t& seed,
+			const unsigned int& numPermutations, Model *pObsModel, Model *pNullModel, uint64_t& numSites)
+{
+  StatePermuter permuter;
+  std::vector<int> allStatesAtThisSite, allStatesAtPrevSite;
+  std::vector<unsigned int> Pvals, randPvals, prevRandPvals;
+  const bool reuseObs = pObsModel->reusesIdenticalSites(), reuseNulls = (pNullModel != NULL && pNullModel->reusesIdenticalSites());
+
+  while (reader.readSite(allStatesAtThisSite))
+    {
+      if (1 == reader.numSitesRead())
+	permuter.init(seed, reader.chrom());
+      if (reuseObs && reader.numSitesRead() > 1 && allStatesAtThisSite == allStatesAtPrevSite)
+	pObsModel->repeatPreviousSite(static_cast<unsigned int>(atoi(reader.beg())), static_cast<unsigned int>(atoi(reader.end())));
+      else
+	{
+	  Pvals.clear();
+	  tallier.processSite(allStatesAtThisSite, &Pvals, false);
+	  pObsModel->processInputValue(static_cast<unsigned int>(atoi(reader.beg())));
+	  pObsModel->processInputValue(static_cast<unsigned int>(atoi(reader.end())));
+	  for (unsigned int i = 0; i < Pvals.size(); i++)
+	    if (!pObsModel->processInputValue(Pvals[i]))
+	      return false;
+	  pObsModel->computeAndWriteMetric();
+	  if (reuseObs)
+	    allStatesAtPrevSite = allStatesAtThisSite;
+	}
+      if (pNullModel != NULL)
+	{
+	  for (unsigned int k = 0; k < numPermutations; k++)
+	    {
+	      randPvals.clear();
+	      tallier.processPermutedSite(allStatesAtThisSite, permuter, reader.linenum(), k, randPvals);
+	      if (reuseNulls && randPvals == prevRandPvals)
+		{
+		  pNullModel->repeatPreviousSite(0, 0);
+		  continue;
+		}
+	      for (unsigned int i = 0; i < randPvals.size(); i++)
+		if (!pNullModel->processInputValue(randPvals[i]))
+		  return false;
+	      pNullModel->computeAndWriteMetric();
+	      if (reuseNulls)
+		prevRandPvals.swap(randPvals);
+	    }
+	}
+    }
+  numSites = reader.numSitesRead();
+  return !reader.failed();
+}
+
+#endif // EPILOGOS_METRIC_MODELS_H
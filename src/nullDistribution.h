@@ -0,0 +1,257 @@
+#ifndef EPILOGOS_NULL_DISTRIBUTION_H
+#define EPILOGOS_NULL_DISTRIBUTION_H
+
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <map>
+#include <string>
+#include <utility> // for pair()
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <climits>
+#include <stdint.h>
+#include "formattedOutput.h"
+#include "nullHistogram.h"
+#include "siteRange.h"
+
+// The null distribution against which observed metric values are compared to estimate their p-values,
+// as used by computeEpilogosPart3_perChrom and computeEpilogos_multiChrom.
+
+const float g_changeOfScale(1.0e+7); // for converting metrics to integers
+
+struct NullData {
+  long metricAsInt;
+  int numOccs;
+  float pvalue;
+};
+
+// Used to binary-search the null distribution, which is sorted in decreasing order of metricAsInt.
+inline bool NullMetric_GE(const NullData& a, const long& metricAsInt);
+inline bool NullMetric_GE(const NullData& a, const long& metricAsInt)
+{
+  return a.metricAsInt >= metricAsInt;
+}
+
+// Returns the estimated p-value of metricAsInt, i.e. the fraction of null values >= metricAsInt:
+// the p-value of the smallest null value that's >= metricAsInt, or 0 if every null value is smaller.
+inline float lookUpPvalue(const long& metricAsInt, const NullData *pBegin, const NullData *pEnd);
+inline float lookUpPvalue(const long& metricAsInt, const NullData *pBegin, const NullData *pEnd)
+{
+  const NullData *p = std::lower_bound(pBegin, pEnd, metricAsInt, NullMetric_GE);
+  if (pBegin == p)
+    return 0;
+  return (p - 1)->pvalue;
+}
+
+inline float lookUpPvalue(const long& metricAsInt, const std::vector<NullData>& nullDistn);
+inline float lookUpPvalue(const long& metricAsInt, const std::vector<NullData>& nullDistn)
+{
+  if (nullDistn.empty())
+    return 0;
+  return lookUpPvalue(metricAsInt, &nullDistn[0], &nullDistn[0] + nullDistn.size());
+}
+
+// The input file is assumed to contain an arbitrary number of columns of data,
+// the last of which is the metric for which a p-value will be estimated.
+// Columns 1-3 are assumed to be genomic coordinates (chr, begin, end).
+// The output file will be same as the input file, but with p-value estimates appended.
+// FDR estimates will need to be made for the p-values by another program/procedure.
+// Each line is written as soon as it's read, so memory use doesn't depend on the size of the input.
+// (Columns are delimited by one or more tabs, as strtok() would find them.)
+// If pRange isn't NULL, only the lines in that range of sites (whose tile, if any, must have been resolved) are written.
+// If pNumLines isn't NULL, it receives the number of lines written.
+// Consecutive lines with the same metric (e.g. the identical sites of a quiescent region) share one look-up of the p-value.
+// The null distribution can be a std::vector<NullData> or a NullTable (see nullTable.h); it's passed to lookUpPvalue().
+
+template<class NullDistn>
+inline bool loadDataAndReport(std::istream& ifs, std::ostream& ofs, const NullDistn& nullDistn, long *pNumLines = NULL,
+			      const SiteRange *pRange = NULL);
+template<class NullDistn>
+inline bool loadDataAndReport(std::istream& ifs, std::ostream& ofs, const NullDistn& nullDistn, long *pNumLines,
+			      const SiteRange *pRange)
+{
+  const int BUFSIZE(10000);
+  char buf[BUFSIZE];
+  const char *pLastField;
+  long linenum(0), firstLinenum(0), numLinesWritten(0), prevMetricAsInt(0);
+  float pvalue(0);
+  int fieldnum, expectedFinalFieldNum(-1);
+  std::string line; // each line of output is formatted here and written with a single write()
+
+  while (ifs.getline(buf,BUFSIZE))
+    {
+      linenum++;
+      if (pRange != NULL && pRange->restricted())
+	{
+	  // compare the chromosome (field 1) and begin coordinate (field 2) with the range
+	  char *pTab = strchr(buf, '\t');
+	  if (pTab != NULL)
+	    *pTab = '\0';
+	  const int cmp = pRange->compare(static_cast<uint64_t>(linenum), buf, pTab != NULL ? strtoul(pTab + 1, NULL, 10) : 0);
+	  if (pTab != NULL)
+	    *pTab = '\t';
+	  if (cmp < 0)
+	    continue;
+	  if (cmp > 0)
+	    break;
+	}
+      fieldnum = 0;
+      pLastField = NULL;
+      for (const char *p = buf; *p != '\0'; p++)
+	{
+	  if (*p != '\t' && (p == buf || '\t' == *(p - 1)))
+	    {
+	      fieldnum++;
+	      pLastField = p;
+	    }
+	}
+      if (0 == numLinesWritten)
+	{
+	  expectedFinalFieldNum = fieldnum;
+	  firstLinenum = linenum;
+	}
+      else
+	{
+	  if (fieldnum != expectedFinalFieldNum)
+	    {
+	      std::cerr << "Error:  Detected " << expectedFinalFieldNum << " column(s) of data on line " << firstLinenum << " of the input file,\n"
+			<< "but detected " << fieldnum << " column(s) of data on line " << linenum << '.' << std::endl << std::endl;
+	      return false;
+	    }
+	}
+      const long metricAsInt = static_cast<long>(floor((pLastField != NULL ? atof(pLastField) : 0)*g_changeOfScale + 0.5));
+      if (0 == numLinesWritten || metricAsInt != prevMetricAsInt)
+	{
+	  pvalue = lookUpPvalue(metricAsInt, nullDistn);
+	  prevMetricAsInt = metricAsInt;
+	}
+      line.assign(buf);
+      line += '\t';
+      appendFloat(line, pvalue, 6); // as written by an ostream
+      line += '\n';
+      ofs.write(line.data(), line.size());
+      numLinesWritten++;
+    }
+  if (pNumLines != NULL)
+    *pNumLines = numLinesWritten;
+
+  return true;
+}
+
+// Converts a histogram of null values (see nullHistogram.h) into a null distribution, with one entry per nonempty bin.
+// Each entry's value is the highest value in its bin, so an observed value's p-value is the fraction of
+// null values in its own bin and higher ones.  This can exceed the p-value obtained from the exact null values
+// by the fraction of null values within a factor of 1.0001 of the observed value.
+inline bool nullDistnFromHistogram(const NullHistogram& hist, std::vector<NullData>& ndistn);
+inline bool nullDistnFromHistogram(const NullHistogram& hist, std::vector<NullData>& ndistn)
+{
+  if (0 == hist.numValues())
+    {
+      std::cerr << "Error:  Received an empty file of null values." << std::endl << std::endl;
+      return false;
+    }
+
+  const double N(static_cast<double>(hist.numValues()));
+  uint64_t runningTallyOfOccurrences(0);
+  NullData ndata;
+  for (unsigned int b = hist.numBins(); b-- > 0; )
+    {
+      if (0 == hist.tally(b))
+	continue;
+      ndata.metricAsInt = (b + 1 < NullHistogram::MAX_BINS) ? static_cast<long>(NullHistogram::lowestValueInBin(b + 1)) - 1 : LONG_MAX;
+      ndata.numOccs = static_cast<int>(hist.tally(b));
+      runningTallyOfOccurrences += hist.tally(b);
+      ndata.pvalue = static_cast<float>(static_cast<double>(runningTallyOfOccurrences) / N);
+      ndistn.push_back(ndata);
+    }
+  ndistn.back().pvalue = 1.;
+
+  return true;
+}
+
+// Reads the null values, one per line, and tallies them into a null distribution,
+// sorted in decreasing order of metricAsInt, with one entry per distinct value.
+inline void loadNullDistn(std::istream& ifs, std::vector<NullData>& ndistn);
+inline void loadNullDistn(std::istream& ifs, std::vector<NullData>& ndistn)
+{
+  const int BUFSIZE(100);
+  char buf[BUFSIZE];
+  uint64_t numNullValues(0);
+  std::map<long,uint64_t> tempMap; // This map provides an efficient means for tallying occurrences of values.
+  std::map<long,uint64_t>::iterator it;
+  std::pair<long,uint64_t> mapElementToInsert;
+  mapElementToInsert.second = 1;
+
+  while (ifs.getline(buf,BUFSIZE))
+    {
+      long value = static_cast<long>(floor(atof(buf)*g_changeOfScale + 0.5));
+      // We use lower_bound() rather than find() because for values that haven't yet been inserted
+      // into the map, the former will give us a "hint" of where the new value should be inserted.
+      it = tempMap.lower_bound(value); // >=
+      if (tempMap.end() == it)
+	{
+	  // no lower bound found in the map; every map element is smaller, or the map is empty
+	  mapElementToInsert.first = value;
+	  if (tempMap.begin() != it)
+	    tempMap.insert(--it, mapElementToInsert);
+	  else // map is empty
+	    tempMap.insert(mapElementToInsert);
+	}
+      else
+	{
+	  if (it->first == value)
+	    it->second++;
+	  else
+	    {
+	      if (it != tempMap.begin())
+		it--;
+	      mapElementToInsert.first = value;
+	      tempMap.insert(it, mapElementToInsert);
+	    }
+	}
+      numNullValues++;
+    }
+
+  if (0 == numNullValues)
+    {
+      std::cerr << "Error:  Received an empty file of null values." << std::endl << std::endl;
+      exit(2);
+    }
+
+  float N(static_cast<float>(numNullValues));
+  uint64_t runningTallyOfOccurrences(0);
+  NullData ndata;
+  it = tempMap.end();
+  it--;
+  while (it != tempMap.begin())
+    {
+      ndata.metricAsInt = it->first;
+      ndata.numOccs = static_cast<int>(it->second);
+      runningTallyOfOccurrences += it->second;
+      ndata.pvalue = static_cast<float>(runningTallyOfOccurrences) / N;
+      ndistn.push_back(ndata);
+      it--;
+    }
+  ndata.metricAsInt = it->first;
+  ndata.numOccs = static_cast<int>(it->second);
+  ndata.pvalue = 1.;
+  ndistn.push_back(ndata);
+
+}
+
+// Alternative to loadNullDistn() whose memory use is bounded, no matter how many null values there are:
+// the null values (or one or more histograms of them written by computeEpilogosPart2_perChrom --null-histogram)
+// are tallied into a histogram (see nullHistogram.h and nullDistnFromHistogram()).
+inline bool loadNullDistnAsHistogram(std::istream& ifs, std::vector<NullData>& ndistn);
+inline bool loadNullDistnAsHistogram(std::istream& ifs, std::vector<NullData>& ndistn)
+{
+  NullHistogram hist;
+
+  if (!hist.load(ifs))
+    return false;
+  return nullDistnFromHistogram(hist, ndistn);
+}
+
+#endif // EPILOGOS_NULL_DISTRIBUTION_H
@@ -0,0 +1,222 @@
+#ifndef EPILOGOS_NULL_HISTOGRAM_H
+#define EPILOGOS_NULL_HISTOGRAM_H
+
+#include <iostream>
+#include <streambuf>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+#include <cmath>
+#include <stdint.h>
+
+// A compact summary of the null distribution:  a histogram of null metric values with logarithmically spaced bins,
+// so its size is bounded (at most MAX_BINS bins) no matter how many values are added to it.
+//
+// Values are first converted to integers exactly as computeEpilogosPart3_perChrom does (m = round(value * 1e7)).
+// Bin 0 holds m <= 0 (the metrics are nonnegative, so in practice just 0); bin b > 0 holds the integers m >= 1
+// with floor(ln(m) * 10000) = b - 1.  So each bin spans a relative range of 1e-4 or less,
+// and every integer below 10000 has a bin of its own.
+//
+// The text format written by write() is a header line, then one line per nonempty bin (the bin number and its tally).
+// Histograms can be merged by concatenating files (e.g. the per-chromosome histograms written by computeEpilogosPart2_perChrom);
+// load() adds up the tallies of repeated bins and skips repeated header lines.
+
+const char g_nullHistogramHeader[] = "#epilogosNullHistogram";
+const double g_nullHistogramChangeOfScale(1.0e+7); // as in computeEpilogosPart3_perChrom
+const double g_nullHistogramBinsPerUnitLog(10000.);
+
+class NullHistogram {
+public:
+  NullHistogram() : m_numValues(0) {};
+  static const unsigned int MAX_BINS = 450000; // enough for every m below 2^64
+  void add(const double& value);
+  void addToBin(const unsigned int& bin, const uint64_t& tally);
+  bool write(std::ostream& os) const;
+  bool load(std::istream& is);
+  void clear(void) { m_tallies.clear(); m_numValues = 0; }
+  uint64_t numValues(void) const { return m_numValues; }
+  unsigned int numBins(void) const { return static_cast<unsigned int>(m_tallies.size()); }
+  uint64_t tally(const unsigned int& bin) const { return m_tallies[bin]; }
+  static unsigned int binOf(const double& m);
+  static double lowestValueInBin(const unsigned int& bin);
+private:
+  std::vector<uint64_t> m_tallies; // indexed by bin; grows as needed, up to MAX_BINS
+  uint64_t m_numValues;
+};
+
+// m is a value that has been multiplied by g_nullHistogramChangeOfScale and rounded to the nearest integer.
+inline unsigned int NullHistogram::binOf(const double& m)
+{
+  if (m < 1.)
+    return 0;
+  const double b = floor(log(m) * g_nullHistogramBinsPerUnitLog) + 1.;
+  return b < static_cast<double>(MAX_BINS - 1) ? static_cast<unsigned int>(b) : MAX_BINS - 1;
+}
+
+// Returns the smallest integer m for which binOf(m) == bin (or 0 for bin 0).
+// The logarithm is inverted numerically, then the result is corrected, so that it agrees exactly with binOf().
+inline double NullHistogram::lowestValueInBin(const unsigned int& bin)
+{
+  if (0 == bin)
+    return 0;
+  double m = ceil(exp(static_cast<double>(bin - 1) / g_nullHistogramBinsPerUnitLog));
+  while (m > 1. && binOf(m - 1.) >= bin)
+    m -= 1.;
+  while (binOf(m) < bin)
+    m += 1.;
+  return m;
+}
+
+inline void NullHistogram::addToBin(const unsigned int& bin, const uint64_t& tally)
+{
+  if (bin >= m_tallies.size())
+    m_tallies.resize(bin + 1, 0);
+  m_tallies[bin] += tally;
+  m_numValues += tally;
+}
+
+inline void NullHistogram::add(const double& value)
+{
+  addToBin(binOf(floor(value * g_nullHistogramChangeOfScale + 0.5)), 1);
+}
+
+inline bool NullHistogram::write(std::ostream& os) const
+{
+  os << g_nullHistogramHeader << '\t' << g_nullHistogramBinsPerUnitLog << '\n';
+  for (unsigned int b = 0; b < m_tallies.size(); b++)
+    if (m_tallies[b] != 0)
+      os << b << '\t' << m_tallies[b] << '\n';
+  os.flush();
+  return static_cast<bool>(os);
+}
+
+// Adds the contents of the stream to the histogram.  The stream can contain either one null value per line,
+// or one or more histograms written by write() (the format is detected from the first line).
+// Returns false if the stream's histogram has a different bin structure or is malformed.
+inline bool NullHistogram::load(std::istream& is)
+{
+  std::string line;
+  bool histogramFormat(false);
+  unsigned long linenum(0);
+
+  while (getline(is, line))
+    {
+      linenum++;
+      if (1 == linenum)
+	histogramFormat = (0 == line.compare(0, strlen(g_nullHistogramHeader), g_nullHistogramHeader));
+      if (!histogramFormat)
+	{
+	  add(atof(line.c_str()));
+	  continue;
+	}
+      if ('#' == line[0])
+	{
+	  const char *p = line.c_str() + strlen(g_nullHistogramHeader);
+	  if (0 != line.compare(0, strlen(g_nullHistogramHeader), g_nullHistogramHeader) || atof(p) != g_nullHistogramBinsPerUnitLog)
+	    {
+	      std::cerr << "Error:  Unexpected null histogram header on line " << linenum << " (\"" << line << "\")." << std::endl << std::endl;
+	      return false;
+	    }
+	  continue;
+	}
+      char *pEnd;
+      const unsigned long bin = strtoul(line.c_str(), &pEnd, 10);
+      if (pEnd == line.c_str() || *pEnd != '\t' || bin >= MAX_BINS)
+	{
+	  std::cerr << "Error:  Invalid null histogram entry on line " << linenum << " (\"" << line << "\")." << std::endl << std::endl;
+	  return false;
+	}
+      const char *pTally = pEnd + 1;
+      addToBin(static_cast<unsigned int>(bin), strtoul(pTally, NULL, 10));
+    }
+  return true;
+}
+
+// An output stream that accepts null values written one per line, as text, and tallies them into a Tally
+// (a NullHistogram, or e.g. a NullRun; see nullTable.h), which close() (or the destructor) writes to the attached stream.
+// The values are parsed from the same text that would otherwise have been written,
+// so the tally is identical to one built from a file of the null values.
+template<class Tally>
+class NullTallyStreambuf : public std::streambuf {
+public:
+  NullTallyStreambuf() : m_pDest(NULL), m_buf(BUFSIZE) { setp(&m_buf[0], &m_buf[0] + BUFSIZE - 1); }
+  ~NullTallyStreambuf() { close(); }
+  void attach(std::ostream& dest) { m_pDest = &dest; }
+  bool close(void);
+protected:
+  typename std::streambuf::int_type overflow(typename std::streambuf::int_type c);
+private:
+  NullTallyStreambuf(const NullTallyStreambuf&); // we have no need for a copy constructor, so disable it
+  void tallyCompleteLines(void);
+  static const unsigned int BUFSIZE = 65536;
+  std::ostream *m_pDest;
+  std::vector<char> m_buf;
+  Tally m_tally;
+};
+
+// Tallies every complete line in the buffer and moves any incomplete one to the beginning of it.
+template<class Tally>
+inline void NullTallyStreambuf<Tally>::tallyCompleteLines(void)
+{
+  char *pLine = this->pbase(), *pEol;
+  while (pLine < this->pptr() && (pEol = static_cast<char*>(memchr(pLine, '\n', this->pptr() - pLine))) != NULL)
+    {
+      *pEol = '\0';
+      if (pEol > pLine)
+	m_tally.add(atof(pLine));
+      pLine = pEol + 1;
+    }
+  const std::ptrdiff_t numLeftover = this->pptr() - pLine;
+  memmove(&m_buf[0], pLine, numLeftover);
+  this->setp(&m_buf[0], &m_buf[0] + BUFSIZE - 1); // the last byte is reserved for the newline close() appends
+  this->pbump(static_cast<int>(numLeftover));
+}
+
+template<class Tally>
+inline typename std::streambuf::int_type NullTallyStreambuf<Tally>::overflow(typename std::streambuf::int_type c)
+{
+  tallyCompleteLines();
+  if (this->pptr() == this->epptr())
+    return traits_type::eof(); // a single line longer than the buffer isn't a null value
+  if (!traits_type::eq_int_type(c, traits_type::eof()))
+    {
+      *this->pptr() = traits_type::to_char_type(c);
+      this->pbump(1);
+    }
+  return traits_type::not_eof(c);
+}
+
+template<class Tally>
+inline bool NullTallyStreambuf<Tally>::close(void)
+{
+  if (NULL == m_pDest)
+    return true;
+  *this->pptr() = '\n';
+  this->pbump(1);
+  tallyCompleteLines();
+  const bool retVal = m_tally.write(*m_pDest);
+  m_pDest = NULL;
+  m_tally.clear();
+  return retVal;
+}
+
+template<class Tally>
+class NullTallyOutputStream : public std::ostream {
+public:
+  NullTallyOutputStream() : std::ostream(NULL) { init(&m_sbuf); }
+  void attach(std::ostream& dest) { m_sbuf.attach(dest); }
+  void close(void)
+  {
+    if (!m_sbuf.close())
+      setstate(std::ios_base::failbit);
+  }
+private:
+  NullTallyOutputStream(const NullTallyOutputStream&); // we have no need for a copy constructor, so disable it
+  NullTallyStreambuf<Tally> m_sbuf;
+};
+
+typedef NullTallyOutputStream<NullHistogram> NullHistogramOutputStream;
+
+#endif // EPILOGOS_NULL_HISTOGRAM_H
@@ -0,0 +1,444 @@
+#ifndef EPILOGOS_NULL_TABLE_H
+#define EPILOGOS_NULL_TABLE_H
+
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <vector>
+#include <string>
+#include <utility> // for pair()
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <climits>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "compressedStreams.h"
+#include "formattedOutput.h"
+#include "nullDistribution.h"
+#include "nullHistogram.h"
+
+// Genome-wide null distributions that are built once, with bounded memory, and then shared by every
+// computeEpilogosPart3_perChrom job, instead of each job reading and tallying every chromosome's null values.
+//
+// A sorted run (NullRun, written by computeEpilogosPart2_perChrom --sorted-nulls) holds one chromosome's null values
+// as distinct values with their tallies, in decreasing order, as text:  a header line (g_nullRunHeader, a tab,
+// and the number of null values), then one line per distinct value (the value as an integer, as loadNullDistn() converts it,
+// a tab, and its tally).  computeEpilogosPart3_perChrom --merge-nulls merges any number of runs, keeping only
+// one line of each in memory (a k-way merge), into a null table:  the null distribution that loadNullDistn() would
+// build from all of their values, in a binary file that each job maps into memory (NullTable).
+// Histograms (see nullHistogram.h) can be merged into a table too, as can files of null values, which are sorted in memory first.
+//
+// The table consists of a header, followed by the NullData entries of the distribution, in decreasing order of metricAsInt.
+// Everything is in the byte order of the machine that wrote the file; a file written with a different byte order
+// (or a different layout of NullData) is rejected.
+//   bytes  0- 7:  magic string "EPINULLT"
+//   bytes  8-11:  format version (currently 1)
+//   bytes 12-15:  0x01020304, in the writer's byte order
+//   bytes 16-19:  sizeof(NullData)
+//   bytes 20-23:  1 if the table was built from histograms (so its p-values are those of nullDistnFromHistogram()), 0 otherwise
+//   bytes 24-31:  number of entries
+//   bytes 32-39:  number of null values
+
+const char g_nullRunHeader[] = "#epilogosNullRun";
+
+class NullRun {
+public:
+  NullRun() : m_numValues(0) {};
+  void add(const double& value);
+  bool write(std::ostream& os);
+  void clear(void) { m_buffer.clear(); m_entries.clear(); m_numValues = 0; }
+private:
+  void compact(void);
+  static const size_t MAX_BUFFERED = 4194304;
+  std::vector<long> m_buffer; // values not yet sorted into m_entries
+  std::vector<std::pair<long, uint64_t> > m_entries; // the distinct values, in decreasing order, and their tallies
+  uint64_t m_numValues;
+};
+
+typedef NullTallyOutputStream<NullRun> NullRunOutputStream;
+
+inline void NullRun::add(const double& value)
+{
+  m_buffer.push_back(static_cast<long>(floor(value*g_changeOfScale + 0.5))); // as in loadNullDistn()
+  m_numValues++;
+  if (m_buffer.size() >= MAX_BUFFERED)
+    compact();
+}
+
+// Sorts the buffered values and merges them into m_entries.
+inline void NullRun::compact(void)
+{
+  std::vector<std::pair<long, uint64_t> > merged;
+  std::sort(m_buffer.begin(), m_buffer.end(), std::greater<long>());
+  merged.reserve(m_entries.size() + m_buffer.size());
+  size_t i(0), j(0);
+  while (i < m_entries.size() || j < m_buffer.size())
+    {
+      if (j == m_buffer.size() || (i < m_entries.size() && m_entries[i].first > m_buffer[j]))
+	{
+	  merged.push_back(m_entries[i++]);
+	  continue;
+	}
+      if (i < m_entries.size() && m_entries[i].first == m_buffer[j])
+	merged.push_back(m_entries[i++]);
+      else
+	merged.push_back(std::make_pair(m_buffer[j], static_cast<uint64_t>(0)));
+      for (const long value = m_buffer[j]; j < m_buffer.size() && m_buffer[j] == value; j++)
+	merged.back().second++;
+    }
+  m_entries.swap(merged);
+  m_buffer.clear();
+}
+
+inline bool NullRun::write(std::ostream& os)
+{
+  std::string buf(g_nullRunHeader);
+  compact();
+  buf += '\t';
+  appendInteger(buf, static_cast<long>(m_numValues));
+  buf += '\n';
+  for (size_t i = 0; i < m_entries.size(); i++)
+    {
+      appendInteger(buf, m_entries[i].first);
+      buf += '\t';
+      appendInteger(buf, static_cast<long>(m_entries[i].second));
+      buf += '\n';
+      if (buf.size() >= 65536)
+	{
+	  os.write(buf.data(), buf.size());
+	  buf.clear();
+	}
+    }
+  os.write(buf.data(), buf.size());
+  os.flush();
+  return !os.fail();
+}
+
+class NullTable {
+public:
+  NullTable() : m_pMap(NULL), m_mapSize(0), m_pEntries(NULL), m_numEntries(0), m_numValues(0) {};
+  ~NullTable() { close(); }
+  // Returns true if the file begins with the table's magic string (so it's not e.g. a file of null values).
+  static bool isNullTable(const char *pFilename);
+  bool open(const char *pFilename);
+  void close(void);
+  // Valid until the table is closed.
+  const NullData* begin(void) const { return m_pEntries; }
+  const NullData* end(void) const { return m_pEntries + m_numEntries; }
+  uint64_t numValues(void) const { return m_numValues; }
+  // Merges the sorted runs, histograms, or files of null values (all of the same kind) into a table.
+  static bool merge(const std::vector<const char*>& infiles, const char *pFilename);
+private:
+  NullTable(const NullTable&); // we have no need for a copy constructor, so disable it
+  class Writer;
+  static const unsigned int HEADER_SIZE = 64;
+  static const uint32_t FORMAT_VERSION = 1;
+  static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+  static uint32_t get32(const char *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+  static uint64_t get64(const char *p) { uint64_t v; memcpy(&v, p, 8); return v; }
+  static void put32(char *p, uint32_t v) { memcpy(p, &v, 4); }
+  static void put64(char *p, uint64_t v) { memcpy(p, &v, 8); }
+  static bool readRunEntry(std::istream& is, const char *pFilename, std::pair<long, uint64_t>& entry);
+  static bool mergeRuns(std::vector<std::istream*>& runs, const std::vector<const char*>& infiles, const uint64_t& numValues, Writer& writer);
+  void *m_pMap;
+  size_t m_mapSize;
+  const NullData *m_pEntries;
+  uint64_t m_numEntries, m_numValues;
+};
+
+// Writes a table's entries, which are added in decreasing order of metricAsInt, as they're computed.
+// The file is written under a temporary name and then renamed, so that the jobs using it never see a partially written table.
+class NullTable::Writer {
+public:
+  Writer() : m_fp(NULL), m_numEntries(0) {};
+  ~Writer() { if (m_fp != NULL) { fclose(m_fp); remove(m_tempFilename.c_str()); } }
+  bool open(const char *pFilename, const bool& fromHistograms, const uint64_t& numValues);
+  bool add(const NullData& entry) { m_numEntries++; return fwrite(&entry, sizeof(entry), 1, m_fp) == 1; }
+  bool close(void);
+private:
+  Writer(const Writer&); // we have no need for a copy constructor, so disable it
+  FILE *m_fp;
+  std::string m_filename, m_tempFilename;
+  char m_header[HEADER_SIZE];
+  uint64_t m_numEntries;
+};
+
+inline bool NullTable::Writer::open(const char *pFilename, const bool& fromHistograms, const uint64_t& numValues)
+{
+  char pid[32];
+  sprintf(pid, ".%ld.tmp", static_cast<long>(getpid()));
+  m_filename = pFilename;
+  m_tempFilename = m_filename + pid;
+  if (NULL == (m_fp = fopen(m_tempFilename.c_str(), "wb")))
+    {
+      std::cerr << "Error:  Unable to open file \"" << m_tempFilename << "\" for writing." << std::endl << std::endl;
+      return false;
+    }
+  memset(m_header, 0, HEADER_SIZE);
+  memcpy(m_header, "EPINULLT", 8);
+  put32(m_header + 8, FORMAT_VERSION);
+  put32(m_header + 12, BYTE_ORDER_MARK);
+  put32(m_header + 16, sizeof(NullData));
+  put32(m_header + 20, fromHistograms ? 1 : 0);
+  put64(m_header + 32, numValues);
+  m_numEntries = 0;
+  return fwrite(m_header, 1, HEADER_SIZE, m_fp) == HEADER_SIZE; // the number of entries is filled in by close()
+}
+
+inline bool NullTable::Writer::close(void)
+{
+  put64(m_header + 24, m_numEntries);
+  bool OK = (0 == fseek(m_fp, 0, SEEK_SET) && fwrite(m_header, 1, HEADER_SIZE, m_fp) == HEADER_SIZE);
+  if (fclose(m_fp) != 0)
+    OK = false;
+  m_fp = NULL;
+  if (OK)
+    OK = (0 == rename(m_tempFilename.c_str(), m_filename.c_str()));
+  if (!OK)
+    {
+      std::cerr << "Error:  Failed to write file \"" << m_filename << "\"." << std::endl << std::endl;
+      remove(m_tempFilename.c_str());
+    }
+  return OK;
+}
+
+inline bool NullTable::isNullTable(const char *pFilename)
+{
+  char magic[8];
+  FILE *fp = fopen(pFilename, "rb");
+  if (NULL == fp)
+    return false;
+  const bool retVal = (fread(magic, 1, 8, fp) == 8 && 0 == memcmp(magic, "EPINULLT", 8));
+  fclose(fp);
+  return retVal;
+}
+
+inline bool NullTable::open(const char *pFilename)
+{
+  close();
+  const int fd = ::open(pFilename, O_RDONLY);
+  if (fd < 0)
+    {
+      std::cerr << "Error:  Failed to open file \"" << pFilename << "\" for read." << std::endl << std::endl;
+      return false;
+    }
+  struct stat st;
+  if (0 == fstat(fd, &st) && st.st_size >= static_cast<off_t>(HEADER_SIZE))
+    {
+      m_mapSize = static_cast<size_t>(st.st_size);
+      m_pMap = mmap(NULL, m_mapSize, PROT_READ, MAP_SHARED, fd, 0);
+      if (MAP_FAILED == m_pMap)
+	m_pMap = NULL;
+    }
+  ::close(fd);
+
+  const char *p = static_cast<const char*>(m_pMap);
+  if (NULL == p || memcmp(p, "EPINULLT", 8) != 0 || get32(p + 8) != FORMAT_VERSION || get32(p + 12) != BYTE_ORDER_MARK
+      || get32(p + 16) != sizeof(NullData) || 0 == get64(p + 24)
+      || get64(p + 24) != (m_mapSize - HEADER_SIZE) / sizeof(NullData))
+    {
+      std::cerr << "Error:  File \"" << pFilename << "\" is not a complete null table written on this kind of machine." << std::endl << std::endl;
+      close();
+      return false;
+    }
+  m_pEntries = reinterpret_cast<const NullData*>(p + HEADER_SIZE);
+  m_numEntries = get64(p + 24);
+  m_numValues = get64(p + 32);
+  return true;
+}
+
+inline void NullTable::close(void)
+{
+  if (m_pMap != NULL)
+    munmap(m_pMap, m_mapSize);
+  m_pMap = NULL;
+  m_mapSize = 0;
+  m_pEntries = NULL;
+  m_numEntries = m_numValues = 0;
+}
+
+// Reads the next line of a sorted run; returns false at the end of the run, or after reporting an error (setting badbit).
+inline bool NullTable::readRunEntry(std::istream& is, const char *pFilename, std::pair<long, uint64_t>& entry)
+{
+  std::string line;
+  if (!getline(is, line))
+    return false;
+  char *pEnd;
+  const long value = strtol(line.c_str(), &pEnd, 10);
+  if (pEnd == line.c_str() || *pEnd != '\t')
+    {
+      std::cerr << "Error:  Invalid line in sorted run \"" << pFilename << "\" (\"" << line << "\")." << std::endl << std::endl;
+      is.setstate(std::ios_base::badbit);
+      return false;
+    }
+  entry.first = value;
+  entry.second = strtoul(pEnd + 1, NULL, 10);
+  return true;
+}
+
+// Merges the runs, whose header lines have been read, one line of each at a time, from the largest value down.
+// Each distinct value's p-value is computed as in loadNullDistn(), from the total number of null values in the headers.
+inline bool NullTable::mergeRuns(std::vector<std::istream*>& runs, const std::vector<const char*>& infiles,
+				 const uint64_t& numValues, Writer& writer)
+{
+  std::priority_queue<std::pair<long, unsigned int> > heads; // each run's next value, and the run
+  std::vector<std::pair<long, uint64_t> > entries(runs.size());
+  const float N(static_cast<float>(numValues));
+  uint64_t runningTallyOfOccurrences(0);
+  NullData ndata;
+  bool haveEntry(false);
+
+  for (unsigned int i = 0; i < runs.size(); i++)
+    {
+      if (readRunEntry(*runs[i], infiles[i], entries[i]))
+	heads.push(std::make_pair(entries[i].first, i));
+      else if (runs[i]->bad())
+	return false;
+    }
+  while (!heads.empty())
+    {
+      const unsigned int i = heads.top().second;
+      const std::pair<long, uint64_t> entry(entries[i]);
+      heads.pop();
+      if (readRunEntry(*runs[i], infiles[i], entries[i]))
+	{
+	  if (entries[i].first >= entry.first)
+	    {
+	      std::cerr << "Error:  Sorted run \"" << infiles[i] << "\" is not in decreasing order (" << entries[i].first
+			<< " follows " << entry.first << ")." << std::endl << std::endl;
+	      return false;
+	    }
+	  heads.push(std::make_pair(entries[i].first, i));
+	}
+      else if (runs[i]->bad())
+	return false;
+      if (haveEntry && entry.first != ndata.metricAsInt)
+	{
+	  ndata.pvalue = static_cast<float>(runningTallyOfOccurrences) / N;
+	  if (!writer.add(ndata))
+	    return false;
+	  haveEntry = false;
+	}
+      if (!haveEntry)
+	{
+	  ndata.metricAsInt = entry.first;
+	  ndata.numOccs = 0;
+	  haveEntry = true;
+	}
+      ndata.numOccs += static_cast<int>(entry.second);
+      runningTallyOfOccurrences += entry.second;
+    }
+  if (!haveEntry || runningTallyOfOccurrences != numValues)
+    {
+      std::cerr << "Error:  The sorted runs hold " << runningTallyOfOccurrences << " null values, but their headers give "
+		<< numValues << '.' << std::endl << std::endl;
+      return false;
+    }
+  ndata.pvalue = 1.; // as in loadNullDistn()
+  return writer.add(ndata);
+}
+
+// Each input file's kind is determined by its first line.  Histograms are added up into one (so the table's p-values
+// are the slight overestimates of nullDistnFromHistogram()); sorted runs are merged; and files of null values
+// (as written by computeEpilogosPart2_perChrom without --sorted-nulls or --null-histogram) are first sorted
+// into runs in memory, one file at a time, then merged with the others.
+inline bool NullTable::merge(const std::vector<const char*>& infiles, const char *pFilename)
+{
+  std::vector<std::istream*> runs;
+  std::vector<std::string> kinds;
+  std::string line;
+  uint64_t numValues(0);
+  bool histograms(false), OK(true);
+
+  for (unsigned int i = 0; i < infiles.size(); i++)
+    {
+      GzInputStream ifs(infiles[i]);
+      if (!ifs)
+	{
+	  std::cerr << "Error:  Failed to open file \"" << infiles[i] << "\" for read." << std::endl << std::endl;
+	  return false;
+	}
+      if (!getline(ifs, line))
+	line.clear();
+      kinds.push_back(line.compare(0, strlen(g_nullRunHeader), g_nullRunHeader) == 0 ? g_nullRunHeader
+		      : (line.compare(0, strlen(g_nullHistogramHeader), g_nullHistogramHeader) == 0 ? g_nullHistogramHeader : ""));
+      if (g_nullHistogramHeader == kinds.back())
+	histograms = true;
+    }
+
+  Writer writer;
+  if (histograms)
+    {
+      NullHistogram hist;
+      std::vector<NullData> nullDistn;
+      for (unsigned int i = 0; i < infiles.size(); i++)
+	{
+	  GzInputStream ifs(infiles[i]);
+	  if (g_nullRunHeader == kinds[i])
+	    {
+	      std::cerr << "Error:  Unable to merge sorted run \"" << infiles[i] << "\" with histograms." << std::endl << std::endl;
+	      return false;
+	    }
+	  if (!hist.load(ifs))
+	    return false;
+	}
+      if (!nullDistnFromHistogram(hist, nullDistn) || !writer.open(pFilename, true, hist.numValues()))
+	return false;
+      for (unsigned int i = 0; i < nullDistn.size(); i++)
+	if (!writer.add(nullDistn[i]))
+	  return false;
+      return writer.close();
+    }
+
+  for (unsigned int i = 0; i < infiles.size() && OK; i++)
+    {
+      GzInputStream *pIfs = new GzInputStream(infiles[i]);
+      if (!*pIfs)
+	{
+	  delete pIfs;
+	  std::cerr << "Error:  Failed to open file \"" << infiles[i] << "\" for read." << std::endl << std::endl;
+	  OK = false;
+	  break;
+	}
+      if (kinds[i].empty())
+	{
+	  NullRun run;
+	  std::stringstream *pRun = new std::stringstream;
+	  while (getline(*pIfs, line))
+	    run.add(atof(line.c_str()));
+	  delete pIfs;
+	  run.write(*pRun);
+	  runs.push_back(pRun);
+	}
+      else
+	runs.push_back(pIfs);
+      getline(*runs.back(), line); // the header
+      numValues += strtoul(line.c_str() + strlen(g_nullRunHeader), NULL, 10);
+    }
+  if (OK && 0 == numValues)
+    {
+      std::cerr << "Error:  Received an empty file of null values." << std::endl << std::endl;
+      OK = false;
+    }
+  if (OK)
+    OK = writer.open(pFilename, false, numValues) && mergeRuns(runs, infiles, numValues, writer) && writer.close();
+  for (unsigned int i = 0; i < runs.size(); i++)
+    delete runs[i];
+  return OK;
+}
+
+// Returns the estimated p-value of metricAsInt, as lookUpPvalue() does for a null distribution in memory.
+inline float lookUpPvalue(const long& metricAsInt, const NullTable& nullDistn);
+inline float lookUpPvalue(const long& metricAsInt, const NullTable& nullDistn)
+{
+  return lookUpPvalue(metricAsInt, nullDistn.begin(), nullDistn.end());
+}
+
+#endif // EPILOGOS_NULL_TABLE_H
@@ -0,0 +1,173 @@
+#ifndef EPILOGOS_ORDERED_PIPELINE_H
+#define EPILOGOS_ORDERED_PIPELINE_H
+
+#include <vector>
+#include <pthread.h>
+#include <stdint.h>
+
+// Processes a stream of batches of work in parallel, while preserving their order.
+// The thread that owns the pipeline fills batches one at a time and submits them;
+// numWorkers worker threads each take the oldest submitted batch and call processBatch() on it;
+// and a single writer thread calls writeBatch() on the processed batches, strictly in the order they were submitted.
+// The batches themselves are owned by the derived class, which stores them in numSlots "slots"
+// that are reused as a ring buffer, so at most numSlots batches are in flight at any time.
+class OrderedPipeline {
+public:
+  OrderedPipeline();
+  virtual ~OrderedPipeline();
+protected:
+  // Starts the threads.  Slot 0 is the first to be filled.
+  void startPipeline(const unsigned int& numWorkers, const unsigned int& numSlots);
+  bool pipelineStarted(void) const { return m_started; }
+  // The slot currently being filled by the owning thread.
+  unsigned int currentSlot(void) const { return static_cast<unsigned int>(m_fillSeq % m_numSlots); }
+  // Submits the batch in the current slot, then waits until the next slot is free and returns it;
+  // the next slot's previous batch, if any, has been written by the time this returns.
+  unsigned int submitBatch(void);
+  // Waits until every submitted batch has been processed and written, then stops the threads.
+  void finishPipeline(void);
+  // workerNum (0, 1, ..., numWorkers-1) identifies the calling worker thread, e.g. to select per-thread state.
+  virtual void processBatch(const unsigned int& workerNum, const unsigned int& slot) = 0;
+  // writeBatch() must leave the slot ready to be refilled.
+  virtual void writeBatch(const unsigned int& slot) = 0;
+private:
+  OrderedPipeline(const OrderedPipeline&); // we have no need for a copy constructor, so disable it
+  struct WorkerArgs {
+    OrderedPipeline *pPipeline;
+    unsigned int workerNum;
+  };
+  static void* workerThread(void *pArgs);
+  static void* writerThread(void *pArgs);
+  void runWorker(const unsigned int& workerNum);
+  void runWriter(void);
+  bool m_started, m_inputDone;
+  unsigned int m_numSlots;
+  // Every batch with a sequence number below m_fillSeq has been submitted;
+  // every one below m_processSeq has been taken by a worker, and every one below m_writeSeq has been written.
+  uint64_t m_fillSeq, m_processSeq, m_writeSeq;
+  std::vector<bool> m_processed; // indexed by slot
+  std::vector<WorkerArgs> m_workerArgs;
+  std::vector<pthread_t> m_workerThreads;
+  pthread_t m_writerThread;
+  pthread_mutex_t m_mutex;
+  pthread_cond_t m_cond;
+};
+
+inline OrderedPipeline::OrderedPipeline()
+  : m_started(false), m_inputDone(false), m_numSlots(1), m_fillSeq(0), m_processSeq(0), m_writeSeq(0)
+{
+  pthread_mutex_init(&m_mutex, NULL);
+  pthread_cond_init(&m_cond, NULL);
+}
+
+// Derived classes must call finishPipeline() in their own destructors,
+// because their batches and their implementations of processBatch() and writeBatch() are gone by the time this runs.
+inline OrderedPipeline::~OrderedPipeline()
+{
+  pthread_cond_destroy(&m_cond);
+  pthread_mutex_destroy(&m_mutex);
+}
+
+inline void* OrderedPipeline::workerThread(void *pArgs)
+{
+  WorkerArgs *pWorkerArgs = static_cast<WorkerArgs*>(pArgs);
+  pWorkerArgs->pPipeline->runWorker(pWorkerArgs->workerNum);
+  return NULL;
+}
+
+inline void* OrderedPipeline::writerThread(void *pArgs)
+{
+  static_cast<OrderedPipeline*>(pArgs)->runWriter();
+  return NULL;
+}
+
+inline void OrderedPipeline::startPipeline(const unsigned int& numWorkers, const unsigned int& numSlots)
+{
+  m_numSlots = numSlots;
+  m_processed.assign(numSlots, false);
+  m_fillSeq = m_processSeq = m_writeSeq = 0;
+  m_inputDone = false;
+  m_workerArgs.resize(numWorkers);
+  m_workerThreads.resize(numWorkers);
+  for (unsigned int i = 0; i < numWorkers; i++)
+    {
+      m_workerArgs[i].pPipeline = this;
+      m_workerArgs[i].workerNum = i;
+      pthread_create(&m_workerThreads[i], NULL, workerThread, &m_workerArgs[i]);
+    }
+  pthread_create(&m_writerThread, NULL, writerThread, this);
+  m_started = true;
+}
+
+inline unsigned int OrderedPipeline::submitBatch(void)
+{
+  pthread_mutex_lock(&m_mutex);
+  m_fillSeq++;
+  pthread_cond_broadcast(&m_cond);
+  while (m_fillSeq - m_writeSeq >= m_numSlots)
+    pthread_cond_wait(&m_cond, &m_mutex);
+  pthread_mutex_unlock(&m_mutex);
+  return currentSlot();
+}
+
+inline void OrderedPipeline::runWorker(const unsigned int& workerNum)
+{
+  pthread_mutex_lock(&m_mutex);
+  for (;;)
+    {
+      if (m_processSeq < m_fillSeq)
+	{
+	  const unsigned int slot = static_cast<unsigned int>(m_processSeq % m_numSlots);
+	  m_processSeq++;
+	  pthread_mutex_unlock(&m_mutex);
+	  processBatch(workerNum, slot);
+	  pthread_mutex_lock(&m_mutex);
+	  m_processed[slot] = true;
+	  pthread_cond_broadcast(&m_cond);
+	  continue;
+	}
+      if (m_inputDone)
+	break;
+      pthread_cond_wait(&m_cond, &m_mutex);
+    }
+  pthread_mutex_unlock(&m_mutex);
+}
+
+inline void OrderedPipeline::runWriter(void)
+{
+  pthread_mutex_lock(&m_mutex);
+  for (;;)
+    {
+      const unsigned int slot = static_cast<unsigned int>(m_writeSeq % m_numSlots);
+      if (m_writeSeq < m_fillSeq && m_processed[slot])
+	{
+	  pthread_mutex_unlock(&m_mutex);
+	  writeBatch(slot);
+	  pthread_mutex_lock(&m_mutex);
+	  m_processed[slot] = false;
+	  m_writeSeq++;
+	  pthread_cond_broadcast(&m_cond);
+	  continue;
+	}
+      if (m_inputDone && m_writeSeq == m_fillSeq)
+	break;
+      pthread_cond_wait(&m_cond, &m_mutex);
+    }
+  pthread_mutex_unlock(&m_mutex);
+}
+
+inline void OrderedPipeline::finishPipeline(void)
+{
+  if (!m_started)
+    return;
+  pthread_mutex_lock(&m_mutex);
+  m_inputDone = true;
+  pthread_cond_broadcast(&m_cond);
+  pthread_mutex_unlock(&m_mutex);
+  for (unsigned int i = 0; i < m_workerThreads.size(); i++)
+    pthread_join(m_workerThreads[i], NULL);
+  pthread_join(m_writerThread, NULL);
+  m_started = false;
+}
+
+#endif // EPILOGOS_ORDERED_PIPELINE_H
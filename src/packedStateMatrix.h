@@ -0,0 +1,235 @@
+#ifndef EPILOGOS_PACKED_STATE_MATRIX_H
+#define EPILOGOS_PACKED_STATE_MATRIX_H
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <stdint.h>
+#include "binaryTallyFormat.h"
+
+// Packed binary alternative to the tab-delimited state files read by computeEpilogosPart1_perChrom
+// (chromosome, beg, end, state of epigenome 1, state of epigenome 2, ...; one line per site),
+// written by computeEpilogosPart1_perChrom --pack-states and read by StateFileReader::open() in place of the text.
+// Every site must be on the same chromosome, and every coordinate must be a decimal integer without leading zeros,
+// so that the text of every coordinate can be reproduced exactly.
+//
+// The file begins with a header; all integers are little-endian.
+//   bytes  0- 7:  magic string "EPISTATE"
+//   bytes  8-11:  format version (currently 1)
+//   bytes 12-15:  number of possible states
+//   bytes 16-19:  number of epigenomes
+//   bytes 20-23:  number of bits used to store each state (4 if numStates <= 16, 8 otherwise)
+//   bytes 24-31:  number of sites
+//   bytes 32-39:  end - beg for every site, if it is the same for every site; otherwise 0xFFFFFFFFFFFFFFFF
+//   bytes 40-43:  length of the chromosome name
+// The chromosome name follows (without a terminating '\0'), and then one row per site, each of the same number of bytes.
+// Each row holds state - 1 for epigenome 1, epigenome 2, ...; with 4 bits per state, an odd-numbered epigenome's state
+// occupies the low 4 bits of its byte and the following epigenome's state occupies the high 4 bits.
+// After the rows come the coordinates:  for each site, beg - (beg of the previous site, or 0 for the first site),
+// followed by end - beg if the header doesn't give it, each as a zigzag-encoded variable-length integer
+// (7 bits per byte, least significant first, with the high bit set on every byte but the last).
+
+const char g_packedStateMagic[8] = {'E','P','I','S','T','A','T','E'};
+const unsigned int g_packedStateFormatVersion(1);
+const unsigned int g_packedStateFixedHeaderSize(44);
+const uint64_t g_packedStateVariableWidth(~static_cast<uint64_t>(0));
+
+struct PackedStateHeader {
+  uint32_t formatVersion;
+  uint32_t numStates;
+  uint32_t numEpigenomes;
+  uint32_t bitsPerState;
+  uint64_t numSites;
+  uint64_t siteWidth;
+  std::string chrom;
+  size_t rowBytes(void) const { return (static_cast<size_t>(numEpigenomes)*bitsPerState + 7)/8; }
+  size_t headerSize(void) const { return g_packedStateFixedHeaderSize + chrom.size(); }
+};
+
+inline void appendVarint(std::string& buf, const int64_t& val);
+inline void appendVarint(std::string& buf, const int64_t& val)
+{
+  uint64_t zigzag = (static_cast<uint64_t>(val) << 1) ^ (val < 0 ? ~static_cast<uint64_t>(0) : 0);
+  while (zigzag >= 0x80)
+    {
+      buf += static_cast<char>((zigzag & 0x7F) | 0x80);
+      zigzag >>= 7;
+    }
+  buf += static_cast<char>(zigzag);
+}
+
+// Returns false if the integer isn't complete before pEnd.  Otherwise p is advanced past it.
+inline bool readVarint(const char*& p, const char *pEnd, int64_t& val);
+inline bool readVarint(const char*& p, const char *pEnd, int64_t& val)
+{
+  uint64_t zigzag(0);
+  for (unsigned int shift = 0; p < pEnd && shift < 64; shift += 7)
+    {
+      const unsigned char c = static_cast<unsigned char>(*p++);
+      zigzag |= static_cast<uint64_t>(c & 0x7F) << shift;
+      if (!(c & 0x80))
+	{
+	  val = static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+	  return true;
+	}
+    }
+  return false;
+}
+
+// Returns true if the len bytes at p begin with the packed header, in which case hdr is filled in.
+inline bool readPackedStateHeader(const char *p, const size_t& len, PackedStateHeader& hdr);
+inline bool readPackedStateHeader(const char *p, const size_t& len, PackedStateHeader& hdr)
+{
+  if (len < g_packedStateFixedHeaderSize || memcmp(p, g_packedStateMagic, sizeof(g_packedStateMagic)) != 0)
+    return false;
+  hdr.formatVersion = static_cast<uint32_t>(unpackLittleEndian(p + 8, 4));
+  hdr.numStates = static_cast<uint32_t>(unpackLittleEndian(p + 12, 4));
+  hdr.numEpigenomes = static_cast<uint32_t>(unpackLittleEndian(p + 16, 4));
+  hdr.bitsPerState = static_cast<uint32_t>(unpackLittleEndian(p + 20, 4));
+  hdr.numSites = unpackLittleEndian(p + 24, 8);
+  hdr.siteWidth = unpackLittleEndian(p + 32, 8);
+  const uint64_t chromLen = unpackLittleEndian(p + 40, 4);
+  if (len - g_packedStateFixedHeaderSize < chromLen)
+    return false;
+  hdr.chrom.assign(p + g_packedStateFixedHeaderSize, static_cast<size_t>(chromLen));
+  return true;
+}
+
+// Writes a packed state file, one site at a time.  The output must be seekable, because
+// the number of sites and their width are written into the header once every site has been added.
+// The coordinates are kept in memory until then (16 bytes per site).
+class PackedStateWriter {
+public:
+  PackedStateWriter() : m_pOs(NULL) {};
+  void attach(std::ostream& os, const int& numStates);
+  // Returns false after reporting an error if the site can't be stored.
+  bool addSite(const std::vector<int>& allStatesAtThisSite, const char *pChrom, const char *pBeg, const char *pEnd);
+  bool finish(void);
+private:
+  PackedStateWriter(const PackedStateWriter&); // we have no need for a copy constructor, so disable it
+  static bool parseCoordinate(const char *p, uint64_t& val);
+  std::ostream *m_pOs;
+  PackedStateHeader m_hdr;
+  std::vector<uint64_t> m_begs, m_ends;
+  std::string m_row;
+};
+
+inline void PackedStateWriter::attach(std::ostream& os, const int& numStates)
+{
+  m_pOs = &os;
+  m_hdr.formatVersion = g_packedStateFormatVersion;
+  m_hdr.numStates = static_cast<uint32_t>(numStates);
+  m_hdr.numEpigenomes = 0;
+  m_hdr.bitsPerState = numStates <= 16 ? 4 : 8;
+  m_hdr.numSites = 0;
+  m_hdr.siteWidth = g_packedStateVariableWidth;
+  m_hdr.chrom.clear();
+  m_begs.clear();
+  m_ends.clear();
+}
+
+// Accepts only the decimal integers whose text the reader can reproduce.
+inline bool PackedStateWriter::parseCoordinate(const char *p, uint64_t& val)
+{
+  if ('\0' == *p || ('0' == *p && p[1] != '\0'))
+    return false;
+  val = 0;
+  for (; *p != '\0'; p++)
+    {
+      if (*p < '0' || *p > '9' || val > (~static_cast<uint64_t>(0) >> 2)/10)
+	return false;
+      val = 10*val + static_cast<uint64_t>(*p - '0');
+    }
+  return true;
+}
+
+inline bool PackedStateWriter::addSite(const std::vector<int>& allStatesAtThisSite, const char *pChrom, const char *pBeg, const char *pEnd)
+{
+  uint64_t beg, end;
+
+  if (0 == m_hdr.numSites)
+    {
+      char buf[g_packedStateFixedHeaderSize];
+      m_hdr.numEpigenomes = static_cast<uint32_t>(allStatesAtThisSite.size());
+      m_hdr.chrom = pChrom;
+      memcpy(buf, g_packedStateMagic, sizeof(g_packedStateMagic));
+      packLittleEndian(buf + 8, m_hdr.formatVersion, 4);
+      packLittleEndian(buf + 12, m_hdr.numStates, 4);
+      packLittleEndian(buf + 16, m_hdr.numEpigenomes, 4);
+      packLittleEndian(buf + 20, m_hdr.bitsPerState, 4);
+      packLittleEndian(buf + 24, 0, 8); // filled in by finish()
+      packLittleEndian(buf + 32, 0, 8); // filled in by finish()
+      packLittleEndian(buf + 40, m_hdr.chrom.size(), 4);
+      m_pOs->write(buf, g_packedStateFixedHeaderSize);
+      m_pOs->write(m_hdr.chrom.data(), m_hdr.chrom.size());
+      m_row.assign(m_hdr.rowBytes(), '\0');
+    }
+  m_hdr.numSites++;
+  if (m_hdr.chrom != pChrom)
+    {
+      std::cerr << "Error:  Site " << m_hdr.numSites << " is on chromosome \"" << pChrom << "\", but site 1 is on \""
+		<< m_hdr.chrom << "\";\na packed state file can only contain sites on one chromosome." << std::endl << std::endl;
+      return false;
+    }
+  if (!parseCoordinate(pBeg, beg) || !parseCoordinate(pEnd, end))
+    {
+      std::cerr << "Error:  The coordinates of site " << m_hdr.numSites << " (\"" << pBeg << "\", \"" << pEnd
+		<< "\") can't be packed;\nonly decimal integers without leading zeros can." << std::endl << std::endl;
+      return false;
+    }
+  m_begs.push_back(beg);
+  m_ends.push_back(end);
+
+  if (4 == m_hdr.bitsPerState)
+    {
+      m_row.assign(m_row.size(), '\0');
+      for (size_t i = 0; i < allStatesAtThisSite.size(); i++)
+	m_row[i/2] = static_cast<char>(static_cast<unsigned char>(m_row[i/2]) | ((allStatesAtThisSite[i] - 1) << (4*(i%2))));
+    }
+  else
+    for (size_t i = 0; i < allStatesAtThisSite.size(); i++)
+      m_row[i] = static_cast<char>(allStatesAtThisSite[i] - 1);
+  m_pOs->write(m_row.data(), m_row.size());
+  return static_cast<bool>(*m_pOs);
+}
+
+// Writes the coordinates and completes the header.
+inline bool PackedStateWriter::finish(void)
+{
+  std::string buf;
+  char packed[8];
+  uint64_t prevBeg(0);
+
+  if (0 == m_hdr.numSites)
+    {
+      std::cerr << "Error:  There are no sites to pack." << std::endl << std::endl;
+      return false;
+    }
+  m_hdr.siteWidth = m_ends[0] - m_begs[0];
+  for (size_t i = 1; i < m_begs.size() && m_hdr.siteWidth != g_packedStateVariableWidth; i++)
+    if (m_ends[i] - m_begs[i] != m_hdr.siteWidth)
+      m_hdr.siteWidth = g_packedStateVariableWidth;
+  for (size_t i = 0; i < m_begs.size(); i++)
+    {
+      appendVarint(buf, static_cast<int64_t>(m_begs[i] - prevBeg));
+      if (g_packedStateVariableWidth == m_hdr.siteWidth)
+	appendVarint(buf, static_cast<int64_t>(m_ends[i] - m_begs[i]));
+      prevBeg = m_begs[i];
+    }
+  m_pOs->write(buf.data(), buf.size());
+  if (!m_pOs->seekp(24, std::ios::beg))
+    {
+      std::cerr << "Error:  The output of a packed state file must be a regular file." << std::endl << std::endl;
+      return false;
+    }
+  packLittleEndian(packed, m_hdr.numSites, 8);
+  m_pOs->write(packed, 8);
+  packLittleEndian(packed, m_hdr.siteWidth, 8);
+  m_pOs->write(packed, 8);
+  m_pOs->flush();
+  return static_cast<bool>(*m_pOs);
+}
+
+#endif // EPILOGOS_PACKED_STATE_MATRIX_H
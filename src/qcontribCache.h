@@ -0,0 +1,205 @@
+#ifndef EPILOGOS_QCONTRIB_CACHE_H
+#define EPILOGOS_QCONTRIB_CACHE_H
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "fileHash.h"
+
+// A file holding the tables that computeEpilogosPart2_perChrom derives from Q, Q*, or Q** (via getQcontrib()),
+// so that the many jobs that use the same genome-wide Q (one per chromosome, for the observations and for the nulls)
+// can map the finished tables into memory instead of parsing the tallies and recomputing them.
+//
+// The file consists of a header, followed by up to MAX_TABLES tables of floats, each starting on a 64-byte boundary.
+// Everything is in the byte order of the machine that wrote the file; a file written with a different byte order is rejected.
+//   bytes  0- 7:  magic string "EPIQCACH"
+//   bytes  8-11:  format version (g_qcontribCacheFormatVersion)
+//   bytes 12-15:  0x01020304, in the writer's byte order
+//   bytes 16-39:  metric, Nsites, number of states, group 1 size, group 2 size, and number of tables (4 bytes each)
+//   bytes 40-71:  size and 64-bit FNV-1a hash of the contents of the group 1 Q file, then those of the group 2 Q file
+//                 (8 bytes each; 0 if there's no group 2); the cache is only used if the Q files still match these,
+//                 so a Q file rewritten with different tallies, however soon and at whatever size, is never mistaken for the old one
+//   bytes 72-135: offset of each table from the beginning of the file, then its length in floats (8 bytes each)
+// The meaning of each table depends on the metric; see the implementations of getQcontribTables().
+
+// Incremented whenever the layout of the file, or what getQcontribTables() puts in the tables, changes,
+// so that a cache written by an earlier version is recomputed rather than misread.
+const uint32_t g_qcontribCacheFormatVersion(2);
+
+struct QcontribCacheKey {
+  uint32_t formatVersion;
+  uint32_t metric;
+  uint32_t Nsites;
+  uint64_t Q1size, Q1hash, Q2size, Q2hash;
+};
+
+// Fills in the version and the file-identifying fields of key from the Q file(s); pQ2filename may be NULL.
+inline bool getQcontribCacheKey(const char *pQ1filename, const char *pQ2filename, QcontribCacheKey& key);
+inline bool getQcontribCacheKey(const char *pQ1filename, const char *pQ2filename, QcontribCacheKey& key)
+{
+  key.formatVersion = g_qcontribCacheFormatVersion;
+  if (!hashFileContents(pQ1filename, key.Q1size, key.Q1hash))
+    return false;
+  key.Q2size = key.Q2hash = 0;
+  if (pQ2filename != NULL && !hashFileContents(pQ2filename, key.Q2size, key.Q2hash))
+    return false;
+  return true;
+}
+
+struct QcontribTable {
+  const float *pData;
+  uint64_t length; // number of floats
+};
+
+class QcontribCache {
+public:
+  QcontribCache() : m_pMap(NULL), m_mapSize(0), m_numStates(0), m_group1size(0), m_group2size(0) {};
+  ~QcontribCache() { close(); }
+  static const unsigned int MAX_TABLES = 4;
+  bool open(const char *pFilename, const QcontribCacheKey& key);
+  void close(void);
+  unsigned int numStates(void) const { return m_numStates; }
+  unsigned int group1size(void) const { return m_group1size; }
+  unsigned int group2size(void) const { return m_group2size; }
+  unsigned int numTables(void) const { return static_cast<unsigned int>(m_tables.size()); }
+  // Valid until the cache is closed.
+  const QcontribTable& table(const unsigned int& i) const { return m_tables[i]; }
+  static bool write(const char *pFilename, const QcontribCacheKey& key, const unsigned int& numStates,
+		    const unsigned int& group1size, const unsigned int& group2size, const std::vector<QcontribTable>& tables);
+private:
+  QcontribCache(const QcontribCache&); // we have no need for a copy constructor, so disable it
+  static const unsigned int HEADER_SIZE = 192; // a multiple of 64
+  static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+  static uint32_t get32(const char *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+  static uint64_t get64(const char *p) { uint64_t v; memcpy(&v, p, 8); return v; }
+  static void put32(char *p, const uint32_t& v) { memcpy(p, &v, 4); }
+  static void put64(char *p, const uint64_t& v) { memcpy(p, &v, 8); }
+  void *m_pMap;
+  size_t m_mapSize;
+  unsigned int m_numStates, m_group1size, m_group2size;
+  std::vector<QcontribTable> m_tables;
+};
+
+// Returns false, without reporting an error, if the file doesn't exist or doesn't match key
+// (in which case the tables should be computed and the cache rewritten).
+inline bool QcontribCache::open(const char *pFilename, const QcontribCacheKey& key)
+{
+  close();
+  const int fd = ::open(pFilename, O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(HEADER_SIZE))
+    {
+      ::close(fd);
+      return false;
+    }
+  m_mapSize = static_cast<size_t>(st.st_size);
+  m_pMap = mmap(NULL, m_mapSize, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (MAP_FAILED == m_pMap)
+    {
+      m_pMap = NULL;
+      return false;
+    }
+
+  const char *p = static_cast<const char*>(m_pMap);
+  const unsigned int numTables = get32(p + 36);
+  if (memcmp(p, "EPIQCACH", 8) != 0 || get32(p + 8) != key.formatVersion || get32(p + 12) != BYTE_ORDER_MARK
+      || get32(p + 16) != key.metric || get32(p + 20) != key.Nsites
+      || get64(p + 40) != key.Q1size || get64(p + 48) != key.Q1hash
+      || get64(p + 56) != key.Q2size || get64(p + 64) != key.Q2hash || numTables > MAX_TABLES)
+    {
+      close();
+      return false;
+    }
+  m_numStates = get32(p + 24);
+  m_group1size = get32(p + 28);
+  m_group2size = get32(p + 32);
+  for (unsigned int i = 0; i < numTables; i++)
+    {
+      const uint64_t offset = get64(p + 72 + 8*i), length = get64(p + 72 + 8*MAX_TABLES + 8*i);
+      if (offset % 64 != 0 || offset > m_mapSize || length > (m_mapSize - offset) / sizeof(float))
+	{
+	  close();
+	  return false;
+	}
+      QcontribTable t;
+      t.pData = reinterpret_cast<const float*>(p + offset);
+      t.length = length;
+      m_tables.push_back(t);
+    }
+  return true;
+}
+
+inline void QcontribCache::close(void)
+{
+  if (m_pMap != NULL)
+    munmap(m_pMap, m_mapSize);
+  m_pMap = NULL;
+  m_mapSize = 0;
+  m_tables.clear();
+}
+
+// The file is written under a temporary name and then renamed, so that jobs running concurrently
+// never see a partially written cache.
+inline bool QcontribCache::write(const char *pFilename, const QcontribCacheKey& key, const unsigned int& numStates,
+				 const unsigned int& group1size, const unsigned int& group2size,
+				 const std::vector<QcontribTable>& tables)
+{
+  char header[HEADER_SIZE];
+  uint64_t offset(HEADER_SIZE);
+
+  if (tables.size() > MAX_TABLES)
+    return false;
+  memset(header, 0, HEADER_SIZE);
+  memcpy(header, "EPIQCACH", 8);
+  put32(header + 8, key.formatVersion);
+  put32(header + 12, BYTE_ORDER_MARK);
+  put32(header + 16, key.metric);
+  put32(header + 20, key.Nsites);
+  put32(header + 24, numStates);
+  put32(header + 28, group1size);
+  put32(header + 32, group2size);
+  put32(header + 36, static_cast<uint32_t>(tables.size()));
+  put64(header + 40, key.Q1size);
+  put64(header + 48, key.Q1hash);
+  put64(header + 56, key.Q2size);
+  put64(header + 64, key.Q2hash);
+  for (unsigned int i = 0; i < tables.size(); i++)
+    {
+      put64(header + 72 + 8*i, offset);
+      put64(header + 72 + 8*MAX_TABLES + 8*i, tables[i].length);
+      offset += (tables[i].length * sizeof(float) + 63) / 64 * 64;
+    }
+
+  char pid[32];
+  sprintf(pid, ".%ld.tmp", static_cast<long>(getpid()));
+  const std::string tempFilename = std::string(pFilename) + pid;
+  FILE *fp = fopen(tempFilename.c_str(), "wb");
+  if (NULL == fp)
+    return false;
+  bool OK = (fwrite(header, 1, HEADER_SIZE, fp) == HEADER_SIZE);
+  const char padding[64] = {0};
+  for (unsigned int i = 0; i < tables.size() && OK; i++)
+    {
+      const size_t numBytes = tables[i].length * sizeof(float), numPadding = (64 - numBytes % 64) % 64;
+      OK = (fwrite(tables[i].pData, 1, numBytes, fp) == numBytes && fwrite(padding, 1, numPadding, fp) == numPadding);
+    }
+  if (fclose(fp) != 0)
+    OK = false;
+  if (OK)
+    OK = (0 == rename(tempFilename.c_str(), pFilename));
+  if (!OK)
+    remove(tempFilename.c_str());
+  return OK;
+}
+
+#endif // EPILOGOS_QCONTRIB_CACHE_H
@@ -0,0 +1,185 @@
+#ifndef EPILOGOS_RUN_STATS_H
+#define EPILOGOS_RUN_STATS_H
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <utility> // for pair()
+#include <stdint.h>
+#include <cstdlib>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+
+// The report written by the --stats option of computeEpilogosPart1_perChrom, computeEpilogosPart2_perChrom,
+// and computeEpilogosPart3_perChrom:  a single JSON object, written to standard error when the program exits
+// (i.e. when the RunStats object, which should be the first one declared in main(), is destroyed), e.g.
+//   {"program": "computeEpilogosPart2_perChrom", "wallSeconds": 2.1, "cpuSeconds": 2.05, "peakRssKB": 35000,
+//    "sites": 1000000, "sitesPerSecond": 476190, "inputFileBytes": 301000000, "bytesWritten": 98000000,
+//    "phases": [{"name": "readQ", "wallSeconds": 0.01, "cpuSeconds": 0.01}, {"name": "score", ...}], ...}
+// followed by any values specific to the program.  The times are measured from enable() to the report;
+// the CPU times are those of every thread.  inputFileBytes is the total size of the input files
+// (as given by stat(), so it isn't the number of bytes read when only part of a file is processed, e.g. with
+// --region or --tile, or when a file is compressed), and bytesWritten is the number of bytes written by the process (from /proc/self/io; omitted where that's unavailable).
+// Nothing is measured or written unless enable() is called.
+
+class RunStats {
+public:
+  RunStats() : m_enabled(false), m_numSites(0), m_inputFileBytes(0), m_inPhase(false) {};
+  ~RunStats() { if (m_enabled) write(std::cerr); }
+  void enable(const char *pProgramName);
+  bool enabled(void) const { return m_enabled; }
+  // Ends the current phase, if there is one, and begins another.
+  void beginPhase(const char *pName);
+  void endPhase(void);
+  void setNumSites(const uint64_t& numSites) { m_numSites = numSites; }
+  void addInputFile(const char *pFilename);
+  void addValue(const char *pName, const double& val);
+  void write(std::ostream& os);
+private:
+  RunStats(const RunStats&); // we have no need for a copy constructor, so disable it
+  struct Phase {
+    std::string name;
+    double wallSeconds, cpuSeconds;
+  };
+  static double wallSeconds(void);
+  static double cpuSeconds(void);
+  static bool bytesWritten(uint64_t& numBytes);
+  bool m_enabled;
+  std::string m_programName;
+  double m_startWall, m_startCpu;
+  uint64_t m_numSites, m_inputFileBytes;
+  std::vector<Phase> m_phases;
+  bool m_inPhase;
+  double m_phaseStartWall, m_phaseStartCpu;
+  std::vector<std::pair<std::string, double> > m_values;
+};
+
+inline double RunStats::wallSeconds(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return static_cast<double>(tv.tv_sec) + 1.0e-6*static_cast<double>(tv.tv_usec);
+}
+
+// User and system time of every thread of the process.
+inline double RunStats::cpuSeconds(void)
+{
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return static_cast<double>(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec)
+    + 1.0e-6*static_cast<double>(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec);
+}
+
+// "wchar" counts every byte written via a system call, whether to a file, a pipe, or a terminal.
+inline bool RunStats::bytesWritten(uint64_t& numBytes)
+{
+  std::ifstream ifs("/proc/self/io");
+  std::string name, val;
+  while (ifs >> name >> val)
+    if ("wchar:" == name)
+      {
+	numBytes = static_cast<uint64_t>(strtoul(val.c_str(), NULL, 10));
+	return true;
+      }
+  return false;
+}
+
+inline void RunStats::enable(const char *pProgramName)
+{
+  m_enabled = true;
+  // Report the name of the program, not the path by which it was run.
+  m_programName = pProgramName;
+  const size_t slash = m_programName.rfind('/');
+  if (slash != std::string::npos)
+    m_programName.erase(0, slash + 1);
+  m_startWall = wallSeconds();
+  m_startCpu = cpuSeconds();
+}
+
+inline void RunStats::beginPhase(const char *pName)
+{
+  if (!m_enabled)
+    return;
+  endPhase();
+  m_phases.push_back(Phase());
+  m_phases.back().name = pName;
+  m_inPhase = true;
+  m_phaseStartWall = wallSeconds();
+  m_phaseStartCpu = cpuSeconds();
+}
+
+inline void RunStats::endPhase(void)
+{
+  if (!m_inPhase)
+    return;
+  m_phases.back().wallSeconds = wallSeconds() - m_phaseStartWall;
+  m_phases.back().cpuSeconds = cpuSeconds() - m_phaseStartCpu;
+  m_inPhase = false;
+}
+
+inline void RunStats::addInputFile(const char *pFilename)
+{
+  struct stat st;
+  if (m_enabled && pFilename != NULL && 0 == stat(pFilename, &st))
+    m_inputFileBytes += static_cast<uint64_t>(st.st_size);
+}
+
+inline void RunStats::addValue(const char *pName, const double& val)
+{
+  if (m_enabled)
+    m_values.push_back(std::make_pair(std::string(pName), val));
+}
+
+// The names written are all plain identifiers, so none of them needs escaping.
+inline void RunStats::write(std::ostream& os)
+{
+  struct rusage ru;
+  uint64_t numBytesWritten;
+
+  endPhase();
+  const double wall = wallSeconds() - m_startWall, cpu = cpuSeconds() - m_startCpu;
+  getrusage(RUSAGE_SELF, &ru);
+  os << "{\"program\": \"" << m_programName << "\", \"wallSeconds\": " << wall << ", \"cpuSeconds\": " << cpu
+     << ", \"peakRssKB\": " << ru.ru_maxrss
+     << ", \"sites\": " << m_numSites << ", \"sitesPerSecond\": " << (wall > 0 ? static_cast<double>(m_numSites)/wall : 0.)
+     << ", \"inputFileBytes\": " << m_inputFileBytes;
+  if (bytesWritten(numBytesWritten))
+    os << ", \"bytesWritten\": " << numBytesWritten;
+  os << ", \"phases\": [";
+  for (size_t i = 0; i < m_phases.size(); i++)
+    os << (0 == i ? "" : ", ") << "{\"name\": \"" << m_phases[i].name << "\", \"wallSeconds\": " << m_phases[i].wallSeconds
+       << ", \"cpuSeconds\": " << m_phases[i].cpuSeconds << '}';
+  os << ']';
+  for (size_t i = 0; i < m_values.size(); i++)
+    os << ", \"" << m_values[i].first << "\": " << m_values[i].second;
+  os << '}' << std::endl;
+  m_enabled = false;
+}
+
+// For timing short intervals, e.g. the stages of scoring a single site:  seconds since an arbitrary time.
+inline double monotonicSeconds(void);
+inline double monotonicSeconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<double>(ts.tv_sec) + 1.0e-9*static_cast<double>(ts.tv_nsec);
+}
+
+// Accumulates the time from each call of start() to the following call of stop(), if enable() has been called;
+// otherwise, start() and stop() do nothing, so they cost next to nothing.
+class Stopwatch {
+public:
+  Stopwatch() : m_enabled(false), m_seconds(0), m_startTime(0) {};
+  void enable(void) { m_enabled = true; }
+  void start(void) { if (m_enabled) m_startTime = monotonicSeconds(); }
+  void stop(void) { if (m_enabled) m_seconds += monotonicSeconds() - m_startTime; }
+  double seconds(void) const { return m_seconds; }
+private:
+  bool m_enabled;
+  double m_seconds, m_startTime;
+};
+
+#endif // EPILOGOS_RUN_STATS_H
@@ -0,0 +1,304 @@
+#ifndef EPILOGOS_SITE_RANGE_H
+#define EPILOGOS_SITE_RANGE_H
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include "binaryTallyFormat.h"
+
+// Restricting a run to part of a chromosome's sites, via the options that computeEpilogosPart1_perChrom,
+// computeEpilogosPart2_perChrom, and computeEpilogosPart3_perChrom all accept:
+//   --region chrom:beg-end  the sites on chrom whose begin coordinates are in [beg, end), as in a BED file
+//   --tile i/N              tile i (1, 2, ..., N) of N tiles of nearly equal numbers of consecutive sites
+// Every site belongs to exactly one tile, so the results of tiles 1, 2, ..., N, concatenated in that order,
+// are those of the whole chromosome (and likewise for adjacent regions).  The sites are numbered
+// by their line numbers in the whole file, so e.g. the random permutations of a tile's sites (see statePermuter.h)
+// are the same as they would be in a run over the whole file.
+//
+// A site index (SiteIndex, written by computeEpilogosPart1_perChrom --index-sites) lets a run seek directly
+// to the first site of its range in an uncompressed state file or a packed one (see packedStateMatrix.h),
+// instead of reading every site before it.  It records the byte offset and begin coordinate of every
+// INTERVAL-th site, and it's found by appending ".sidx" to the name of the file it indexes.
+// The index file begins with a header; all integers are little-endian.
+//   bytes  0- 7:  magic string "EPISIDX1"
+//   bytes  8-11:  format version (currently 1)
+//   bytes 12-15:  the interval between indexed sites
+//   bytes 16-23:  number of sites in the indexed file
+//   bytes 24-31:  size in bytes of the indexed file (an index of a file of any other size is ignored)
+//   bytes 32-39:  number of entries
+// Then, for sites 1, interval + 1, 2*interval + 1, ..., the byte offset of the site's line (or, in a packed file,
+// of its coordinates) and its begin coordinate, 8 bytes each.
+
+const char g_siteIndexMagic[8] = {'E','P','I','S','I','D','X','1'};
+const unsigned int g_siteIndexFormatVersion(1);
+const unsigned int g_siteIndexHeaderSize(40);
+
+class SiteRange {
+public:
+  SiteRange() : m_type(ALL_SITES), m_beg(0), m_end(0), m_tileNum(0), m_numTiles(0), m_firstSite(1), m_lastSite(~static_cast<uint64_t>(0)) {};
+  // Parses pOption ("--region" or "--tile") and its argument; returns false after reporting an error,
+  // e.g. if a range has already been given.
+  bool parseOption(const char *pOption, const char *pArg);
+  bool parseRegion(const char *pSpec);
+  bool parseTile(const char *pSpec);
+  bool restricted(void) const { return m_type != ALL_SITES; }
+  bool isRegion(void) const { return REGION == m_type; }
+  bool isTile(void) const { return TILE == m_type; }
+  // A tile's sites are only known once the number of sites in the whole file is.
+  void setNumSites(const uint64_t& numSites);
+  // Returns -1 if the site (siteNum is its 1-based line number) precedes the range, 0 if it's in it, and 1 if it follows it.
+  // pChrom can be NULL if the chromosome isn't known (i.e., it's assumed to be that of the region).
+  int compare(const uint64_t& siteNum, const char *pChrom, const uint64_t& beg) const;
+  const std::string& chrom(void) const { return m_chrom; }
+  uint64_t beg(void) const { return m_beg; }
+  uint64_t end(void) const { return m_end; }
+  uint64_t firstSite(void) const { return m_firstSite; }
+private:
+  enum RangeType { ALL_SITES, REGION, TILE };
+  RangeType m_type;
+  std::string m_chrom;
+  uint64_t m_beg, m_end;
+  unsigned long m_tileNum, m_numTiles;
+  uint64_t m_firstSite, m_lastSite; // of a tile
+};
+
+inline bool SiteRange::parseOption(const char *pOption, const char *pArg)
+{
+  if (restricted())
+    {
+      std::cerr << "Error:  At most one --region or --tile can be given." << std::endl << std::endl;
+      return false;
+    }
+  return 0 == strcmp(pOption, "--region") ? parseRegion(pArg) : parseTile(pArg);
+}
+
+inline bool SiteRange::parseRegion(const char *pSpec)
+{
+  const char *pColon = strrchr(pSpec, ':');
+  char *pEnd;
+
+  if (pColon != NULL && pColon != pSpec)
+    {
+      m_beg = strtoul(pColon + 1, &pEnd, 10);
+      if (pEnd != pColon + 1 && '-' == *pEnd)
+	{
+	  const char *pEndCoord = pEnd + 1;
+	  m_end = strtoul(pEndCoord, &pEnd, 10);
+	  if (pEnd != pEndCoord && '\0' == *pEnd && m_end > m_beg)
+	    {
+	      m_type = REGION;
+	      m_chrom.assign(pSpec, pColon);
+	      return true;
+	    }
+	}
+    }
+  std::cerr << "Error:  Invalid region (\"" << pSpec << "\") received; expected chrom:beg-end, with beg < end." << std::endl << std::endl;
+  return false;
+}
+
+inline bool SiteRange::parseTile(const char *pSpec)
+{
+  char *pEnd;
+
+  m_tileNum = strtoul(pSpec, &pEnd, 10);
+  if (pEnd != pSpec && '/' == *pEnd)
+    {
+      const char *pNumTiles = pEnd + 1;
+      m_numTiles = strtoul(pNumTiles, &pEnd, 10);
+      if (pEnd != pNumTiles && '\0' == *pEnd && m_tileNum >= 1 && m_tileNum <= m_numTiles)
+	{
+	  m_type = TILE;
+	  m_firstSite = 1;
+	  m_lastSite = 0; // until setNumSites() is called
+	  return true;
+	}
+    }
+  std::cerr << "Error:  Invalid tile (\"" << pSpec << "\") received; expected i/N, with 1 <= i <= N." << std::endl << std::endl;
+  return false;
+}
+
+// Tile i of N holds sites floor((i-1)*numSites/N) + 1 through floor(i*numSites/N).
+inline void SiteRange::setNumSites(const uint64_t& numSites)
+{
+  if (m_type != TILE)
+    return;
+  m_firstSite = (m_tileNum - 1) * numSites / m_numTiles + 1;
+  m_lastSite = m_tileNum * numSites / m_numTiles;
+}
+
+inline int SiteRange::compare(const uint64_t& siteNum, const char *pChrom, const uint64_t& beg) const
+{
+  switch (m_type) {
+  case TILE:
+    return siteNum < m_firstSite ? -1 : (siteNum > m_lastSite ? 1 : 0);
+  case REGION:
+    if (pChrom != NULL && m_chrom != pChrom)
+      return -1; // every site of a per-chromosome file is on the same chromosome, so none will be in the region
+    return beg < m_beg ? -1 : (beg >= m_end ? 1 : 0);
+  default:
+    return 0;
+  }
+}
+
+// The number of lines in the stream, which is then rewound.  A final line without a newline counts as a line.
+inline bool countLines(std::istream& is, uint64_t& numLines);
+inline bool countLines(std::istream& is, uint64_t& numLines)
+{
+  std::vector<char> buf(262144);
+  char lastChar('\n');
+
+  numLines = 0;
+  while (is.read(&buf[0], buf.size()) || is.gcount() > 0)
+    {
+      const char *p = &buf[0], *pEnd = p + is.gcount();
+      while ((p = static_cast<const char*>(memchr(p, '\n', pEnd - p))) != NULL)
+	{
+	  numLines++;
+	  p++;
+	}
+      lastChar = *(pEnd - 1);
+    }
+  if (lastChar != '\n')
+    numLines++;
+  is.clear();
+  return static_cast<bool>(is.seekg(0, std::ios::beg));
+}
+
+class SiteIndex {
+public:
+  SiteIndex() : m_interval(0), m_numSites(0) {};
+  static const unsigned int INTERVAL = 1024;
+  static std::string indexFilename(const char *pIndexedFilename) { return std::string(pIndexedFilename) + ".sidx"; }
+  // Returns false if there's no index of the file (whose size is indexedFileSize), or if it's invalid or out of date.
+  bool load(const char *pIndexedFilename, const uint64_t& indexedFileSize);
+  uint64_t numSites(void) const { return m_numSites; }
+  // Finds the last indexed site that doesn't follow the first site of range (whose tile, if any, must be resolved),
+  // and returns its 1-based site number, byte offset, and begin coordinate; returns false if there is none.
+  bool findStart(const SiteRange& range, uint64_t& siteNum, uint64_t& offset, uint64_t& beg) const;
+  // Building an index:  call addSite() for every site of the file, in order, then write().
+  void addSite(const uint64_t& offset, const uint64_t& beg);
+  bool write(const char *pIndexedFilename, const uint64_t& indexedFileSize) const;
+private:
+  unsigned int m_interval;
+  uint64_t m_numSites;
+  std::vector<uint64_t> m_offsets, m_begs;
+};
+
+inline bool SiteIndex::load(const char *pIndexedFilename, const uint64_t& indexedFileSize)
+{
+  const std::string filename(indexFilename(pIndexedFilename));
+  std::ifstream ifs(filename.c_str(), std::ios::binary);
+  char hdr[g_siteIndexHeaderSize];
+
+  m_offsets.clear();
+  m_begs.clear();
+  if (!ifs || !ifs.read(hdr, g_siteIndexHeaderSize) || memcmp(hdr, g_siteIndexMagic, sizeof(g_siteIndexMagic)) != 0
+      || unpackLittleEndian(hdr + 8, 4) != g_siteIndexFormatVersion)
+    return false;
+  m_interval = static_cast<unsigned int>(unpackLittleEndian(hdr + 12, 4));
+  m_numSites = unpackLittleEndian(hdr + 16, 8);
+  const uint64_t numEntries = unpackLittleEndian(hdr + 32, 8);
+  if (unpackLittleEndian(hdr + 24, 8) != indexedFileSize)
+    {
+      std::cerr << "Warning:  Ignoring " << filename << ", which was written for a different version of " << pIndexedFilename << '.' << std::endl;
+      return false;
+    }
+  if (0 == m_interval || numEntries != (m_numSites + m_interval - 1) / m_interval)
+    return false;
+  std::vector<char> entries(static_cast<size_t>(numEntries) * 16);
+  if (!entries.empty() && !ifs.read(&entries[0], entries.size()))
+    return false;
+  m_offsets.resize(static_cast<size_t>(numEntries));
+  m_begs.resize(static_cast<size_t>(numEntries));
+  for (size_t i = 0; i < m_offsets.size(); i++)
+    {
+      m_offsets[i] = unpackLittleEndian(&entries[16*i], 8);
+      m_begs[i] = unpackLittleEndian(&entries[16*i + 8], 8);
+    }
+  return true;
+}
+
+inline bool SiteIndex::findStart(const SiteRange& range, uint64_t& siteNum, uint64_t& offset, uint64_t& beg) const
+{
+  if (m_offsets.empty())
+    return false;
+  size_t i(0);
+  if (range.isTile())
+    i = static_cast<size_t>((range.firstSite() - 1) / m_interval);
+  else if (range.isRegion())
+    {
+      // the last entry whose site begins before the region (so no site in the region precedes it)
+      size_t lo(0), hi(m_begs.size());
+      while (hi - lo > 1)
+	{
+	  const size_t mid = lo + (hi - lo)/2;
+	  if (m_begs[mid] < range.beg())
+	    lo = mid;
+	  else
+	    hi = mid;
+	}
+      i = lo;
+    }
+  if (i >= m_offsets.size())
+    return false;
+  siteNum = static_cast<uint64_t>(i) * m_interval + 1;
+  offset = m_offsets[i];
+  beg = m_begs[i];
+  return true;
+}
+
+inline void SiteIndex::addSite(const uint64_t& offset, const uint64_t& beg)
+{
+  m_interval = INTERVAL;
+  if (0 == m_numSites % m_interval)
+    {
+      m_offsets.push_back(offset);
+      m_begs.push_back(beg);
+    }
+  m_numSites++;
+}
+
+inline bool SiteIndex::write(const char *pIndexedFilename, const uint64_t& indexedFileSize) const
+{
+  const std::string filename(indexFilename(pIndexedFilename));
+  std::ofstream ofs(filename.c_str(), std::ios::binary);
+  std::string buf(g_siteIndexMagic, sizeof(g_siteIndexMagic));
+  char packed[8];
+
+  if (!ofs)
+    {
+      std::cerr << "Error:  Unable to open file \"" << filename << "\" for writing." << std::endl << std::endl;
+      return false;
+    }
+  packLittleEndian(packed, g_siteIndexFormatVersion, 4);
+  buf.append(packed, 4);
+  packLittleEndian(packed, INTERVAL, 4);
+  buf.append(packed, 4);
+  packLittleEndian(packed, m_numSites, 8);
+  buf.append(packed, 8);
+  packLittleEndian(packed, indexedFileSize, 8);
+  buf.append(packed, 8);
+  packLittleEndian(packed, m_offsets.size(), 8);
+  buf.append(packed, 8);
+  for (size_t i = 0; i < m_offsets.size(); i++)
+    {
+      packLittleEndian(packed, m_offsets[i], 8);
+      buf.append(packed, 8);
+      packLittleEndian(packed, m_begs[i], 8);
+      buf.append(packed, 8);
+    }
+  ofs.write(buf.data(), buf.size());
+  ofs.close();
+  if (!ofs)
+    {
+      std::cerr << "Error:  Failed to write file \"" << filename << "\"." << std::endl << std::endl;
+      return false;
+    }
+  return true;
+}
+
+#endif // EPILOGOS_SITE_RANGE_H
@@ -0,0 +1,542 @@
+#ifndef EPILOGOS_SITE_TALLIES_H
+#define EPILOGOS_SITE_TALLIES_H
+
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <set>
+#include <string>
+#include <cstdlib>
+#include <cctype>
+#include <stdint.h>
+#include "statePermuter.h"
+
+enum measurementType {KL = 1, KLs, KLss}; // corresponding to measurements using S1 (KL), S2 (KL*), or S3 (KL**)
+
+inline bool parseOneSetOfColumnSpecs(char* pString, std::set<int>& colsOut);
+inline bool parseOneSetOfColumnSpecs(char* pString, std::set<int>& colsOut)
+{
+  using std::cerr;
+  using std::endl;
+  std::string origString(pString);
+  char *p1 = NULL, *p2 = pString;
+  int first(-1), last(-1); // first and last column numbers in a range, e.g. 1 and 10 in the range 1-10
+  while (true)
+    {
+      if (',' == *p2 || '\0' == *p2)
+	{
+	  if (p1 != NULL)
+	    {
+	      if (',' == *p2)
+		*p2++ = '\0';
+	      last = atoi(p1);
+	      if (first < 0)
+		first = last;
+	      for (int i = first; i <= last; i++)
+		{
+		  std::set<int>::iterator it = colsOut.find(i);
+		  if (it != colsOut.end())
+		    {
+		      cerr << "Warning:  Value " << i << " specified multiple times in \""
+			   << origString << "\"" << endl;
+		      continue;
+		    }
+		  colsOut.insert(i);
+		}
+	      if ('\0' == *p2)
+		break;
+	    }
+	  else
+	    cerr << "Warning:  Range string \"" << origString << "\" begins with \',\'; anything intended to precede it "
+		 << "will necessarily be excluded." << endl << endl;
+	  p1 = p2;
+	  first = last = -1;
+	  continue;
+	}
+      else
+	{
+	  if ('-' == *p2)
+	    {
+	      if (p1 != NULL)
+		{
+		  *p2++ = '\0';
+		  first = atoi(p1);
+		  p1 = p2;
+		  if ('\0' == *p1)
+		    {
+		      cerr << "Error:  Range \"" << origString << "\" ends with \'-\'. The final value in the range must be explicitly specified."
+			   << endl << endl;
+		      return false;
+		    }
+		  continue;
+		}
+	      else
+		{
+		  cerr << "Error:  Range \"" << origString << "\" begins with \'-\'. Must begin with a valid column number, 1 or greater."
+		       << endl << endl;
+		  return false;
+		}
+	    }
+	  else
+	    {
+	      if (!isdigit(*p2))
+		{
+		  cerr << "Error:  Invalid character \'" << *p2 << "\' in range \"" << origString << "\"."
+		       << endl << endl;
+		  return false;
+		}
+	      if (NULL == p1)
+		p1 = p2;
+	      p2++;
+	      continue;
+	    }
+	}
+    }
+  return true;
+}
+
+// Ensure the input data contain a column for each epigenome in group1 and group2.
+inline bool groupsFitInput(const std::set<int>& group1, const std::set<int>& group2, const int& totalNumEpigenomes);
+inline bool groupsFitInput(const std::set<int>& group1, const std::set<int>& group2, const int& totalNumEpigenomes)
+{
+  using std::cerr;
+  using std::endl;
+  if (*group1.rbegin() > totalNumEpigenomes)
+    {
+      cerr << "Error:  Specification for group 1 calls for data for " << *group1.rbegin()
+	   << " epigenomes to be provided, but data for only "
+	   << totalNumEpigenomes << " were found." << endl << endl;
+      return false;
+    }
+  if (!group2.empty() && *group2.rbegin() > totalNumEpigenomes)
+    {
+      cerr << "Error:  Specification for group 2 calls for data for " << *group2.rbegin()
+	   << " epigenomes to be provided, but data for only "
+	   << totalNumEpigenomes << " were found." << endl << endl;
+      return false;
+    }
+  return true;
+}
+
+// Renumbers group (1-based epigenomes of the input) as epigenomes of the states read from the input columns cols only
+// (see StateFileReader::selectColumns()):  cols holds sorted 0-based indices, including one for each member of group,
+// and the epigenome in column cols[0] becomes epigenome 1, etc.
+inline void selectGroupColumns(const std::set<int>& group, const std::vector<int>& cols, std::set<int>& selectedGroup);
+inline void selectGroupColumns(const std::set<int>& group, const std::vector<int>& cols, std::set<int>& selectedGroup)
+{
+  selectedGroup.clear();
+  for (std::set<int>::const_iterator it = group.begin(); it != group.end(); it++)
+    selectedGroup.insert(static_cast<int>(std::lower_bound(cols.begin(), cols.end(), *it - 1) - cols.begin()) + 1);
+}
+
+// Example with 15 states:  Ordered state pairs (1,1), (1,2), ..., (1,15) map to 1, 2, ..., 15;
+// ordered state pairs (2,1), (2,2), ..., (2,15) map to 16, 17, ..., 30;
+// state pair (15,15) maps to 225.
+inline int orderedStatePairID(const int& stateOfEpi1, const int& stateOfEpi2, const int& numStates);
+inline int orderedStatePairID(const int& stateOfEpi1, const int& stateOfEpi2, const int& numStates)
+{
+  return (stateOfEpi1 - 1)*numStates + stateOfEpi2;
+}
+
+// Upper triangular matrix, entries = 0, 1, ..., numStates-1 in row 1; numStates, ..., 2*numStates - 2 in row 2;
+// entry for the bottom right corner is numStates*(numStates+1)/2 - 1.
+inline int uniqueStatePairID(int stateOfEpi1, int stateOfEpi2, const int& numStates);
+inline int uniqueStatePairID(int stateOfEpi1, int stateOfEpi2, const int& numStates)
+{
+  if (stateOfEpi1 > stateOfEpi2)
+    {
+      // swap these, to make the calculation simpler
+      int temp = stateOfEpi1;
+      stateOfEpi1 = stateOfEpi2;
+      stateOfEpi2 = temp;
+    }
+  return (stateOfEpi1 - 1)*numStates - (stateOfEpi1-2)*(stateOfEpi1-1)/2 + (stateOfEpi2-stateOfEpi1);
+}
+
+// Given the states observed in all epigenomes at a site, computes the values
+// that describe the site for metric S1, S2, or S3 (state tallies, unordered state-pair tallies,
+// or the ordered state pair observed in each epigenome pair, respectively),
+// and optionally adds the site's contribution to the tallies for Q, Q*, or Q**.
+// If two groups are being compared, it can also compute the same values after randomly permuting
+// the states observed in the union of epigenomes from groups 1 and 2.
+// (Technically, these aren't P, P*, P**, Q, Q*, or Q**,
+// but rather the main components of them; they'll be "completed"
+// during subsequent processing by computeEpilogosPart2_perChrom.)
+class SiteTallier {
+public:
+  SiteTallier() : m_KLtype(KL), m_numStates(0), m_comparisonOfGroups(false), m_recordMemberStates(false) {};
+  void init(const measurementType& KLtype, const std::set<int>& group1, const std::set<int>& group2, const int& numStates);
+  // For S3, the values computed for each site are then the states observed in the epigenomes of group 1, followed by group 2,
+  // from which the state pairs can be derived (see KLssModel::useMemberStates()); there are far fewer of them in a large group.
+  void recordMemberStates(void) { m_recordMemberStates = (KLss == m_KLtype); }
+  void processSite(const std::vector<int>& allStatesAtThisSite, std::vector<unsigned int> *pPvals, const bool& accumulateQ);
+  void processPermutedSite(const std::vector<int>& allStatesAtThisSite, const StatePermuter& permuter,
+			   const uint64_t& siteNum, const uint64_t& permutationNum, std::vector<unsigned int>& randPvals);
+  // Adds the contribution of the site last given to processSite() to the tallies for Q, Q*, or Q** numRepeats more times,
+  // as processSite() would for that many more sites with the same states, but in a single pass over them.
+  void repeatSite(const unsigned long& numRepeats);
+  void addQ(const SiteTallier& other);
+  void writeQ(std::ostream& osQ, std::ostream& osQ2) const;
+  // The tallies of Q, Q*, or row number row of Q** (see writeQ()) of group 1 or group 2, e.g. to fill them in from a TallyStore.
+  std::vector<unsigned long>& Qtallies(const bool& group2, const unsigned int& row = 0);
+  bool comparisonOfGroups(void) const { return m_comparisonOfGroups; }
+private:
+  SiteTallier(const SiteTallier&); // we have no need for a copy constructor, so disable it
+  void selectStates(const std::vector<int>& allStatesAtThisSite, std::vector<int>& states) const;
+  void tallyStatePairs(const std::vector<int>& states, const unsigned int& offset, const unsigned int& groupSize,
+		       std::vector<unsigned int> *pPvals, std::vector<int> *pPs, std::vector<unsigned long> *pQs,
+		       std::vector<std::vector<unsigned long> > *pQss);
+  measurementType m_KLtype;
+  int m_numStates;
+  bool m_comparisonOfGroups;
+  bool m_recordMemberStates;
+  std::vector<int> m_group1cols, m_group2cols; // 0-based indices into allStatesAtThisSite
+  std::vector<int> m_statesInThe2groupsAtThisSite, m_shuffledStatesInThe2groupsAtThisSite;
+  std::vector<unsigned int> m_stateCounts; // for S2; all 0 between sites
+  std::vector<int> m_observedStates; // for S2
+  std::vector<int> m_P1, m_P2, m_Ps1, m_Ps2;
+  std::vector<unsigned long> m_Q1, m_Q2, m_Qs1, m_Qs2;
+  std::vector<std::vector<unsigned long> > m_Qss1, m_Qss2;
+};
+
+inline void SiteTallier::init(const measurementType& KLtype, const std::set<int>& group1, const std::set<int>& group2, const int& numStates)
+{
+  const int numStatePairs(numStates * numStates), numUniqueStatePairs(numStates*(numStates+1)/2);
+  m_KLtype = KLtype;
+  m_numStates = numStates;
+  m_comparisonOfGroups = !group2.empty();
+  m_recordMemberStates = false;
+  m_group1cols.clear();
+  m_group2cols.clear();
+  for (std::set<int>::const_iterator it = group1.begin(); it != group1.end(); it++)
+    m_group1cols.push_back(*it - 1);
+  for (std::set<int>::const_iterator it = group2.begin(); it != group2.end(); it++)
+    m_group2cols.push_back(*it - 1);
+  m_statesInThe2groupsAtThisSite.assign(group1.size() + group2.size(), 0);
+  m_shuffledStatesInThe2groupsAtThisSite.assign(group1.size() + group2.size(), 0);
+
+  if (KLtype != KL)
+    {
+      if (KLss == KLtype)
+	{
+	  // We track specific state pairs in specific epigenome pairs.
+	  m_Qss1.assign((group1.size() * (group1.size()-1)) / 2, std::vector<unsigned long>(numStatePairs, 0));
+	  if (m_comparisonOfGroups)
+	    m_Qss2.assign((group2.size() * (group2.size()-1)) / 2, std::vector<unsigned long>(numStatePairs, 0));
+	}
+      else
+	{
+	  // We tally observances of state pairs across epigenome pairs.
+	  // For numStates states, there are numStates*numStates ordered state pairs,
+	  // and (numStates*numStates - numStates)/2 + numStates = numStates*(numStates+1)/2
+	  // unique (unordered) state pairs.
+	  m_Ps1.assign(numUniqueStatePairs, 0);
+	  m_Qs1.assign(numUniqueStatePairs, 0);
+	  m_stateCounts.assign(numStates, 0);
+	  if (m_comparisonOfGroups)
+	    {
+	      m_Ps2.assign(numUniqueStatePairs, 0);
+	      m_Qs2.assign(numUniqueStatePairs, 0);
+	    }
+	}
+    }
+  else
+    {
+      // We tally observances of states.
+      m_P1.assign(numStates, 0);
+      m_Q1.assign(numStates, 0);
+      if (m_comparisonOfGroups)
+	{
+	  m_P2.assign(numStates, 0);
+	  m_Q2.assign(numStates, 0);
+	}
+    }
+}
+
+// Loop over all pairs of epigenomes (states[offset + i], states[offset + j]), 0 <= i < j < groupSize,
+// recording the ordered state pair observed in each (S3) in *pPvals (if pPvals is not NULL; or the states themselves,
+// if recordMemberStates() was called),
+// or tallying the unordered state pairs observed (S2) in *pPs (from the number of epigenomes in each state),
+// and, if requested, recording these observations in Q* (*pQs) or Q** (*pQss).
+inline void SiteTallier::tallyStatePairs(const std::vector<int>& states, const unsigned int& offset, const unsigned int& groupSize,
+					 std::vector<unsigned int> *pPvals, std::vector<int> *pPs, std::vector<unsigned long> *pQs,
+					 std::vector<std::vector<unsigned long> > *pQss)
+{
+  unsigned int j(0);
+  if (KLss == m_KLtype)
+    {
+      if (m_recordMemberStates && pPvals != NULL)
+	{
+	  pPvals->insert(pPvals->end(), states.begin() + offset, states.begin() + offset + groupSize);
+	  pPvals = NULL;
+	}
+      if (NULL == pPvals && NULL == pQss)
+	return;
+      for (unsigned int k = offset; k < offset + groupSize; k++)
+	for (unsigned int k2 = k + 1; k2 < offset + groupSize; k2++)
+	  {
+	    const int thisStatePairID = orderedStatePairID(states[k], states[k2], m_numStates);
+	    if (pPvals != NULL)
+	      pPvals->push_back(thisStatePairID);
+	    if (pQss != NULL)
+	      (*pQss)[j++][thisStatePairID - 1]++;
+	  }
+    }
+  else // KLs == m_KLtype
+    {
+      // The number of epigenome pairs observed in unordered state pair (a,b) follows from the number of epigenomes
+      // in each state:  n_a*n_b if a != b, and n_a*(n_a - 1)/2 if a == b.  Only the states observed are visited.
+      std::vector<unsigned int>& stateCounts = m_stateCounts;
+      std::vector<int>& observedStates = m_observedStates;
+      pPs->assign(pPs->size(), 0);
+      observedStates.clear();
+      for (unsigned int k = offset; k < offset + groupSize; k++)
+	if (0 == stateCounts[states[k] - 1]++)
+	  observedStates.push_back(states[k]);
+      for (unsigned int i = 0; i < observedStates.size(); i++)
+	{
+	  const unsigned int n_a = stateCounts[observedStates[i] - 1];
+	  for (unsigned int i2 = i; i2 < observedStates.size(); i2++)
+	    {
+	      const unsigned int n_b = stateCounts[observedStates[i2] - 1];
+	      const int numPairs = static_cast<int>(i == i2 ? n_a*(n_a - 1)/2 : n_a*n_b);
+	      if (0 == numPairs)
+		continue;
+	      const int thisUniqueStatePairID = uniqueStatePairID(observedStates[i], observedStates[i2], m_numStates);
+	      (*pPs)[thisUniqueStatePairID] = numPairs;
+	      if (pQs != NULL)
+		(*pQs)[thisUniqueStatePairID] += numPairs;
+	    }
+	}
+      for (unsigned int i = 0; i < observedStates.size(); i++)
+	stateCounts[observedStates[i] - 1] = 0;
+    }
+}
+
+// Select the states observed in the epigenomes of interest, group 1 followed by group 2.
+inline void SiteTallier::selectStates(const std::vector<int>& allStatesAtThisSite, std::vector<int>& states) const
+{
+  unsigned int k(0);
+  for (unsigned int i = 0; i < m_group1cols.size(); i++)
+    states[k++] = allStatesAtThisSite[m_group1cols[i]];
+  for (unsigned int i = 0; i < m_group2cols.size(); i++)
+    states[k++] = allStatesAtThisSite[m_group2cols[i]];
+}
+
+// The values for the observed states are appended to *pPvals, if pPvals is not NULL.
+inline void SiteTallier::processSite(const std::vector<int>& allStatesAtThisSite, std::vector<unsigned int> *pPvals,
+				     const bool& accumulateQ)
+{
+  const unsigned int group1size(m_group1cols.size()), group2size(m_group2cols.size());
+  std::vector<int>& states = m_statesInThe2groupsAtThisSite;
+
+  selectStates(allStatesAtThisSite, states);
+
+  if (KL == m_KLtype)
+    {
+      if (accumulateQ)
+	{
+	  for (unsigned int i = 0; i < group1size; i++)
+	    m_Q1[states[i] - 1]++;
+	  for (unsigned int i = group1size; i < group1size + group2size; i++)
+	    m_Q2[states[i] - 1]++;
+	}
+      if (pPvals != NULL)
+	{
+	  m_P1.assign(m_P1.size(), 0);
+	  for (unsigned int i = 0; i < group1size; i++)
+	    m_P1[states[i] - 1]++;
+	  pPvals->insert(pPvals->end(), m_P1.begin(), m_P1.end());
+	  if (m_comparisonOfGroups)
+	    {
+	      m_P2.assign(m_P2.size(), 0);
+	      for (unsigned int i = group1size; i < group1size + group2size; i++)
+		m_P2[states[i] - 1]++;
+	      pPvals->insert(pPvals->end(), m_P2.begin(), m_P2.end());
+	    }
+	}
+      return;
+    }
+
+  // KL* or KL**
+  if (pPvals != NULL || accumulateQ)
+    {
+      tallyStatePairs(states, 0, group1size, pPvals, &m_Ps1,
+		      accumulateQ ? &m_Qs1 : NULL, accumulateQ ? &m_Qss1 : NULL);
+      if (m_comparisonOfGroups)
+	tallyStatePairs(states, group1size, group2size, pPvals, &m_Ps2,
+			accumulateQ ? &m_Qs2 : NULL, accumulateQ ? &m_Qss2 : NULL);
+      if (KLs == m_KLtype && pPvals != NULL)
+	{
+	  pPvals->insert(pPvals->end(), m_Ps1.begin(), m_Ps1.end());
+	  if (m_comparisonOfGroups)
+	    pPvals->insert(pPvals->end(), m_Ps2.begin(), m_Ps2.end());
+	}
+    }
+}
+
+// Only valid when two groups are being compared.  The states observed in the two groups are shuffled
+// (permutation number permutationNum of site number siteNum; see statePermuter.h),
+// and the corresponding values are appended to randPvals.
+inline void SiteTallier::processPermutedSite(const std::vector<int>& allStatesAtThisSite, const StatePermuter& permuter,
+					     const uint64_t& siteNum, const uint64_t& permutationNum, std::vector<unsigned int>& randPvals)
+{
+  const unsigned int group1size(m_group1cols.size()), group2size(m_group2cols.size());
+  std::vector<int>& shuffledStates = m_shuffledStatesInThe2groupsAtThisSite;
+
+  selectStates(allStatesAtThisSite, shuffledStates);
+  permuter.permute(shuffledStates, siteNum, permutationNum);
+
+  if (KL == m_KLtype)
+    {
+      m_P1.assign(m_P1.size(), 0);
+      for (unsigned int i = 0; i < group1size; i++)
+	m_P1[shuffledStates[i] - 1]++;
+      randPvals.insert(randPvals.end(), m_P1.begin(), m_P1.end());
+      m_P2.assign(m_P2.size(), 0);
+      for (unsigned int i = group1size; i < group1size + group2size; i++)
+	m_P2[shuffledStates[i] - 1]++;
+      randPvals.insert(randPvals.end(), m_P2.begin(), m_P2.end());
+      return;
+    }
+
+  // KL* or KL**
+  tallyStatePairs(shuffledStates, 0, group1size, &randPvals, &m_Ps1, NULL, NULL);
+  if (KLs == m_KLtype)
+    randPvals.insert(randPvals.end(), m_Ps1.begin(), m_Ps1.end());
+  tallyStatePairs(shuffledStates, group1size, group2size, &randPvals, &m_Ps2, NULL, NULL);
+  if (KLs == m_KLtype)
+    randPvals.insert(randPvals.end(), m_Ps2.begin(), m_Ps2.end());
+}
+
+inline void SiteTallier::repeatSite(const unsigned long& numRepeats)
+{
+  const unsigned int group1size(m_group1cols.size()), group2size(m_group2cols.size());
+  const std::vector<int>& states = m_statesInThe2groupsAtThisSite; // unchanged by processPermutedSite()
+
+  if (0 == numRepeats)
+    return;
+  switch (m_KLtype) {
+  case KL:
+    for (unsigned int i = 0; i < group1size; i++)
+      m_Q1[states[i] - 1] += numRepeats;
+    for (unsigned int i = group1size; i < group1size + group2size; i++)
+      m_Q2[states[i] - 1] += numRepeats;
+    break;
+
+  case KLs:
+    // m_Ps1 and m_Ps2 may since have been overwritten by processPermutedSite(), so the tallies are recomputed.
+    tallyStatePairs(states, 0, group1size, NULL, &m_Ps1, NULL, NULL);
+    for (unsigned int i = 0; i < m_Qs1.size(); i++)
+      m_Qs1[i] += numRepeats * static_cast<unsigned long>(m_Ps1[i]);
+    if (m_comparisonOfGroups)
+      {
+	tallyStatePairs(states, group1size, group2size, NULL, &m_Ps2, NULL, NULL);
+	for (unsigned int i = 0; i < m_Qs2.size(); i++)
+	  m_Qs2[i] += numRepeats * static_cast<unsigned long>(m_Ps2[i]);
+      }
+    break;
+
+  case KLss:
+    for (int g = 0; g < (m_comparisonOfGroups ? 2 : 1); g++)
+      {
+	const unsigned int offset(0 == g ? 0 : group1size), groupSize(0 == g ? group1size : group2size);
+	std::vector<std::vector<unsigned long> >& Qss = (0 == g ? m_Qss1 : m_Qss2);
+	unsigned int j(0);
+	for (unsigned int k = offset; k < offset + groupSize; k++)
+	  for (unsigned int k2 = k + 1; k2 < offset + groupSize; k2++)
+	    Qss[j++][orderedStatePairID(states[k], states[k2], m_numStates) - 1] += numRepeats;
+      }
+    break;
+  }
+}
+
+// Adds the Q, Q*, or Q** tallies accumulated by another SiteTallier, initialized identically, to this one's.
+inline void SiteTallier::addQ(const SiteTallier& other)
+{
+  for (unsigned int i = 0; i < m_Q1.size(); i++)
+    m_Q1[i] += other.m_Q1[i];
+  for (unsigned int i = 0; i < m_Q2.size(); i++)
+    m_Q2[i] += other.m_Q2[i];
+  for (unsigned int i = 0; i < m_Qs1.size(); i++)
+    m_Qs1[i] += other.m_Qs1[i];
+  for (unsigned int i = 0; i < m_Qs2.size(); i++)
+    m_Qs2[i] += other.m_Qs2[i];
+  for (unsigned int i = 0; i < m_Qss1.size(); i++)
+    for (unsigned int j = 0; j < m_Qss1[i].size(); j++)
+      m_Qss1[i][j] += other.m_Qss1[i][j];
+  for (unsigned int i = 0; i < m_Qss2.size(); i++)
+    for (unsigned int j = 0; j < m_Qss2[i].size(); j++)
+      m_Qss2[i][j] += other.m_Qss2[i][j];
+}
+
+inline std::vector<unsigned long>& SiteTallier::Qtallies(const bool& group2, const unsigned int& row)
+{
+  switch (m_KLtype) {
+  case KL:
+    return group2 ? m_Q2 : m_Q1;
+  case KLs:
+    return group2 ? m_Qs2 : m_Qs1;
+  default:
+    return group2 ? m_Qss2[row] : m_Qss1[row];
+  }
+}
+
+// Write out the tallies over sites, for eventual use in Q, Q*, or Q**.
+// If two groups are being compared, the tallies for group 2 are written to osQ2.
+inline void SiteTallier::writeQ(std::ostream& osQ, std::ostream& osQ2) const
+{
+  using std::endl;
+  switch (m_KLtype) {
+
+  case KL:
+    osQ << m_Q1[0];
+    for (unsigned int i = 1; i < m_Q1.size(); i++)
+      osQ << '\t' << m_Q1[i];
+    if (m_comparisonOfGroups)
+      {
+	osQ2 << m_Q2[0];
+	for (unsigned int i = 1; i < m_Q2.size(); i++)
+	  osQ2 << '\t' << m_Q2[i];
+	osQ2 << endl;
+      }
+    osQ << endl;
+    break;
+
+  case KLs:
+    osQ << m_Qs1[0];
+    for (unsigned int i = 1; i < m_Qs1.size(); i++)
+      osQ << '\t' << m_Qs1[i];
+    if (m_comparisonOfGroups)
+      {
+	osQ2 << m_Qs2[0];
+	for (unsigned int i = 1; i < m_Qs2.size(); i++)
+	  osQ2 << '\t' << m_Qs2[i];
+	osQ2 << endl;
+      }
+    osQ << endl;
+    break;
+
+  case KLss:
+    for (unsigned int i = 0; i < m_Qss1.size(); i++)
+      {
+	osQ << m_Qss1[i][0];
+	for (unsigned int j = 1; j < m_Qss1[0].size(); j++)
+	  osQ << '\t' << m_Qss1[i][j];
+	osQ << endl;
+      }
+    if (m_comparisonOfGroups)
+      {
+	for (unsigned int i = 0; i < m_Qss2.size(); i++)
+	  {
+	    osQ2 << m_Qss2[i][0];
+	    for (unsigned int j = 1; j < m_Qss2[0].size(); j++)
+	      osQ2 << '\t' << m_Qss2[i][j];
+	    osQ2 << endl;
+	  }
+      }
+    break;
+  }
+}
+
+#endif // EPILOGOS_SITE_TALLIES_H
@@ -0,0 +1,518 @@
+#ifndef EPILOGOS_STATE_FILE_READER_H
+#define EPILOGOS_STATE_FILE_READER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <climits>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "compressedStreams.h"
+#include "packedStateMatrix.h"
+#include "siteRange.h"
+
+// Reads the input data one site (line) at a time.
+// The format of the input file is chromosome, beg position, end position,
+// state of epigenome 1 at that site/region, state of epigenome 2 there, ....
+// Every state is checked to ensure it's an integer between 1 and numStates, inclusive,
+// and every line is checked to ensure it contains the same number of fields as line 1.
+// Lines can be of any length.
+//
+// The input is either a stream (init()) or a file (open()).  An uncompressed file is memory-mapped,
+// and its lines are parsed where they lie, without being copied; a compressed file is read via GzInputStream.
+// A packed state file (see packedStateMatrix.h) is also memory-mapped, and its rows are unpacked as they're read.
+// Only the coordinates of each site are copied, so that chrom(), beg(), and end() can return C strings.
+//
+// By default, the states of every epigenome are returned.  After selectColumns(), only the states in the selected columns are,
+// and the others are skipped without being converted, unless they're to be checked.
+// After restrictToRange(), only the sites in the range (see siteRange.h) are returned; linenum() remains the line number
+// of the most recently read site in the whole file, and numSitesRead() counts the sites returned.
+class StateFileReader {
+public:
+  StateFileReader() : m_pIs(NULL), m_numStates(0), m_linenum(0), m_numFieldsOnLineOne(0), m_failed(false),
+    m_checkAllColumns(true), m_pMapped(NULL), m_mappedLength(0), m_pNext(NULL), m_pMapEnd(NULL), m_packed(false), m_prevBeg(0),
+    m_numSitesRead(0), m_pastRange(false) {};
+  ~StateFileReader() { close(); }
+  void init(std::istream& is, const int& numStates);
+  // Returns false if the file can't be opened.
+  bool open(const char *pFilename, const int& numStates);
+  void close(void);
+  // Returns to the first site, e.g. for a second pass through the input, and removes any restriction to a range of sites.
+  bool rewind(void);
+  // Must be called before the first site is read (or just after rewind()).  Returns false after reporting an error.
+  bool restrictToRange(const SiteRange& range);
+  // cols holds the sorted 0-based indices of the epigenomes whose states readSite() will return, in that order
+  // (see selectGroupColumns() in siteTallies.h); they must all exist (see numEpigenomes()).
+  // If checkOtherColumns is false, the states of the other epigenomes aren't checked, only counted.
+  void selectColumns(const std::vector<int>& cols, const bool& checkOtherColumns);
+  bool readSite(std::vector<int>& allStatesAtThisSite);
+  bool failed(void) const { return m_failed; }
+  unsigned int linenum(void) const { return m_linenum; }
+  unsigned int numSitesRead(void) const { return m_numSitesRead; }
+  // The following support building a site index (see siteRange.h); the file must be uncompressed or packed.
+  bool mapped(void) const { return m_pMapped != NULL; }
+  uint64_t fileSize(void) const { return m_mappedLength; }
+  // The offset of the next site's line, or, if packed, of its coordinates.
+  uint64_t nextSiteOffset(void) const { return static_cast<uint64_t>(m_pNext - (m_packed ? m_pCoords : m_pMapped)); }
+  // The number of epigenomes in the input, once line 1 has been read.
+  int numEpigenomes(void) const { return static_cast<int>(m_numFieldsOnLineOne) - 3; }
+  // The following are the fields of the most recently read line.
+  const char* chrom(void) const { return m_chrom.c_str(); }
+  const char* beg(void) const { return m_beg.c_str(); }
+  const char* end(void) const { return m_end.c_str(); }
+private:
+  StateFileReader(const StateFileReader&); // we have no need for a copy constructor, so disable it
+  void reset(const int& numStates);
+  bool nextLine(const char*& pLine, const char*& pLineEnd);
+  bool readPackedSite(std::vector<int>& allStatesAtThisSite);
+  bool openPacked(const char *pFilename);
+  bool countSites(uint64_t& numSites);
+  bool seekToSite(const uint64_t& siteNum, const uint64_t& offset, const uint64_t& beg);
+  static const char* nextField(const char *p, const char *pLineEnd, const char*& pFieldEnd);
+  static int parseState(const char *p, const char *pFieldEnd);
+  std::istream *m_pIs;
+  int m_numStates;
+  unsigned int m_linenum, m_numFieldsOnLineOne;
+  bool m_failed;
+  std::vector<int> m_selectedCols; // empty if every column is to be returned
+  bool m_checkAllColumns;
+  std::string m_line; // the most recently read line, if reading from a stream
+  std::string m_chrom, m_beg, m_end;
+  GzInputStream m_gzis; // used if open() receives a compressed file
+  char *m_pMapped; // used if open() receives an uncompressed file
+  size_t m_mappedLength;
+  const char *m_pNext, *m_pMapEnd; // the beginning of the next line (or coordinates, if packed), and the end of the mapped file
+  bool m_packed;
+  PackedStateHeader m_packedHdr;
+  const char *m_pRows, *m_pCoords; // in the mapped packed file
+  uint64_t m_prevBeg;
+  std::string m_filename; // used to find the file's site index
+  SiteRange m_range;
+  unsigned int m_numSitesRead;
+  bool m_pastRange;
+};
+
+inline void StateFileReader::reset(const int& numStates)
+{
+  m_numStates = numStates;
+  m_linenum = m_numFieldsOnLineOne = 0;
+  m_failed = false;
+  m_numSitesRead = 0;
+  m_pastRange = false;
+  m_range = SiteRange();
+  m_filename.clear();
+  m_chrom.clear();
+  m_beg.clear();
+  m_end.clear();
+}
+
+inline void StateFileReader::selectColumns(const std::vector<int>& cols, const bool& checkOtherColumns)
+{
+  m_selectedCols = cols;
+  m_checkAllColumns = checkOtherColumns;
+}
+
+inline void StateFileReader::init(std::istream& is, const int& numStates)
+{
+  close();
+  m_pIs = &is;
+  reset(numStates);
+}
+
+inline bool StateFileReader::open(const char *pFilename, const int& numStates)
+{
+  const int fd = ::open(pFilename, O_RDONLY);
+  struct stat fileInfo;
+  unsigned char magic[2];
+
+  close();
+  reset(numStates);
+  if (fd < 0)
+    return false;
+  m_filename = pFilename;
+  // Map the file if it's a nonempty regular file that doesn't begin with the gzip magic number.
+  if (0 == fstat(fd, &fileInfo) && S_ISREG(fileInfo.st_mode) && fileInfo.st_size > 0
+      && !(2 == pread(fd, magic, 2, 0) && 0x1f == magic[0] && 0x8b == magic[1]))
+    {
+      void *p = mmap(NULL, static_cast<size_t>(fileInfo.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED)
+	{
+	  m_pMapped = static_cast<char*>(p);
+	  m_mappedLength = static_cast<size_t>(fileInfo.st_size);
+	  madvise(m_pMapped, m_mappedLength, MADV_SEQUENTIAL);
+	  m_pNext = m_pMapped;
+	  m_pMapEnd = m_pMapped + m_mappedLength;
+	  ::close(fd);
+	  return openPacked(pFilename);
+	}
+    }
+  ::close(fd);
+  m_gzis.open(pFilename);
+  if (!m_gzis)
+    return false;
+  m_pIs = &m_gzis;
+  return true;
+}
+
+inline void StateFileReader::close(void)
+{
+  if (m_pMapped != NULL)
+    {
+      munmap(m_pMapped, m_mappedLength);
+      m_pMapped = NULL;
+      m_mappedLength = 0;
+      m_pNext = m_pMapEnd = NULL;
+    }
+  m_packed = false;
+  if (m_gzis.is_open())
+    m_gzis.close();
+  m_pIs = NULL;
+}
+
+// Called once the file has been mapped; if it's a packed state file, prepares to read it as such.
+inline bool StateFileReader::openPacked(const char *pFilename)
+{
+  if (!readPackedStateHeader(m_pMapped, m_mappedLength, m_packedHdr))
+    return true; // it's text
+  if (m_packedHdr.formatVersion != g_packedStateFormatVersion
+      || (m_packedHdr.bitsPerState != 4 && m_packedHdr.bitsPerState != 8)
+      || m_packedHdr.numEpigenomes == 0
+      || (m_mappedLength - m_packedHdr.headerSize()) / m_packedHdr.rowBytes() < m_packedHdr.numSites)
+    {
+      std::cerr << "Error:  File \"" << pFilename << "\" is not a valid packed state file (version "
+		<< g_packedStateFormatVersion << ")." << std::endl << std::endl;
+      close();
+      return false;
+    }
+  m_packed = true;
+  m_pRows = m_pMapped + m_packedHdr.headerSize();
+  m_pNext = m_pCoords = m_pRows + m_packedHdr.numSites*m_packedHdr.rowBytes();
+  m_prevBeg = 0;
+  m_numFieldsOnLineOne = m_packedHdr.numEpigenomes + 3;
+  m_chrom = m_packedHdr.chrom;
+  return true;
+}
+
+inline bool StateFileReader::rewind(void)
+{
+  m_linenum = 0;
+  m_failed = false;
+  m_numSitesRead = 0;
+  m_pastRange = false;
+  m_range = SiteRange();
+  if (m_pMapped != NULL)
+    {
+      m_pNext = m_packed ? m_pCoords : m_pMapped;
+      m_prevBeg = 0;
+      return true;
+    }
+  m_numFieldsOnLineOne = 0;
+  if (NULL == m_pIs)
+    return false;
+  m_pIs->clear();
+  return static_cast<bool>(m_pIs->seekg(0, std::ios::beg));
+}
+
+// If the file has an up-to-date site index, reading begins at the indexed site nearest the range;
+// otherwise every site preceding the range is read (but not parsed beyond its coordinates) and skipped.
+inline bool StateFileReader::restrictToRange(const SiteRange& range)
+{
+  SiteIndex index;
+  uint64_t siteNum, offset, beg;
+  const bool haveIndex(range.restricted() && m_pMapped != NULL && index.load(m_filename.c_str(), m_mappedLength));
+
+  m_range = range;
+  if (m_range.isTile())
+    {
+      uint64_t numSites;
+      if (m_packed)
+	numSites = m_packedHdr.numSites;
+      else if (haveIndex)
+	numSites = index.numSites();
+      else if (!countSites(numSites))
+	{
+	  std::cerr << "Error:  Unable to count the sites of the input, to divide them into tiles." << std::endl << std::endl;
+	  m_failed = true;
+	  return false;
+	}
+      m_range.setNumSites(numSites);
+    }
+  if (haveIndex && index.findStart(m_range, siteNum, offset, beg) && siteNum > 1)
+    return seekToSite(siteNum, offset, beg);
+  return true;
+}
+
+// Counts the lines of a text file, without parsing them, and returns to the first one.
+inline bool StateFileReader::countSites(uint64_t& numSites)
+{
+  if (NULL == m_pMapped)
+    return m_pIs != NULL && countLines(*m_pIs, numSites);
+  numSites = 0;
+  for (const char *p = m_pMapped; p < m_pMapEnd; numSites++)
+    {
+      const char *pNewline = static_cast<const char*>(memchr(p, '\n', static_cast<size_t>(m_pMapEnd - p)));
+      p = (pNewline != NULL) ? pNewline + 1 : m_pMapEnd;
+    }
+  return true;
+}
+
+// Positions the reader so that the next site read is site number siteNum, found at offset, which begins at beg.
+inline bool StateFileReader::seekToSite(const uint64_t& siteNum, const uint64_t& offset, const uint64_t& beg)
+{
+  const char *pBegin = m_packed ? m_pCoords : m_pMapped;
+  const char *p = pBegin + offset;
+  int64_t begDelta;
+
+  if (offset >= static_cast<uint64_t>(m_pMapEnd - pBegin) || (m_packed && !readVarint(p, m_pMapEnd, begDelta)))
+    {
+      std::cerr << "Error:  The site index of \"" << m_filename << "\" doesn't match the file; delete it, or rebuild it." << std::endl << std::endl;
+      m_failed = true;
+      return false;
+    }
+  m_pNext = pBegin + offset;
+  if (m_packed)
+    m_prevBeg = beg - static_cast<uint64_t>(begDelta); // the begin coordinate of the preceding site
+  m_linenum = static_cast<unsigned int>(siteNum - 1);
+  return true;
+}
+
+// Unpacks the next row of a packed state file, and reproduces the text of its coordinates.
+inline bool StateFileReader::readPackedSite(std::vector<int>& allStatesAtThisSite)
+{
+  const bool allColumns(m_selectedCols.empty());
+  const bool checkOtherColumns(m_checkAllColumns && static_cast<int>(m_packedHdr.numStates) > m_numStates);
+  const unsigned int numEpigenomes(m_packedHdr.numEpigenomes);
+  int64_t begDelta, width(static_cast<int64_t>(m_packedHdr.siteWidth));
+
+  if (m_failed || m_pastRange)
+    return false;
+  for (;;)
+    {
+      if (m_linenum == m_packedHdr.numSites)
+	return false;
+      if (!readVarint(m_pNext, m_pMapEnd, begDelta)
+	  || (g_packedStateVariableWidth == m_packedHdr.siteWidth && !readVarint(m_pNext, m_pMapEnd, width)))
+	{
+	  std::cerr << "Error:  The packed state file ends within the coordinates of site " << m_linenum + 1 << '.' << std::endl << std::endl;
+	  m_failed = true;
+	  return false;
+	}
+      m_linenum++;
+      m_prevBeg += static_cast<uint64_t>(begDelta);
+      const int cmp = m_range.compare(m_linenum, NULL, m_prevBeg);
+      if (0 == cmp)
+	break;
+      if (cmp > 0)
+	{
+	  m_pastRange = true;
+	  return false;
+	}
+    }
+  const unsigned char *pRow = reinterpret_cast<const unsigned char*>(m_pRows) + (m_linenum - 1)*m_packedHdr.rowBytes();
+  m_beg.clear();
+  appendDecimal(m_beg, m_prevBeg);
+  m_end.clear();
+  appendDecimal(m_end, m_prevBeg + static_cast<uint64_t>(width));
+
+  allStatesAtThisSite.resize(allColumns ? numEpigenomes : m_selectedCols.size());
+  unsigned int k(0);
+  for (unsigned int e = 0; e < numEpigenomes; e++)
+    {
+      const bool selected(allColumns || (k < m_selectedCols.size() && static_cast<int>(e) == m_selectedCols[k]));
+      if (!selected && !checkOtherColumns)
+	continue;
+      const int thisState = 1 + (4 == m_packedHdr.bitsPerState ? ((pRow[e/2] >> (4*(e%2))) & 0xF) : pRow[e]);
+      if (thisState > m_numStates)
+	{
+	  std::cerr << "Error:  Illegal state (" << thisState
+		    << ") detected in field " << e + 4 << " of site " << m_linenum
+		    << ".  Re-specify the correct number of possible states." << std::endl << std::endl;
+	  m_failed = true;
+	  return false;
+	}
+      if (selected)
+	allStatesAtThisSite[k++] = thisState;
+    }
+  m_numSitesRead++;
+
+  return true;
+}
+
+// Returns false at the end of the input.  The line does not include its newline character.
+inline bool StateFileReader::nextLine(const char*& pLine, const char*& pLineEnd)
+{
+  if (m_pMapped != NULL)
+    {
+      if (m_pNext == m_pMapEnd)
+	return false;
+      const char *pNewline = static_cast<const char*>(memchr(m_pNext, '\n', static_cast<size_t>(m_pMapEnd - m_pNext)));
+      pLine = m_pNext;
+      pLineEnd = (pNewline != NULL) ? pNewline : m_pMapEnd;
+      m_pNext = (pNewline != NULL) ? pNewline + 1 : m_pMapEnd;
+      return true;
+    }
+  if (NULL == m_pIs || !std::getline(*m_pIs, m_line))
+    return false;
+  pLine = m_line.data();
+  pLineEnd = pLine + m_line.size();
+  return true;
+}
+
+// Returns the beginning of the first field at or after p, and sets pFieldEnd to the tab or line end that follows it;
+// returns NULL if there are no more fields.  As with strtok(), a run of tabs delimits a single pair of fields.
+inline const char* StateFileReader::nextField(const char *p, const char *pLineEnd, const char*& pFieldEnd)
+{
+  while (p < pLineEnd && '\t' == *p)
+    p++;
+  if (p == pLineEnd)
+    return NULL;
+  pFieldEnd = p + 1;
+  while (pFieldEnd < pLineEnd && *pFieldEnd != '\t')
+    pFieldEnd++;
+  return p;
+}
+
+// Converts the field as atoi() would, without reading past its end.
+// States of 1 or 2 digits, by far the most common, are handled first.
+inline int StateFileReader::parseState(const char *p, const char *pFieldEnd)
+{
+  const unsigned int d0 = static_cast<unsigned int>(static_cast<unsigned char>(p[0])) - '0';
+  if (d0 < 10)
+    {
+      if (pFieldEnd - p == 1)
+	return static_cast<int>(d0);
+      const unsigned int d1 = static_cast<unsigned int>(static_cast<unsigned char>(p[1])) - '0';
+      if (pFieldEnd - p == 2 && d1 < 10)
+	return static_cast<int>(10*d0 + d1);
+    }
+
+  long val(0);
+  bool negative(false);
+  while (p < pFieldEnd && isspace(static_cast<unsigned char>(*p)))
+    p++;
+  if (p < pFieldEnd && ('-' == *p || '+' == *p))
+    negative = ('-' == *p++);
+  while (p < pFieldEnd && isdigit(static_cast<unsigned char>(*p)) && val <= INT_MAX)
+    val = 10*val + (*p++ - '0');
+  if (val > INT_MAX)
+    val = INT_MAX; // illegal regardless of its sign
+  return static_cast<int>(negative ? -val : val);
+}
+
+// Returns true if the states observed at another site were successfully read into allStatesAtThisSite.
+// Returns false at the end of the input, or if an error was encountered, in which case failed() returns true.
+inline bool StateFileReader::readSite(std::vector<int>& allStatesAtThisSite)
+{
+  using std::cerr;
+  using std::endl;
+  const char *pLine, *pLineEnd, *p, *pFieldEnd(NULL);
+  const bool allColumns(m_selectedCols.empty());
+  unsigned int fieldnum, numSelectedColsRead(0);
+
+  if (m_packed)
+    return readPackedSite(allStatesAtThisSite);
+  if (m_failed || m_pastRange)
+    return false;
+
+  for (;;)
+    {
+      if (!nextLine(pLine, pLineEnd))
+	return false;
+      m_linenum++;
+      fieldnum = 1;
+      // field 1:  chromosome
+      if ((p = nextField(pLine, pLineEnd, pFieldEnd)))
+	m_chrom.assign(p, pFieldEnd);
+      fieldnum++;
+      if (!p || !(p = nextField(pFieldEnd, pLineEnd, pFieldEnd)))
+	{
+	MissingField:
+	  cerr << "Error:  Failed to find field " << fieldnum
+	       << " on line " << m_linenum << " of the input file."
+	       << endl << endl;
+	  m_failed = true;
+	  return false;
+	}
+      // field 2:  begin site
+      m_beg.assign(p, pFieldEnd);
+      fieldnum++;
+      if (!(p = nextField(pFieldEnd, pLineEnd, pFieldEnd)))
+	goto MissingField;
+      // field 3:  end site
+      m_end.assign(p, pFieldEnd);
+
+      if (!m_range.restricted())
+	break;
+      const int cmp = m_range.compare(m_linenum, m_chrom.c_str(), strtoul(m_beg.c_str(), NULL, 10));
+      if (0 == cmp)
+	break;
+      if (cmp > 0)
+	{
+	  m_pastRange = true;
+	  return false;
+	}
+    }
+
+  const bool firstSite(0 == m_numSitesRead);
+  if (firstSite)
+    allStatesAtThisSite.assign(allColumns ? 0 : m_selectedCols.size(), 0);
+  while ((p = nextField(pFieldEnd, pLineEnd, pFieldEnd)))
+    {
+      const bool selected(allColumns || (numSelectedColsRead < m_selectedCols.size()
+					 && static_cast<int>(fieldnum - 3) == m_selectedCols[numSelectedColsRead]));
+      const int thisState((selected || m_checkAllColumns) ? parseState(p, pFieldEnd) : 1);
+      if (thisState > m_numStates || thisState < 1)
+	{
+	  cerr << "Error:  Illegal state (" << thisState
+	       << ") detected in field " << ++fieldnum << " on line "
+	       << m_linenum << ".  Re-specify the correct number of possible states,\n"
+	       << "and/or ensure each state label is a positive (nonzero) integer."
+	       << endl << endl;
+	  m_failed = true;
+	  return false;
+	}
+      if (!firstSite && fieldnum >= m_numFieldsOnLineOne)
+	{
+	  cerr << "Error:  Expected to find " << m_numFieldsOnLineOne
+	       << " fields of data on line " << m_linenum
+	       << ", to match the # found on line 1; found at least "
+	       << ++fieldnum << " instead." << endl << endl;
+	  m_failed = true;
+	  return false;
+	}
+      if (!allColumns)
+	{
+	  if (selected)
+	    allStatesAtThisSite[numSelectedColsRead++] = thisState;
+	}
+      else if (firstSite)
+	allStatesAtThisSite.push_back(thisState);
+      else
+	allStatesAtThisSite[fieldnum - 3] = thisState;
+      fieldnum++;
+    }
+  if (firstSite)
+    m_numFieldsOnLineOne = fieldnum;
+  else
+    {
+      if (fieldnum != m_numFieldsOnLineOne)
+	{
+	  cerr << "Error:  Expected to find " << m_numFieldsOnLineOne
+	       << " fields of data on line " << m_linenum
+	       << ", to match the # found on line 1; but only found "
+	       << fieldnum << "." << endl << endl;
+	  m_failed = true;
+	  return false;
+	}
+    }
+  m_numSitesRead++;
+
+  return true;
+}
+
+#endif // EPILOGOS_STATE_FILE_READER_H
@@ -0,0 +1,81 @@
+#ifndef EPILOGOS_STATE_PERMUTER_H
+#define EPILOGOS_STATE_PERMUTER_H
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdint.h>
+
+// Random permutations of the states observed at a site, for generating the null distribution.
+// Permutation number k of site number i (i.e., line i of the input file) is a pure function of
+// (seed, chromosome, i, k):  it's a Fisher-Yates shuffle driven by a counter-based generator
+// (splitmix64, keyed by a hash of those four values), not by a generator whose state depends on
+// every random number drawn before it.  So the permutations are identical on every platform,
+// don't depend on the order in which sites are processed (or on the number of threads processing them),
+// and any subset of sites can be regenerated on its own.
+
+// 64-bit constants are assembled from 32-bit halves, because C++98 has no portable 64-bit literal.
+inline uint64_t makeUint64(const uint32_t& hi, const uint32_t& lo);
+inline uint64_t makeUint64(const uint32_t& hi, const uint32_t& lo)
+{
+  return (static_cast<uint64_t>(hi) << 32) | lo;
+}
+
+// The finalizer of splitmix64, a bijective mixing of the bits of x.
+inline uint64_t mix64(uint64_t x);
+inline uint64_t mix64(uint64_t x)
+{
+  static const uint64_t M1(makeUint64(0xBF58476DU, 0x1CE4E5B9U)), M2(makeUint64(0x94D049BBU, 0x133111EBU));
+  x = (x ^ (x >> 30)) * M1;
+  x = (x ^ (x >> 27)) * M2;
+  return x ^ (x >> 31);
+}
+
+class StatePermuter {
+public:
+  StatePermuter() : m_key(0) {};
+  void init(const uint64_t& seed, const std::string& chrom);
+  void permute(std::vector<int>& states, const uint64_t& siteNum, const uint64_t& permutationNum) const;
+private:
+  static uint64_t nextRandom(uint64_t& counter);
+  static uint64_t randomBelow(uint64_t& counter, const uint64_t& bound);
+  uint64_t m_key; // derived from the seed and the chromosome
+};
+
+inline void StatePermuter::init(const uint64_t& seed, const std::string& chrom)
+{
+  // 64-bit FNV-1a hash of the chromosome name
+  uint64_t chromHash(makeUint64(0xCBF29CE4U, 0x84222325U));
+  const uint64_t FNV_PRIME(makeUint64(0x00000100U, 0x000001B3U));
+  for (size_t i = 0; i < chrom.size(); i++)
+    chromHash = (chromHash ^ static_cast<unsigned char>(chrom[i])) * FNV_PRIME;
+  m_key = mix64(mix64(seed) ^ chromHash);
+}
+
+// The splitmix64 generator:  successive outputs are the mixed values of an arithmetic progression.
+inline uint64_t StatePermuter::nextRandom(uint64_t& counter)
+{
+  static const uint64_t GOLDEN_GAMMA(makeUint64(0x9E3779B9U, 0x7F4A7C15U));
+  counter += GOLDEN_GAMMA;
+  return mix64(counter);
+}
+
+// Returns a uniformly distributed integer in [0, bound), without modulo bias.
+inline uint64_t StatePermuter::randomBelow(uint64_t& counter, const uint64_t& bound)
+{
+  const uint64_t threshold = (~bound + 1) % bound; // 2^64 mod bound
+  uint64_t r;
+  do {
+    r = nextRandom(counter);
+  } while (r < threshold);
+  return r % bound;
+}
+
+inline void StatePermuter::permute(std::vector<int>& states, const uint64_t& siteNum, const uint64_t& permutationNum) const
+{
+  uint64_t counter = mix64(m_key ^ mix64(siteNum ^ mix64(permutationNum)));
+  for (size_t i = states.size(); i > 1; i--)
+    std::swap(states[i - 1], states[randomBelow(counter, i)]);
+}
+
+#endif // EPILOGOS_STATE_PERMUTER_H
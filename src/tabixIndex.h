@@ -0,0 +1,211 @@
+#ifndef EPILOGOS_TABIX_INDEX_H
+#define EPILOGOS_TABIX_INDEX_H
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <map>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include "binaryTallyFormat.h"
+
+// Builds the tabix index (".tbi" file) of a BGZF-compressed BED-like file as the file is written,
+// so it needn't be read back in by tabix afterwards.  BgzfStreambuf passes each block to addBlock()
+// as it writes it; the index is the one "tabix -p bed" would make:  column 1 is the sequence name,
+// and columns 2 and 3 are the 0-based begin and (exclusive) end coordinates.  Lines beginning with '#' are skipped.
+// The lines must be sorted, as tabix requires:  each sequence's lines consecutive, in nondecreasing order of begin.
+//
+// The index (see the SAM/BAM specification) holds, for each sequence, the chunks of the file (pairs of virtual offsets,
+// i.e. (block's offset in the file) << 16 | (offset within the uncompressed block)) of the lines in each bin
+// of the UCSC binning scheme, and a linear index of the first line overlapping each 16 kb window.
+// write() writes it uncompressed; it's BGZF-compressed like the file it indexes (see BgzfOutputStream).
+
+class TabixIndexer {
+public:
+  TabixIndexer() : m_lineBeg(0), m_lineLength(0), m_ok(true) {};
+  void addBlock(const char *pData, const unsigned int& len, const uint64_t& blockOffset, const unsigned int& blockSize);
+  bool write(std::ostream& os) const;
+  bool ok(void) const { return m_ok; }
+  void clear(void);
+private:
+  TabixIndexer(const TabixIndexer&); // we have no need for a copy constructor, so disable it
+  struct Sequence {
+    std::string name;
+    std::map<uint32_t, std::vector<std::pair<uint64_t, uint64_t> > > chunksOfBin;
+    std::vector<uint64_t> linearIndex; // ~0 for windows that no line has overlapped (yet)
+    uint64_t firstLineBeg, lastLineEnd, numLines;
+    unsigned long lastBeg;
+  };
+  static uint32_t reg2bin(const unsigned long& beg, unsigned long end);
+  void addLine(const uint64_t& lineEnd);
+  static const unsigned int MAX_FIELDS_LENGTH = 1024;
+  static const uint32_t PSEUDO_BIN = 37450; // holds the sequence's offsets and number of lines, as htslib writes
+  std::vector<Sequence> m_sequences;
+  std::string m_fields; // the first 3 fields (at most) of the line being read
+  uint64_t m_lineBeg; // virtual offset of the line being read
+  unsigned int m_lineLength; // of the line being read, so far
+  bool m_ok;
+};
+
+inline void TabixIndexer::clear(void)
+{
+  m_sequences.clear();
+  m_fields.clear();
+  m_lineBeg = 0;
+  m_lineLength = 0;
+  m_ok = true;
+}
+
+// The bin of the smallest of the UCSC binning scheme's nested intervals (16 kb, 128 kb, 1 Mb, 8 Mb, 64 Mb, 512 Mb)
+// that contains [beg, end).
+inline uint32_t TabixIndexer::reg2bin(const unsigned long& beg, unsigned long end)
+{
+  end--;
+  if (beg >> 14 == end >> 14) return ((1 << 15) - 1)/7 + static_cast<uint32_t>(beg >> 14);
+  if (beg >> 17 == end >> 17) return ((1 << 12) - 1)/7 + static_cast<uint32_t>(beg >> 17);
+  if (beg >> 20 == end >> 20) return ((1 << 9) - 1)/7 + static_cast<uint32_t>(beg >> 20);
+  if (beg >> 23 == end >> 23) return ((1 << 6) - 1)/7 + static_cast<uint32_t>(beg >> 23);
+  if (beg >> 26 == end >> 26) return ((1 << 3) - 1)/7 + static_cast<uint32_t>(beg >> 26);
+  return 0;
+}
+
+// Called for each block of the file, in order.  The offsets of the lines are virtual offsets;
+// the end of a line that ends its block is given as the beginning of the next block, as htslib gives it.
+inline void TabixIndexer::addBlock(const char *pData, const unsigned int& len, const uint64_t& blockOffset, const unsigned int& blockSize)
+{
+  for (unsigned int i = 0; i < len && m_ok; i++)
+    {
+      if (0 == m_lineLength++)
+	m_lineBeg = (blockOffset << 16) | i;
+      if (pData[i] != '\n')
+	{
+	  if (m_fields.size() < MAX_FIELDS_LENGTH)
+	    m_fields += pData[i];
+	  continue;
+	}
+      addLine(i + 1 == len ? (blockOffset + blockSize) << 16 : (blockOffset << 16) | (i + 1));
+      m_fields.clear();
+      m_lineLength = 0;
+    }
+}
+
+inline void TabixIndexer::addLine(const uint64_t& lineEnd)
+{
+  if (m_fields.empty() || '#' == m_fields[0])
+    return;
+  const size_t tab1 = m_fields.find('\t'), tab2 = (std::string::npos == tab1 ? tab1 : m_fields.find('\t', tab1 + 1));
+  if (std::string::npos == tab2)
+    {
+      std::cerr << "Error:  Unable to index a line with fewer than 3 columns (\"" << m_fields << "\")." << std::endl << std::endl;
+      m_ok = false;
+      return;
+    }
+  const std::string name(m_fields, 0, tab1);
+  const unsigned long beg = strtoul(m_fields.c_str() + tab1 + 1, NULL, 10);
+  unsigned long end = strtoul(m_fields.c_str() + tab2 + 1, NULL, 10);
+  if (end <= beg)
+    end = beg + 1;
+
+  if (m_sequences.empty() || m_sequences.back().name != name)
+    {
+      for (unsigned int i = 0; i < m_sequences.size(); i++)
+	if (m_sequences[i].name == name)
+	  {
+	    std::cerr << "Error:  Unable to index the lines of sequence " << name << ", because they're not consecutive." << std::endl << std::endl;
+	    m_ok = false;
+	    return;
+	  }
+      m_sequences.push_back(Sequence());
+      m_sequences.back().name = name;
+      m_sequences.back().firstLineBeg = m_lineBeg;
+      m_sequences.back().numLines = 0;
+      m_sequences.back().lastBeg = 0;
+    }
+  Sequence& s = m_sequences.back();
+  if (beg < s.lastBeg)
+    {
+      std::cerr << "Error:  Unable to index the lines of sequence " << name << ", because they're not sorted by begin coordinate ("
+		<< beg << " follows " << s.lastBeg << ")." << std::endl << std::endl;
+      m_ok = false;
+      return;
+    }
+  s.lastBeg = beg;
+  s.lastLineEnd = lineEnd;
+  s.numLines++;
+
+  // A line continuing the previous chunk of its bin extends it.
+  std::vector<std::pair<uint64_t, uint64_t> >& chunks = s.chunksOfBin[reg2bin(beg, end)];
+  if (!chunks.empty() && chunks.back().second == m_lineBeg)
+    chunks.back().second = lineEnd;
+  else
+    chunks.push_back(std::make_pair(m_lineBeg, lineEnd));
+
+  const unsigned long lastWindow = (end - 1) >> 14;
+  if (s.linearIndex.size() <= lastWindow)
+    s.linearIndex.resize(lastWindow + 1, ~static_cast<uint64_t>(0));
+  for (unsigned long w = beg >> 14; w <= lastWindow; w++)
+    if (~static_cast<uint64_t>(0) == s.linearIndex[w])
+      s.linearIndex[w] = m_lineBeg;
+}
+
+inline bool TabixIndexer::write(std::ostream& os) const
+{
+  static const int TBX_UCSC(0x10000); // 0-based, half-open coordinates
+  std::string buf("TBI\1", 4), names;
+  char packed[8];
+
+  if (!m_ok)
+    return false;
+  for (unsigned int i = 0; i < m_sequences.size(); i++)
+    names.append(m_sequences[i].name.c_str(), m_sequences[i].name.size() + 1);
+  const uint64_t hdr[8] = {m_sequences.size(), TBX_UCSC, 1, 2, 3, '#', 0, names.size()};
+  for (unsigned int i = 0; i < 8; i++)
+    {
+      packLittleEndian(packed, hdr[i], 4);
+      buf.append(packed, 4);
+    }
+  buf += names;
+  for (unsigned int i = 0; i < m_sequences.size(); i++)
+    {
+      const Sequence& s = m_sequences[i];
+      packLittleEndian(packed, s.chunksOfBin.size() + 1, 4);
+      buf.append(packed, 4);
+      for (std::map<uint32_t, std::vector<std::pair<uint64_t, uint64_t> > >::const_iterator it = s.chunksOfBin.begin();
+	   it != s.chunksOfBin.end(); it++)
+	{
+	  packLittleEndian(packed, it->first, 4);
+	  buf.append(packed, 4);
+	  packLittleEndian(packed, it->second.size(), 4);
+	  buf.append(packed, 4);
+	  for (unsigned int j = 0; j < it->second.size(); j++)
+	    {
+	      packLittleEndian(packed, it->second[j].first, 8);
+	      buf.append(packed, 8);
+	      packLittleEndian(packed, it->second[j].second, 8);
+	      buf.append(packed, 8);
+	    }
+	}
+      const uint64_t pseudoBin[6] = {PSEUDO_BIN, 2, s.firstLineBeg, s.lastLineEnd, s.numLines, 0};
+      for (unsigned int j = 0; j < 6; j++)
+	{
+	  packLittleEndian(packed, pseudoBin[j], j < 2 ? 4 : 8);
+	  buf.append(packed, j < 2 ? 4 : 8);
+	}
+      // Windows that no line overlaps get the offset of the preceding window (or of the sequence's first line).
+      packLittleEndian(packed, s.linearIndex.size(), 4);
+      buf.append(packed, 4);
+      uint64_t offset(s.firstLineBeg);
+      for (unsigned int w = 0; w < s.linearIndex.size(); w++)
+	{
+	  if (s.linearIndex[w] != ~static_cast<uint64_t>(0))
+	    offset = s.linearIndex[w];
+	  packLittleEndian(packed, offset, 8);
+	  buf.append(packed, 8);
+	}
+    }
+  os.write(buf.data(), buf.size());
+  return !os.fail();
+}
+
+#endif // EPILOGOS_TABIX_INDEX_H
@@ -0,0 +1,372 @@
+#ifndef EPILOGOS_TALLY_STORE_H
+#define EPILOGOS_TALLY_STORE_H
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <set>
+#include <map>
+#include <string>
+#include <utility> // for pair()
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <unistd.h>
+#include "binaryTallyFormat.h"
+#include "fileHash.h"
+#include "siteTallies.h"
+#include "stateFileReader.h"
+
+// The tallies that computeEpilogosPart1_perChrom accumulates into Q, Q*, or Q** are sums of the contributions
+// of individual epigenomes (S1) or individual pairs of epigenomes (S2, S3) over a chromosome's sites:
+// * S1's Q is the sum, over the epigenomes of the group, of the number of sites at which each is in each state;
+// * S3's Q** has one row per pair of epigenomes of the group, the number of sites at which the pair is in each ordered state pair;
+// * S2's Q* is the sum of those rows over the pairs of the group, with each state pair and its reverse combined.
+// A TallyStore keeps these per-epigenome and per-pair tallies for one state file (computeEpilogosPart1_perChrom --tally-store),
+// filling in whichever a group needs that it doesn't hold yet, so that Q for a new composition of a group can be derived
+// by tallying only its new members (and, for S2 and S3, only the pairs involving them); removing members needs no tallying at all.
+//
+// The file begins with a header; all integers are little-endian.
+//   bytes  0- 7:  magic string "EPITALLY"
+//   bytes  8-11:  format version (currently 2)
+//   bytes 12-15:  number of possible states
+//   bytes 16-19:  number of epigenomes in the state file
+//   bytes 20-23:  0
+//   bytes 24-31:  number of sites in the state file
+//   bytes 32-39:  size in bytes of the state file
+//   bytes 40-47:  number of epigenomes whose state counts follow
+//   bytes 48-55:  number of pairs of epigenomes whose state pair tallies follow them
+//   bytes 56-63:  64-bit FNV-1a hash of the contents of the state file (see fileHash.h)
+// A store written for a state file of any other size or contents (or for a different number of states) is ignored and rewritten,
+// as is one written in version 1 of the format, which identified the state file by its size alone.
+// Each epigenome's entry is its number (1 = the epigenome in column 4 of the state file; 4 bytes)
+// followed by its counts of states 1, 2, ..., numStates (8 bytes each).  Each pair's entry is the numbers of its
+// epigenomes e1 < e2 (4 bytes each) followed by its counts of the numStates^2 ordered state pairs (state of e1, state of e2),
+// in the order of orderedStatePairID() (8 bytes each).
+
+const char g_tallyStoreMagic[8] = {'E','P','I','T','A','L','L','Y'};
+const unsigned int g_tallyStoreFormatVersion(2);
+const unsigned int g_tallyStoreHeaderSize(64);
+const unsigned int g_tallyStoreVersion1HeaderSize(56);
+
+class TallyStore {
+public:
+  TallyStore() : m_numStates(0), m_numEpigenomes(0), m_numSites(0), m_stateFileSize(0), m_stateFileHash(0) {};
+  // Starts an empty store for the state file pStateFilename, then loads pFilename, if it exists and was written
+  // for a file of the same size and contents and the same number of states.  Returns false after reporting an error.
+  bool load(const char *pFilename, const char *pStateFilename, const int& numStates);
+  bool write(const char *pFilename) const;
+  // The epigenomes (numbered from 1, as in group specifications) of group1 and group2 whose counts (S1),
+  // or the pairs of epigenomes of the same group whose tallies (S2, S3), the store doesn't hold yet.
+  void findMissing(const measurementType& KLtype, const std::set<int>& group1, const std::set<int>& group2,
+		   std::set<int>& missingEpigenomes, std::set<std::pair<int,int> >& missingPairs) const;
+  // Tallies the missing epigenomes and pairs over every site read by reader, which must be positioned at the first site,
+  // and adds them to the store.  Returns false after reporting an error.
+  bool tallyMissing(StateFileReader& reader, const bool& checkAllColumns,
+		    const std::set<int>& missingEpigenomes, const std::set<std::pair<int,int> >& missingPairs);
+  // Returns false after reporting an error if group1 or group2 doesn't fit the state file.
+  bool groupsFit(const std::set<int>& group1, const std::set<int>& group2) const;
+  // Adds the tallies of the groups, all of which must be held by the store, to Q, Q*, or Q** of tallier,
+  // which must have been initialized for KLtype, group1, group2, and the store's number of states.
+  void addQ(const measurementType& KLtype, const std::set<int>& group1, const std::set<int>& group2, SiteTallier& tallier) const;
+  uint64_t numSites(void) const { return m_numSites; }
+private:
+  TallyStore(const TallyStore&); // we have no need for a copy constructor, so disable it
+  void addPairs(const std::set<int>& group, SiteTallier& tallier, const measurementType& KLtype, const bool& group2) const;
+  unsigned int m_numStates, m_numEpigenomes;
+  uint64_t m_numSites, m_stateFileSize, m_stateFileHash;
+  std::map<int, std::vector<uint64_t> > m_stateCounts;
+  std::map<std::pair<int,int>, std::vector<uint64_t> > m_pairTallies;
+};
+
+inline bool TallyStore::load(const char *pFilename, const char *pStateFilename, const int& numStates)
+{
+  std::ifstream ifs;
+  char hdr[g_tallyStoreHeaderSize];
+
+  if (!hashFileContents(pStateFilename, m_stateFileSize, m_stateFileHash))
+    {
+      std::cerr << "Error:  Unable to read file \"" << pStateFilename << "\"." << std::endl << std::endl;
+      return false;
+    }
+  m_numStates = static_cast<unsigned int>(numStates);
+  m_numEpigenomes = 0;
+  m_numSites = 0;
+  m_stateCounts.clear();
+  m_pairTallies.clear();
+  if (access(pFilename, F_OK) != 0)
+    return true; // a new store
+  ifs.open(pFilename, std::ios::binary);
+  const bool isStore = ifs && ifs.read(hdr, g_tallyStoreVersion1HeaderSize)
+    && 0 == memcmp(hdr, g_tallyStoreMagic, sizeof(g_tallyStoreMagic));
+  const uint64_t version = isStore ? unpackLittleEndian(hdr + 8, 4) : 0;
+  if (!isStore || (version != 1 && version != g_tallyStoreFormatVersion)
+      || (g_tallyStoreFormatVersion == version
+	  && !ifs.read(hdr + g_tallyStoreVersion1HeaderSize, g_tallyStoreHeaderSize - g_tallyStoreVersion1HeaderSize)))
+    {
+      std::cerr << "Error:  File \"" << pFilename << "\" is not a tally store written by this version of epilogos." << std::endl << std::endl;
+      return false;
+    }
+  if (version != g_tallyStoreFormatVersion || unpackLittleEndian(hdr + 12, 4) != m_numStates
+      || unpackLittleEndian(hdr + 32, 8) != m_stateFileSize || unpackLittleEndian(hdr + 56, 8) != m_stateFileHash)
+    {
+      std::cerr << "Warning:  Ignoring the tallies in " << pFilename << ", which were written for a different state file "
+		<< "or number of states; it will be rewritten." << std::endl;
+      return true;
+    }
+  m_numEpigenomes = static_cast<unsigned int>(unpackLittleEndian(hdr + 16, 4));
+  m_numSites = unpackLittleEndian(hdr + 24, 8);
+  const uint64_t numEpigenomeEntries = unpackLittleEndian(hdr + 40, 8), numPairEntries = unpackLittleEndian(hdr + 48, 8);
+  const unsigned int numStatePairs(m_numStates * m_numStates);
+  std::vector<char> entry(8 + 8*numStatePairs);
+
+  for (uint64_t i = 0; i < numEpigenomeEntries; i++)
+    {
+      if (!ifs.read(&entry[0], 4 + 8*m_numStates))
+	goto Truncated;
+      std::vector<uint64_t>& counts = m_stateCounts[static_cast<int>(unpackLittleEndian(&entry[0], 4))];
+      counts.resize(m_numStates);
+      for (unsigned int s = 0; s < m_numStates; s++)
+	counts[s] = unpackLittleEndian(&entry[4 + 8*s], 8);
+    }
+  for (uint64_t i = 0; i < numPairEntries; i++)
+    {
+      if (!ifs.read(&entry[0], entry.size()))
+	goto Truncated;
+      const std::pair<int,int> epigenomes(static_cast<int>(unpackLittleEndian(&entry[0], 4)), static_cast<int>(unpackLittleEndian(&entry[4], 4)));
+      std::vector<uint64_t>& tallies = m_pairTallies[epigenomes];
+      tallies.resize(numStatePairs);
+      for (unsigned int sp = 0; sp < numStatePairs; sp++)
+	tallies[sp] = unpackLittleEndian(&entry[8 + 8*sp], 8);
+    }
+  return true;
+
+ Truncated:
+  std::cerr << "Error:  Tally store \"" << pFilename << "\" is truncated." << std::endl << std::endl;
+  return false;
+}
+
+// The store is written to a temporary file, which then replaces pFilename, so a failure leaves the old store intact.
+inline bool TallyStore::write(const char *pFilename) const
+{
+  std::string buf(g_tallyStoreMagic, sizeof(g_tallyStoreMagic));
+  char packed[8];
+
+  packLittleEndian(packed, g_tallyStoreFormatVersion, 4);
+  buf.append(packed, 4);
+  packLittleEndian(packed, m_numStates, 4);
+  buf.append(packed, 4);
+  packLittleEndian(packed, m_numEpigenomes, 4);
+  buf.append(packed, 4);
+  packLittleEndian(packed, 0, 4);
+  buf.append(packed, 4);
+  packLittleEndian(packed, m_numSites, 8);
+  buf.append(packed, 8);
+  packLittleEndian(packed, m_stateFileSize, 8);
+  buf.append(packed, 8);
+  packLittleEndian(packed, m_stateCounts.size(), 8);
+  buf.append(packed, 8);
+  packLittleEndian(packed, m_pairTallies.size(), 8);
+  buf.append(packed, 8);
+  packLittleEndian(packed, m_stateFileHash, 8);
+  buf.append(packed, 8);
+  for (std::map<int, std::vector<uint64_t> >::const_iterator it = m_stateCounts.begin(); it != m_stateCounts.end(); it++)
+    {
+      packLittleEndian(packed, static_cast<uint64_t>(it->first), 4);
+      buf.append(packed, 4);
+      for (unsigned int s = 0; s < it->second.size(); s++)
+	{
+	  packLittleEndian(packed, it->second[s], 8);
+	  buf.append(packed, 8);
+	}
+    }
+  for (std::map<std::pair<int,int>, std::vector<uint64_t> >::const_iterator it = m_pairTallies.begin(); it != m_pairTallies.end(); it++)
+    {
+      packLittleEndian(packed, static_cast<uint64_t>(it->first.first), 4);
+      buf.append(packed, 4);
+      packLittleEndian(packed, static_cast<uint64_t>(it->first.second), 4);
+      buf.append(packed, 4);
+      for (unsigned int sp = 0; sp < it->second.size(); sp++)
+	{
+	  packLittleEndian(packed, it->second[sp], 8);
+	  buf.append(packed, 8);
+	}
+    }
+
+  char pid[32];
+  sprintf(pid, ".%ld.tmp", static_cast<long>(getpid()));
+  const std::string tempFilename = std::string(pFilename) + pid;
+  FILE *fp = fopen(tempFilename.c_str(), "wb");
+  bool OK = (fp != NULL && fwrite(buf.data(), 1, buf.size(), fp) == buf.size());
+  if (fp != NULL && fclose(fp) != 0)
+    OK = false;
+  if (OK)
+    OK = (0 == rename(tempFilename.c_str(), pFilename));
+  if (!OK)
+    {
+      remove(tempFilename.c_str());
+      std::cerr << "Error:  Failed to write tally store \"" << pFilename << "\"." << std::endl << std::endl;
+    }
+  return OK;
+}
+
+inline void TallyStore::findMissing(const measurementType& KLtype, const std::set<int>& group1, const std::set<int>& group2,
+				    std::set<int>& missingEpigenomes, std::set<std::pair<int,int> >& missingPairs) const
+{
+  const std::set<int> *groups[2] = {&group1, &group2};
+
+  missingEpigenomes.clear();
+  missingPairs.clear();
+  for (int g = 0; g < 2; g++)
+    for (std::set<int>::const_iterator it = groups[g]->begin(); it != groups[g]->end(); it++)
+      {
+	if (KL == KLtype)
+	  {
+	    if (m_stateCounts.find(*it) == m_stateCounts.end())
+	      missingEpigenomes.insert(*it);
+	    continue;
+	  }
+	std::set<int>::const_iterator it2 = it;
+	for (it2++; it2 != groups[g]->end(); it2++)
+	  if (m_pairTallies.find(std::make_pair(*it, *it2)) == m_pairTallies.end())
+	    missingPairs.insert(std::make_pair(*it, *it2));
+      }
+}
+
+inline bool TallyStore::tallyMissing(StateFileReader& reader, const bool& checkAllColumns,
+				     const std::set<int>& missingEpigenomes, const std::set<std::pair<int,int> >& missingPairs)
+{
+  const unsigned int numStates(m_numStates), numStatePairs(numStates * numStates);
+  std::set<int> epigenomesRead(missingEpigenomes);
+  std::vector<int> cols, statesAtThisSite;
+  std::map<int, unsigned int> colIndex; // epigenome number -> position in statesAtThisSite
+
+  for (std::set<std::pair<int,int> >::const_iterator it = missingPairs.begin(); it != missingPairs.end(); it++)
+    {
+      epigenomesRead.insert(it->first);
+      epigenomesRead.insert(it->second);
+    }
+  for (std::set<int>::const_iterator it = epigenomesRead.begin(); it != epigenomesRead.end(); it++)
+    {
+      colIndex[*it] = static_cast<unsigned int>(cols.size());
+      cols.push_back(*it - 1);
+    }
+
+  // The tallies are accumulated in flat arrays, indexed by the positions of the epigenomes in statesAtThisSite.
+  std::vector<unsigned int> epigenomeCols, pairCols;
+  for (std::set<int>::const_iterator it = missingEpigenomes.begin(); it != missingEpigenomes.end(); it++)
+    epigenomeCols.push_back(colIndex[*it]);
+  for (std::set<std::pair<int,int> >::const_iterator it = missingPairs.begin(); it != missingPairs.end(); it++)
+    {
+      pairCols.push_back(colIndex[it->first]);
+      pairCols.push_back(colIndex[it->second]);
+    }
+  std::vector<uint64_t> stateCounts(epigenomeCols.size() * numStates, 0), pairTallies(missingPairs.size() * numStatePairs, 0);
+
+  reader.selectColumns(cols, checkAllColumns);
+  while (reader.readSite(statesAtThisSite))
+    {
+      if (1 == reader.numSitesRead())
+	{
+	  if (0 == m_numEpigenomes)
+	    m_numEpigenomes = static_cast<unsigned int>(reader.numEpigenomes());
+	  else if (static_cast<int>(m_numEpigenomes) != reader.numEpigenomes())
+	    {
+	      std::cerr << "Error:  The state file contains " << reader.numEpigenomes() << " epigenomes, but the tally store was written for "
+			<< m_numEpigenomes << "." << std::endl << std::endl;
+	      return false;
+	    }
+	  if (!epigenomesRead.empty() && *epigenomesRead.rbegin() > static_cast<int>(m_numEpigenomes))
+	    {
+	      std::cerr << "Error:  Epigenome " << *epigenomesRead.rbegin() << " was requested, but the state file only contains "
+			<< m_numEpigenomes << "." << std::endl << std::endl;
+	      return false;
+	    }
+	}
+      uint64_t *pCounts = epigenomeCols.empty() ? NULL : &stateCounts[0];
+      for (unsigned int i = 0; i < epigenomeCols.size(); i++, pCounts += numStates)
+	pCounts[statesAtThisSite[epigenomeCols[i]] - 1]++;
+      uint64_t *pTallies = pairCols.empty() ? NULL : &pairTallies[0];
+      for (unsigned int i = 0; i < pairCols.size(); i += 2, pTallies += numStatePairs)
+	pTallies[orderedStatePairID(statesAtThisSite[pairCols[i]], statesAtThisSite[pairCols[i + 1]], numStates) - 1]++;
+    }
+  if (reader.failed())
+    return false;
+  if (0 == reader.numSitesRead())
+    {
+      std::cerr << "Error:  The state file is empty." << std::endl << std::endl;
+      return false;
+    }
+  if (m_numSites != 0 && m_numSites != reader.numSitesRead())
+    {
+      std::cerr << "Error:  The state file contains " << reader.numSitesRead() << " sites, but the tally store was written for "
+		<< m_numSites << "." << std::endl << std::endl;
+      return false;
+    }
+  m_numSites = reader.numSitesRead();
+
+  unsigned int i(0);
+  for (std::set<int>::const_iterator it = missingEpigenomes.begin(); it != missingEpigenomes.end(); it++, i++)
+    m_stateCounts[*it].assign(stateCounts.begin() + i*numStates, stateCounts.begin() + (i + 1)*numStates);
+  i = 0;
+  for (std::set<std::pair<int,int> >::const_iterator it = missingPairs.begin(); it != missingPairs.end(); it++, i++)
+    m_pairTallies[*it].assign(pairTallies.begin() + i*numStatePairs, pairTallies.begin() + (i + 1)*numStatePairs);
+  return true;
+}
+
+inline bool TallyStore::groupsFit(const std::set<int>& group1, const std::set<int>& group2) const
+{
+  return groupsFitInput(group1, group2, static_cast<int>(m_numEpigenomes));
+}
+
+inline void TallyStore::addQ(const measurementType& KLtype, const std::set<int>& group1, const std::set<int>& group2, SiteTallier& tallier) const
+{
+  if (KL == KLtype)
+    {
+      const std::set<int> *groups[2] = {&group1, &group2};
+      for (int g = 0; g < 2; g++)
+	{
+	  if (groups[g]->empty())
+	    continue;
+	  std::vector<unsigned long>& Q = tallier.Qtallies(1 == g);
+	  for (std::set<int>::const_iterator it = groups[g]->begin(); it != groups[g]->end(); it++)
+	    {
+	      const std::vector<uint64_t>& counts = m_stateCounts.find(*it)->second;
+	      for (unsigned int s = 0; s < m_numStates; s++)
+		Q[s] += counts[s];
+	    }
+	}
+      return;
+    }
+  addPairs(group1, tallier, KLtype, false);
+  if (!group2.empty())
+    addPairs(group2, tallier, KLtype, true);
+}
+
+// The pairs of a group are ordered as SiteTallier orders the rows of Q**.
+inline void TallyStore::addPairs(const std::set<int>& group, SiteTallier& tallier, const measurementType& KLtype, const bool& group2) const
+{
+  const int numStates(static_cast<int>(m_numStates));
+  unsigned int row(0);
+
+  for (std::set<int>::const_iterator it = group.begin(); it != group.end(); it++)
+    {
+      std::set<int>::const_iterator it2 = it;
+      for (it2++; it2 != group.end(); it2++, row++)
+	{
+	  const std::vector<uint64_t>& tallies = m_pairTallies.find(std::make_pair(*it, *it2))->second;
+	  std::vector<unsigned long>& Q = tallier.Qtallies(group2, KLss == KLtype ? row : 0);
+	  if (KLss == KLtype)
+	    {
+	      for (unsigned int sp = 0; sp < tallies.size(); sp++)
+		Q[sp] += tallies[sp];
+	      continue;
+	    }
+	  for (int s1 = 1; s1 <= numStates; s1++)
+	    for (int s2 = 1; s2 <= numStates; s2++)
+	      Q[uniqueStatePairID(s1, s2, numStates)] += tallies[orderedStatePairID(s1, s2, numStates) - 1];
+	}
+    }
+}
+
+#endif // EPILOGOS_TALLY_STORE_H